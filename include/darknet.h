@@ -54,6 +54,10 @@ extern "C" {
 struct network;
 typedef struct network network;
 
+struct layer_profiler;
+struct layer_graph;
+struct detection_pool;
+
 struct network_state;
 typedef struct network_state network_state;
 
@@ -127,6 +131,11 @@ typedef enum {
     NO_WEIGHTS, PER_FEATURE, PER_CHANNEL
 } WEIGHTS_TYPE_T;
 
+// convolutional_layer.h
+typedef enum {
+    CONV_ALGO_IM2COL, CONV_ALGO_DIRECT_1X1, CONV_ALGO_WINOGRAD_2X2, CONV_ALGO_WINOGRAD_4X4
+} CONV_ALGO;
+
 // parser.h
 typedef enum {
     NO_NORMALIZATION, RELU_NORMALIZATION, SOFTMAX_NORMALIZATION
@@ -421,10 +430,24 @@ struct layer {
 
     float *weights;
     float *weight_updates;
+    float *weights_packed;      // inference-only copy in the packed GEMM layout, see prepack_convolutional_weights()
+    float *weights_winograd;    // inference-only Winograd-transformed weights, see set_convolutional_algorithm()
+    CONV_ALGO conv_algo;
+    int nchwc;                  // channel block size of the output in the blocked NCHWc layout, 0 - planar NCHW
+    float *weights_nchwc;       // inference-only weights reordered for the NCHWc convolution, see nchwc.c
+    float *biases_nchwc;
+    int8_t *weights_int8;       // inference-only INT8 weights in the u8 x s8 GEMM layout, see quantize.c
+    float *int8_scales;         // per output channel
+    int32_t *int8_offsets;      // per output channel: sum of the weights x input zero-points
+    float *int8_input_scales;   // per input channel
+    uint8_t *int8_input_zero;   // per input channel
+    const char *weights_map;    // prepared model mapping the weights may point into (not freed with the layer), see prepared.h
+    size_t weights_map_size;
 
     float scale_x_y;
     int objectness_smooth;
     int new_coords;
+    int output_logits;          // CPU inference: forward_yolo_layer() leaves the logits, get_yolo_detections() decodes them, see set_yolo_decode()
     int show_details;
     float max_delta;
     float uc_normalizer;
@@ -834,6 +857,21 @@ typedef struct network {
     int optimized_memory;
     int dynamic_minibatch;
     size_t workspace_size_limit;
+    int nchwc;                  // [net] nchwc=1 - run CPU inference in the blocked NCHWc layout
+    int nchwc_block;            // active channel block size, 0 - planar NCHW
+    float *nchwc_scratch;       // layout conversion buffer (network input, yolo heads)
+    int memory_plan;            // [net] memory_plan=1 - layer outputs share one arena in CPU inference
+    int fast_activations;       // [net] fast_activations=1 - polynomial mish/swish/logistic/tanh in CPU inference, see fast_activations.h
+    float *memory_arena;        // the arena, see plan_network_memory()
+    size_t memory_arena_size;   // bytes
+    void *prepared_map;         // mapped prepared model file the layers' weights point into, see prepared.h
+    size_t prepared_map_size;
+    int prefetch;               // [net] prefetch=N - batches the training data loader loads ahead, see data_loader.h
+    struct layer_profiler *profiler;    // CPU forward_network() times the layers into it, see layer_profiler.h
+    int parallel_branches;      // [net] parallel_branches=1 - independent layers run at once in CPU inference
+    struct layer_graph *graph;  // the executor of parallel_branches, see layer_graph.h
+    int yolo_decode;            // [net] yolo_decode=1 - fused decode of the yolo logits in CPU inference, see set_yolo_decode()
+    struct detection_pool *detection_pool;  // reused by get_network_boxes_pooled(), see detection_pool.h
 } network;
 
 // network.h
@@ -1040,9 +1078,16 @@ LIB_API void set_batch_network(network *net, int b);
 LIB_API detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter);
 LIB_API det_num_pair* network_predict_batch(network *net, image im, int batch_size, int w, int h, float thresh, float hier, int *map, int relative, int letter);
 LIB_API void free_detections(detection *dets, int n);
+// as get_network_boxes(), but the detections come from a pool of the network and
+// are given back with release_network_boxes() instead of free_detections():
+// in steady state nothing is allocated per frame
+LIB_API detection *get_network_boxes_pooled(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter);
+LIB_API void release_network_boxes(detection *dets);
 LIB_API void free_batch_detections(det_num_pair *det_num_pairs, int n);
 LIB_API void fuse_conv_batchnorm(network net);
 LIB_API void calculate_binary_weights(network net);
+LIB_API void prepare_network_for_inference(network *net);
+LIB_API void set_int8_quantization_table(char *filename);
 LIB_API char *detection_to_json(detection *dets, int nboxes, int classes, char **names, long long int frame_id, char *filename);
 
 LIB_API layer* get_network_layer(network* net, int i);
@@ -43,6 +43,7 @@ struct bbox_t_container {
 #include <memory>
 #include <vector>
 #include <deque>
+#include <future>
 #include <algorithm>
 #include <chrono>
 #include <string>
@@ -69,6 +70,7 @@ extern "C" LIB_API void send_json_custom(char const* send_buf, int port, int tim
 
 class Detector {
     std::shared_ptr<void> detector_gpu_ptr;
+    std::shared_ptr<void> detector_async_ptr;
     std::deque<std::vector<bbox_t>> prev_bbox_vec_deque;
     std::string _cfg_filename, _weight_filename;
 public:
@@ -82,6 +84,14 @@ public:
     LIB_API std::vector<bbox_t> detect(std::string image_filename, float thresh = 0.2, bool use_mean = false);
     LIB_API std::vector<bbox_t> detect(image_t img, float thresh = 0.2, bool use_mean = false);
     LIB_API std::vector<std::vector<bbox_t>> detectBatch(image_t img, int batch_size, int width, int height, float thresh, bool make_nms = true);
+
+    // Thread-safe: the image is copied and queued, one worker gathers the requests of all
+    // the threads into batches of up to max_batch images (the batch_size of the constructor
+    // by default) and runs each batch as one forward pass. A batch runs when it is full or
+    // max_wait_us after its first request, the future gets the boxes in init_w x init_h pixels.
+    LIB_API std::future<std::vector<bbox_t>> detect_async(image_t img, float thresh = 0.2);
+    LIB_API std::future<std::vector<bbox_t>> detect_async_resized(image_t img, int init_w, int init_h, float thresh = 0.2);
+    LIB_API void set_async_batching(int max_batch, int max_wait_us = 2000);
     static LIB_API image_t load_image(std::string image_filename);
     static LIB_API void free_image(image_t m);
     LIB_API int get_net_width() const;
@@ -115,6 +125,14 @@ public:
         return detect_resized(*image_ptr, mat.cols, mat.rows, thresh, use_mean);
     }
 
+    std::future<std::vector<bbox_t>> detect_async(cv::Mat mat, float thresh = 0.2)
+    {
+        if(mat.data == NULL)
+            throw std::runtime_error("Image is empty");
+        auto image_ptr = mat_to_image_resize(mat);
+        return detect_async_resized(*image_ptr, mat.cols, mat.rows, thresh);
+    }
+
     std::shared_ptr<image_t> mat_to_image_resize(cv::Mat mat) const
     {
         if (mat.data == NULL) return std::shared_ptr<image_t>(NULL);
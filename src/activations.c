@@ -180,6 +180,44 @@ void activate_array_hard_mish(float *x, const int n, float * activation_input, f
     }
 }
 
+void bias_activate_array(float *x, const int n, const float bias, const ACTIVATION a)
+{
+    const float MISH_THRESHOLD = 20;
+    int i;
+    if (a == LINEAR) {
+        for (i = 0; i < n; ++i) x[i] += bias;
+    }
+    else if (a == LEAKY) {
+        for (i = 0; i < n; ++i) {
+            const float x_val = x[i] + bias;
+            x[i] = (x_val > 0) ? x_val : .1f*x_val;
+        }
+    }
+    else if (a == MISH) {
+        for (i = 0; i < n; ++i) {
+            const float x_val = x[i] + bias;
+            x[i] = x_val * tanh_activate(softplus_activate(x_val, MISH_THRESHOLD));
+        }
+    }
+    else if (a == SWISH) {
+        for (i = 0; i < n; ++i) {
+            const float x_val = x[i] + bias;
+            x[i] = x_val * logistic_activate(x_val);
+        }
+    }
+    else if (a == HARD_MISH) {
+        for (i = 0; i < n; ++i) x[i] = hard_mish_yashas(x[i] + bias);
+    }
+    else {
+        for (i = 0; i < n; ++i) x[i] = activate(x[i] + bias, a);
+    }
+}
+
+int is_activation_elementwise(ACTIVATION a)
+{
+    return a != NORM_CHAN && a != NORM_CHAN_SOFTMAX && a != NORM_CHAN_SOFTMAX_MAXVAL;
+}
+
 void activate_array_normalize_channels(float *x, const int n, int batch, int channels, int wh_step, float *output)
 {
     int size = n / channels;
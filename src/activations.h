@@ -25,6 +25,11 @@ void activate_array(float *x, const int n, const ACTIVATION a);
 void activate_array_swish(float *x, const int n, float * output_sigmoid, float * output);
 void activate_array_mish(float *x, const int n, float * activation_input, float * output);
 void activate_array_hard_mish(float *x, const int n, float * activation_input, float * output);
+// x = activation(x + bias) over one row of a conv output, for the fused GEMM epilogue:
+// no OpenMP and no activation_input (inference only)
+void bias_activate_array(float *x, const int n, const float bias, const ACTIVATION a);
+// 0 - NORM_CHAN*, the activations that mix channels
+int is_activation_elementwise(ACTIVATION a);
 void activate_array_normalize_channels(float *x, const int n, int batch, int channels, int wh_step, float *output);
 void gradient_array_normalize_channels(float *x, const int n, int batch, int channels, int wh_step, float *delta);
 void activate_array_normalize_channels_softmax(float *x, const int n, int batch, int channels, int wh_step, float *output, int use_max_val);
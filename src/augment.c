@@ -0,0 +1,432 @@
+#include "augment.h"
+#include "gemm.h"
+#include "utils.h"
+#include <math.h>
+#include <stdlib.h>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define AUGMENT_X86
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define AUGMENT_TARGET_AVX2 __attribute__((target("avx,avx2,fma")))
+#else
+#define AUGMENT_TARGET_AVX2
+#endif
+#endif
+
+// where each output pixel samples the source: (1 - dx) * pixel(x0) + dx * pixel(x1),
+// then the same over the rows
+typedef struct augment_map {
+    int *x0, *x1;       // source offsets of the columns (x * c), flip applied
+    float *wx0, *wx1;
+    int *y0, *y1;       // source rows
+    float *wy0, *wy1;
+    int w, h;
+} augment_map;
+
+// the uint8 source and the w x h region at x, y of the float planes written
+typedef struct augment_io {
+    const unsigned char *src;
+    int src_w, src_h, c;
+    size_t step;        // bytes per source row
+    int swap_rb;        // BGR source
+    float *dst;
+    int dst_w, dst_h;
+    int x, y;
+} augment_io;
+
+static augment_map alloc_augment_map(int w, int h)
+{
+    augment_map m;
+    m.x0 = (int*)xcalloc(w, sizeof(int));
+    m.x1 = (int*)xcalloc(w, sizeof(int));
+    m.wx0 = (float*)xcalloc(w, sizeof(float));
+    m.wx1 = (float*)xcalloc(w, sizeof(float));
+    m.y0 = (int*)xcalloc(h, sizeof(int));
+    m.y1 = (int*)xcalloc(h, sizeof(int));
+    m.wy0 = (float*)xcalloc(h, sizeof(float));
+    m.wy1 = (float*)xcalloc(h, sizeof(float));
+    m.w = w;
+    m.h = h;
+    return m;
+}
+
+// resize_image() of the crop
+static augment_map make_augment_map(int src_w, int src_h, int c, augment_params p, int w, int h)
+{
+    augment_map m = alloc_augment_map(w, h);
+    const float w_scale = (w > 1) ? (float)(p.crop_w - 1) / (w - 1) : 0;
+    const float h_scale = (h > 1) ? (float)(p.crop_h - 1) / (h - 1) : 0;
+    int j, r;
+    for (j = 0; j < w; ++j) {
+        const int col = p.flip ? w - 1 - j : j;
+        if (col == w - 1 || p.crop_w == 1) {
+            m.x0[j] = m.x1[j] = constrain_int(p.crop_x + p.crop_w - 1, 0, src_w - 1) * c;
+            m.wx0[j] = 1;
+            m.wx1[j] = 0;
+        }
+        else {
+            const float sx = col*w_scale;
+            const int ix = (int)sx;
+            const float dx = sx - ix;
+            m.x0[j] = constrain_int(p.crop_x + ix, 0, src_w - 1) * c;
+            m.x1[j] = constrain_int(p.crop_x + ix + 1, 0, src_w - 1) * c;
+            m.wx0[j] = 1 - dx;
+            m.wx1[j] = dx;
+        }
+    }
+    for (r = 0; r < h; ++r) {
+        const float sy = r*h_scale;
+        const int iy = (int)sy;
+        const float dy = sy - iy;
+        m.y0[r] = constrain_int(p.crop_y + iy, 0, src_h - 1);
+        m.wy0[r] = 1 - dy;
+        // resize_image() leaves out the second row of the last output row
+        if (r == h - 1 || p.crop_h == 1) {
+            m.y1[r] = m.y0[r];
+            m.wy1[r] = 0;
+        }
+        else {
+            m.y1[r] = constrain_int(p.crop_y + iy + 1, 0, src_h - 1);
+            m.wy1[r] = dy;
+        }
+    }
+    return m;
+}
+
+// pixel centers as cv::resize() INTER_LINEAR: x = (j + 0.5) * src_w / w - 0.5
+static void linear_map_axis(int src_n, int n, int scale_by, int *i0, int *i1, float *w0, float *w1)
+{
+    const float scale = (float)src_n / n;
+    int j;
+    for (j = 0; j < n; ++j) {
+        float s = (j + 0.5f)*scale - 0.5f;
+        int i = (int)floorf(s);
+        float d = s - i;
+        if (i < 0) {
+            i = 0;
+            d = 0;
+        }
+        if (i >= src_n - 1) {
+            i = src_n - 1;
+            d = 0;
+        }
+        i0[j] = i * scale_by;
+        i1[j] = ((i + 1 < src_n) ? i + 1 : i) * scale_by;
+        w0[j] = 1 - d;
+        w1[j] = d;
+    }
+}
+
+static augment_map make_linear_map(int src_w, int src_h, int c, int w, int h)
+{
+    augment_map m = alloc_augment_map(w, h);
+    linear_map_axis(src_w, w, c, m.x0, m.x1, m.wx0, m.wx1);
+    linear_map_axis(src_h, h, 1, m.y0, m.y1, m.wy0, m.wy1);
+    return m;
+}
+
+static void free_augment_map(augment_map m)
+{
+    free(m.x0);
+    free(m.x1);
+    free(m.wx0);
+    free(m.wx1);
+    free(m.y0);
+    free(m.y1);
+    free(m.wy0);
+    free(m.wy1);
+}
+
+static float augment_constrain(float v)
+{
+    return (v < 0) ? 0 : ((v > 1) ? 1 : v);
+}
+
+// rgb_to_hsv(), the scales and the hue shift of distort_image(), hsv_to_rgb()
+static void augment_distort_pixel(float *r, float *g, float *b, float hue, float sat, float exposure)
+{
+    const float max = (*r > *g) ? ((*r > *b) ? *r : *b) : ((*g > *b) ? *g : *b);
+    const float min = (*r < *g) ? ((*r < *b) ? *r : *b) : ((*g < *b) ? *g : *b);
+    const float delta = max - min;
+    float h = 0, s = 0, v = max;
+    if (max != 0 && delta != 0) {
+        s = delta / max;
+        if (*r == max) h = (*g - *b) / delta;
+        else if (*g == max) h = 2 + (*b - *r) / delta;
+        else h = 4 + (*r - *g) / delta;
+        if (h < 0) h += 6;
+        h = h / 6;
+    }
+    s *= sat;
+    v *= exposure;
+    h += hue;
+    if (h > 1) h -= 1;
+    if (h < 0) h += 1;
+    if (s == 0) {
+        *r = *g = *b = v;
+    }
+    else {
+        const float h6 = 6 * h;
+        const int index = (int)floorf(h6);
+        const float f = h6 - index;
+        const float p = v*(1 - s);
+        const float q = v*(1 - s*f);
+        const float t = v*(1 - s*(1 - f));
+        if (index == 0) { *r = v; *g = t; *b = p; }
+        else if (index == 1) { *r = q; *g = v; *b = p; }
+        else if (index == 2) { *r = p; *g = v; *b = t; }
+        else if (index == 3) { *r = p; *g = q; *b = v; }
+        else if (index == 4) { *r = t; *g = p; *b = v; }
+        else { *r = v; *g = p; *b = q; }
+    }
+}
+
+// source byte of channel k of a pixel
+static inline int augment_channel(const augment_io *io, int k)
+{
+    return (io->swap_rb && io->c == 3) ? 2 - k : k;
+}
+
+// output columns [j0, j1) of row r of the region
+static void augment_row_scalar(const augment_io *io, augment_params p, const augment_map *m, int r, int j0, int j1)
+{
+    const int c = io->c;
+    const unsigned char *row0 = io->src + (size_t)m->y0[r] * io->step;
+    const unsigned char *row1 = io->src + (size_t)m->y1[r] * io->step;
+    const float wy0 = m->wy0[r], wy1 = m->wy1[r];
+    const size_t plane = (size_t)io->dst_w * io->dst_h;
+    float *out = io->dst + (size_t)(io->y + r) * io->dst_w + io->x;
+    int j, k;
+    for (j = j0; j < j1; ++j) {
+        for (k = 0; k < c; ++k) {
+            const int sk = augment_channel(io, k);
+            const float h0 = m->wx0[j] * (row0[m->x0[j] + sk] / 255.f) + m->wx1[j] * (row0[m->x1[j] + sk] / 255.f);
+            const float h1 = m->wx0[j] * (row1[m->x0[j] + sk] / 255.f) + m->wx1[j] * (row1[m->x1[j] + sk] / 255.f);
+            out[k * plane + j] = wy0 * h0 + wy1 * h1;
+        }
+        if (!p.distort) continue;
+        if (c >= 3) augment_distort_pixel(&out[j], &out[plane + j], &out[2 * plane + j], p.hue, p.sat, p.exposure);
+        else out[j] *= p.exposure;
+        for (k = 0; k < c; ++k) out[k * plane + j] = augment_constrain(out[k * plane + j]);
+    }
+}
+
+static void augment_scalar(const augment_io *io, augment_params p, const augment_map *m)
+{
+    int r;
+    for (r = 0; r < m->h; ++r) augment_row_scalar(io, p, m, r, 0, m->w);
+}
+
+#ifdef AUGMENT_X86
+// 8 uint8 values at byte offsets idx (4 bytes are read at each) as floats / 255
+static inline AUGMENT_TARGET_AVX2 __m256 augment_gather_u8(const unsigned char *row, __m256i idx)
+{
+    const __m256i v = _mm256_i32gather_epi32((const int*)row, idx, 1);
+    return _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xFF))), _mm256_set1_ps(255.f));
+}
+
+static inline AUGMENT_TARGET_AVX2 __m256 augment_sample_avx2(const unsigned char *row0, const unsigned char *row1,
+    __m256i x0, __m256i x1, __m256 wx0, __m256 wx1, __m256 wy0, __m256 wy1)
+{
+    const __m256 h0 = _mm256_add_ps(_mm256_mul_ps(wx0, augment_gather_u8(row0, x0)), _mm256_mul_ps(wx1, augment_gather_u8(row0, x1)));
+    const __m256 h1 = _mm256_add_ps(_mm256_mul_ps(wx0, augment_gather_u8(row1, x0)), _mm256_mul_ps(wx1, augment_gather_u8(row1, x1)));
+    return _mm256_add_ps(_mm256_mul_ps(wy0, h0), _mm256_mul_ps(wy1, h1));
+}
+
+static inline AUGMENT_TARGET_AVX2 __m256 augment_select(__m256 mask, __m256 a, __m256 b)
+{
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+// augment_distort_pixel() for 8 pixels
+static inline AUGMENT_TARGET_AVX2 void augment_distort_avx2(__m256 *r, __m256 *g, __m256 *b, float hue, float sat, float exposure)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 six = _mm256_set1_ps(6);
+    const __m256 max = _mm256_max_ps(*r, _mm256_max_ps(*g, *b));
+    const __m256 min = _mm256_min_ps(*r, _mm256_min_ps(*g, *b));
+    const __m256 delta = _mm256_sub_ps(max, min);
+    const __m256 colored = _mm256_and_ps(_mm256_cmp_ps(max, zero, _CMP_NEQ_OQ), _mm256_cmp_ps(delta, zero, _CMP_NEQ_OQ));
+    // the lanes that aren't colored divide by 0, their h and s are replaced with 0
+    __m256 s = _mm256_and_ps(colored, _mm256_div_ps(delta, max));
+    const __m256 hr = _mm256_div_ps(_mm256_sub_ps(*g, *b), delta);
+    const __m256 hg = _mm256_add_ps(_mm256_set1_ps(2), _mm256_div_ps(_mm256_sub_ps(*b, *r), delta));
+    const __m256 hb = _mm256_add_ps(_mm256_set1_ps(4), _mm256_div_ps(_mm256_sub_ps(*r, *g), delta));
+    __m256 h = augment_select(_mm256_cmp_ps(*r, max, _CMP_EQ_OQ), hr, augment_select(_mm256_cmp_ps(*g, max, _CMP_EQ_OQ), hg, hb));
+    h = _mm256_add_ps(h, _mm256_and_ps(_mm256_cmp_ps(h, zero, _CMP_LT_OQ), six));
+    h = _mm256_and_ps(colored, _mm256_div_ps(h, six));
+
+    s = _mm256_mul_ps(s, _mm256_set1_ps(sat));
+    const __m256 v = _mm256_mul_ps(max, _mm256_set1_ps(exposure));
+    h = _mm256_add_ps(h, _mm256_set1_ps(hue));
+    h = _mm256_sub_ps(h, _mm256_and_ps(_mm256_cmp_ps(h, one, _CMP_GT_OQ), one));
+    h = _mm256_add_ps(h, _mm256_and_ps(_mm256_cmp_ps(h, zero, _CMP_LT_OQ), one));
+
+    const __m256 h6 = _mm256_mul_ps(six, h);
+    const __m256 index = _mm256_floor_ps(h6);
+    const __m256 f = _mm256_sub_ps(h6, index);
+    const __m256 p = _mm256_mul_ps(v, _mm256_sub_ps(one, s));
+    const __m256 q = _mm256_mul_ps(v, _mm256_sub_ps(one, _mm256_mul_ps(s, f)));
+    const __m256 t = _mm256_mul_ps(v, _mm256_sub_ps(one, _mm256_mul_ps(s, _mm256_sub_ps(one, f))));
+    const __m256 i0 = _mm256_cmp_ps(index, zero, _CMP_EQ_OQ);
+    const __m256 i1 = _mm256_cmp_ps(index, one, _CMP_EQ_OQ);
+    const __m256 i2 = _mm256_cmp_ps(index, _mm256_set1_ps(2), _CMP_EQ_OQ);
+    const __m256 i3 = _mm256_cmp_ps(index, _mm256_set1_ps(3), _CMP_EQ_OQ);
+    const __m256 i4 = _mm256_cmp_ps(index, _mm256_set1_ps(4), _CMP_EQ_OQ);
+    __m256 nr = augment_select(i0, v, augment_select(i1, q, augment_select(i2, p, augment_select(i3, p, augment_select(i4, t, v)))));
+    __m256 ng = augment_select(i0, t, augment_select(i1, v, augment_select(i2, v, augment_select(i3, q, p))));
+    __m256 nb = augment_select(i0, p, augment_select(i1, p, augment_select(i2, t, augment_select(i3, v, augment_select(i4, v, q)))));
+    const __m256 gray = _mm256_cmp_ps(s, zero, _CMP_EQ_OQ);
+    nr = augment_select(gray, v, nr);
+    ng = augment_select(gray, v, ng);
+    nb = augment_select(gray, v, nb);
+    *r = _mm256_min_ps(_mm256_max_ps(nr, zero), one);
+    *g = _mm256_min_ps(_mm256_max_ps(ng, zero), one);
+    *b = _mm256_min_ps(_mm256_max_ps(nb, zero), one);
+}
+
+static AUGMENT_TARGET_AVX2 void augment_avx2(const augment_io *io, augment_params p, const augment_map *m)
+{
+    const int c = io->c, w = m->w;
+    const size_t src_size = (size_t)(io->src_h - 1) * io->step + (size_t)io->src_w * c;
+    const size_t plane = (size_t)io->dst_w * io->dst_h;
+    const int chunks = w / 8;
+    // the last byte a chunk gathers from in its row, to keep the 4-byte reads inside src
+    int *chunk_end = (int*)xcalloc(chunks > 0 ? chunks : 1, sizeof(int));
+    int r, j, k, n;
+    for (n = 0; n < chunks; ++n) {
+        for (j = n * 8; j < n * 8 + 8; ++j) {
+            const int end = ((m->x0[j] > m->x1[j]) ? m->x0[j] : m->x1[j]) + c - 1;
+            if (end > chunk_end[n]) chunk_end[n] = end;
+        }
+    }
+    for (r = 0; r < m->h; ++r) {
+        const unsigned char *row0 = io->src + (size_t)m->y0[r] * io->step;
+        const unsigned char *row1 = io->src + (size_t)m->y1[r] * io->step;
+        const size_t last_row = (size_t)((m->y0[r] > m->y1[r]) ? m->y0[r] : m->y1[r]) * io->step;
+        const __m256 wy0 = _mm256_set1_ps(m->wy0[r]);
+        const __m256 wy1 = _mm256_set1_ps(m->wy1[r]);
+        float *out = io->dst + (size_t)(io->y + r) * io->dst_w + io->x;
+        for (n = 0; n < chunks; ++n) {
+            j = n * 8;
+            if (last_row + chunk_end[n] + 3 >= src_size) {
+                augment_row_scalar(io, p, m, r, j, j + 8);
+                continue;
+            }
+            const __m256i x0 = _mm256_loadu_si256((const __m256i*)(m->x0 + j));
+            const __m256i x1 = _mm256_loadu_si256((const __m256i*)(m->x1 + j));
+            const __m256 wx0 = _mm256_loadu_ps(m->wx0 + j);
+            const __m256 wx1 = _mm256_loadu_ps(m->wx1 + j);
+            if (c == 3) {
+                __m256 v[3];
+                for (k = 0; k < 3; ++k) {
+                    const __m256i ck = _mm256_set1_epi32(augment_channel(io, k));
+                    v[k] = augment_sample_avx2(row0, row1, _mm256_add_epi32(x0, ck), _mm256_add_epi32(x1, ck), wx0, wx1, wy0, wy1);
+                }
+                if (p.distort) augment_distort_avx2(&v[0], &v[1], &v[2], p.hue, p.sat, p.exposure);
+                _mm256_storeu_ps(out + j, v[0]);
+                _mm256_storeu_ps(out + plane + j, v[1]);
+                _mm256_storeu_ps(out + 2 * plane + j, v[2]);
+            }
+            else {
+                __m256 v = augment_sample_avx2(row0, row1, x0, x1, wx0, wx1, wy0, wy1);
+                if (p.distort) {
+                    v = _mm256_mul_ps(v, _mm256_set1_ps(p.exposure));
+                    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1));
+                }
+                _mm256_storeu_ps(out + j, v);
+            }
+        }
+        if (chunks * 8 < w) augment_row_scalar(io, p, m, r, chunks * 8, w);
+    }
+    free(chunk_end);
+}
+#endif  // AUGMENT_X86
+
+static void augment_run(const augment_io *io, augment_params p, const augment_map *m)
+{
+#ifdef AUGMENT_X86
+    if ((io->c == 1 || io->c == 3) && is_cpu_fma_avx2()) {
+        augment_avx2(io, p, m);
+        return;
+    }
+#endif
+    augment_scalar(io, p, m);
+}
+
+static augment_io make_augment_io(const unsigned char *src, int src_w, int src_h, size_t step, int c, int swap_rb, image dst)
+{
+    augment_io io;
+    io.src = src;
+    io.src_w = src_w;
+    io.src_h = src_h;
+    io.c = c;
+    io.step = step;
+    io.swap_rb = swap_rb;
+    io.dst = dst.data;
+    io.dst_w = dst.w;
+    io.dst_h = dst.h;
+    io.x = io.y = 0;
+    return io;
+}
+
+void augment_image_u8(const unsigned char *src, int src_w, int src_h, int c, augment_params p, float *dst, int w, int h)
+{
+    const image out = { w, h, c, dst };
+    const augment_io io = make_augment_io(src, src_w, src_h, (size_t)src_w * c, c, 0, out);
+    augment_map m = make_augment_map(src_w, src_h, c, p, w, h);
+    augment_run(&io, p, &m);
+    free_augment_map(m);
+}
+
+void augment_image_u8_scalar(const unsigned char *src, int src_w, int src_h, int c, augment_params p, float *dst, int w, int h)
+{
+    const image out = { w, h, c, dst };
+    const augment_io io = make_augment_io(src, src_w, src_h, (size_t)src_w * c, c, 0, out);
+    augment_map m = make_augment_map(src_w, src_h, c, p, w, h);
+    augment_scalar(&io, p, &m);
+    free_augment_map(m);
+}
+
+void letterbox_image_u8_into(const unsigned char *src, int src_w, int src_h, size_t step, int swap_rb, image dst)
+{
+    const augment_params p = { 0, 0, src_w, src_h, 0, 0, 0, 1, 1 };
+    augment_io io = make_augment_io(src, src_w, src_h, step, dst.c, swap_rb, dst);
+    int new_w, new_h, k, r, j;
+    // the size and place of letterbox_image()
+    if (((float)dst.w / src_w) < ((float)dst.h / src_h)) {
+        new_w = dst.w;
+        new_h = (src_h * dst.w) / src_w;
+    }
+    else {
+        new_h = dst.h;
+        new_w = (src_w * dst.h) / src_h;
+    }
+    io.x = (dst.w - new_w) / 2;
+    io.y = (dst.h - new_h) / 2;
+    for (k = 0; k < dst.c; ++k) {
+        for (r = 0; r < dst.h; ++r) {
+            float *row = dst.data + ((size_t)k * dst.h + r) * dst.w;
+            if (r < io.y || r >= io.y + new_h) {
+                for (j = 0; j < dst.w; ++j) row[j] = .5;
+                continue;
+            }
+            for (j = 0; j < io.x; ++j) row[j] = .5;
+            for (j = io.x + new_w; j < dst.w; ++j) row[j] = .5;
+        }
+    }
+    augment_map m = make_augment_map(src_w, src_h, dst.c, p, new_w, new_h);
+    augment_run(&io, p, &m);
+    free_augment_map(m);
+}
+
+void resize_image_u8_into(const unsigned char *src, int src_w, int src_h, size_t step, int swap_rb, image dst)
+{
+    const augment_params p = { 0 };
+    const augment_io io = make_augment_io(src, src_w, src_h, step, dst.c, swap_rb, dst);
+    augment_map m = make_linear_map(src_w, src_h, dst.c, dst.w, dst.h);
+    augment_run(&io, p, &m);
+    free_augment_map(m);
+}
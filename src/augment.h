@@ -0,0 +1,40 @@
+#ifndef AUGMENT_H
+#define AUGMENT_H
+#include "darknet.h"
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fused augmentation of a decoded uint8 image, one pass per output row:
+// crop_image() -> resize_image() -> flip_image() -> distort_image() -> constrain,
+// from HWC uint8 (stb, packed datasets) to a normalized CHW float image.
+// The same sampling and HSV math as the per-pixel functions of image.c;
+// AVX2 does 8 output pixels at a time (gathers from the uint8 rows), with a
+// scalar fallback. The results differ from the float path by rounding only.
+
+typedef struct augment_params {
+    int crop_x, crop_y;     // crop in the source, can be out of it: the edge pixels repeat
+    int crop_w, crop_h;
+    int flip;
+    int distort;            // 0 - no HSV distortion
+    float hue, sat, exposure;   // as distort_image()
+} augment_params;
+
+// dst: w x h x c floats, AVX2 for c = 1 and 3
+void augment_image_u8(const unsigned char *src, int src_w, int src_h, int c, augment_params p, float *dst, int w, int h);
+// the scalar kernel, for comparisons
+void augment_image_u8_scalar(const unsigned char *src, int src_w, int src_h, int c, augment_params p, float *dst, int w, int h);
+
+// Network input of a captured HWC uint8 frame (step bytes per row, BGR if swap_rb)
+// written straight into dst (net.w x net.h x net.c, the frame has dst.c channels):
+// no float copy of the frame and nothing to free per frame.
+// letterbox_image() - the same size, place, sampling and .5 padding
+void letterbox_image_u8_into(const unsigned char *src, int src_w, int src_h, size_t step, int swap_rb, image dst);
+// bilinear with the pixel centers of cv::resize(), without its rounding to uint8
+void resize_image_u8_into(const unsigned char *src, int src_w, int src_h, size_t step, int swap_rb, image dst);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
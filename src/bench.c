@@ -0,0 +1,2110 @@
+#include "darknet.h"
+#include "network.h"
+#include "parser.h"
+#include "utils.h"
+#include "gemm.h"
+#include "gemm_packed.h"
+#include "convolutional_layer.h"
+#include "nchwc.h"
+#include "quantize.h"
+#include "memory_plan.h"
+#include "frame_pipeline.h"
+#include "stream_server.h"
+#include "http_stream.h"
+#include "box.h"
+#include "prepared.h"
+#include "data_loader.h"
+#include "data_pack.h"
+#include "data.h"
+#include "augment.h"
+#include "fast_activations.h"
+#include "layer_graph.h"
+#include "detection_pool.h"
+#include "yolo_layer.h"
+#include "json_writer.h"
+#include "blas.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+// Micro-benchmarks and self-checks for the CPU inference path:
+//   darknet bench gemm [cfg ...] [-iters N]
+//   darknet bench prepack [cfg ...] [-iters N]
+//   darknet bench conv [cfg ...] [-iters N]       - CPU conv algorithms vs the im2col reference
+//   darknet bench nchwc [cfg ...] [-iters N]      - blocked NCHWc layout vs NCHW, end-to-end
+//   darknet bench int8 [cfg ...] [-iters N] [-calib N] - INT8 kernels, INT8 vs fp32 network, end-to-end
+//   darknet bench memory [cfg ...] [-iters N]     - memory-planned arena vs a buffer per layer
+//   darknet bench ring [-items N] [-depth N]      - SPSC frame ring: order, drop-oldest, throughput
+//   darknet bench streams [cfg ...] [-streams N] [-frames N] [-max_batch N] [-max_wait_ms N]
+//                                                 - batched vs single forward, multi-stream scheduler
+//   darknet bench nms [-total N] [-classes N] [-iters N] - NMS engine vs the naive NMS, results must be identical
+//   darknet bench prepared [cfg ...] [-iters N]   - prepared model vs .weights: load time, identical outputs
+//   darknet bench loader <train.txt or packed> [-batch N] [-batches N] [-threads N] [-size N]
+//                                                 - training data: load_data() vs the prefetching loader
+//   darknet bench augment [-iters N] [-w N] [-h N] [-size N] - fused uint8 augmentation vs the per-pixel functions
+//   darknet bench preprocess [-iters N] [-w N] [-h N] [-size N] - fused letterbox/resize of a BGR frame vs the float image
+//   darknet bench activations [cfg ...] [-iters N] - polynomial activations: max ulp vs libm, speed, network outputs
+//   darknet bench graph [cfg ...] [-iters N] [-threads N] - dependency-graph executor vs the sequential forward
+//   darknet bench detections [cfg ...] [-iters N] [-thresh F] - pooled detections vs get_network_boxes()
+//   darknet bench yolo [cfg ...] [-iters N] [-thresh F] [-background F] - fused decode of the yolo logits vs the activated heads
+//   darknet bench json [-total N] [-classes N] [-iters N] - JSON writer vs the sprintf/strcat detection_to_json(), identical output
+//   darknet bench http [-port N] [-frames N]     - streaming server: JSON/MJPEG on loopback, paths, a stalled client
+//   darknet bench mjpeg [-port N] [-frames N] [-w N] [-h N] [-threads N] [-width N] [-interval MS]
+//                                                 - MJPEG encoder threads vs encoding on the caller's thread
+
+typedef struct gemm_shape {
+    int m, n, k;
+    int count;
+} gemm_shape;
+
+typedef void (*gemm_func_t)(int TA, int TB, int M, int N, int K, float ALPHA,
+    float *A, int lda, float *B, int ldb, float BETA, float *C, int ldc);
+
+// unique M/N/K of all the (non-binary) convolutional layers of a cfg
+static int collect_conv_gemm_shapes(char *cfgfile, gemm_shape *shapes, int count, int max_count)
+{
+    network net = parse_network_cfg_custom(cfgfile, 1, 0);
+    int i, j;
+    for (i = 0; i < net.n; ++i) {
+        layer l = net.layers[i];
+        if (l.type != CONVOLUTIONAL || l.xnor) continue;
+        const int m = l.n / l.groups;
+        const int n = l.out_w * l.out_h;
+        const int k = l.size * l.size * l.c / l.groups;
+        for (j = 0; j < count; ++j) {
+            if (shapes[j].m == m && shapes[j].n == n && shapes[j].k == k) break;
+        }
+        if (j < count) {
+            shapes[j].count += l.groups;
+        }
+        else if (count < max_count) {
+            shapes[count].m = m;
+            shapes[count].n = n;
+            shapes[count].k = k;
+            shapes[count].count = l.groups;
+            ++count;
+        }
+    }
+    free_network(net);
+    return count;
+}
+
+// best time of several runs, in seconds
+static double time_gemm(gemm_func_t func, int iters, gemm_shape s, float *a, float *b, float *c)
+{
+    double best = 0;
+    int i;
+    func(0, 0, s.m, s.n, s.k, 1, a, s.k, b, s.n, 0, c, s.n);   // warm-up
+    for (i = 0; i < iters; ++i) {
+        double start = get_time_point();
+        func(0, 0, s.m, s.n, s.k, 1, a, s.k, b, s.n, 0, c, s.n);
+        double t = (get_time_point() - start) / 1000000.;
+        if (i == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+static float max_relative_error(const float *ref, const float *val, size_t size)
+{
+    float max_err = 0;
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        float err = fabsf(ref[i] - val[i]) / fmaxf(1.0f, fabsf(ref[i]));
+        if (err > max_err) max_err = err;
+    }
+    return max_err;
+}
+
+static void bench_gemm(int argc, char **argv)
+{
+    int iters = find_int_arg(argc, argv, "-iters", 3);
+    char *default_cfgs[] = { "cfg/yolov4.cfg", "ball_v1.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 2;
+    int i;
+    // find_*_arg() removes the options it has found, so count what is left
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    gemm_packed_print_info();
+
+    int c;
+    for (c = 0; c < cfgs_count; ++c) {
+        gemm_shape shapes[512];
+        int count = collect_conv_gemm_shapes(cfgs[c], shapes, 0, 512);
+        double total_legacy = 0, total_packed = 0, total_flops = 0;
+        int fails = 0;
+
+        printf("\n %s: %d unique conv GEMM shapes \n", cfgs[c], count);
+        printf(" %6s %8s %6s %5s | %10s %10s | %7s | %9s \n", "M", "N", "K", "x", "legacy", "packed", "speedup", "max_err");
+        for (i = 0; i < count; ++i) {
+            gemm_shape s = shapes[i];
+            float *a = random_matrix(s.m, s.k);
+            float *b = random_matrix(s.k, s.n);
+            float *c_legacy = (float*)xcalloc((size_t)s.m * s.n, sizeof(float));
+            float *c_packed = (float*)xcalloc((size_t)s.m * s.n, sizeof(float));
+            double flops = 2.0 * s.m * s.n * s.k;
+
+            double t_legacy = time_gemm(gemm_cpu_legacy, iters, s, a, b, c_legacy);
+            double t_packed = time_gemm(gemm_packed, iters, s, a, b, c_packed);
+            float err = max_relative_error(c_legacy, c_packed, (size_t)s.m * s.n);
+            if (err > 1e-3f) ++fails;
+
+            printf(" %6d %8d %6d %5d | %10.2f %10.2f | %6.2fx | %9.2e %s\n", s.m, s.n, s.k, s.count,
+                flops / t_legacy / 1e9, flops / t_packed / 1e9, t_legacy / t_packed, err, (err > 1e-3f) ? "FAIL" : "");
+
+            total_legacy += t_legacy * s.count;
+            total_packed += t_packed * s.count;
+            total_flops += flops * s.count;
+            free(a);
+            free(b);
+            free(c_legacy);
+            free(c_packed);
+        }
+        printf(" total (GFLOP/s): legacy %.2f, packed %.2f, speedup %.2fx, %d mismatches \n",
+            total_flops / total_legacy / 1e9, total_flops / total_packed / 1e9, total_legacy / total_packed, fails);
+    }
+}
+
+// cfg with random weights, ready for inference: batch-norm fused
+static network bench_load_network_batch(char *cfgfile, int batch)
+{
+    network net = parse_network_cfg_custom(cfgfile, batch, 1);
+    int i, f;
+    for (i = 0; i < net.n; ++i) {
+        layer *l = &net.layers[i];
+        if (l->type == CONVOLUTIONAL && l->batch_normalize && l->rolling_variance) {
+            for (f = 0; f < l->n; ++f) l->rolling_variance[f] = 1;
+        }
+    }
+    fuse_conv_batchnorm(net);
+    calculate_binary_weights(net);
+    return net;
+}
+
+static network bench_load_network(char *cfgfile)
+{
+    return bench_load_network_batch(cfgfile, 1);
+}
+
+static float *bench_random_input_size(size_t size)
+{
+    float *input = (float*)xcalloc(size, sizeof(float));
+    size_t i;
+    for (i = 0; i < size; ++i) input[i] = rand_uniform(0, 1);
+    return input;
+}
+
+static float *bench_random_input(network net)
+{
+    return bench_random_input_size((size_t)net.w * net.h * net.c);
+}
+
+// best time of several forward passes, in milli-seconds
+static double bench_forward(network net, float *input, int iters)
+{
+    double best = 0;
+    int i;
+    network_predict(net, input);   // warm-up
+    for (i = 0; i < iters; ++i) {
+        double start = get_time_point();
+        network_predict(net, input);
+        double t = (get_time_point() - start) / 1000.;
+        if (i == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+// outputs of the detection heads, to compare different inference paths
+static float **bench_copy_outputs(network net)
+{
+    float **outputs = (float**)xcalloc(net.n, sizeof(float*));
+    int i;
+    for (i = 0; i < net.n; ++i) {
+        layer l = net.layers[i];
+        if (l.type != YOLO && l.type != GAUSSIAN_YOLO && l.type != REGION && l.type != DETECTION && i != net.n - 1) continue;
+        outputs[i] = (float*)xcalloc(l.outputs, sizeof(float));
+        memcpy(outputs[i], l.output, l.outputs * sizeof(float));
+    }
+    return outputs;
+}
+
+static float bench_compare_outputs(network net, float **outputs)
+{
+    float max_err = 0;
+    int i;
+    for (i = 0; i < net.n; ++i) {
+        if (!outputs[i]) continue;
+        float err = max_relative_error(outputs[i], net.layers[i].output, net.layers[i].outputs);
+        if (err > max_err) max_err = err;
+    }
+    return max_err;
+}
+
+static void bench_free_outputs(network net, float **outputs)
+{
+    int i;
+    for (i = 0; i < net.n; ++i) free(outputs[i]);
+    free(outputs);
+}
+
+static void bench_prepack(int argc, char **argv)
+{
+    int iters = find_int_arg(argc, argv, "-iters", 3);
+    char *default_cfgs[] = { "cfg/yolov4.cfg", "ball_v1.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 2;
+    int c, i;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    gemm_packed_print_info();
+
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        float *input = bench_random_input(net);
+
+        double t_repack = bench_forward(net, input, iters);
+        float **ref = bench_copy_outputs(net);
+
+        prepare_network_for_inference(&net);
+        print_cpu_conv_algorithms(net);
+        double t_prepacked = bench_forward(net, input, iters);
+        float err = bench_compare_outputs(net, ref);
+
+        printf("\n %s: generic path %.2f ms, prepare_network_for_inference() %.2f ms, speedup %.2fx, max_err %.2e %s\n",
+            cfgs[c], t_repack, t_prepacked, t_repack / t_prepacked, err, (err > 1e-3f) ? "FAIL" : "");
+
+        bench_free_outputs(net, ref);
+        free(input);
+        free_network(net);
+    }
+}
+
+// max |ref - val| relative to the largest |ref|, for outputs where single values can be ~0
+static float max_normalized_error(const float *ref, const float *val, size_t size)
+{
+    float max_err = 0, max_ref = 1;
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        if (fabsf(ref[i]) > max_ref) max_ref = fabsf(ref[i]);
+    }
+    for (i = 0; i < size; ++i) {
+        float err = fabsf(ref[i] - val[i]) / max_ref;
+        if (err > max_err) max_err = err;
+    }
+    return max_err;
+}
+
+// best time of several runs of one conv layer, in milli-seconds
+static double bench_conv_forward(layer l, network_state state, int iters)
+{
+    double best = 0;
+    int i;
+    forward_convolutional_layer(l, state);   // warm-up
+    for (i = 0; i < iters; ++i) {
+        double start = get_time_point();
+        forward_convolutional_layer(l, state);
+        double t = (get_time_point() - start) / 1000.;
+        if (i == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+static void bench_conv(int argc, char **argv)
+{
+    int iters = find_int_arg(argc, argv, "-iters", 3);
+    char *default_cfgs[] = { "cfg/yolov4.cfg", "ball_v1.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 2;
+    int c, i, a;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    gemm_packed_print_info();
+
+    int total_fails = 0;
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        double total_ref = 0, total_selected = 0;
+        size_t ref_workspace = 0, selected_workspace = 0;
+        int fails = 0;
+
+        printf("\n %s \n", cfgs[c]);
+        printf(" %4s %5s %4s %4s %5s %3s %2s | %9s | %-12s %9s %9s \n", "L", "c", "h", "w", "n", "sz", "st", "im2col", "algo", "ms", "err");
+        for (i = 0; i < net.n; ++i) {
+            layer l = net.layers[i];
+            if (l.type != CONVOLUTIONAL || l.xnor) continue;
+            l.antialiasing = 0;
+            l.weights_packed = NULL;
+            l.weights_winograd = NULL;
+            l.conv_algo = CONV_ALGO_IM2COL;
+
+            const size_t output_size = (size_t)l.outputs * l.batch;
+            const size_t workspace_size = get_convolutional_workspace_size(l);
+            network_state state = { 0 };
+            state.net = net;
+            state.index = i;
+            state.train = 0;
+            state.input = bench_random_input_size((size_t)l.inputs * l.batch);
+            state.workspace = (float*)xcalloc(1, workspace_size);
+
+            double t_ref = bench_conv_forward(l, state, iters);
+            float *ref = (float*)xcalloc(output_size, sizeof(float));
+            memcpy(ref, l.output, output_size * sizeof(float));
+            if (workspace_size > ref_workspace) ref_workspace = workspace_size;
+
+            const CONV_ALGO selected = select_convolutional_algorithm(l);
+            printf(" %4d %5d %4d %4d %5d %3d %2d | %9.2f |", i, l.c, l.h, l.w, l.n, l.size, l.stride_x, t_ref);
+            int printed = 0;
+            for (a = CONV_ALGO_IM2COL; a <= CONV_ALGO_WINOGRAD_4X4; ++a) {
+                if (!is_convolutional_algorithm_supported(l, (CONV_ALGO)a)) continue;
+                layer t = l;
+                set_convolutional_algorithm(&t, (CONV_ALGO)a);
+                const size_t algo_workspace = get_convolutional_workspace_size(t);
+                if (algo_workspace > workspace_size) {
+                    free(state.workspace);
+                    state.workspace = (float*)xcalloc(1, algo_workspace);
+                }
+                double t_algo = bench_conv_forward(t, state, iters);
+                float err = max_normalized_error(ref, t.output, output_size);
+                if (err > 1e-3f) ++fails;
+                if (a == selected) {
+                    total_selected += t_algo;
+                    if (algo_workspace > selected_workspace) selected_workspace = algo_workspace;
+                }
+                printf("%s %-11s%c %9.2f %9.2e %s\n", printed ? "                                             |" : "",
+                    get_conv_algo_string((CONV_ALGO)a), (a == selected) ? '*' : ' ', t_algo, err, (err > 1e-3f) ? "FAIL" : "");
+                printed = 1;
+                gemm_aligned_free(t.weights_packed);
+                gemm_aligned_free(t.weights_winograd);
+            }
+            total_ref += t_ref;
+
+            free(ref);
+            free(state.input);
+            free(state.workspace);
+        }
+        printf(" total: im2col reference %.2f ms, selected (*) %.2f ms, speedup %.2fx \n", total_ref, total_selected, total_ref / total_selected);
+        printf(" peak conv workspace: %.1f MB -> %.1f MB, %d mismatches \n",
+            (float)ref_workspace / (1024 * 1024), (float)selected_workspace / (1024 * 1024), fails);
+        total_fails += fails;
+        free_network(net);
+    }
+    if (total_fails) printf("\n conv selftest FAILED: %d mismatches \n", total_fails);
+    else printf("\n conv selftest passed \n");
+}
+
+static void bench_nchwc(int argc, char **argv)
+{
+    int iters = find_int_arg(argc, argv, "-iters", 3);
+    char *default_cfgs[] = { "cfg/yolov4.cfg", "cfg/yolov3-tiny.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 2;
+    int c, i, fails = 0;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    printf(" NCHWc channel block: %d \n", nchwc_block_size());
+
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        float *input = bench_random_input(net);
+
+        prepare_network_for_inference(&net);
+        double t_nchw = bench_forward(net, input, iters);
+        float **ref = bench_copy_outputs(net);
+
+        if (!enable_network_nchwc(&net)) {
+            printf("\n %s: NCHWc is not supported \n", cfgs[c]);
+        }
+        else {
+            double t_nchwc = bench_forward(net, input, iters);
+            float err = bench_compare_outputs(net, ref);
+            if (err > 1e-3f) ++fails;
+            printf("\n %s: NCHW %.2f ms, NCHWc %.2f ms, speedup %.2fx, max_err %.2e %s\n",
+                cfgs[c], t_nchw, t_nchwc, t_nchw / t_nchwc, err, (err > 1e-3f) ? "FAIL" : "");
+
+            // back to NCHW must give the reference again
+            disable_network_nchwc(&net);
+            network_predict(net, input);
+            err = bench_compare_outputs(net, ref);
+            if (err > 1e-3f) ++fails, printf(" NCHW after disable_network_nchwc(): max_err %.2e FAIL \n", err);
+        }
+
+        bench_free_outputs(net, ref);
+        free(input);
+        free_network(net);
+    }
+    if (fails) printf("\n nchwc selftest FAILED \n");
+    else printf("\n nchwc selftest passed \n");
+}
+
+static void bench_int8(int argc, char **argv)
+{
+    int iters = find_int_arg(argc, argv, "-iters", 3);
+    int calib = find_int_arg(argc, argv, "-calib", 4);
+    char *default_cfgs[] = { "cfg/yolov4-tiny.cfg", "cfg/yolov3-tiny.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 2;
+    int c, i, j, fails;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    fails = test_int8_kernels();
+
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        int8_calibration *cal = make_int8_calibration(net);
+        float *input = 0;
+        for (i = 0; i < calib; ++i) {
+            free(input);
+            input = bench_random_input(net);
+            network_predict(net, input);
+            update_int8_calibration(cal, net, input);
+        }
+        input = bench_random_input(net);
+
+        prepare_network_for_inference(&net);
+        double t_fp32 = bench_forward(net, input, iters);
+        float **ref = bench_copy_outputs(net);
+
+        if (!quantize_network_int8(&net, cal)) {
+            printf("\n %s: no layer can be quantized \n", cfgs[c]);
+        }
+        else {
+            double t_int8 = bench_forward(net, input, iters);
+            // the heads: error relative to the largest output, and mean error
+            float max_err = 0, mean_err = 0;
+            size_t size = 0;
+            for (j = 0; j < net.n; ++j) {
+                layer l = net.layers[j];
+                size_t k;
+                if (!ref[j]) continue;
+                float err = max_normalized_error(ref[j], l.output, l.outputs);
+                if (err > max_err) max_err = err;
+                for (k = 0; k < (size_t)l.outputs; ++k) mean_err += fabsf(ref[j][k] - l.output[k]);
+                size += l.outputs;
+            }
+            mean_err /= size;
+            printf("\n %s: fp32 %.2f ms, int8 %.2f ms, speedup %.2fx, head error max %.2e mean %.2e \n",
+                cfgs[c], t_fp32, t_int8, t_fp32 / t_int8, max_err, mean_err);
+        }
+
+        free_int8_calibration(cal);
+        bench_free_outputs(net, ref);
+        free(input);
+        free_network(net);
+    }
+    if (fails) printf("\n int8 selftest FAILED \n");
+    else printf("\n int8 selftest passed \n");
+}
+
+static void bench_memory(int argc, char **argv)
+{
+    int iters = find_int_arg(argc, argv, "-iters", 3);
+    char *default_cfgs[] = { "cfg/yolov4.cfg", "cfg/yolov3-tiny.cfg", "cfg/darknet53.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 3;
+    int c, i, fails = 0;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        float *input = bench_random_input(net);
+        int pass;
+
+        prepare_network_for_inference(&net);
+        // planar, then blocked NCHWc when this CPU and network can
+        for (pass = 0; pass < 2; ++pass) {
+            if (pass == 1 && !enable_network_nchwc(&net)) break;
+            double t_ref = bench_forward(net, input, iters);
+            float **ref = bench_copy_outputs(net);
+            if (!plan_network_memory(&net)) {
+                printf("\n %s: the memory plan is not supported \n", cfgs[c]);
+                bench_free_outputs(net, ref);
+                break;
+            }
+            double t_plan = bench_forward(net, input, iters);
+            float err = bench_compare_outputs(net, ref);
+            if (err != 0) ++fails;
+            printf("\n %s%s: a buffer per layer %.2f ms, arena %.2f ms, max_err %.2e %s\n",
+                cfgs[c], pass ? " (NCHWc)" : "", t_ref, t_plan, err, err ? "FAIL" : "");
+
+            // resize and back must give the reference again (classifiers can't be resized)
+            if (net.layers[net.n - 1].type == YOLO || net.layers[net.n - 1].type == REGION) {
+                resize_network(&net, net.w + 32, net.h + 32);
+                resize_network(&net, net.w - 32, net.h - 32);
+                network_predict(net, input);
+                err = bench_compare_outputs(net, ref);
+                if (err != 0) ++fails, printf(" after resize_network(): max_err %.2e FAIL \n", err);
+            }
+
+            release_network_memory_plan(&net);
+            bench_free_outputs(net, ref);
+        }
+
+        free(input);
+        free_network(net);
+    }
+    if (fails) printf("\n memory selftest FAILED \n");
+    else printf("\n memory selftest passed \n");
+}
+
+typedef struct bench_ring_args {
+    spsc_ring *ring;
+    int items;
+    int drop_oldest;
+    long long dropped;      // sum of the dropped items
+    int dropped_count;
+} bench_ring_args;
+
+// pushes 1..items and closes the ring
+static void *bench_ring_producer(void *ptr)
+{
+    bench_ring_args *args = (bench_ring_args*)ptr;
+    intptr_t i;
+    for (i = 1; i <= args->items; ++i) {
+        if (args->drop_oldest) {
+            void *dropped = spsc_ring_push_drop_oldest(args->ring, (void*)i);
+            if (dropped) {
+                args->dropped += (intptr_t)dropped;
+                ++args->dropped_count;
+            }
+        }
+        else if (!spsc_ring_push(args->ring, (void*)i)) break;
+    }
+    spsc_ring_close(args->ring);
+    return 0;
+}
+
+// the consumer must get increasing items and, with the dropped ones, every item once
+static int bench_ring_run(int items, int depth, int drop_oldest, int slow_consumer)
+{
+    bench_ring_args args = { 0 };
+    custom_thread_t producer = NULL;
+    long long sum = 0;
+    intptr_t last = 0;
+    int popped = 0, order_errors = 0, ok;
+    void *item;
+    double start = get_time_point();
+
+    args.ring = make_spsc_ring(depth);
+    args.items = items;
+    args.drop_oldest = drop_oldest;
+    if (custom_create_thread(&producer, 0, bench_ring_producer, &args)) error("Thread creation failed", DARKNET_LOC);
+    while ((item = spsc_ring_pop(args.ring))) {
+        if ((intptr_t)item <= last) ++order_errors;
+        last = (intptr_t)item;
+        sum += last;
+        ++popped;
+        if (slow_consumer && popped % 64 == 0) this_thread_sleep_for(1);
+    }
+    custom_join(producer, 0);
+    free_spsc_ring(args.ring);
+
+    ok = !order_errors && popped + args.dropped_count == items &&
+        sum + args.dropped == (long long)items * (items + 1) / 2 &&
+        (drop_oldest || !args.dropped_count);
+    printf(" depth %2d, %-11s %-9s consumer: %d popped, %d dropped, %.2f M items/s %s\n",
+        depth, drop_oldest ? "drop-oldest" : "blocking", slow_consumer ? "slow" : "fast",
+        popped, args.dropped_count, items / (get_time_point() - start), ok ? "" : "FAIL");
+    return ok;
+}
+
+static void bench_ring(int argc, char **argv)
+{
+    int items = find_int_arg(argc, argv, "-items", 1000000);
+    int depth = find_int_arg(argc, argv, "-depth", 0);
+    int depths[] = { 1, 2, 4, 64 };
+    int d, fails = 0;
+
+    printf("\n");
+    for (d = 0; d < 4; ++d) {
+        const int dd = depth ? depth : depths[d];
+        fails += !bench_ring_run(items, dd, 0, 0);
+        fails += !bench_ring_run(items, dd, 1, 0);
+        fails += !bench_ring_run(items / 100, dd, 0, 1);
+        fails += !bench_ring_run(items / 100, dd, 1, 1);
+        if (depth) break;
+    }
+    if (fails) printf("\n ring selftest FAILED \n");
+    else printf("\n ring selftest passed \n");
+}
+
+typedef struct bench_stream_args {
+    stream_scheduler *s;
+    int stream;
+    int frames;
+    float *input;
+} bench_stream_args;
+
+// a source that pushes its frames as fast as the scheduler takes them
+static void *bench_stream_source(void *ptr)
+{
+    bench_stream_args *args = (bench_stream_args*)ptr;
+    network *net = args->s->net;
+    int i;
+    for (i = 0; i < args->frames; ++i) {
+        image in = get_stream_input(args->s, args->stream);
+        memcpy(in.data, args->input, (size_t)net->w * net->h * net->c * sizeof(float));
+        if (!push_stream_frame(args->s, make_stream_frame(args->stream, i + 1, in, net->w, net->h, NULL), 0)) break;
+    }
+    close_stream_input(args->s, args->stream);
+    return 0;
+}
+
+// all the frames of all the streams through the scheduler, returns frames/s
+static double bench_stream_scheduler(network *net, int streams, int frames, int max_batch, int max_wait_ms, float **inputs, int *fails)
+{
+    stream_scheduler *s = make_stream_scheduler(net, streams, 2, max_batch, max_wait_ms);
+    bench_stream_args *args = (bench_stream_args*)xcalloc(streams, sizeof(bench_stream_args));
+    custom_thread_t *threads = (custom_thread_t*)xcalloc(streams, sizeof(custom_thread_t));
+    long long *last = (long long*)xcalloc(streams, sizeof(long long));
+    int i, done = 0, order_errors = 0;
+    double start = get_time_point(), elapsed;
+
+    for (i = 0; i < streams; ++i) {
+        args[i].s = s;
+        args[i].stream = i;
+        args[i].frames = frames;
+        args[i].input = inputs[i % max_batch];
+        if (custom_create_thread(&threads[i], 0, bench_stream_source, &args[i])) error("Thread creation failed", DARKNET_LOC);
+    }
+    while (run_stream_batch(s)) {
+        for (i = 0; i < streams; ++i) {
+            stream_frame *frame;
+            while ((frame = (stream_frame*)spsc_ring_try_pop(s->out[i]))) {
+                if (frame->id != last[i] + 1) ++order_errors;
+                last[i] = frame->id;
+                ++done;
+                free_stream_frame(frame);
+            }
+        }
+    }
+    elapsed = get_time_point() - start;
+    for (i = 0; i < streams; ++i) custom_join(threads[i], 0);
+
+    printf("\n max_batch %d, max_wait %d ms: ", s->max_batch, max_wait_ms);
+    print_stream_scheduler(s, elapsed);
+    if (done != streams * frames || order_errors) {
+        printf(" %d of %d frames, %d out of order FAIL \n", done, streams * frames, order_errors);
+        ++*fails;
+    }
+    free_stream_scheduler(s);
+    free(args);
+    free(threads);
+    free(last);
+    return done * 1000000. / elapsed;
+}
+
+static void bench_streams(int argc, char **argv)
+{
+    int streams = find_int_arg(argc, argv, "-streams", 8);
+    int frames = find_int_arg(argc, argv, "-frames", 8);
+    int max_batch = find_int_arg(argc, argv, "-max_batch", 4);
+    int max_wait_ms = find_int_arg(argc, argv, "-max_wait_ms", 10);
+    char *default_cfgs[] = { "cfg/yolov4-tiny.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 1;
+    int c, i, b, fails = 0;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+    if (max_batch < 1) max_batch = 1;
+
+    init_cpu();
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network_batch(cfgs[c], max_batch);
+        const size_t size = (size_t)net.w * net.h * net.c;
+        float **inputs = (float**)xcalloc(max_batch, sizeof(float*));
+        float *batch_input = (float*)xcalloc(size * max_batch, sizeof(float));
+        float ***refs = (float***)xcalloc(max_batch, sizeof(float**));
+        double t_single, t_batch, fps_single, fps_batch;
+        float max_err = 0;
+
+        prepare_network_for_inference(&net);
+        for (b = 0; b < max_batch; ++b) {
+            inputs[b] = bench_random_input(net);
+            memcpy(batch_input + b*size, inputs[b], size * sizeof(float));
+        }
+
+        // one image at a time, then all of them in one batch: every image must give the same outputs
+        t_single = get_time_point();
+        for (b = 0; b < max_batch; ++b) {
+            network_predict_batched(&net, inputs[b], 1);
+            refs[b] = bench_copy_outputs(net);
+        }
+        t_single = (get_time_point() - t_single) / 1000.;
+        t_batch = get_time_point();
+        network_predict_batched(&net, batch_input, max_batch);
+        t_batch = (get_time_point() - t_batch) / 1000.;
+        for (b = 0; b < max_batch; ++b) {
+            for (i = 0; i < net.n; ++i) {
+                if (!refs[b][i]) continue;
+                layer l = net.layers[i];
+                float err = max_relative_error(refs[b][i], l.output + (size_t)b*l.outputs, l.outputs);
+                if (err > max_err) max_err = err;
+            }
+            bench_free_outputs(net, refs[b]);
+        }
+        if (max_err != 0) ++fails;
+        printf("\n %s: %d images one by one %.2f ms, as one batch %.2f ms, max_err %.2e %s\n",
+            cfgs[c], max_batch, t_single, t_batch, max_err, max_err ? "FAIL" : "");
+
+        fps_single = bench_stream_scheduler(&net, streams, frames, 1, 0, inputs, &fails);
+        fps_batch = bench_stream_scheduler(&net, streams, frames, max_batch, max_wait_ms, inputs, &fails);
+        printf("\n %s: %d streams, %.1f frames/s with max_batch 1, %.1f frames/s with max_batch %d \n",
+            cfgs[c], streams, fps_single, fps_batch, max_batch);
+
+        for (b = 0; b < max_batch; ++b) free(inputs[b]);
+        free(inputs);
+        free(refs);
+        free(batch_input);
+        free_network(net);
+    }
+    if (fails) printf("\n streams selftest FAILED \n");
+    else printf("\n streams selftest passed \n");
+}
+
+// yolo-like detections around a few objects, objectness 0 for some, class
+// probabilities 0 below 0.005; quantized scores and duplicated boxes give ties
+static detection *bench_make_detections(int total, int classes, int quantize)
+{
+    const int objects = total / 20 + 1;
+    detection *dets = (detection*)xcalloc(total, sizeof(detection));
+    box *centers = (box*)xcalloc(objects, sizeof(box));
+    int i, k;
+    for (i = 0; i < objects; ++i) {
+        centers[i].x = rand_uniform(0, 1);
+        centers[i].y = rand_uniform(0, 1);
+        centers[i].w = rand_uniform(.02, .5);
+        centers[i].h = rand_uniform(.02, .5);
+    }
+    for (i = 0; i < total; ++i) {
+        const int o = rand() % objects;
+        detection *d = &dets[i];
+        d->classes = classes;
+        d->prob = (float*)xcalloc(classes, sizeof(float));
+        if (quantize && i > 0 && rand() % 8 == 0) d->bbox = dets[i - 1].bbox;
+        else {
+            d->bbox.x = centers[o].x + rand_uniform(-.03, .03);
+            d->bbox.y = centers[o].y + rand_uniform(-.03, .03);
+            d->bbox.w = centers[o].w * rand_uniform(.7, 1.3);
+            d->bbox.h = centers[o].h * rand_uniform(.7, 1.3);
+        }
+        d->objectness = rand() % 10 ? rand_uniform(0, 1) : 0;
+        if (quantize) d->objectness = roundf(d->objectness * 8) / 8;
+        for (k = 0; k < classes; ++k) {
+            const int likely = k == o % classes || rand() % 16 == 0;
+            float p = likely ? d->objectness * rand_uniform(0, 1) : 0;
+            if (quantize) p = roundf(p * 16) / 16;
+            d->prob[k] = p > .005 ? p : 0;
+        }
+    }
+    free(centers);
+    return dets;
+}
+
+static detection *bench_copy_detections(const detection *dets, int total, int classes)
+{
+    detection *copy = (detection*)xcalloc(total, sizeof(detection));
+    int i;
+    for (i = 0; i < total; ++i) {
+        copy[i] = dets[i];
+        copy[i].prob = (float*)xcalloc(classes, sizeof(float));
+        memcpy(copy[i].prob, dets[i].prob, classes * sizeof(float));
+    }
+    return copy;
+}
+
+// the same detections in the same order, bit for bit
+static int bench_same_detections(const detection *a, const detection *b, int total, int classes)
+{
+    int i;
+    for (i = 0; i < total; ++i) {
+        if (memcmp(&a[i].bbox, &b[i].bbox, sizeof(box)) || a[i].objectness != b[i].objectness ||
+            a[i].sort_class != b[i].sort_class || memcmp(a[i].prob, b[i].prob, classes * sizeof(float))) return 0;
+    }
+    return 1;
+}
+
+// kind: -1 do_nms_obj, DEFAULT_NMS do_nms_sort, other diounms_sort
+static void bench_run_nms(detection *dets, int total, int classes, float thresh, int kind, int naive)
+{
+    if (kind < 0) {
+        if (naive) do_nms_obj_naive(dets, total, classes, thresh);
+        else do_nms_obj(dets, total, classes, thresh);
+    }
+    else if (kind == DEFAULT_NMS) {
+        if (naive) do_nms_sort_naive(dets, total, classes, thresh);
+        else do_nms_sort(dets, total, classes, thresh);
+    }
+    else {
+        if (naive) diounms_sort_naive(dets, total, classes, thresh, (NMS_KIND)kind, 0.6);
+        else diounms_sort(dets, total, classes, thresh, (NMS_KIND)kind, 0.6);
+    }
+}
+
+static void bench_nms(int argc, char **argv)
+{
+    int total = find_int_arg(argc, argv, "-total", 5000);
+    int classes = find_int_arg(argc, argv, "-classes", 80);
+    int iters = find_int_arg(argc, argv, "-iters", 3);
+    const int kinds[] = { -1, DEFAULT_NMS, GREEDY_NMS, DIOU_NMS, CORNERS_NMS };
+    const char *kind_names[] = { "obj", "default", "greedy", "diou", "corners" };
+    const int totals[] = { 0, 1, 2, 50, 500, 2000 };
+    const int class_counts[] = { 1, 3, 80 };
+    const float threshs[] = { 0, .45, .7 };
+    int t, c, h, q, k, i, cases = 0, fails = 0;
+
+    srand(1);
+    for (t = 0; t < 6; ++t) {
+        for (c = 0; c < 3; ++c) {
+            for (h = 0; h < 3; ++h) {
+                for (q = 0; q < 2; ++q) {
+                    detection *dets = bench_make_detections(totals[t], class_counts[c], q);
+                    for (k = 0; k < 5; ++k) {
+                        detection *ref = bench_copy_detections(dets, totals[t], class_counts[c]);
+                        detection *val = bench_copy_detections(dets, totals[t], class_counts[c]);
+                        bench_run_nms(ref, totals[t], class_counts[c], threshs[h], kinds[k], 1);
+                        bench_run_nms(val, totals[t], class_counts[c], threshs[h], kinds[k], 0);
+                        if (!bench_same_detections(ref, val, totals[t], class_counts[c])) {
+                            printf(" FAIL: %s, %d detections, %d classes, thresh %.2f%s \n",
+                                kind_names[k], totals[t], class_counts[c], threshs[h], q ? ", ties" : "");
+                            ++fails;
+                        }
+                        ++cases;
+                        free_detections(ref, totals[t]);
+                        free_detections(val, totals[t]);
+                    }
+                    free_detections(dets, totals[t]);
+                }
+            }
+        }
+    }
+    printf("\n %d cases, %d differ from the naive NMS \n\n", cases, fails);
+
+    {
+        detection *dets = bench_make_detections(total, classes, 0);
+        printf(" %d detections, %d classes: \n", total, classes);
+        for (k = 0; k < 5; ++k) {
+            double best[2] = { 0, 0 };
+            int naive;
+            for (naive = 1; naive >= 0; --naive) {
+                for (i = 0; i < iters; ++i) {
+                    detection *copy = bench_copy_detections(dets, total, classes);
+                    double start = get_time_point();
+                    bench_run_nms(copy, total, classes, .45, kinds[k], naive);
+                    start = (get_time_point() - start) / 1000.;
+                    if (i == 0 || start < best[naive]) best[naive] = start;
+                    free_detections(copy, total);
+                }
+            }
+            printf(" %-8s naive %9.2f ms, engine %8.2f ms, %6.1fx \n", kind_names[k], best[1], best[0],
+                best[0] > 0 ? best[1] / best[0] : 0);
+        }
+        free_detections(dets, total);
+    }
+    if (fails) printf("\n nms selftest FAILED \n");
+    else printf("\n nms selftest passed \n");
+}
+
+static network *bench_load_weights_file(char *cfgfile, char *weightfile, double *load_ms)
+{
+    double start = get_time_point();
+    network *net = load_network_custom(cfgfile, weightfile, 0, 1);
+    *load_ms = (get_time_point() - start) / 1000.;
+    return net;
+}
+
+static void bench_prepared(int argc, char **argv)
+{
+    int iters = find_int_arg(argc, argv, "-iters", 3);
+    char *default_cfgs[] = { "cfg/yolov4.cfg", "cfg/yolov4-tiny.cfg" };
+    char **cfgs = default_cfgs;
+    char *weightfile = "bench_prepared.weights";
+    char *preparedfile = "bench_prepared.prepared";
+    int cfgs_count = 2;
+    int c, i, fails = 0;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    for (c = 0; c < cfgs_count; ++c) {
+        // random weights with positive variances, saved as a .weights file
+        network src = parse_network_cfg_custom(cfgs[c], 1, 1);
+        for (i = 0; i < src.n; ++i) {
+            layer *l = &src.layers[i];
+            if (l->type == CONVOLUTIONAL && l->batch_normalize && l->rolling_variance) {
+                int f;
+                for (f = 0; f < l->n; ++f) l->rolling_variance[f] = rand_uniform(.5, 2);
+            }
+        }
+        float *input = bench_random_input(src);
+        save_weights(src, weightfile);
+        free_network(src);
+        export_prepared_model(cfgs[c], weightfile, preparedfile);
+
+        double t_weights, t_prepared;
+        network *ref = bench_load_weights_file(cfgs[c], weightfile, &t_weights);
+        double f_weights = bench_forward(*ref, input, iters);
+        float **outputs = bench_copy_outputs(*ref);
+
+        network *net = bench_load_weights_file(cfgs[c], preparedfile, &t_prepared);
+        double f_prepared = bench_forward(*net, input, iters);
+        float err = bench_compare_outputs(*net, outputs);
+        if (err != 0) ++fails;
+
+        printf("\n %s: load .weights %.1f ms, prepared %.1f ms (%.1fx); forward %.2f ms vs %.2f ms, max_err %.2e %s\n",
+            cfgs[c], t_weights, t_prepared, t_weights / t_prepared, f_weights, f_prepared, err, err ? "FAIL" : "");
+
+        bench_free_outputs(*ref, outputs);
+        free_network_ptr(ref);
+        free_network_ptr(net);
+        free(ref);
+        free(net);
+        free(input);
+        remove(weightfile);
+        remove(preparedfile);
+    }
+    if (fails) printf("\n prepared selftest FAILED \n");
+    else printf("\n prepared selftest passed \n");
+}
+
+static void bench_loader(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s %s loader <train.txt> [-batch N] [-batches N] [-threads N] [-size N]\n", argv[0], argv[1]);
+        return;
+    }
+    const int batch = find_int_arg(argc, argv, "-batch", 64);
+    const int batches = find_int_arg(argc, argv, "-batches", 10);
+    const int size = find_int_arg(argc, argv, "-size", 416);
+    const int packed_list = is_packed_dataset(argv[3]);
+    list *plist = packed_list ? open_packed_dataset(argv[3]) : get_paths(argv[3]);
+    char **paths = (char **)list_to_array(plist);
+    load_args args = { 0 };
+    data train, buffer;
+    int i;
+
+    args.threads = find_int_arg(argc, argv, "-threads", 16);
+    args.w = size;
+    args.h = size;
+    args.c = 3;
+    args.paths = paths;
+    args.n = batch;
+    args.m = plist->size;
+    args.classes = 80;
+    args.flip = 1;
+    args.jitter = .3;
+    args.resize = 1;
+    args.num_boxes = 90;
+    args.truth_size = 5;
+    args.hue = .1;
+    args.saturation = 1.5;
+    args.exposure = 1.5;
+    args.type = DETECTION_DATA;
+
+    // the trainer takes each batch at once: steady state from the first batch on
+    args.d = &buffer;
+    double start = 0;
+    pthread_t thread = load_data(args);
+    for (i = 0; i <= batches; ++i) {
+        pthread_join(thread, 0);
+        if (i == 0) start = get_time_point();
+        train = buffer;
+        if (i < batches) thread = load_data(args);
+        free_data(train);
+    }
+    const double t_threads = get_time_point() - start;
+    free_load_threads(&args);
+
+    data_loader *loader = make_data_loader(args, 2);
+    for (i = 0; i <= batches; ++i) {
+        train = data_loader_next(loader);
+        if (i == 0) start = get_time_point();
+        free_data(train);
+    }
+    const double t_loader = get_time_point() - start;
+    print_data_loader_stats(loader);
+    free_data_loader(loader);
+
+    printf("\n %d batches of %d images %d x %d, %d threads: load_data() %.1f images/s, data loader %.1f images/s, %.2fx \n",
+        batches, batch, size, size, args.threads, batches * batch * 1e6 / t_threads, batches * batch * 1e6 / t_loader, t_threads / t_loader);
+    if (packed_list) close_packed_dataset();
+    free(paths);
+    free_list_contents(plist);
+    free_list(plist);
+}
+
+// crop_image() + resize_image() + flip_image() + distort_image() of the float image vs the fused uint8 kernels
+static void bench_augment(int argc, char **argv)
+{
+    const int iters = find_int_arg(argc, argv, "-iters", 20);
+    const int src_w = find_int_arg(argc, argv, "-w", 1280);
+    const int src_h = find_int_arg(argc, argv, "-h", 720);
+    const int size = find_int_arg(argc, argv, "-size", 416);
+    int c, i, k;
+    for (c = 1; c <= 3; c += 2) {
+        unsigned char *src = (unsigned char*)xcalloc((size_t)src_w * src_h * c, sizeof(unsigned char));
+        image orig = make_image(src_w, src_h, c);
+        image out_scalar = make_image(size, size, c);
+        image out_simd = make_image(size, size, c);
+        double t_ref = 0, t_scalar = 0, t_simd = 0;
+        float max_err_scalar = 0, max_err_simd = 0;
+        // a hue that lands within rounding of 1 wraps to either end of hsv_to_rgb(): a few such pixels can differ
+        size_t off_scalar = 0, off_simd = 0;
+        for (i = 0; i < src_w * src_h * c; ++i) src[i] = random_gen() % 256;
+        for (k = 0; k < c; ++k) {
+            for (i = 0; i < src_w * src_h; ++i) orig.data[k*src_w*src_h + i] = (float)src[i*c + k] / 255.;  // as load_image_stb()
+        }
+        for (i = 0; i < iters; ++i) {
+            // as the jitter of load_data_detection(), the crop can leave the image
+            const int dw = src_w * .3, dh = src_h * .3;
+            const int pleft = rand_int(-dw, dw), pright = rand_int(-dw, dw);
+            const int ptop = rand_int(-dh, dh), pbot = rand_int(-dh, dh);
+            augment_params p = { pleft, ptop, src_w - pleft - pright, src_h - ptop - pbot, i % 2, 1,
+                rand_uniform_strong(-.1, .1), rand_scale(1.5), rand_scale(1.5) };
+            double start = get_time_point();
+            image cropped = crop_image(orig, p.crop_x, p.crop_y, p.crop_w, p.crop_h);
+            image ref = resize_image(cropped, size, size);
+            if (p.flip) flip_image(ref);
+            distort_image(ref, p.hue, p.sat, p.exposure);
+            t_ref += get_time_point() - start;
+
+            start = get_time_point();
+            augment_image_u8_scalar(src, src_w, src_h, c, p, out_scalar.data, size, size);
+            t_scalar += get_time_point() - start;
+            start = get_time_point();
+            augment_image_u8(src, src_w, src_h, c, p, out_simd.data, size, size);
+            t_simd += get_time_point() - start;
+
+            for (k = 0; k < size * size * c; ++k) {
+                const float err_scalar = fabsf(ref.data[k] - out_scalar.data[k]);
+                const float err_simd = fabsf(ref.data[k] - out_simd.data[k]);
+                if (err_scalar > 1e-4) ++off_scalar;
+                else max_err_scalar = fmaxf(max_err_scalar, err_scalar);
+                if (err_simd > 1e-4) ++off_simd;
+                else max_err_simd = fmaxf(max_err_simd, err_simd);
+            }
+            free_image(cropped);
+            free_image(ref);
+        }
+        const size_t total = (size_t)iters * size * size * c;
+        printf(" %d x %d x %d -> %d x %d: per-pixel %.2f ms, fused scalar %.2f ms (max_err %g, %zu off), fused %s %.2f ms (max_err %g, %zu off), %.2fx %s\n",
+            src_w, src_h, c, size, size, t_ref / iters / 1000, t_scalar / iters / 1000, max_err_scalar, off_scalar,
+            is_cpu_fma_avx2() ? "AVX2" : "scalar", t_simd / iters / 1000, max_err_simd, off_simd, t_ref / t_simd,
+            (off_scalar * 100000 < total && off_simd * 100000 < total) ? "OK" : "MISMATCH");
+        free(src);
+        free_image(orig);
+        free_image(out_scalar);
+        free_image(out_simd);
+    }
+}
+
+// cv::resize() INTER_LINEAR of the float image, without its fixed-point weights and uint8 rounding
+static void bench_linear_resize(image im, image out)
+{
+    int x, y, k;
+    for (k = 0; k < im.c; ++k) {
+        for (y = 0; y < out.h; ++y) {
+            float sy = (y + .5f) * ((float)im.h / out.h) - .5f;
+            int iy = (int)floorf(sy);
+            float dy = sy - iy;
+            if (iy < 0) {
+                iy = 0;
+                dy = 0;
+            }
+            if (iy >= im.h - 1) {
+                iy = im.h - 1;
+                dy = 0;
+            }
+            for (x = 0; x < out.w; ++x) {
+                float sx = (x + .5f) * ((float)im.w / out.w) - .5f;
+                int ix = (int)floorf(sx);
+                float dx = sx - ix;
+                if (ix < 0) {
+                    ix = 0;
+                    dx = 0;
+                }
+                if (ix >= im.w - 1) {
+                    ix = im.w - 1;
+                    dx = 0;
+                }
+                const int ix1 = (ix + 1 < im.w) ? ix + 1 : ix, iy1 = (iy + 1 < im.h) ? iy + 1 : iy;
+                const float *p = im.data + k*im.w*im.h;
+                out.data[(k*out.h + y)*out.w + x] = (1 - dy) * ((1 - dx) * p[iy*im.w + ix] + dx * p[iy*im.w + ix1]) +
+                    dy * ((1 - dx) * p[iy1*im.w + ix] + dx * p[iy1*im.w + ix1]);
+            }
+        }
+    }
+}
+
+// network input of a BGR uint8 frame: mat_to_image() + letterbox_image() / resize vs the fused kernels
+static void bench_preprocess(int argc, char **argv)
+{
+    const int iters = find_int_arg(argc, argv, "-iters", 20);
+    const int src_w = find_int_arg(argc, argv, "-w", 1920);
+    const int src_h = find_int_arg(argc, argv, "-h", 1080);
+    const int size = find_int_arg(argc, argv, "-size", 416);
+    const int c = 3;
+    const size_t step = (size_t)src_w * c + 32;     // rows with padding, as a cv::Mat ROI
+    unsigned char *frame = (unsigned char*)xcalloc(step * src_h, sizeof(unsigned char));
+    image out = make_image(size, size, c);
+    int letter_box, i, k, x, y;
+    for (i = 0; i < (int)(step * src_h); ++i) frame[i] = random_gen() % 256;
+    for (letter_box = 1; letter_box >= 0; --letter_box) {
+        double t_ref = 0, t_fused = 0;
+        float max_err = 0;
+        for (i = 0; i < iters; ++i) {
+            double start = get_time_point();
+            image rgb = make_image(src_w, src_h, c);
+            for (y = 0; y < src_h; ++y) {
+                for (k = 0; k < c; ++k) {
+                    for (x = 0; x < src_w; ++x) rgb.data[(k*src_h + y)*src_w + x] = frame[y*step + x*c + (c - 1 - k)] / 255.0f;
+                }
+            }
+            image ref;
+            if (letter_box) ref = letterbox_image(rgb, size, size);
+            else {
+                ref = make_image(size, size, c);
+                bench_linear_resize(rgb, ref);
+            }
+            free_image(rgb);
+            t_ref += get_time_point() - start;
+
+            start = get_time_point();
+            if (letter_box) letterbox_image_u8_into(frame, src_w, src_h, step, 1, out);
+            else resize_image_u8_into(frame, src_w, src_h, step, 1, out);
+            t_fused += get_time_point() - start;
+
+            for (k = 0; k < size * size * c; ++k) max_err = fmaxf(max_err, fabsf(ref.data[k] - out.data[k]));
+            free_image(ref);
+        }
+        printf(" %s %d x %d BGR -> %d x %d: float image %.2f ms, fused %s %.2f ms, %.2fx, max_err %g %s\n",
+            letter_box ? "letterbox" : "resize", src_w, src_h, size, size, t_ref / iters / 1000,
+            is_cpu_fma_avx2() ? "AVX2" : "scalar", t_fused / iters / 1000, t_ref / t_fused, max_err, max_err < 1e-4 ? "OK" : "MISMATCH");
+    }
+    free(frame);
+    free_image(out);
+}
+
+// the functions of fast_activations.c, ACTIVATION or -1 for exp()
+typedef struct bench_activation {
+    const char *name;
+    int a;
+    double max_ulp;
+} bench_activation;
+
+static double bench_activation_ref(double x, int a)
+{
+    switch (a) {
+    case LOGISTIC: return 1 / (1 + exp(-x));
+    case TANH: return tanh(x);
+    case SWISH: return x / (1 + exp(-x));
+    case MISH: return x * tanh(log1p(exp(x)));
+    default: return exp(x);
+    }
+}
+
+// the current (libm) activations of activations.h
+static float bench_activation_libm(float x, int a)
+{
+    switch (a) {
+    case LOGISTIC: return logistic_activate(x);
+    case TANH: return tanh_activate(x);
+    case SWISH: return x * logistic_activate(x);
+    case MISH: return x * tanh_activate(softplus_activate(x, 20));
+    default: return expf(x);
+    }
+}
+
+// |val - ref| in units in the last place of the float result, 0 for subnormal results
+static double bench_ulp_error(float val, double ref)
+{
+    int e;
+    if (fabs(ref) < FLT_MIN) return 0;
+    frexp(ref, &e);
+    return fabs(val - ref) / ldexp(1, e - 24);
+}
+
+// arguments: a uniform grid over [-80, 80] and +-10^u, u in [-6, log10(80)), for the small values
+static float *bench_activation_args(int *count)
+{
+    const int uniform = 1 << 22;
+    const int log_steps = 800000;
+    const double log_max = log10(80.);
+    float *x = (float*)xcalloc(uniform + 2 * log_steps, sizeof(float));
+    int i;
+    for (i = 0; i < uniform; ++i) x[i] = -80 + 160 * (float)i / (uniform - 1);
+    for (i = 0; i < log_steps; ++i) {
+        const float v = (float)pow(10, -6 + (log_max + 6) * i / log_steps);
+        x[uniform + 2 * i] = v;
+        x[uniform + 2 * i + 1] = -v;
+    }
+    *count = uniform + 2 * log_steps;
+    return x;
+}
+
+static void bench_activations(int argc, char **argv)
+{
+    const int iters = find_int_arg(argc, argv, "-iters", 3);
+    const bench_activation funcs[] = {
+        { "exp", -1, FAST_EXP_MAX_ULP },
+        { "logistic", LOGISTIC, FAST_LOGISTIC_MAX_ULP },
+        { "tanh", TANH, FAST_TANH_MAX_ULP },
+        { "swish", SWISH, FAST_SWISH_MAX_ULP },
+        { "mish", MISH, FAST_MISH_MAX_ULP }
+    };
+    const int funcs_count = sizeof(funcs) / sizeof(funcs[0]);
+    const int speed_size = 1 << 20;
+    char *default_cfgs[] = { "cfg/yolov4.cfg", "cfg/yolov4-csp-swish.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 2;
+    int count, c, f, i, fails = 0;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    printf(" fast activations: %s \n", fast_activations_kernel_name());
+    float *x = bench_activation_args(&count);
+    float *y = (float*)xcalloc(count, sizeof(float));
+    for (f = 0; f < funcs_count; ++f) {
+        const int a = funcs[f].a;
+        double ulp_simd = 0, ulp_scalar = 0, ulp_libm = 0;
+        memcpy(y, x, count * sizeof(float));
+        if (a < 0) fast_exp_array(y, count);
+        else fast_activate_array(y, count, (ACTIVATION)a);
+        for (i = 0; i < count; ++i) {
+            const double ref = bench_activation_ref(x[i], a);
+            const float scalar = (a < 0) ? fast_expf(x[i]) : fast_activate(x[i], (ACTIVATION)a);
+            ulp_simd = fmax(ulp_simd, bench_ulp_error(y[i], ref));
+            ulp_scalar = fmax(ulp_scalar, bench_ulp_error(scalar, ref));
+            ulp_libm = fmax(ulp_libm, bench_ulp_error(bench_activation_libm(x[i], a), ref));
+        }
+
+        double t_libm = 0, t_fast = 0;
+        int k;
+        for (k = 0; k < iters; ++k) {
+            memcpy(y, x, speed_size * sizeof(float));
+            double start = get_time_point();
+            if (a < 0) {
+                for (i = 0; i < speed_size; ++i) y[i] = expf(y[i]);
+            }
+            else bias_activate_array(y, speed_size, 0, (ACTIVATION)a);
+            double t = get_time_point() - start;
+            if (k == 0 || t < t_libm) t_libm = t;
+
+            memcpy(y, x, speed_size * sizeof(float));
+            start = get_time_point();
+            if (a < 0) fast_exp_array(y, speed_size);
+            else fast_bias_activate_array(y, speed_size, 0, (ACTIVATION)a);
+            t = get_time_point() - start;
+            if (k == 0 || t < t_fast) t_fast = t;
+        }
+
+        const int ok = ulp_simd <= funcs[f].max_ulp && ulp_scalar <= funcs[f].max_ulp;
+        if (!ok) ++fails;
+        printf(" %-8s max ulp: fast %.2f (scalar %.2f, documented %.1f), libm %.2f;  %.2f ms -> %.2f ms, %.2fx %s\n",
+            funcs[f].name, ulp_simd, ulp_scalar, funcs[f].max_ulp, ulp_libm,
+            t_libm / 1000, t_fast / 1000, t_libm / t_fast, ok ? "OK" : "FAIL");
+    }
+    free(x);
+    free(y);
+
+    // softmax of 1000 classes
+    {
+        const int n = 1000, groups = 100;
+        float *in = bench_random_input_size((size_t)n * groups);
+        float *ref = (float*)xcalloc((size_t)n * groups, sizeof(float));
+        float *out = (float*)xcalloc((size_t)n * groups, sizeof(float));
+        float max_err = 0;
+        for (i = 0; i < n * groups; ++i) in[i] = in[i] * 40 - 20;
+        softmax_cpu(in, n, 1, n * groups, groups, n, 1, 1, ref);
+        fast_softmax_cpu(in, n, 1, n * groups, groups, n, 1, 1, out);
+        for (i = 0; i < n * groups; ++i) max_err = fmaxf(max_err, fabsf(ref[i] - out[i]));
+        if (max_err > 1e-6f) ++fails;
+        printf(" softmax  %d x %d: max_err %.2e %s\n", groups, n, max_err, (max_err > 1e-6f) ? "FAIL" : "OK");
+        free(in);
+        free(ref);
+        free(out);
+    }
+
+    // the deviation of the network outputs; the mAP: darknet detector map ... [-fast_activations]
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        float *input = bench_random_input(net);
+
+        prepare_network_for_inference(&net);
+        double t_libm = bench_forward(net, input, iters);
+        float **ref = bench_copy_outputs(net);
+
+        net.fast_activations = 1;
+        double t_fast = bench_forward(net, input, iters);
+        float err = bench_compare_outputs(net, ref);
+        if (err > 1e-3f) ++fails;
+        printf("\n %s: libm %.2f ms, fast activations %.2f ms, speedup %.2fx, max_err %.2e %s\n",
+            cfgs[c], t_libm, t_fast, t_libm / t_fast, err, (err > 1e-3f) ? "FAIL" : "");
+
+        bench_free_outputs(net, ref);
+        free(input);
+        free_network(net);
+    }
+    printf(" mAP: darknet detector map <data> <cfg> <weights> [-fast_activations] \n");
+    if (fails) printf("\n activations selftest FAILED \n");
+    else printf("\n activations selftest passed \n");
+}
+
+static void bench_graph(int argc, char **argv)
+{
+    const int iters = find_int_arg(argc, argv, "-iters", 3);
+    const int threads = find_int_arg(argc, argv, "-threads", 0);
+    char *default_cfgs[] = { "cfg/yolov4.cfg", "cfg/yolov4-csp.cfg", "cfg/yolov4-tiny.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 3;
+    int c, i, k, fails = 0;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        float *input = bench_random_input(net);
+
+        prepare_network_for_inference(&net);
+        double t_seq = bench_forward(net, input, iters);
+        float **ref = bench_copy_outputs(net);
+
+        // at least 2 threads, also on a single core: the results must not depend on the schedule
+        net.graph = make_layer_graph(net, threads ? threads : 2);
+        if (!net.graph) {
+            printf("\n %s: no independent layers \n", cfgs[c]);
+        }
+        else {
+            double t_graph = bench_forward(net, input, iters);
+            float err = bench_compare_outputs(net, ref);
+            for (k = 0; k < iters; ++k) {
+                network_predict(net, input);
+                err = fmaxf(err, bench_compare_outputs(net, ref));
+            }
+            if (err > 1e-5f) ++fails;
+            printf("\n %s: sequential %.2f ms, graph %d threads %.2f ms, speedup %.2fx, max_err %.2e %s\n",
+                cfgs[c], t_seq, layer_graph_threads(net.graph), t_graph, t_seq / t_graph, err, (err > 1e-5f) ? "FAIL" : "");
+
+            // resize_network() rebuilds the graph for the new workspace
+            resize_network(&net, net.w + 64, net.h + 64);
+            resize_network(&net, net.w - 64, net.h - 64);
+            network_predict(net, input);
+            err = bench_compare_outputs(net, ref);
+            if (err > 1e-5f || !net.graph) ++fails, printf(" graph after resize_network(): max_err %.2e FAIL \n", err);
+        }
+
+        bench_free_outputs(net, ref);
+        free(input);
+        free_network(net);
+    }
+    if (fails) printf("\n graph selftest FAILED \n");
+    else printf("\n graph selftest passed \n");
+}
+
+static void bench_detections(int argc, char **argv)
+{
+    const int iters = find_int_arg(argc, argv, "-iters", 100);
+    const float thresh = find_float_arg(argc, argv, "-thresh", .005f);
+    char *default_cfgs[] = { "cfg/yolov4-tiny.cfg", "cfg/yolov4.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 2;
+    int c, i, k, fails = 0;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        float *input = bench_random_input(net);
+        detection *in_flight[3];
+        int nboxes = 0, pooled_nboxes = 0;
+        double t_ref = 0, t_pool = 0;
+        long long allocations;
+        prepare_network_for_inference(&net);
+        network_predict(net, input);
+
+        detection *ref = get_network_boxes(&net, net.w, net.h, thresh, .5, 0, 1, &nboxes, 0);
+        detection *dets = get_network_boxes_pooled(&net, net.w, net.h, thresh, .5, 0, 1, &pooled_nboxes, 0);
+        const int same = (nboxes == pooled_nboxes) && bench_same_detections(ref, dets, nboxes, nboxes ? ref[0].classes : 0);
+        free_detections(ref, nboxes);
+        release_network_boxes(dets);
+        // frames in flight in a pipeline
+        for (k = 0; k < 3; ++k) in_flight[k] = get_network_boxes_pooled(&net, net.w, net.h, thresh, .5, 0, 1, &pooled_nboxes, 0);
+        for (k = 0; k < 3; ++k) release_network_boxes(in_flight[k]);
+        allocations = detection_pool_allocations(net.detection_pool);
+
+        for (k = 0; k < iters; ++k) {
+            double start = get_time_point();
+            ref = get_network_boxes(&net, net.w, net.h, thresh, .5, 0, 1, &nboxes, 0);
+            free_detections(ref, nboxes);
+            t_ref += get_time_point() - start;
+
+            start = get_time_point();
+            dets = get_network_boxes_pooled(&net, net.w, net.h, thresh, .5, 0, 1, &pooled_nboxes, 0);
+            release_network_boxes(dets);
+            t_pool += get_time_point() - start;
+        }
+        allocations = detection_pool_allocations(net.detection_pool) - allocations;
+        if (!same || allocations) ++fails;
+        printf("\n %s: %d detections, get_network_boxes() %.3f ms, pooled %.3f ms, %.2fx, %s, %lld allocations in %d frames %s\n",
+            cfgs[c], nboxes, t_ref / iters / 1000, t_pool / iters / 1000, t_ref / t_pool,
+            same ? "identical" : "MISMATCH", allocations, iters, (!same || allocations) ? "FAIL" : "");
+
+        free(input);
+        free_network(net);
+    }
+    if (fails) printf("\n detections selftest FAILED \n");
+    else printf("\n detections selftest passed \n");
+}
+
+// the same detections in the same order, the boxes and probs within eps (relative);
+// a prob within eps of thresh may be cut in one of them
+static int bench_close_detections(const detection *a, const detection *b, int total, int classes, float thresh, float eps)
+{
+    int i, k;
+    for (i = 0; i < total; ++i) {
+        const box ba = a[i].bbox, bb = b[i].bbox;
+        if (fabsf(ba.x - bb.x) > eps * fmaxf(1, fabsf(ba.x)) || fabsf(ba.y - bb.y) > eps * fmaxf(1, fabsf(ba.y)) ||
+            fabsf(ba.w - bb.w) > eps * fmaxf(1, fabsf(ba.w)) || fabsf(ba.h - bb.h) > eps * fmaxf(1, fabsf(ba.h))) return 0;
+        if (fabsf(a[i].objectness - b[i].objectness) > eps) return 0;
+        for (k = 0; k < classes; ++k) {
+            const float pa = a[i].prob[k], pb = b[i].prob[k];
+            if (fabsf(pa - pb) > eps && !(fminf(pa, pb) == 0 && fmaxf(pa, pb) < thresh + eps)) return 0;
+        }
+    }
+    return 1;
+}
+
+static void bench_set_output_logits(network *net, int enable)
+{
+    int j;
+    for (j = 0; j < net->n; ++j) {
+        if (net->layers[j].type == YOLO) net->layers[j].output_logits = enable;
+    }
+}
+
+// the forward of the yolo heads of the last frame, then their detections: the best ms
+static double bench_yolo_heads(network *net, int w, int h, float thresh, int letter, int iters, detection **out, int *nboxes)
+{
+    double best = 0;
+    int j, k;
+    for (k = 0; k < iters; ++k) {
+        const double start = get_time_point();
+        for (j = 1; j < net->n; ++j) {
+            layer l = net->layers[j];
+            if (l.type != YOLO) continue;
+            network_state state = { 0 };
+            state.net = *net;
+            state.index = j;
+            state.input = net->layers[j - 1].output;
+            state.workspace = net->workspace;
+            l.forward(l, state);
+        }
+        detection *dets = get_network_boxes_pooled(net, w, h, thresh, .5, 0, 1, nboxes, letter);
+        const double t = get_time_point() - start;
+        if (!k || t < best) best = t;
+        if (out && k == iters - 1) *out = dets;
+        else release_network_boxes(dets);
+    }
+    return best / 1000;
+}
+
+// most cells of the yolo inputs background, as in a real frame: objectness logits
+// in [-12, -4], the rest in [-2, 6]
+static void bench_background_heads(network *net, float background)
+{
+    int j, n, i;
+    for (j = 1; j < net->n; ++j) {
+        const layer l = net->layers[j];
+        if (l.type != YOLO) continue;
+        for (n = 0; n < l.n; ++n) {
+            float *obj = net->layers[j - 1].output + n*l.w*l.h*(4 + l.classes + 1) + 4*l.w*l.h;
+            for (i = 0; i < l.w*l.h; ++i) obj[i] = (rand_uniform(0, 1) < background) ? rand_uniform(-12, -4) : rand_uniform(-2, 6);
+        }
+    }
+}
+
+static void bench_yolo(int argc, char **argv)
+{
+    const int iters = find_int_arg(argc, argv, "-iters", 100);
+    const float thresh = find_float_arg(argc, argv, "-thresh", .25f);
+    const float background = find_float_arg(argc, argv, "-background", .99f);
+    const float threshs[] = { .005f, .25f, .9f };
+    char *default_cfgs[] = { "cfg/yolov4-tiny.cfg", "cfg/yolov4.cfg", "cfg/yolov4-csp.cfg" };
+    char **cfgs = default_cfgs;
+    int cfgs_count = 3;
+    int c, i, s, t, fails = 0;
+    for (i = 3; i < argc && argv[i]; ++i);
+    if (i > 3) {
+        cfgs = argv + 3;
+        cfgs_count = i - 3;
+    }
+
+    init_cpu();
+    for (c = 0; c < cfgs_count; ++c) {
+        network net = bench_load_network(cfgs[c]);
+        float *input = bench_random_input(net);
+        int checks = 0, mismatches = 0;
+        prepare_network_for_inference(&net);
+        network_predict(net, input);
+
+        // the random heads, mostly above thresh, then mostly background; full frame and letterboxed 1280x720
+        for (s = 0; s < 2; ++s) {
+            if (s) bench_background_heads(&net, background);
+            for (t = 0; t < 6; ++t) {
+                const int letter = t & 1;
+                const int w = letter ? 1280 : net.w;
+                const int h = letter ? 720 : net.h;
+                detection *ref = NULL, *dets = NULL;
+                int nboxes = 0, fused_nboxes = 0;
+                bench_set_output_logits(&net, 0);
+                bench_yolo_heads(&net, w, h, threshs[t / 2], letter, 1, &ref, &nboxes);
+                bench_set_output_logits(&net, 1);
+                bench_yolo_heads(&net, w, h, threshs[t / 2], letter, 1, &dets, &fused_nboxes);
+                const int same = (nboxes == fused_nboxes) && bench_close_detections(ref, dets, nboxes, nboxes ? ref[0].classes : 0, threshs[t / 2], 1e-5f);
+                if (!same) {
+                    printf(" %s: %s heads, thresh %.3f, %dx%d: %d detections, fused %d MISMATCH \n",
+                        cfgs[c], s ? "background" : "random", threshs[t / 2], w, h, nboxes, fused_nboxes);
+                    ++mismatches;
+                }
+                ++checks;
+                release_network_boxes(ref);
+                release_network_boxes(dets);
+            }
+        }
+
+        int nboxes = 0;
+        bench_set_output_logits(&net, 0);
+        const double t_ref = bench_yolo_heads(&net, 1280, 720, thresh, 1, iters, NULL, &nboxes);
+        bench_set_output_logits(&net, 1);
+        const double t_fused = bench_yolo_heads(&net, 1280, 720, thresh, 1, iters, NULL, &nboxes);
+        if (mismatches) ++fails;
+        printf("\n %s: %d of %d checks match; %.0f%% background, thresh %.2f, %d detections: heads + decode %.3f ms, fused %.3f ms, %.2fx %s\n",
+            cfgs[c], checks - mismatches, checks, background * 100, thresh, nboxes, t_ref, t_fused, t_ref / t_fused, mismatches ? "FAIL" : "");
+
+        free(input);
+        free_network(net);
+    }
+    if (fails) printf("\n yolo selftest FAILED \n");
+    else printf("\n yolo selftest passed \n");
+}
+
+// detection_to_json() as it was: sprintf, strlen/strcat and a realloc per object
+static char *bench_detection_to_json_ref(detection *dets, int nboxes, int classes, char **names, long long int frame_id, char *filename)
+{
+    const float thresh = 0.005;
+    char *send_buf = (char *)xcalloc(1024, sizeof(char));
+    int i, j;
+    int class_id = -1;
+    if (filename) sprintf(send_buf, "{\n \"frame_id\":%lld, \n \"filename\":\"%s\", \n \"objects\": [ \n", frame_id, filename);
+    else sprintf(send_buf, "{\n \"frame_id\":%lld, \n \"objects\": [ \n", frame_id);
+    for (i = 0; i < nboxes; ++i) {
+        for (j = 0; j < classes; ++j) {
+            int show = strncmp(names[j], "dont_show", 9);
+            if (dets[i].prob[j] > thresh && show) {
+                char buf[2048];
+                if (class_id != -1) strcat(send_buf, ", \n");
+                class_id = j;
+                sprintf(buf, "  {\"class_id\":%d, \"name\":\"%s\", \"relative_coordinates\":{\"center_x\":%f, \"center_y\":%f, \"width\":%f, \"height\":%f}, \"confidence\":%f}",
+                    j, names[j], dets[i].bbox.x, dets[i].bbox.y, dets[i].bbox.w, dets[i].bbox.h, dets[i].prob[j]);
+                send_buf = (char *)xrealloc(send_buf, strlen(send_buf) + strlen(buf) + 100);
+                strcat(send_buf, buf);
+            }
+        }
+    }
+    strcat(send_buf, "\n ] \n}");
+    return send_buf;
+}
+
+static void bench_json(int argc, char **argv)
+{
+    const int total = find_int_arg(argc, argv, "-total", 1000);
+    const int classes = find_int_arg(argc, argv, "-classes", 80);
+    const int iters = find_int_arg(argc, argv, "-iters", 20);
+    const float specials[] = { 0, -0.f, 1.f / 128, -1.f / 128, 3.f / 128, .5f, 1e-7f, -1e-7f, 5e-7f, 4.9999997e-7f,
+        123456.789f, 9.99e11f, 2e12f, -3e20f, FLT_MAX, -FLT_MAX, FLT_MIN, INFINITY, -INFINITY, NAN };
+    const int specials_count = sizeof(specials) / sizeof(specials[0]);
+    json_writer json = { 0 };
+    char tmp[512];
+    char **names = (char**)xcalloc(classes, sizeof(char*));
+    int i, k, float_mismatches = 0, fails = 0;
+    double t_ref = 0, t_writer = 0;
+
+    for (k = 0; k < classes; ++k) {
+        sprintf(tmp, k == 1 ? "dont_show %d" : "class_%d", k);
+        names[k] = copy_string(tmp);
+    }
+
+    // floats: printf("%f") of the specials, and random ones on a log scale of both signs
+    for (i = 0; i < 1000000 + specials_count; ++i) {
+        float v = (i < specials_count) ? specials[i] : powf(10, rand_uniform(-9, 12)) * (rand() % 2 ? 1 : -1);
+        if (i >= specials_count && i % 7 == 0) v = roundf(v * 128) / 128;    // ties at the 7th decimal
+        json_writer_reset(&json);
+        json_write_float(&json, v);
+        snprintf(tmp, sizeof(tmp), "%f", v);
+        if (strcmp(json.buf, tmp)) {
+            if (float_mismatches++ < 10) printf(" json_write_float(%.9g) = %s, printf %s \n", v, json.buf, tmp);
+        }
+    }
+    printf(" floats: %d mismatches of %d \n", float_mismatches, 1000000 + specials_count);
+    if (float_mismatches) ++fails;
+
+    // detections, with and without the file name
+    detection *dets = bench_make_detections(total, classes, 0);
+    for (k = 0; k < 2; ++k) {
+        char *filename = k ? "data/dog.jpg" : NULL;
+        char *ref = bench_detection_to_json_ref(dets, total, classes, names, 42 + k, filename);
+        char *out = detection_to_json(dets, total, classes, names, 42 + k, filename);
+        const int same = !strcmp(ref, out);
+        if (!same) ++fails;
+        printf(" detection_to_json()%s: %d bytes, %s \n", filename ? " with filename" : "", (int)strlen(ref), same ? "identical" : "MISMATCH");
+        free(ref);
+        free(out);
+    }
+
+    // a COCO line
+    json_writer_reset(&json);
+    json_write_coco(&json, 139, 90, 12.25f, 0, 630.5f, 1e-3f, .125f);
+    sprintf(tmp, "{\"image_id\":%d, \"category_id\":%d, \"bbox\":[%f, %f, %f, %f], \"score\":%f},\n", 139, 90, 12.25f, 0.f, 630.5f, 1e-3f, .125f);
+    if (strcmp(json.buf, tmp)) {
+        printf(" json_write_coco() MISMATCH: %s vs %s", json.buf, tmp);
+        ++fails;
+    }
+
+    for (k = 0; k < iters; ++k) {
+        double start = get_time_point();
+        char *ref = bench_detection_to_json_ref(dets, total, classes, names, k, NULL);
+        t_ref += get_time_point() - start;
+        free(ref);
+
+        start = get_time_point();
+        json_writer_reset(&json);
+        json_write_detections(&json, dets, total, classes, names, k, NULL);
+        t_writer += get_time_point() - start;
+    }
+    printf("\n %d detections, %d classes: sprintf/strcat %.3f ms, json writer %.3f ms, %.2fx \n",
+        total, classes, t_ref / iters / 1000, t_writer / iters / 1000, t_ref / t_writer);
+
+    free_detections(dets, total);
+    free_ptrs((void**)names, classes);
+    json_writer_free(&json);
+    if (fails) printf("\n json selftest FAILED \n");
+    else printf("\n json selftest passed \n");
+}
+
+#ifndef _WIN32
+// a client of the streaming server: the request is sent, rcvbuf 0 - the default
+static int bench_http_connect(int port, const char *path, int rcvbuf)
+{
+    struct sockaddr_in address;
+    char request[256];
+    const struct timeval timeout = { 0, 300000 };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (rcvbuf) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address))) {
+        close(fd);
+        return -1;
+    }
+    sprintf(request, "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+    if (send(fd, request, strlen(request), 0) < 0) {}
+    return fd;
+}
+
+// all the bytes until the server closes or 300 ms pass without any; the body after the header
+static char *bench_http_read(int fd, int *size)
+{
+    int capacity = 1 << 16, len = 0, n;
+    char *buf = (char*)xcalloc(capacity + 1, 1);
+    for (;;) {
+        if (len == capacity) {
+            buf = (char*)xrealloc(buf, 2 * capacity + 1);
+            capacity *= 2;
+        }
+        n = recv(fd, buf + len, capacity - len, 0);
+        if (n <= 0) break;
+        len += n;
+    }
+    buf[len] = 0;
+    *size = len;
+    return buf;
+}
+
+static char *bench_http_body(char *response, int size, int *body_size)
+{
+    char *body = strstr(response, "\r\n\r\n");
+    if (!body) return NULL;
+    body += 4;
+    *body_size = size - (int)(body - response);
+    return body;
+}
+
+// MJPEG frames filled with their index and tag: whole frames, ascending indexes;
+// returns the count, -1 if broken, *last the index of the last one
+static int bench_http_check_mjpeg(char *body, int size, char tag, int *last)
+{
+    static const char part[] = "--mjpegstream\r\nContent-Type: image/jpeg\r\nContent-Length: ";
+    int count = 0, k;
+    char *p = body, *end = body + size;
+    *last = -1;
+    while (p < end) {
+        int length;
+        if (end - p < (int)sizeof(part) || memcmp(p, part, sizeof(part) - 1)) return -1;
+        length = atoi(p + sizeof(part) - 1);
+        p = strstr(p, "\r\n\r\n");
+        if (!p || (p += 4) + length > end || length < 2) return -1;
+        if (p[0] != tag || (unsigned char)p[1] <= *last) return -1;
+        for (k = 2; k < length; ++k) {
+            if (p[k] != p[1]) return -1;
+        }
+        *last = (unsigned char)p[1];
+        p += length;
+        ++count;
+    }
+    return count;
+}
+
+static void bench_http(int argc, char **argv)
+{
+    const int port = find_int_arg(argc, argv, "-port", 18090);
+    const int frames = find_int_arg(argc, argv, "-frames", 100);
+    const int frame_size = 256 * 1024;
+    char *frame = (char*)xcalloc(frame_size, 1);
+    char object[64];
+    int fails = 0, i, size, body_size, last, count;
+    double max_publish = 0;
+
+    // JSON: a fast client gets "[\n" and the objects, then "\n]" when the stream is closed
+    const int json = http_stream_open(port, "/", HTTP_STREAM_JSON, 2000000);
+    int client = bench_http_connect(port, "/", 0);
+    this_thread_sleep_for(100);
+    for (i = 0; i < frames; ++i) {
+        sprintf(object, "{\"frame_id\":%d}", i);
+        http_stream_publish(json, object, strlen(object));
+        this_thread_sleep_for(1);
+    }
+    this_thread_sleep_for(100);
+    http_stream_close(json);
+    char *response = bench_http_read(client, &size);
+    char *body = bench_http_body(response, size, &body_size);
+    {
+        int ok = body && !strncmp(body, "[\n", 2) && body_size >= 4 && !strcmp(body + body_size - 2, "\n]");
+        char *p = body ? body + 2 : NULL;
+        last = -1;
+        count = 0;
+        while (ok && p < body + body_size - 2) {
+            int id = -1, n = 0;
+            if (count && strncmp(p, ", \n", 3)) ok = 0;
+            if (count) p += 3;
+            if (!ok || sscanf(p, "{\"frame_id\":%d}%n", &id, &n) != 1 || id <= last) ok = 0;
+            last = id;
+            p += n;
+            ++count;
+        }
+        http_stream_stats stats = get_http_stream_stats(json);
+        printf(" JSON: %d of %d objects, the last %d, %lld bytes sent, %lld connections %s\n",
+            count, frames, last, stats.bytes_sent, stats.connections, (ok && last == frames - 1) ? "" : "FAIL");
+        if (!ok || last != frames - 1) ++fails;
+    }
+    free(response);
+    close(client);
+
+    // MJPEG: two streams on a port told apart by the path, an unknown path gets 404
+    const int stream_a = http_stream_open(port + 1, "/a", HTTP_STREAM_MJPEG, 2000000);
+    const int stream_b = http_stream_open(port + 1, "/b", HTTP_STREAM_MJPEG, 2000000);
+    int client_a = bench_http_connect(port + 1, "/a", 0);
+    int client_b = bench_http_connect(port + 1, "/b?camera=2", 0);
+    int client_c = bench_http_connect(port + 1, "/c", 0);
+    this_thread_sleep_for(100);
+    for (i = 0; i < 20; ++i) {
+        memset(frame, i, 4096);
+        frame[0] = 'A';
+        http_stream_publish(stream_a, frame, 4096);
+        frame[0] = 'B';
+        http_stream_publish(stream_b, frame, 4096);
+        this_thread_sleep_for(2);
+    }
+    {
+        int size_a, size_b, size_c, last_b;
+        char *ra = bench_http_read(client_a, &size_a);
+        char *rb = bench_http_read(client_b, &size_b);
+        char *rc = bench_http_read(client_c, &size_c);
+        char *ba = bench_http_body(ra, size_a, &body_size);
+        const int count_a = ba ? bench_http_check_mjpeg(ba, body_size, 'A', &last) : -1;
+        char *bb = bench_http_body(rb, size_b, &body_size);
+        const int count_b = bb ? bench_http_check_mjpeg(bb, body_size, 'B', &last_b) : -1;
+        const int not_found = !strncmp(rc, "HTTP/1.0 404", 12);
+        const int ok = count_a > 0 && count_b > 0 && last == 19 && last_b == 19 && not_found;
+        printf(" MJPEG paths: /a %d frames, /b %d frames, /c %s %s\n", count_a, count_b, not_found ? "404" : "MISSING 404", ok ? "" : "FAIL");
+        if (!ok) ++fails;
+        free(ra);
+        free(rb);
+        free(rc);
+    }
+    close(client_a);
+    close(client_b);
+    close(client_c);
+
+    // a client that stops reading: publishing doesn't wait for it, it gets whole frames and the latest
+    // (the frames go on from the index 20 of the frame it gets first)
+    {
+        http_stream_stats before = get_http_stream_stats(stream_a);
+        int slow = bench_http_connect(port + 1, "/a", 4096);
+        this_thread_sleep_for(100);
+        for (i = 0; i < frames && i < 200; ++i) {
+            memset(frame, 20 + i, frame_size);
+            frame[0] = 'A';
+            const double start = get_time_point();
+            http_stream_publish(stream_a, frame, frame_size);
+            const double t = get_time_point() - start;
+            if (t > max_publish) max_publish = t;
+            this_thread_sleep_for(1);
+        }
+        const int published = i;
+        this_thread_sleep_for(100);
+        response = bench_http_read(slow, &size);
+        body = bench_http_body(response, size, &body_size);
+        count = body ? bench_http_check_mjpeg(body, body_size, 'A', &last) : -1;
+        http_stream_stats stats = get_http_stream_stats(stream_a);
+        const long long dropped = stats.frames_dropped - before.frames_dropped;
+        const int ok = count > 0 && last == 20 + published - 1 && dropped > 0;
+        printf(" MJPEG slow client: %d of %d frames of %d KB, the last %d, %lld dropped, publish max %.3f ms %s\n",
+            count, published, frame_size / 1024, last - 20, dropped, max_publish / 1000, ok ? "" : "FAIL");
+        if (!ok) ++fails;
+        free(response);
+        close(slow);
+    }
+    http_stream_close(stream_a);
+    http_stream_close(stream_b);
+
+    http_stream_stats all = get_http_stream_stats(-1);
+    printf("\n all streams: %lld connections, %d clients, %lld frames published, %lld sent, %lld dropped, %.1f MB sent \n",
+        all.connections, all.clients, all.frames, all.frames_sent, all.frames_dropped, all.bytes_sent / (1024. * 1024));
+    free(frame);
+    if (fails) printf("\n http selftest FAILED \n");
+    else printf("\n http selftest passed \n");
+}
+
+// the size of a whole baseline/progressive JPEG, 0 - not a JPEG
+static int bench_jpeg_size(const unsigned char *p, int size, int *w, int *h)
+{
+    int i = 2;
+    if (size < 4 || p[0] != 0xFF || p[1] != 0xD8 || p[size - 2] != 0xFF || p[size - 1] != 0xD9) return 0;
+    while (i + 9 < size && p[i] == 0xFF) {
+        const int marker = p[i + 1];
+        const int length = (p[i + 2] << 8) | p[i + 3];
+        if (marker >= 0xC0 && marker <= 0xC2) {
+            *h = (p[i + 5] << 8) | p[i + 6];
+            *w = (p[i + 7] << 8) | p[i + 8];
+            return 1;
+        }
+        i += 2 + length;
+    }
+    return 0;
+}
+
+// the MJPEG parts of a response: all JPEGs of w x h; returns the count, -1 if broken
+static int bench_check_jpegs(char *body, int size, int w, int h)
+{
+    static const char part[] = "--mjpegstream\r\nContent-Type: image/jpeg\r\nContent-Length: ";
+    int count = 0, jw = 0, jh = 0;
+    char *p = body, *end = body + size;
+    while (p < end) {
+        int length;
+        if (end - p < (int)sizeof(part) || memcmp(p, part, sizeof(part) - 1)) return -1;
+        length = atoi(p + sizeof(part) - 1);
+        p = strstr(p, "\r\n\r\n");
+        if (!p || (p += 4) + length > end) return -1;
+        if (!bench_jpeg_size((unsigned char*)p, length, &jw, &jh) || jw != w || jh != h) return -1;
+        p += length;
+        ++count;
+    }
+    return count;
+}
+
+// frames handed to the encoder of port at an interval; the caller's time per frame in ms
+static double bench_mjpeg_send(unsigned char *frame, int w, int h, int frames, int port, int interval_ms)
+{
+    double total = 0;
+    int i;
+    for (i = 0; i < frames; ++i) {
+        memset(frame + (size_t)(i % h) * w * 3, i, (size_t)w * 3);     // a row of each frame differs
+        const double start = get_time_point();
+        send_mjpeg_frame(frame, w, h, 3, w * 3, port, 2000000, 80);
+        total += get_time_point() - start;
+        if (interval_ms) this_thread_sleep_for(interval_ms);
+    }
+    return total / frames / 1000;
+}
+
+static void bench_mjpeg(int argc, char **argv)
+{
+    const int port = find_int_arg(argc, argv, "-port", 18190);
+    const int frames = find_int_arg(argc, argv, "-frames", 30);
+    const int w = find_int_arg(argc, argv, "-w", 1920);
+    const int h = find_int_arg(argc, argv, "-h", 1080);
+    const int threads = find_int_arg(argc, argv, "-threads", 2);
+    const int width = find_int_arg(argc, argv, "-width", w / 2);
+    const int interval_ms = find_int_arg(argc, argv, "-interval", 10);
+    unsigned char *frame = (unsigned char*)xcalloc((size_t)w * h * 3, 1);
+    int fails = 0, i, x, y, size, body_size;
+    double t_sync = 0, t_async = 0;
+
+    for (y = 0; y < h; ++y) {
+        for (x = 0; x < w; ++x) {
+            unsigned char *p = frame + ((size_t)y * w + x) * 3;
+            p[0] = (unsigned char)(x * 255 / w);
+            p[1] = (unsigned char)(y * 255 / h);
+            p[2] = (unsigned char)((x + y) & 255);
+        }
+    }
+    printf(" MJPEG encoding of %d x %d frames, %d encoder threads, a frame every %d ms \n", w, h, threads, interval_ms);
+
+    // no clients: nothing is encoded
+    {
+        set_mjpeg_encoder(threads, 0);
+        const double t = bench_mjpeg_send(frame, w, h, frames, port, 0);
+        wait_mjpeg_encoder(port);
+        mjpeg_encoder_stats stats = get_mjpeg_encoder_stats(port);
+        const int ok = stats.skipped == frames && stats.encoded == 0;
+        printf(" no clients: %lld of %d skipped, %.3f ms per frame %s\n", stats.skipped, frames, t, ok ? "" : "FAIL");
+        if (!ok) ++fails;
+    }
+
+    // on the caller's thread, on the encoder threads, downscaled: the client gets whole JPEGs of the size
+    for (i = 0; i < 3; ++i) {
+        const int p = port + 1 + i;
+        const int enc_threads = (i == 0) ? 0 : threads;
+        const int enc_width = (i == 2) ? width : 0;
+        int ew, eh;
+        set_mjpeg_encoder(enc_threads, enc_width);
+        send_mjpeg_frame(frame, w, h, 3, w * 3, p, 2000000, 80);   // opens the stream
+        int client = bench_http_connect(p, "/", 1 << 22);
+        this_thread_sleep_for(100);
+        const double t = bench_mjpeg_send(frame, w, h, frames, p, interval_ms);
+        wait_mjpeg_encoder(p);
+        this_thread_sleep_for(100);
+        char *response = bench_http_read(client, &size);
+        char *body = bench_http_body(response, size, &body_size);
+        ew = (enc_width && w > enc_width) ? enc_width : w;
+        eh = (ew == w) ? h : (int)(((long long)h * ew + w / 2) / w);
+        const int count = body ? bench_check_jpegs(body, body_size, ew, eh) : -1;
+        mjpeg_encoder_stats stats = get_mjpeg_encoder_stats(p);
+        const long long handed = stats.frames - stats.skipped;
+        const int ok = count > 0 && stats.encoded > 0 && stats.encoded + stats.dropped + stats.late == handed;
+        printf(" %-29s %lld frames: %lld encoded (%.1f ms each), %lld dropped, %lld late; client got %d JPEGs %dx%d; caller %.3f ms per frame %s\n",
+            i == 0 ? "encoded by the caller:" : i == 1 ? "encoder threads:" : "encoder threads, downscaled:",
+            handed, stats.encoded, stats.encoded ? stats.encode_ms / (stats.encoded + stats.late) : 0, stats.dropped, stats.late,
+            count, ew, eh, t, ok ? "" : "FAIL");
+        if (!ok) ++fails;
+        if (i == 0) t_sync = t;
+        if (i == 1) t_async = t;
+        free(response);
+        close(client);
+    }
+    printf("\n caller's time per frame: encoding %.3f ms, handing to the encoder threads %.3f ms, %.1fx \n",
+        t_sync, t_async, t_sync / t_async);
+
+    free(frame);
+    if (fails) printf("\n mjpeg selftest FAILED \n");
+    else printf("\n mjpeg selftest passed \n");
+}
+#else
+static void bench_http(int argc, char **argv)
+{
+    printf(" bench http isn't implemented on Windows \n");
+}
+
+static void bench_mjpeg(int argc, char **argv)
+{
+    printf(" bench mjpeg isn't implemented on Windows \n");
+}
+#endif
+
+void run_bench(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s %s [gemm/prepack/conv/nchwc/int8/memory/ring/streams/nms/prepared/loader/augment/preprocess/activations/graph/detections/yolo/json/http/mjpeg] [options]\n", argv[0], argv[1]);
+        return;
+    }
+    if (0 == strcmp(argv[2], "gemm")) bench_gemm(argc, argv);
+    else if (0 == strcmp(argv[2], "prepack")) bench_prepack(argc, argv);
+    else if (0 == strcmp(argv[2], "conv")) bench_conv(argc, argv);
+    else if (0 == strcmp(argv[2], "nchwc")) bench_nchwc(argc, argv);
+    else if (0 == strcmp(argv[2], "int8")) bench_int8(argc, argv);
+    else if (0 == strcmp(argv[2], "memory")) bench_memory(argc, argv);
+    else if (0 == strcmp(argv[2], "ring")) bench_ring(argc, argv);
+    else if (0 == strcmp(argv[2], "streams")) bench_streams(argc, argv);
+    else if (0 == strcmp(argv[2], "nms")) bench_nms(argc, argv);
+    else if (0 == strcmp(argv[2], "prepared")) bench_prepared(argc, argv);
+    else if (0 == strcmp(argv[2], "loader")) bench_loader(argc, argv);
+    else if (0 == strcmp(argv[2], "augment")) bench_augment(argc, argv);
+    else if (0 == strcmp(argv[2], "preprocess")) bench_preprocess(argc, argv);
+    else if (0 == strcmp(argv[2], "activations")) bench_activations(argc, argv);
+    else if (0 == strcmp(argv[2], "graph")) bench_graph(argc, argv);
+    else if (0 == strcmp(argv[2], "detections")) bench_detections(argc, argv);
+    else if (0 == strcmp(argv[2], "yolo")) bench_yolo(argc, argv);
+    else if (0 == strcmp(argv[2], "json")) bench_json(argc, argv);
+    else if (0 == strcmp(argv[2], "http")) bench_http(argc, argv);
+    else if (0 == strcmp(argv[2], "mjpeg")) bench_mjpeg(argc, argv);
+    else printf(" There isn't such command: %s", argv[2]);
+}
@@ -1,4 +1,5 @@
 #include "box.h"
+#include "nms.h"
 #include "utils.h"
 #include <stdio.h>
 #include <math.h>
@@ -773,7 +774,7 @@ int nms_comparator_v3(const void *pa, const void *pb)
     return 0;
 }
 
-void do_nms_obj(detection *dets, int total, int classes, float thresh)
+void do_nms_obj_naive(detection *dets, int total, int classes, float thresh)
 {
     int i, j, k;
     k = total - 1;
@@ -809,7 +810,7 @@ void do_nms_obj(detection *dets, int total, int classes, float thresh)
     }
 }
 
-void do_nms_sort(detection *dets, int total, int classes, float thresh)
+void do_nms_sort_naive(detection *dets, int total, int classes, float thresh)
 {
     int i, j, k;
     k = total - 1;
@@ -865,7 +866,7 @@ void do_nms(box *boxes, float **probs, int total, int classes, float thresh)
 
 // https://github.com/Zzh-tju/DIoU-darknet
 // https://arxiv.org/abs/1911.08287
-void diounms_sort(detection *dets, int total, int classes, float thresh, NMS_KIND nms_kind, float beta1)
+void diounms_sort_naive(detection *dets, int total, int classes, float thresh, NMS_KIND nms_kind, float beta1)
 {
     int i, j, k;
     k = total - 1;
@@ -929,6 +930,27 @@ void diounms_sort(detection *dets, int total, int classes, float thresh, NMS_KIN
     }
 }
 
+// the naive versions are the reference: a negative threshold suppresses
+// boxes that don't overlap, which the engine does not look for
+void do_nms_obj(detection *dets, int total, int classes, float thresh)
+{
+    if (thresh >= 0) nms_sort_objectness(dets, total, classes, thresh);
+    else do_nms_obj_naive(dets, total, classes, thresh);
+}
+
+void do_nms_sort(detection *dets, int total, int classes, float thresh)
+{
+    if (thresh >= 0) nms_sort_classes(dets, total, classes, thresh, DEFAULT_NMS, 0);
+    else do_nms_sort_naive(dets, total, classes, thresh);
+}
+
+void diounms_sort(detection *dets, int total, int classes, float thresh, NMS_KIND nms_kind, float beta1)
+{
+    // DEFAULT_NMS only sorts
+    if (thresh >= 0 && nms_kind != DEFAULT_NMS) nms_sort_classes(dets, total, classes, thresh, nms_kind, beta1);
+    else diounms_sort_naive(dets, total, classes, thresh, nms_kind, beta1);
+}
+
 box encode_box(box b, box anchor)
 {
     box encode;
@@ -607,6 +607,7 @@ float validate_classifier_single(char *datacfg, char *filename, char *weightfile
         //set_batch_network(&net, 1);
         fuse_conv_batchnorm(net);
         calculate_binary_weights(net);
+        prepare_network_for_inference(&net);
     }
     srand(time(0));
 
@@ -834,6 +835,7 @@ void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *fi
 
     fuse_conv_batchnorm(net);
     calculate_binary_weights(net);
+    prepare_network_for_inference(&net);
 
     list *options = read_data_cfg(datacfg);
 
@@ -951,6 +953,7 @@ void test_classifier(char *datacfg, char *cfgfile, char *weightfile, int target_
     srand(time(0));
     fuse_conv_batchnorm(net);
     calculate_binary_weights(net);
+    prepare_network_for_inference(&net);
 
     list *options = read_data_cfg(datacfg);
 
@@ -1251,6 +1254,7 @@ void demo_classifier(char *datacfg, char *cfgfile, char *weightfile, int cam_ind
 
     fuse_conv_batchnorm(net);
     calculate_binary_weights(net);
+    prepare_network_for_inference(&net);
 
     srand(2222222);
     cap_cv * cap;
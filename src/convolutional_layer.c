@@ -5,7 +5,14 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "gemm_packed.h"
+#include "winograd.h"
+#include "nchwc.h"
+#include "prepared.h"
+#include "quantize.h"
 #include "box.h"
+#include "layer_profiler.h"
+#include "fast_activations.h"
 #include <stdio.h>
 #include <time.h>
 
@@ -141,6 +148,9 @@ size_t get_workspace_size32(layer l){
         if (workspace_size < re_packed_input_size) workspace_size = re_packed_input_size;
         return workspace_size;
     }
+    if (l.weights_int8) return get_convolutional_int8_workspace_size(l);
+    if (l.weights_nchwc) return get_convolutional_nchwc_workspace_size(l);
+    if (l.weights_packed || l.weights_winograd) return get_convolutional_inference_workspace_size(l);
     return (size_t)l.out_h*l.out_w*l.size*l.size*(l.c / l.groups)*sizeof(float);
 }
 
@@ -1071,6 +1081,172 @@ void bit_to_float(unsigned char *src, float *dst, size_t size, size_t filters, f
     }
 }
 
+// rows of the im2col output processed at once by the inference path
+static int get_im2col_chunk_rows(convolutional_layer l)
+{
+    const size_t row_size = (size_t)l.out_w*l.size*l.size*(l.c / l.groups)*sizeof(float);
+    int rows = (int)(CONV_INFERENCE_WORKSPACE / row_size);
+    if (rows < 1) rows = 1;
+    if (rows > l.out_h) rows = l.out_h;
+    return rows;
+}
+
+static int get_winograd_tile(CONV_ALGO algo)
+{
+    return (algo == CONV_ALGO_WINOGRAD_4X4) ? 4 : 2;
+}
+
+size_t get_convolutional_inference_workspace_size(convolutional_layer l)
+{
+    size_t workspace_size = 0;
+    if (l.conv_algo == CONV_ALGO_WINOGRAD_2X2 || l.conv_algo == CONV_ALGO_WINOGRAD_4X4) {
+        workspace_size = winograd_workspace_size(get_winograd_tile(l.conv_algo), l.n, l.c, l.out_h, l.out_w, CONV_INFERENCE_WORKSPACE);
+    }
+    else if (l.conv_algo == CONV_ALGO_IM2COL) {
+        workspace_size = (size_t)get_im2col_chunk_rows(l)*l.out_w*l.size*l.size*(l.c / l.groups)*sizeof(float);
+    }
+    if (l.antialiasing && l.input_layer) {
+        size_t aa_size = get_convolutional_workspace_size(*l.input_layer);
+        if (aa_size > workspace_size) workspace_size = aa_size;
+    }
+    return workspace_size;
+}
+
+int is_convolutional_algorithm_supported(convolutional_layer l, CONV_ALGO algo)
+{
+    if (l.type != CONVOLUTIONAL || l.xnor) return 0;
+    switch (algo) {
+    case CONV_ALGO_IM2COL:
+        return 1;
+    case CONV_ALGO_DIRECT_1X1:
+        return l.size == 1 && l.stride_x == 1 && l.stride_y == 1 && l.dilation == 1;
+    case CONV_ALGO_WINOGRAD_2X2:
+    case CONV_ALGO_WINOGRAD_4X4:
+        return l.size == 3 && l.stride_x == 1 && l.stride_y == 1 && l.dilation == 1 && l.groups == 1;
+    }
+    return 0;
+}
+
+// Shape-based choice: Winograd cuts the GEMM work 2.25x (2x2) or 4x (4x4),
+// but its transforms cost per input/output channel and tile, so it is used
+// only when there are enough channels, and 4x4 only on large feature maps
+// (its weights are 4x bigger, and small maps waste partial tiles).
+CONV_ALGO select_convolutional_algorithm(convolutional_layer l)
+{
+    if (is_convolutional_algorithm_supported(l, CONV_ALGO_DIRECT_1X1)) return CONV_ALGO_DIRECT_1X1;
+    if (is_convolutional_algorithm_supported(l, CONV_ALGO_WINOGRAD_2X2) && l.c >= 16 && l.n >= 16) {
+        if (l.out_w >= 16 && l.out_h >= 16) return CONV_ALGO_WINOGRAD_4X4;
+        if (l.out_w >= 8 && l.out_h >= 8) return CONV_ALGO_WINOGRAD_2X2;
+    }
+    return CONV_ALGO_IM2COL;
+}
+
+const char *get_conv_algo_string(CONV_ALGO algo)
+{
+    switch (algo) {
+    case CONV_ALGO_IM2COL: return "im2col";
+    case CONV_ALGO_DIRECT_1X1: return "direct_1x1";
+    case CONV_ALGO_WINOGRAD_2X2: return "winograd_2x2";
+    case CONV_ALGO_WINOGRAD_4X4: return "winograd_4x4";
+    }
+    return "unknown";
+}
+
+// Prepares the inference-only weights for the algorithm (call after fuse_conv_batchnorm()),
+// the network workspace has to be recalculated afterwards.
+void set_convolutional_algorithm(convolutional_layer *l, CONV_ALGO algo)
+{
+    if (!is_convolutional_algorithm_supported(*l, algo)) algo = CONV_ALGO_IM2COL;
+    free_convolutional_inference_weights(l);
+    if (l->type != CONVOLUTIONAL || l->xnor || !l->weights) return;
+    if (l->weights_int8) return;    // quantized, see quantize_convolutional_layer()
+
+    l->conv_algo = algo;
+    if (algo == CONV_ALGO_WINOGRAD_2X2 || algo == CONV_ALGO_WINOGRAD_4X4) {
+        const int tile = get_winograd_tile(algo);
+        l->weights_winograd = (float*)gemm_aligned_alloc(winograd_weights_size(tile, l->n, l->c) * sizeof(float));
+        winograd_transform_weights(tile, l->weights, l->n, l->c, l->weights_winograd);
+    }
+    else {
+        prepack_convolutional_weights(l);
+    }
+    if (l->antialiasing && l->input_layer) {
+        set_convolutional_algorithm(l->input_layer, select_convolutional_algorithm(*l->input_layer));
+    }
+}
+
+// one batch item / group with the inference-only weights,
+// fused: the output isn't cleared and gets the bias and activation in the GEMM epilogue,
+// fast: with the polynomial activations of fast_activations.c
+static void forward_convolutional_inference(convolutional_layer l, float *im, int group, float *workspace, float *output, int fused, int fast)
+{
+    const int m = l.n / l.groups;
+    const int k = l.size*l.size*l.c / l.groups;
+    const int n = l.out_h*l.out_w;
+    const gemm_epilogue epilogue = { l.biases + group*m, l.activation, fast };
+    const gemm_epilogue *ep = fused ? &epilogue : NULL;
+    const float beta = fused ? 0 : 1;
+
+    double t = profile_phase_begin();
+    if (l.conv_algo == CONV_ALGO_WINOGRAD_2X2 || l.conv_algo == CONV_ALGO_WINOGRAD_4X4) {
+        winograd_convolution(get_winograd_tile(l.conv_algo), im, l.c, l.h, l.w, l.pad, l.weights_winograd,
+            l.n, output, l.out_h, l.out_w, workspace, CONV_INFERENCE_WORKSPACE, ep);
+        profile_phase_end(PROFILE_GEMM, t);
+        return;
+    }
+
+    const float *a = l.weights_packed + group*gemm_packed_a_size(m, k);
+    if (l.conv_algo == CONV_ALGO_DIRECT_1X1) {
+        gemm_prepacked_epilogue(0, m, n, k, a, im, n, beta, output, n, ep);
+        profile_phase_end(PROFILE_GEMM, t);
+    }
+    else {
+        const int chunk_rows = get_im2col_chunk_rows(l);
+        int row;
+        for (row = 0; row < l.out_h; row += chunk_rows) {
+            const int row_end = (row + chunk_rows < l.out_h) ? (row + chunk_rows) : l.out_h;
+            const int cols = (row_end - row)*l.out_w;
+            t = profile_phase_begin();
+            im2col_cpu_ext_rows(im, l.c / l.groups, l.h, l.w, l.size, l.size,
+                l.pad * l.dilation, l.pad * l.dilation,
+                l.stride_y, l.stride_x,
+                l.dilation, l.dilation,
+                row, row_end, workspace);
+            profile_phase_end(PROFILE_IM2COL, t);
+            t = profile_phase_begin();
+            gemm_prepacked_epilogue(0, m, cols, k, a, workspace, cols, beta, output + row*l.out_w, n, ep);
+            profile_phase_end(PROFILE_GEMM, t);
+        }
+    }
+}
+
+// Keep a copy of the (already fused) weights in the packed GEMM panel layout,
+// so inference doesn't repack the same static weights on every frame.
+// Must be called again if l->weights change (it is not used while training).
+void prepack_convolutional_weights(convolutional_layer *l)
+{
+    if (l->type != CONVOLUTIONAL || l->xnor || !l->weights) return;
+    const int m = l->n / l->groups;
+    const int k = l->size*l->size*l->c / l->groups;
+    const size_t group_size = gemm_packed_a_size(m, k);
+    int j;
+
+    if (l->weights_packed && layer_owns_weights(*l, l->weights_packed)) gemm_aligned_free(l->weights_packed);
+    l->weights_packed = (float*)gemm_aligned_alloc(group_size * l->groups * sizeof(float));
+    for (j = 0; j < l->groups; ++j) {
+        gemm_pack_a(0, m, k, 1, l->weights + j*l->nweights / l->groups, k, l->weights_packed + j*group_size);
+    }
+}
+
+// the packed / Winograd copies can be in a prepared model mapping
+void free_convolutional_inference_weights(convolutional_layer *l)
+{
+    if (l->weights_packed && layer_owns_weights(*l, l->weights_packed)) gemm_aligned_free(l->weights_packed);
+    if (l->weights_winograd && layer_owns_weights(*l, l->weights_winograd)) gemm_aligned_free(l->weights_winograd);
+    l->weights_packed = NULL;
+    l->weights_winograd = NULL;
+}
+
 void binary_align_weights(convolutional_layer *l)
 {
     int m = l->n;   // (l->n / l->groups)
@@ -1206,8 +1382,13 @@ void forward_convolutional_layer(convolutional_layer l, network_state state)
     int out_h = convolutional_out_height(l);
     int out_w = convolutional_out_width(l);
     int i, j;
+    // inference with packed / Winograd weights and batch-norm fused into them:
+    // bias and activation are applied by the GEMM epilogue instead of 3 passes over l.output
+    const int fused = !state.train && (l.weights_packed || l.weights_winograd) && !l.weights_int8 &&
+        !l.batch_normalize && is_activation_elementwise(l.activation);
+    const int fast = !state.train && state.net.fast_activations && is_fast_activation(l.activation);
 
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
+    if (!fused) fill_cpu(l.outputs*l.batch, 0, l.output, 1);
 
     if (l.xnor && (!l.align_bit_weights || state.train)) {
         if (!l.align_bit_weights || state.train) {
@@ -1362,12 +1543,23 @@ void forward_convolutional_layer(convolutional_layer l, network_state state)
             else {
                 //printf(" l.index = %d - FP32 \n", l.index);
                 float *im = state.input + (i*l.groups + j)*(l.c / l.groups)*l.h*l.w;
+                if (!state.train && l.weights_int8) {
+                    const double t = profile_phase_begin();
+                    forward_convolutional_int8(l, im, state.workspace, c);
+                    profile_phase_end(PROFILE_GEMM, t);
+                    continue;
+                }
+                if (!state.train && (l.weights_packed || l.weights_winograd)) {
+                    forward_convolutional_inference(l, im, j, state.workspace, c, fused, fast);
+                    continue;
+                }
                 if (l.size == 1 && l.stride == 1 && l.dilation == 1) {
                     b = im;
                 }
                 else {
                     //im2col_cpu(im, l.c / l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
 
+                    const double t = profile_phase_begin();
                     im2col_cpu_ext(im,   // input
                         l.c / l.groups,     // input channels
                         l.h, l.w,           // input size (h, w)
@@ -1376,10 +1568,12 @@ void forward_convolutional_layer(convolutional_layer l, network_state state)
                         l.stride_y, l.stride_x, // stride (h, w)
                         l.dilation, l.dilation, // dilation (h, w)
                         b);                 // output
-
+                    profile_phase_end(PROFILE_IM2COL, t);
                 }
 
+                const double t = profile_phase_begin();
                 gemm(0, 0, m, n, k, 1, a, k, b, n, 1, c, n);
+                profile_phase_end(PROFILE_GEMM, t);
                 // bit-count to float
             }
             //c += n*m;
@@ -1387,7 +1581,8 @@ void forward_convolutional_layer(convolutional_layer l, network_state state)
         }
     }
 
-    if(l.batch_normalize){
+    if (fused) {}
+    else if(l.batch_normalize){
         forward_batchnorm_layer(l, state);
     }
     else {
@@ -1395,13 +1590,17 @@ void forward_convolutional_layer(convolutional_layer l, network_state state)
     }
 
     //activate_array(l.output, m*n*l.batch, l.activation);
-    if (l.activation == SWISH) activate_array_swish(l.output, l.outputs*l.batch, l.activation_input, l.output);
+    const double t_activation = profile_phase_begin();
+    if (fused) {}
+    else if (fast) fast_activate_array(l.output, l.outputs*l.batch, l.activation);
+    else if (l.activation == SWISH) activate_array_swish(l.output, l.outputs*l.batch, l.activation_input, l.output);
     else if (l.activation == MISH) activate_array_mish(l.output, l.outputs*l.batch, l.activation_input, l.output);
     else if (l.activation == HARD_MISH) activate_array_hard_mish(l.output, l.outputs*l.batch, l.activation_input, l.output);
     else if (l.activation == NORM_CHAN) activate_array_normalize_channels(l.output, l.outputs*l.batch, l.batch, l.out_c, l.out_w*l.out_h, l.output);
     else if (l.activation == NORM_CHAN_SOFTMAX) activate_array_normalize_channels_softmax(l.output, l.outputs*l.batch, l.batch, l.out_c, l.out_w*l.out_h, l.output, 0);
     else if (l.activation == NORM_CHAN_SOFTMAX_MAXVAL) activate_array_normalize_channels_softmax(l.output, l.outputs*l.batch, l.batch, l.out_c, l.out_w*l.out_h, l.output, 1);
     else activate_array_cpu_custom(l.output, l.outputs*l.batch, l.activation);
+    profile_phase_end(PROFILE_ACTIVATION, t_activation);
 
     if(l.binary || l.xnor) swap_binary(&l);
 
@@ -43,6 +43,16 @@ void swap_binary(convolutional_layer *l);
 void binarize_weights2(float *weights, int n, int size, char *binary, float *scales);
 
 void binary_align_weights(convolutional_layer *l);
+void prepack_convolutional_weights(convolutional_layer *l);
+void free_convolutional_inference_weights(convolutional_layer *l);
+
+// CPU inference: workspace limit of the im2col / Winograd paths (bytes)
+#define CONV_INFERENCE_WORKSPACE (16*1024*1024)
+int is_convolutional_algorithm_supported(convolutional_layer l, CONV_ALGO algo);
+CONV_ALGO select_convolutional_algorithm(convolutional_layer l);
+void set_convolutional_algorithm(convolutional_layer *l, CONV_ALGO algo);
+const char *get_conv_algo_string(CONV_ALGO algo);
+size_t get_convolutional_inference_workspace_size(convolutional_layer l);
 
 void backward_convolutional_layer(convolutional_layer layer, network_state state);
 
@@ -1,4 +1,5 @@
 //#include "mini_blas.h"
+#include "gemm_packed.h"
 #ifdef __cplusplus
 #define PUT_IN_REGISTER
 #else
@@ -73,24 +74,12 @@ void cpu_gemm_tt(int TA, int TB, int M, int N, int K, float ALPHA,
 }
 
 
+// the naive loops above are kept as a reference, the real work goes to the packed engine
 void cpu_gemm(int TA, int TB, int M, int N, int K, float ALPHA,
         float *A, int lda,
         float *B, int ldb,
         float BETA,
         float *C, int ldc)
 {
-    int i, j;
-    for(i = 0; i < M; ++i){
-        for(j = 0; j < N; ++j){
-            C[i*ldc + j] *= BETA;
-        }
-    }
-    if(!TA && !TB)
-        cpu_gemm_nn( TA,  TB,  M, N, K, ALPHA,A,lda, B, ldb,BETA,C,ldc);
-    else if(TA && !TB)
-        cpu_gemm_tn( TA,  TB,  M, N, K, ALPHA,A,lda, B, ldb,BETA,C,ldc);
-    else if(!TA && TB)
-        cpu_gemm_nt( TA,  TB,  M, N, K, ALPHA,A,lda, B, ldb,BETA,C,ldc);
-    else
-        cpu_gemm_tt( TA,  TB,  M, N, K, ALPHA,A,lda, B, ldb,BETA,C,ldc);
+    gemm_packed(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc);
 }
@@ -11,6 +11,11 @@
 #include "dark_cuda.h"
 #include "blas.h"
 #include "connected_layer.h"
+#include "prepared.h"
+#include "fast_activations.h"
+#include "layer_graph.h"
+#include "yolo_layer.h"
+#include "http_stream.h"
 
 
 extern void predict_classifier(char *datacfg, char *cfgfile, char *weightfile, char *filename, int top);
@@ -31,6 +36,8 @@ extern void run_cifar(int argc, char **argv);
 extern void run_go(int argc, char **argv);
 extern void run_art(int argc, char **argv);
 extern void run_super(int argc, char **argv);
+extern void run_bench(int argc, char **argv);
+extern void run_profile(int argc, char **argv);
 
 void average(int argc, char *argv[])
 {
@@ -476,6 +483,13 @@ int main(int argc, char **argv)
 
     show_opencv_info();
 
+    char *int8_table = find_char_arg(argc, argv, "-int8", 0);
+    if (int8_table) set_int8_quantization_table(int8_table);
+    if (find_arg(argc, argv, "-fast_activations")) set_fast_activations(1);
+    if (find_arg(argc, argv, "-parallel_branches")) set_parallel_branches(1);
+    if (find_arg(argc, argv, "-yolo_decode")) set_yolo_decode(1);
+    set_mjpeg_encoder(find_int_arg(argc, argv, "-mjpeg_threads", -1), find_int_arg(argc, argv, "-mjpeg_width", 0));
+
     if (0 == strcmp(argv[1], "average")){
         average(argc, argv);
     } else if (0 == strcmp(argv[1], "yolo")){
@@ -484,6 +498,10 @@ int main(int argc, char **argv)
         run_voxel(argc, argv);
     } else if (0 == strcmp(argv[1], "super")){
         run_super(argc, argv);
+    } else if (0 == strcmp(argv[1], "bench")){
+        run_bench(argc, argv);
+    } else if (0 == strcmp(argv[1], "profile")){
+        run_profile(argc, argv);
     } else if (0 == strcmp(argv[1], "detector")){
         run_detector(argc, argv);
     } else if (0 == strcmp(argv[1], "detect")){
@@ -541,6 +559,12 @@ int main(int argc, char **argv)
         speed(argv[2], (argc > 3 && argv[3]) ? atoi(argv[3]) : 0);
     } else if (0 == strcmp(argv[1], "oneoff")){
         oneoff(argv[2], argv[3], argv[4]);
+    } else if (0 == strcmp(argv[1], "export_prepared")){
+        if (argc < 5) {
+            fprintf(stderr, "usage: %s export_prepared <cfg> <weights> <output>\n", argv[0]);
+            return 0;
+        }
+        export_prepared_model(argv[2], argv[3], argv[4]);
     } else if (0 == strcmp(argv[1], "partial")){
         partial(argv[2], argv[3], argv[4], atoi(argv[5]));
     } else if (0 == strcmp(argv[1], "visualize")){
@@ -0,0 +1,608 @@
+#include "darknet.h"
+#include "network.h"
+#include "parser.h"
+#include "utils.h"
+#include "gemm.h"
+#include "im2col.h"
+#include "activations.h"
+#include "blas.h"
+#include "maxpool_layer.h"
+#include "shortcut_layer.h"
+#include "box.h"
+#include "augment.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Deterministic benchmark suite of the CPU inference path, for regression checks:
+//   darknet_bench [cfg[:size] ...] [-iters N] [-warmup N] [-e2e_iters N] [-seed N]
+//                 [-filter substr] [-out darknet_bench.json] [-baseline old.json] [-tolerance 0.1]
+// Micro-benchmarks: GEMM shapes of the YOLO convolutions, im2col, activations,
+// maxpool, shortcut, upsample, NMS and the fused preprocessing. End-to-end: the
+// given cfgs (cfg/yolov4-tiny.cfg, cfg/yolov3-tiny.cfg, cfg/yolov4.cfg at 416 by
+// default) with random weights, so no data is needed.
+// Every case is seeded on its own and has a fixed size, so two builds run the same work.
+// The results (ms per call: min, mean, stddev, p50, p90, p99, max) are written as JSON,
+// one case per line, to a file: the layers print their summaries to stdout.
+// With -baseline the p50 of every case is compared with an older run: slower by
+// more than the tolerance is a regression and the exit code is 1.
+// CPU only, the GPU is not used even in a GPU build.
+
+typedef struct bench_case bench_case;
+typedef void (*bench_func)(bench_case *c);
+
+struct bench_case {
+    const char *group;
+    char name[128];
+    int reps;           // calls per sample, for the kernels too fast for the timer
+    double flops;       // per call, 0 - not reported
+    double bytes;       // memory traffic per call, 0 - not reported
+    bench_func setup, reset, run, teardown;
+
+    int p[8];
+    float *buf[4];
+    size_t size;
+    layer l;
+    network net;
+    network_state state;
+    detection *dets, *work;
+    unsigned char *frame;
+    image im;
+    char *cfgfile;
+};
+
+static float *bench_random_floats(size_t size, float min, float max)
+{
+    float *x = (float*)xcalloc(size, sizeof(float));
+    size_t i;
+    for (i = 0; i < size; ++i) x[i] = rand_uniform(min, max);
+    return x;
+}
+
+static void bench_free_buffers(bench_case *c)
+{
+    int i;
+    for (i = 0; i < 4; ++i) {
+        free(c->buf[i]);
+        c->buf[i] = NULL;
+    }
+}
+
+// GEMM: p = M, N, K as in the convolutional layers, C = A * B
+static void gemm_setup(bench_case *c)
+{
+    const int m = c->p[0], n = c->p[1], k = c->p[2];
+    c->buf[0] = bench_random_floats((size_t)m * k, -1, 1);
+    c->buf[1] = bench_random_floats((size_t)k * n, -1, 1);
+    c->buf[2] = (float*)xcalloc((size_t)m * n, sizeof(float));
+    c->flops = 2. * m * n * k;
+}
+
+static void gemm_reset(bench_case *c)
+{
+    memset(c->buf[2], 0, (size_t)c->p[0] * c->p[1] * sizeof(float));
+}
+
+static void gemm_run(bench_case *c)
+{
+    const int m = c->p[0], n = c->p[1], k = c->p[2];
+    gemm(0, 0, m, n, k, 1, c->buf[0], k, c->buf[1], n, 1, c->buf[2], n);
+}
+
+// im2col: p = channels, height, width, kernel size, stride
+static void im2col_setup(bench_case *c)
+{
+    const int ch = c->p[0], h = c->p[1], w = c->p[2], size = c->p[3], stride = c->p[4];
+    const int out_h = (h + 2 * (size / 2) - size) / stride + 1;
+    const int out_w = (w + 2 * (size / 2) - size) / stride + 1;
+    const size_t cols = (size_t)ch * size * size * out_h * out_w;
+    c->buf[0] = bench_random_floats((size_t)ch * h * w, -1, 1);
+    c->buf[1] = (float*)xcalloc(cols, sizeof(float));
+    c->bytes = ((size_t)ch * h * w + cols) * sizeof(float);
+}
+
+static void im2col_run(bench_case *c)
+{
+    const int size = c->p[3], stride = c->p[4];
+    im2col_cpu_ext(c->buf[0], c->p[0], c->p[1], c->p[2], size, size, size / 2, size / 2,
+        stride, stride, 1, 1, c->buf[1]);
+}
+
+// activations: p = ACTIVATION
+static void activation_setup(bench_case *c)
+{
+    c->buf[0] = bench_random_floats(c->size, -4, 4);
+    c->buf[1] = (float*)xcalloc(c->size, sizeof(float));
+    c->buf[2] = (float*)xcalloc(c->size, sizeof(float));
+    c->bytes = (c->p[0] == LEAKY ? 2 : 3) * c->size * sizeof(float);
+    if (c->p[0] == LEAKY) memcpy(c->buf[1], c->buf[0], c->size * sizeof(float));
+}
+
+// leaky is in-place: back to the same input for every sample
+static void activation_reset(bench_case *c)
+{
+    if (c->p[0] == LEAKY) memcpy(c->buf[1], c->buf[0], c->size * sizeof(float));
+}
+
+static void activation_run(bench_case *c)
+{
+    if (c->p[0] == MISH) activate_array_mish(c->buf[0], (int)c->size, c->buf[1], c->buf[2]);
+    else if (c->p[0] == SWISH) activate_array_swish(c->buf[0], (int)c->size, c->buf[1], c->buf[2]);
+    else activate_array(c->buf[1], (int)c->size, (ACTIVATION)c->p[0]);
+}
+
+// maxpool: p = channels, height, width, size, stride
+static void maxpool_setup(bench_case *c)
+{
+    const int ch = c->p[0], h = c->p[1], w = c->p[2], size = c->p[3], stride = c->p[4];
+    c->l = make_maxpool_layer(1, h, w, ch, size, stride, stride, size - 1, 0, 0, 0, 0, 0);
+    c->buf[0] = bench_random_floats(c->l.inputs, -1, 1);
+    memset(&c->state, 0, sizeof(c->state));
+    c->state.input = c->buf[0];
+    c->bytes = (double)(c->l.inputs + c->l.outputs) * sizeof(float);
+}
+
+static void maxpool_run(bench_case *c)
+{
+    forward_maxpool_layer(c->l, c->state);
+}
+
+static void layer_teardown(bench_case *c)
+{
+    free_layer(c->l);
+    free(c->net.layers);
+    memset(&c->net, 0, sizeof(c->net));
+    bench_free_buffers(c);
+}
+
+// shortcut: p = channels, height, width; the residual add of the CSP blocks
+static void shortcut_setup(bench_case *c)
+{
+    const int ch = c->p[0], h = c->p[1], w = c->p[2];
+    const int outputs = ch * h * w;
+    int *input_layers = (int*)xcalloc(1, sizeof(int));
+    int *input_sizes = (int*)xcalloc(1, sizeof(int));
+    float **layers_output = (float**)xcalloc(1, sizeof(float*));
+    c->buf[0] = bench_random_floats(outputs, -1, 1);
+    c->buf[1] = bench_random_floats(outputs, -1, 1);
+    input_sizes[0] = outputs;
+    layers_output[0] = c->buf[0];
+    c->net.n = 1;
+    c->net.layers = (layer*)xcalloc(1, sizeof(layer));
+    c->net.layers[0].w = w;
+    c->net.layers[0].h = h;
+    c->net.layers[0].c = ch;
+    c->net.layers[0].output = c->buf[0];
+    c->l = make_shortcut_layer(1, 1, input_layers, input_sizes, w, h, ch, layers_output, NULL, NULL, NULL,
+        NO_WEIGHTS, NO_NORMALIZATION, LINEAR, 0);
+    memset(&c->state, 0, sizeof(c->state));
+    c->state.net = c->net;
+    c->state.input = c->buf[1];
+    c->bytes = 3. * outputs * sizeof(float);
+}
+
+static void shortcut_run(bench_case *c)
+{
+    forward_shortcut_layer(c->l, c->state);
+}
+
+// upsample: p = channels, height, width, stride; as forward_upsample_layer()
+static void upsample_setup(bench_case *c)
+{
+    const int ch = c->p[0], h = c->p[1], w = c->p[2], stride = c->p[3];
+    c->size = (size_t)ch * h * w * stride * stride;
+    c->buf[0] = bench_random_floats((size_t)ch * h * w, -1, 1);
+    c->buf[1] = (float*)xcalloc(c->size, sizeof(float));
+    c->bytes = ((size_t)ch * h * w + 2 * c->size) * sizeof(float);
+}
+
+static void upsample_run(bench_case *c)
+{
+    fill_cpu((int)c->size, 0, c->buf[1], 1);
+    upsample_cpu(c->buf[0], c->p[2], c->p[1], c->p[0], 1, c->p[3], 1, 1, c->buf[1]);
+}
+
+// NMS: p = total, classes, NMS_KIND; boxes clustered around objects, as the YOLO heads output them
+static void nms_setup(bench_case *c)
+{
+    const int total = c->p[0], classes = c->p[1];
+    const int objects = total / 20 + 1;
+    box *centers = (box*)xcalloc(objects, sizeof(box));
+    int i, k;
+    c->dets = (detection*)xcalloc(total, sizeof(detection));
+    c->work = (detection*)xcalloc(total, sizeof(detection));
+    for (i = 0; i < objects; ++i) {
+        centers[i].x = rand_uniform(0, 1);
+        centers[i].y = rand_uniform(0, 1);
+        centers[i].w = rand_uniform(.02, .5);
+        centers[i].h = rand_uniform(.02, .5);
+    }
+    for (i = 0; i < total; ++i) {
+        const int o = rand() % objects;
+        detection *d = &c->dets[i];
+        d->classes = classes;
+        d->prob = (float*)xcalloc(classes, sizeof(float));
+        d->bbox.x = centers[o].x + rand_uniform(-.03, .03);
+        d->bbox.y = centers[o].y + rand_uniform(-.03, .03);
+        d->bbox.w = centers[o].w * rand_uniform(.7, 1.3);
+        d->bbox.h = centers[o].h * rand_uniform(.7, 1.3);
+        d->objectness = rand() % 10 ? rand_uniform(0, 1) : 0;
+        for (k = 0; k < classes; ++k) {
+            const int likely = k == o % classes || rand() % 16 == 0;
+            const float p = likely ? d->objectness * rand_uniform(0, 1) : 0;
+            d->prob[k] = p > .005 ? p : 0;
+        }
+        c->work[i].prob = (float*)xcalloc(classes, sizeof(float));
+    }
+    free(centers);
+}
+
+// NMS sorts the detections and clears the probabilities: a fresh copy for every sample
+static void nms_reset(bench_case *c)
+{
+    int i;
+    for (i = 0; i < c->p[0]; ++i) {
+        float *prob = c->work[i].prob;
+        c->work[i] = c->dets[i];
+        c->work[i].prob = prob;
+        memcpy(prob, c->dets[i].prob, c->p[1] * sizeof(float));
+    }
+}
+
+static void nms_run(bench_case *c)
+{
+    if (c->p[2] == DEFAULT_NMS) do_nms_sort(c->work, c->p[0], c->p[1], .45);
+    else diounms_sort(c->work, c->p[0], c->p[1], .45, (NMS_KIND)c->p[2], .6);
+}
+
+static void nms_teardown(bench_case *c)
+{
+    int i;
+    for (i = 0; i < c->p[0]; ++i) {
+        free(c->dets[i].prob);
+        free(c->work[i].prob);
+    }
+    free(c->dets);
+    free(c->work);
+    c->dets = c->work = NULL;
+}
+
+// preprocessing of a BGR camera frame: p = frame width, height, network size, letterbox
+static void preprocess_setup(bench_case *c)
+{
+    const size_t frame_size = (size_t)c->p[0] * c->p[1] * 3;
+    size_t i;
+    c->frame = (unsigned char*)xcalloc(frame_size, 1);
+    for (i = 0; i < frame_size; ++i) c->frame[i] = rand() & 255;
+    c->im = make_image(c->p[2], c->p[2], 3);
+    c->bytes = frame_size + (double)c->im.w * c->im.h * c->im.c * sizeof(float);
+}
+
+static void preprocess_run(bench_case *c)
+{
+    if (c->p[3]) letterbox_image_u8_into(c->frame, c->p[0], c->p[1], (size_t)c->p[0] * 3, 1, c->im);
+    else resize_image_u8_into(c->frame, c->p[0], c->p[1], (size_t)c->p[0] * 3, 1, c->im);
+}
+
+static void preprocess_teardown(bench_case *c)
+{
+    free(c->frame);
+    c->frame = NULL;
+    free_image(c->im);
+}
+
+// end-to-end: cfg with random weights at a fixed size, prepared for inference as the detector does
+static void e2e_setup(bench_case *c)
+{
+    int i, f;
+    c->net = parse_network_cfg_custom(c->cfgfile, 1, 1);
+    // l.bflops are of the cfg size and scale with the area
+    const double scale = (double)c->p[0] * c->p[0] / (c->net.w * c->net.h);
+    if (c->net.w != c->p[0] || c->net.h != c->p[0]) resize_network(&c->net, c->p[0], c->p[0]);
+    for (i = 0; i < c->net.n; ++i) {
+        layer *l = &c->net.layers[i];
+        if (l->type == CONVOLUTIONAL && l->batch_normalize && l->rolling_variance) {
+            for (f = 0; f < l->n; ++f) l->rolling_variance[f] = 1;
+        }
+    }
+    fuse_conv_batchnorm(c->net);
+    calculate_binary_weights(c->net);
+    prepare_network_for_inference(&c->net);
+    c->buf[0] = bench_random_floats((size_t)c->net.w * c->net.h * c->net.c, 0, 1);
+    c->flops = 0;
+    for (i = 0; i < c->net.n; ++i) c->flops += c->net.layers[i].bflops * 1e9 * scale;
+}
+
+static void e2e_run(bench_case *c)
+{
+    network_predict(c->net, c->buf[0]);
+}
+
+static void e2e_teardown(bench_case *c)
+{
+    free_network(c->net);
+    memset(&c->net, 0, sizeof(c->net));
+    bench_free_buffers(c);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, int n, double p)
+{
+    int i = (int)ceil(p / 100. * n) - 1;
+    if (i < 0) i = 0;
+    if (i >= n) i = n - 1;
+    return sorted[i];
+}
+
+typedef struct bench_result {
+    double min, mean, stddev, p50, p90, p99, max;
+} bench_result;
+
+static bench_result run_case(bench_case *c, int iters, int warmup, unsigned int seed)
+{
+    bench_result r = { 0 };
+    double *samples = (double*)xcalloc(iters, sizeof(double));
+    int i, k;
+    srand(seed);
+    if (c->setup) c->setup(c);
+    for (i = 0; i < warmup; ++i) {
+        if (c->reset) c->reset(c);
+        for (k = 0; k < c->reps; ++k) c->run(c);
+    }
+    for (i = 0; i < iters; ++i) {
+        if (c->reset) c->reset(c);
+        double start = get_time_point();
+        for (k = 0; k < c->reps; ++k) c->run(c);
+        samples[i] = (get_time_point() - start) / 1000. / c->reps;
+    }
+    if (c->teardown) c->teardown(c);
+    else bench_free_buffers(c);
+
+    for (i = 0; i < iters; ++i) r.mean += samples[i];
+    r.mean /= iters;
+    for (i = 0; i < iters; ++i) r.stddev += (samples[i] - r.mean) * (samples[i] - r.mean);
+    r.stddev = sqrt(r.stddev / iters);
+    qsort(samples, iters, sizeof(double), cmp_double);
+    r.min = samples[0];
+    r.max = samples[iters - 1];
+    r.p50 = percentile(samples, iters, 50);
+    r.p90 = percentile(samples, iters, 90);
+    r.p99 = percentile(samples, iters, 99);
+    free(samples);
+    return r;
+}
+
+static void fprint_json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') fputc('\\', fp);
+        if ((unsigned char)*s >= ' ') fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static void fprint_result(FILE *fp, const bench_case *c, bench_result r, int iters, int last)
+{
+    fprintf(fp, "    {\"group\": ");
+    fprint_json_string(fp, c->group);
+    fprintf(fp, ", \"name\": ");
+    fprint_json_string(fp, c->name);
+    fprintf(fp, ", \"iters\": %d, \"reps\": %d, \"min_ms\": %.6f, \"mean_ms\": %.6f, \"stddev_ms\": %.6f, "
+        "\"p50_ms\": %.6f, \"p90_ms\": %.6f, \"p99_ms\": %.6f, \"max_ms\": %.6f",
+        iters, c->reps, r.min, r.mean, r.stddev, r.p50, r.p90, r.p99, r.max);
+    if (c->flops > 0) fprintf(fp, ", \"gflops\": %.3f", c->flops / (r.p50 * 1e6));
+    if (c->bytes > 0) fprintf(fp, ", \"gbs\": %.3f", c->bytes / (r.p50 * 1e6));
+    if (c->run == e2e_run) fprintf(fp, ", \"fps\": %.3f", 1000. / r.p50);
+    fprintf(fp, "}%s\n", last ? "" : ",");
+}
+
+// p50 of a case in an older result file, -1 - not there
+static double baseline_p50(const char *filename, const char *name)
+{
+    char line[1024], key[160];
+    double p50 = -1;
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return -1;
+    sprintf(key, "\"name\": \"%s\"", name);
+    while (fgets(line, sizeof(line), fp)) {
+        const char *v;
+        if (!strstr(line, key) || !(v = strstr(line, "\"p50_ms\": "))) continue;
+        p50 = atof(v + strlen("\"p50_ms\": "));
+        break;
+    }
+    fclose(fp);
+    return p50;
+}
+
+static bench_case *add_case(bench_case *cases, int *n, const char *group, bench_func setup, bench_func reset,
+    bench_func run, bench_func teardown, int reps)
+{
+    bench_case *c = &cases[(*n)++];
+    memset(c, 0, sizeof(*c));
+    c->group = group;
+    c->setup = setup;
+    c->reset = reset;
+    c->run = run;
+    c->teardown = teardown;
+    c->reps = reps;
+    return c;
+}
+
+#define MAX_BENCH_CASES 128
+
+static int make_cases(bench_case *cases, char **cfgs, int *sizes, int ncfgs)
+{
+    static const int gemm_shapes[][3] = {   // M, N, K of yolov4-tiny and yolov4 at 416x416
+        { 64, 10816, 288 }, { 64, 10816, 576 }, { 128, 2704, 1152 }, { 256, 676, 2304 },
+        { 512, 169, 4608 }, { 255, 169, 512 }, { 128, 676, 256 }
+    };
+    static const int im2col_shapes[][5] = { // channels, height, width, size, stride
+        { 32, 208, 208, 3, 2 }, { 64, 104, 104, 3, 1 }, { 256, 26, 26, 3, 1 }
+    };
+    static const int maxpool_shapes[][5] = {
+        { 128, 104, 104, 2, 2 }, { 512, 26, 26, 2, 2 }, { 512, 13, 13, 5, 1 }, { 512, 13, 13, 13, 1 }
+    };
+    static const int shortcut_shapes[][3] = { { 128, 104, 104 }, { 512, 26, 26 } };
+    static const int upsample_shapes[][4] = { { 128, 13, 13, 2 }, { 256, 26, 26, 2 } };
+    static const struct { int act; const char *name; } activations[] = {
+        { LEAKY, "leaky" }, { MISH, "mish" }, { SWISH, "swish" }
+    };
+    const size_t activation_size = 64 * 208 * 208;
+    int n = 0, i;
+    bench_case *c;
+
+    for (i = 0; i < sizeof(gemm_shapes) / sizeof(gemm_shapes[0]); ++i) {
+        c = add_case(cases, &n, "gemm", gemm_setup, gemm_reset, gemm_run, NULL, 1);
+        memcpy(c->p, gemm_shapes[i], sizeof(gemm_shapes[i]));
+        sprintf(c->name, "gemm/%dx%dx%d", c->p[0], c->p[1], c->p[2]);
+    }
+    for (i = 0; i < sizeof(im2col_shapes) / sizeof(im2col_shapes[0]); ++i) {
+        c = add_case(cases, &n, "im2col", im2col_setup, NULL, im2col_run, NULL, 1);
+        memcpy(c->p, im2col_shapes[i], sizeof(im2col_shapes[i]));
+        sprintf(c->name, "im2col/%dx%dx%d_k%ds%d", c->p[0], c->p[1], c->p[2], c->p[3], c->p[4]);
+    }
+    for (i = 0; i < sizeof(activations) / sizeof(activations[0]); ++i) {
+        c = add_case(cases, &n, "activation", activation_setup, activation_reset, activation_run, NULL, 1);
+        c->p[0] = activations[i].act;
+        c->size = activation_size;
+        sprintf(c->name, "activation/%s_%d", activations[i].name, (int)c->size);
+    }
+    for (i = 0; i < sizeof(maxpool_shapes) / sizeof(maxpool_shapes[0]); ++i) {
+        c = add_case(cases, &n, "maxpool", maxpool_setup, NULL, maxpool_run, layer_teardown, 4);
+        memcpy(c->p, maxpool_shapes[i], sizeof(maxpool_shapes[i]));
+        sprintf(c->name, "maxpool/%dx%dx%d_k%ds%d", c->p[0], c->p[1], c->p[2], c->p[3], c->p[4]);
+    }
+    for (i = 0; i < sizeof(shortcut_shapes) / sizeof(shortcut_shapes[0]); ++i) {
+        c = add_case(cases, &n, "shortcut", shortcut_setup, NULL, shortcut_run, layer_teardown, 4);
+        memcpy(c->p, shortcut_shapes[i], sizeof(shortcut_shapes[i]));
+        sprintf(c->name, "shortcut/%dx%dx%d", c->p[0], c->p[1], c->p[2]);
+    }
+    for (i = 0; i < sizeof(upsample_shapes) / sizeof(upsample_shapes[0]); ++i) {
+        c = add_case(cases, &n, "upsample", upsample_setup, NULL, upsample_run, NULL, 16);
+        memcpy(c->p, upsample_shapes[i], sizeof(upsample_shapes[i]));
+        sprintf(c->name, "upsample/%dx%dx%d_s%d", c->p[0], c->p[1], c->p[2], c->p[3]);
+    }
+
+    c = add_case(cases, &n, "nms", nms_setup, nms_reset, nms_run, nms_teardown, 1);
+    c->p[0] = 10647; c->p[1] = 80; c->p[2] = DEFAULT_NMS;
+    sprintf(c->name, "nms/sort_%dx%d", c->p[0], c->p[1]);
+    c = add_case(cases, &n, "nms", nms_setup, nms_reset, nms_run, nms_teardown, 1);
+    c->p[0] = 10647; c->p[1] = 80; c->p[2] = DIOU_NMS;
+    sprintf(c->name, "nms/diou_%dx%d", c->p[0], c->p[1]);
+
+    c = add_case(cases, &n, "preprocess", preprocess_setup, NULL, preprocess_run, preprocess_teardown, 4);
+    c->p[0] = 1280; c->p[1] = 720; c->p[2] = 416; c->p[3] = 1;
+    sprintf(c->name, "preprocess/letterbox_%dx%d_%d", c->p[0], c->p[1], c->p[2]);
+    c = add_case(cases, &n, "preprocess", preprocess_setup, NULL, preprocess_run, preprocess_teardown, 4);
+    c->p[0] = 1280; c->p[1] = 720; c->p[2] = 416; c->p[3] = 0;
+    sprintf(c->name, "preprocess/resize_%dx%d_%d", c->p[0], c->p[1], c->p[2]);
+
+    for (i = 0; i < ncfgs && n < MAX_BENCH_CASES; ++i) {
+        c = add_case(cases, &n, "e2e", e2e_setup, NULL, e2e_run, e2e_teardown, 1);
+        c->cfgfile = cfgs[i];
+        c->p[0] = sizes[i];
+        char *base = basecfg(cfgs[i]);
+        sprintf(c->name, "e2e/%.96s@%d", base, sizes[i]);
+        free(base);
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    static char *default_cfgs[] = { "cfg/yolov4-tiny.cfg", "cfg/yolov3-tiny.cfg", "cfg/yolov4.cfg" };
+    const int iters = find_int_arg(argc, argv, "-iters", 50);
+    const int warmup = find_int_arg(argc, argv, "-warmup", 3);
+    const int e2e_iters = find_int_arg(argc, argv, "-e2e_iters", 10);
+    const unsigned int seed = find_int_arg(argc, argv, "-seed", 1);
+    char *filter = find_char_arg(argc, argv, "-filter", 0);
+    char *outfile = find_char_arg(argc, argv, "-out", "darknet_bench.json");
+    char *baseline = find_char_arg(argc, argv, "-baseline", 0);
+    const float tolerance = find_float_arg(argc, argv, "-tolerance", .1);
+    bench_case *cases = (bench_case*)xcalloc(MAX_BENCH_CASES, sizeof(bench_case));
+    char *cfgs[MAX_BENCH_CASES];
+    int sizes[MAX_BENCH_CASES];
+    int ncfgs = 0, ncases, selected = 0, done = 0, regressions = 0, threads = 1;
+    int i;
+    FILE *fp;
+
+    if (iters < 1 || e2e_iters < 1) error("Error: -iters and -e2e_iters must be at least 1", DARKNET_LOC);
+    gpu_index = -1;
+    init_cpu();
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    for (i = 1; i < argc && ncfgs < MAX_BENCH_CASES / 2; ++i) {
+        if (!argv[i]) continue;
+        if (argv[i][0] == '-') {
+            fprintf(stderr, " Unknown option: %s \n", argv[i]);
+            continue;
+        }
+        char *colon = strrchr(argv[i], ':');
+        sizes[ncfgs] = 416;
+        if (colon && colon[1] >= '0' && colon[1] <= '9') {
+            *colon = 0;
+            sizes[ncfgs] = atoi(colon + 1);
+        }
+        cfgs[ncfgs++] = argv[i];
+    }
+    if (ncfgs == 0) {
+        for (i = 0; i < sizeof(default_cfgs) / sizeof(default_cfgs[0]); ++i) {
+            FILE *cfg = fopen(default_cfgs[i], "r");
+            if (!cfg) {
+                fprintf(stderr, " %s not found, run from the darknet directory for the end-to-end benchmarks \n", default_cfgs[i]);
+                continue;
+            }
+            fclose(cfg);
+            cfgs[ncfgs] = default_cfgs[i];
+            sizes[ncfgs++] = 416;
+        }
+    }
+    ncases = make_cases(cases, cfgs, sizes, ncfgs);
+    for (i = 0; i < ncases; ++i) {
+        if (!filter || strstr(cases[i].name, filter)) ++selected;
+    }
+
+    fp = fopen(outfile, "w");
+    if (!fp) error("Error: can't write the results", DARKNET_LOC);
+    fprintf(fp, "{\n  \"suite\": \"darknet_bench\", \"seed\": %u, \"iters\": %d, \"e2e_iters\": %d, \"warmup\": %d, "
+        "\"threads\": %d, \"cpu_fma_avx2\": %d,\n  \"results\": [\n",
+        seed, iters, e2e_iters, warmup, threads, is_cpu_fma_avx2());
+
+    for (i = 0; i < ncases; ++i) {
+        bench_case *c = &cases[i];
+        if (filter && !strstr(c->name, filter)) continue;
+        const int n = c->run == e2e_run ? e2e_iters : iters;
+        bench_result r = run_case(c, n, c->run == e2e_run ? 1 : warmup, seed);
+        fprint_result(fp, c, r, n, ++done == selected);
+        fflush(fp);
+        fprintf(stderr, " %-36s p50 %10.4f ms, p90 %10.4f ms, p99 %10.4f ms", c->name, r.p50, r.p90, r.p99);
+        if (baseline) {
+            const double old = baseline_p50(baseline, c->name);
+            if (old > 0) {
+                const int slower = r.p50 > old * (1 + tolerance);
+                fprintf(stderr, ", baseline %10.4f ms (%+.1f%%)%s", old, (r.p50 / old - 1) * 100, slower ? " REGRESSION" : "");
+                regressions += slower;
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+    fprintf(stderr, " %d results saved to %s \n", done, outfile);
+    if (baseline) fprintf(stderr, " %d regressions (tolerance %.0f%%) \n", regressions, tolerance * 100);
+    free(cases);
+    return regressions ? 1 : 0;
+}
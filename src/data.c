@@ -3,6 +3,8 @@
 #include "image.h"
 #include "dark_cuda.h"
 #include "box.h"
+#include "data_pack.h"
+#include "augment.h"
 #include "http_stream.h"
 
 #include <stdio.h>
@@ -376,7 +378,8 @@ int fill_truth_detection(const char *path, int num_boxes, int truth_size, float
 
     int count = 0;
     int i;
-    box_label *boxes = read_boxes(labelpath, &count);
+    box_label *boxes = load_packed_boxes(path, labelpath, &count);
+    if (!boxes) boxes = read_boxes(labelpath, &count);
     int min_w_h = 0;
     float lowest_w = 1.F / net_w;
     float lowest_h = 1.F / net_h;
@@ -1092,8 +1095,8 @@ data load_data_detection(int n, char **paths, int m, int w, int h, int c, int bo
             const char *filename = random_paths[i];
 
             int flag = (c >= 3);
-            mat_cv *src;
-            src = load_image_mat_cv(filename, flag);
+            mat_cv *src = load_packed_image_mat(filename, c);
+            if (!src) src = load_image_mat_cv(filename, flag);
             if (src == NULL) {
                 printf("\n Error in load_data_detection() - OpenCV \n");
                 fflush(stdout);
@@ -1409,10 +1412,10 @@ data load_data_detection(int n, char **paths, int m, int w, int h, int c, int bo
             float *truth = (float*)xcalloc(truth_size * boxes, sizeof(float));
             char *filename = (i_mixup) ? mixup_random_paths[i] : random_paths[i];
 
-            image orig = load_image(filename, 0, 0, c);
-
-            int oh = orig.h;
-            int ow = orig.w;
+            int ow, oh;
+            unsigned char *decoded = NULL;
+            const unsigned char *pixels = load_packed_image_u8(filename, c, &ow, &oh);
+            if (!pixels) pixels = decoded = load_image_stb_u8(filename, c, &ow, &oh);
 
             int dw = (ow*jitter);
             int dh = (oh*jitter);
@@ -1501,15 +1504,14 @@ data load_data_detection(int n, char **paths, int m, int w, int h, int c, int bo
             float sx = (float)swidth / ow;
             float sy = (float)sheight / oh;
 
-            image cropped = crop_image(orig, pleft, ptop, swidth, sheight);
-
             float dx = ((float)pleft / ow) / sx;
             float dy = ((float)ptop / oh) / sy;
 
-            image sized = resize_image(cropped, w, h);
-            if (flip) flip_image(sized);
-            distort_image(sized, dhue, dsat, dexp);
-            //random_distort_image(sized, hue, saturation, exposure);
+            // crop, resize, flip and distort in one pass over the uint8 pixels
+            image sized = make_image(w, h, c);
+            augment_params aug = { pleft, ptop, swidth, sheight, (int)flip, 1, dhue, dsat, dexp };
+            augment_image_u8(pixels, ow, oh, c, aug, sized.data, w, h);
+            free(decoded);
 
             fill_truth_detection(filename, boxes, truth_size, truth, classes, flip, dx, dy, 1. / sx, 1. / sy, w, h);
 
@@ -1551,8 +1553,6 @@ data load_data_detection(int n, char **paths, int m, int w, int h, int c, int bo
                 printf("\nYou use flag -show_imgs, so will be saved aug_...jpg images\n");
             }
 
-            free_image(orig);
-            free_image(cropped);
             free(truth);
         }
     }
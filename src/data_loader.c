@@ -0,0 +1,369 @@
+#include "data_loader.h"
+#include "data.h"
+#include "utils.h"
+#include "http_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+enum { LOADER_FREE, LOADER_LOADING, LOADER_READY, LOADER_TAKEN };
+
+typedef struct loader_task {
+    int slot;
+    int first;      // first row of the batch
+} loader_task;
+
+// circular, the tasks of older batches are at the front
+typedef struct loader_deque {
+    pthread_mutex_t mutex;
+    loader_task *tasks;
+    int capacity;
+    int head;
+    int size;
+} loader_deque;
+
+typedef struct loader_slot {
+    data d;             // X rows point into x
+    float *x;
+    load_args args;     // args the batch is loaded with
+    int state;
+    int remaining;      // tasks not done
+    long long seq;      // batches are returned in this order
+} loader_slot;
+
+struct data_loader {
+    load_args args;
+    int grain;          // images per task
+    int workers;
+    int slots_count;
+    pthread_t *threads;
+    loader_deque *deques;
+    loader_slot *slots;
+    int next_deque;     // round-robin for new tasks
+
+    // everything below is guarded by mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t work;    // tasks were queued or exit
+    pthread_cond_t done;    // a task is done
+    int queued;
+    int running;
+    int exit;
+    long long submit_seq;
+    long long next_seq;
+    int taken;              // slot the trainer has, -1 - none
+
+    long long images;
+    long long stats_images;
+    double stats_time;
+    double stall_us;
+};
+
+typedef struct loader_worker_args {
+    data_loader *loader;
+    int id;
+} loader_worker_args;
+
+static int loader_deque_pop(loader_deque *q, loader_task *task)
+{
+    int ok = 0;
+    pthread_mutex_lock(&q->mutex);
+    if (q->size > 0) {
+        *task = q->tasks[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        --q->size;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return ok;
+}
+
+static void loader_deque_push(loader_deque *q, loader_task task)
+{
+    pthread_mutex_lock(&q->mutex);
+    if (q->size == q->capacity) {
+        loader_task *tasks = (loader_task*)xcalloc(q->capacity * 2, sizeof(loader_task));
+        int i;
+        for (i = 0; i < q->size; ++i) tasks[i] = q->tasks[(q->head + i) % q->capacity];
+        free(q->tasks);
+        q->tasks = tasks;
+        q->capacity *= 2;
+        q->head = 0;
+    }
+    q->tasks[(q->head + q->size) % q->capacity] = task;
+    ++q->size;
+    pthread_mutex_unlock(&q->mutex);
+}
+
+// own deque first, then the others. A thief takes the oldest task as well:
+// it belongs to the batch the trainer will wait for first.
+static int loader_take_task(data_loader *loader, int id, loader_task *task)
+{
+    int i;
+    for (i = 0; i < loader->workers; ++i) {
+        if (loader_deque_pop(&loader->deques[(id + i) % loader->workers], task)) return 1;
+    }
+    return 0;
+}
+
+static void loader_run_task(data_loader *loader, loader_task task)
+{
+    loader_slot *s = &loader->slots[task.slot];
+    data part = { 0 };
+    load_args *args = (load_args*)xcalloc(1, sizeof(load_args));
+    int i;
+    *args = s->args;
+    args->n = loader->grain;
+    args->threads = 1;
+    args->d = &part;
+    load_thread(args);  // frees args
+
+    if (part.X.cols != s->d.X.cols || part.y.cols != s->d.y.cols) {
+        printf(" data loader: rows of %d x %d, expected %d x %d \n", part.X.cols, part.y.cols, s->d.X.cols, s->d.y.cols);
+        error("Error: the loaded data doesn't fit the batch", DARKNET_LOC);
+    }
+    for (i = 0; i < loader->grain; ++i) {
+        float *x = s->d.X.vals[task.first + i];
+        float *y = s->d.y.vals[task.first + i];
+        // an image that failed to load is left empty, as load_data_detection() does
+        if (i < part.X.rows && part.X.vals[i]) memcpy(x, part.X.vals[i], s->d.X.cols * sizeof(float));
+        else memset(x, 0, s->d.X.cols * sizeof(float));
+        if (i < part.y.rows && part.y.vals[i]) memcpy(y, part.y.vals[i], s->d.y.cols * sizeof(float));
+        else memset(y, 0, s->d.y.cols * sizeof(float));
+    }
+    free_data(part);
+}
+
+static void *loader_worker(void *ptr)
+{
+    loader_worker_args a = *(loader_worker_args*)ptr;
+    data_loader *loader = a.loader;
+    loader_task task;
+    free(ptr);
+
+    while (1) {
+        if (!loader_take_task(loader, a.id, &task)) {
+            pthread_mutex_lock(&loader->mutex);
+            while (!loader->exit && loader->queued == 0) pthread_cond_wait(&loader->work, &loader->mutex);
+            const int stop = loader->exit;
+            pthread_mutex_unlock(&loader->mutex);
+            if (stop) break;
+            continue;
+        }
+        pthread_mutex_lock(&loader->mutex);
+        --loader->queued;
+        ++loader->running;
+        pthread_mutex_unlock(&loader->mutex);
+
+        loader_run_task(loader, task);
+
+        pthread_mutex_lock(&loader->mutex);
+        --loader->running;
+        loader->images += loader->grain;
+        loader_slot *s = &loader->slots[task.slot];
+        if (--s->remaining == 0) s->state = LOADER_READY;
+        pthread_cond_broadcast(&loader->done);
+        pthread_mutex_unlock(&loader->mutex);
+    }
+    return 0;
+}
+
+static void loader_free_slot(loader_slot *s)
+{
+    free(s->d.X.vals);
+    free(s->x);
+    free_matrix(s->d.y);
+    memset(&s->d, 0, sizeof(s->d));
+    s->x = NULL;
+}
+
+// (re)allocates the slot for args.n rows of the size of args
+static void loader_fit_slot(loader_slot *s, load_args args)
+{
+    const int c = args.c ? args.c : 3;
+    const int x_cols = args.w * args.h * c;
+    const int y_cols = args.truth_size * args.num_boxes;
+    int i;
+    if (s->x && s->d.X.rows == args.n && s->d.X.cols == x_cols && s->d.y.cols == y_cols) return;
+    loader_free_slot(s);
+    s->x = (float*)xcalloc((size_t)args.n * x_cols, sizeof(float));
+    s->d.shallow = 0;
+    s->d.X.rows = args.n;
+    s->d.X.cols = x_cols;
+    s->d.X.vals = (float**)xcalloc(args.n, sizeof(float*));
+    for (i = 0; i < args.n; ++i) s->d.X.vals[i] = s->x + (size_t)i * x_cols;
+    s->d.y = make_matrix(args.n, y_cols);
+}
+
+// queues the tasks of the next batch into the slot, under mutex
+static void loader_submit(data_loader *loader, int index)
+{
+    loader_slot *s = &loader->slots[index];
+    const int tasks = loader->args.n / loader->grain;
+    int i;
+    loader_fit_slot(s, loader->args);
+    s->args = loader->args;
+    s->state = LOADER_LOADING;
+    s->remaining = tasks;
+    s->seq = loader->submit_seq++;
+    for (i = 0; i < tasks; ++i) {
+        loader_task task;
+        task.slot = index;
+        task.first = i * loader->grain;
+        loader_deque_push(&loader->deques[loader->next_deque], task);
+        loader->next_deque = (loader->next_deque + 1) % loader->workers;
+    }
+    loader->queued += tasks;
+    // a worker per task, not the whole pool
+    for (i = 0; i < tasks && i < loader->workers; ++i) pthread_cond_signal(&loader->work);
+}
+
+static void loader_check_args(data_loader *loader, load_args args)
+{
+    if (args.type != DETECTION_DATA || args.track) {
+        error("Error: the data loader supports DETECTION_DATA without track=1 only, use load_data()", DARKNET_LOC);
+    }
+    if (args.n % loader->grain) {
+        printf(" data loader: %d images per batch, %d per task \n", args.n, loader->grain);
+        error("Error: the batch isn't a multiple of the images per task", DARKNET_LOC);
+    }
+}
+
+data_loader *make_data_loader(load_args args, int prefetch)
+{
+    data_loader *loader = (data_loader*)xcalloc(1, sizeof(data_loader));
+    int i;
+    if (prefetch < 1) prefetch = 1;
+    loader->grain = args.contrastive ? 2 : 1;
+    loader_check_args(loader, args);
+    loader->args = args;
+    loader->workers = args.threads > 0 ? args.threads : 1;
+    loader->slots_count = prefetch + 1;
+    loader->taken = -1;
+    pthread_mutex_init(&loader->mutex, 0);
+    pthread_cond_init(&loader->work, 0);
+    pthread_cond_init(&loader->done, 0);
+
+    loader->deques = (loader_deque*)xcalloc(loader->workers, sizeof(loader_deque));
+    for (i = 0; i < loader->workers; ++i) {
+        loader_deque *q = &loader->deques[i];
+        pthread_mutex_init(&q->mutex, 0);
+        q->capacity = (prefetch * args.n / loader->grain) / loader->workers + 1;
+        q->tasks = (loader_task*)xcalloc(q->capacity, sizeof(loader_task));
+    }
+    loader->slots = (loader_slot*)xcalloc(loader->slots_count, sizeof(loader_slot));
+    fprintf(stderr, " Data loader: %d threads, %d batches prefetched \n", loader->workers, prefetch);
+
+    loader->threads = (pthread_t*)xcalloc(loader->workers, sizeof(pthread_t));
+    for (i = 0; i < loader->workers; ++i) {
+        loader_worker_args *ptr = (loader_worker_args*)xcalloc(1, sizeof(loader_worker_args));
+        ptr->loader = loader;
+        ptr->id = i;
+        if (pthread_create(&loader->threads[i], 0, loader_worker, ptr)) error("Thread creation failed", DARKNET_LOC);
+    }
+
+    pthread_mutex_lock(&loader->mutex);
+    for (i = 0; i < loader->slots_count; ++i) loader_submit(loader, i);
+    loader->stats_time = get_time_point();
+    pthread_mutex_unlock(&loader->mutex);
+    return loader;
+}
+
+// removes the queued tasks and waits for the running ones, under mutex
+static void loader_cancel(data_loader *loader)
+{
+    int i;
+    for (i = 0; i < loader->workers; ++i) {
+        loader_deque *q = &loader->deques[i];
+        pthread_mutex_lock(&q->mutex);
+        loader->queued -= q->size;
+        q->size = 0;
+        q->head = 0;
+        pthread_mutex_unlock(&q->mutex);
+    }
+    while (loader->running > 0 || loader->queued > 0) pthread_cond_wait(&loader->done, &loader->mutex);
+    for (i = 0; i < loader->slots_count; ++i) loader->slots[i].state = LOADER_FREE;
+    loader->taken = -1;
+    loader->next_seq = loader->submit_seq;
+}
+
+void free_data_loader(data_loader *loader)
+{
+    int i;
+    if (!loader) return;
+    pthread_mutex_lock(&loader->mutex);
+    loader_cancel(loader);
+    loader->exit = 1;
+    pthread_cond_broadcast(&loader->work);
+    pthread_mutex_unlock(&loader->mutex);
+    for (i = 0; i < loader->workers; ++i) pthread_join(loader->threads[i], 0);
+
+    for (i = 0; i < loader->slots_count; ++i) loader_free_slot(&loader->slots[i]);
+    for (i = 0; i < loader->workers; ++i) {
+        pthread_mutex_destroy(&loader->deques[i].mutex);
+        free(loader->deques[i].tasks);
+    }
+    pthread_cond_destroy(&loader->work);
+    pthread_cond_destroy(&loader->done);
+    pthread_mutex_destroy(&loader->mutex);
+    free(loader->deques);
+    free(loader->slots);
+    free(loader->threads);
+    free(loader);
+}
+
+data data_loader_next(data_loader *loader)
+{
+    loader_slot *s = NULL;
+    data d;
+    int i;
+    pthread_mutex_lock(&loader->mutex);
+    // the previous batch is done with, its buffer loads the next one
+    if (loader->taken >= 0) loader_submit(loader, loader->taken);
+    loader->taken = -1;
+    for (i = 0; i < loader->slots_count; ++i) {
+        if (loader->slots[i].state != LOADER_FREE && loader->slots[i].seq == loader->next_seq) s = &loader->slots[i];
+    }
+    const double start = get_time_point();
+    while (s->state != LOADER_READY) pthread_cond_wait(&loader->done, &loader->mutex);
+    loader->stall_us = get_time_point() - start;
+    s->state = LOADER_TAKEN;
+    loader->taken = s - loader->slots;
+    ++loader->next_seq;
+    pthread_mutex_unlock(&loader->mutex);
+
+    // own row arrays, so that free_data() of the caller leaves the rows alone
+    d = s->d;
+    d.shallow = 1;
+    d.X.vals = (float**)xcalloc(d.X.rows, sizeof(float*));
+    d.y.vals = (float**)xcalloc(d.y.rows, sizeof(float*));
+    memcpy(d.X.vals, s->d.X.vals, d.X.rows * sizeof(float*));
+    memcpy(d.y.vals, s->d.y.vals, d.y.rows * sizeof(float*));
+    return d;
+}
+
+void data_loader_reset(data_loader *loader, load_args args)
+{
+    int i;
+    pthread_mutex_lock(&loader->mutex);
+    loader_check_args(loader, args);
+    loader_cancel(loader);
+    loader->args = args;
+    for (i = 0; i < loader->slots_count; ++i) loader_submit(loader, i);
+    pthread_mutex_unlock(&loader->mutex);
+}
+
+void print_data_loader_stats(data_loader *loader)
+{
+    int i, ready = 0;
+    pthread_mutex_lock(&loader->mutex);
+    const double now = get_time_point();
+    const double images = (double)(loader->images - loader->stats_images);
+    const double elapsed = now - loader->stats_time;
+    for (i = 0; i < loader->slots_count; ++i) ready += (loader->slots[i].state == LOADER_READY);
+    loader->stats_images = loader->images;
+    loader->stats_time = now;
+    pthread_mutex_unlock(&loader->mutex);
+    printf(" data loader: %.1f images/s, waited %.1f ms, %d of %d batches ready \n",
+        elapsed > 0 ? images * 1000000. / elapsed : 0., loader->stall_us / 1000., ready, loader->slots_count - 1);
+}
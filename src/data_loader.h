@@ -0,0 +1,33 @@
+#ifndef DATA_LOADER_H
+#define DATA_LOADER_H
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Prefetching training data loader: a pool of args.threads workers loads the
+// images of prefetch batches ahead of the trainer. A batch is split into tasks
+// of one image (a pair of images with contrastive=1); every worker has its own
+// deque of tasks and an idle worker steals from the others, so a slow image
+// (mosaic, mixup) no longer holds up the rest of the batch. Each task writes its
+// rows straight into the batch, which lives in one of prefetch + 1 buffers
+// allocated once; workers and the trainer wait on condition variables.
+// DETECTION_DATA only, without track=1.
+
+typedef struct data_loader data_loader;
+
+// starts loading prefetch batches of args right away
+data_loader *make_data_loader(load_args args, int prefetch);
+void free_data_loader(data_loader *loader);
+// waits for the next batch. The rows stay owned by the loader and valid until the
+// next call: free_data() of the returned data frees only its row arrays.
+data data_loader_next(data_loader *loader);
+// drops the prefetched batches and loads the next ones with args (new size or batch)
+void data_loader_reset(data_loader *loader, load_args args);
+// images/s since the last call and how long the last data_loader_next() waited
+void print_data_loader_stats(data_loader *loader);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,364 @@
+#include "data_pack.h"
+#include "utils.h"
+#include "image.h"
+#include "option_list.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACK_MAGIC "DARKPACK"
+#define PACK_VERSION 1
+#define PACK_ALIGN 64
+// images decoded in parallel while packing
+#define PACK_CHUNK 64
+
+typedef struct pack_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t count;
+    uint32_t shards;
+    uint32_t channels;
+    uint32_t max_size;
+    uint64_t paths_size;
+} pack_header;
+
+typedef struct pack_sample {
+    uint32_t shard;
+    uint32_t w, h;
+    uint32_t boxes;
+    uint64_t offset;    // in the shard: w*h*channels bytes, then the boxes
+    uint64_t path;      // in the paths
+} pack_sample;
+
+typedef struct pack_box {
+    int32_t id;
+    float x, y, w, h;
+} pack_box;
+
+typedef struct packed_dataset {
+    char *index;
+    size_t index_size;
+    pack_header header;
+    const pack_sample *samples;
+    const char *paths;
+    unsigned char **shards;
+    size_t *shard_sizes;
+    uint32_t *table;    // open addressing: sample + 1, 0 - empty
+    uint32_t table_mask;
+} packed_dataset;
+
+// read-only after open_packed_dataset(), the loader threads share it
+static packed_dataset *packed = NULL;
+
+static uint64_t pack_align(uint64_t offset)
+{
+    return (offset + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+static void pack_shard_name(char *buff, size_t size, const char *outfile, int shard)
+{
+    snprintf(buff, size, "%s.%d", outfile, shard);
+}
+
+static void pack_write_padding(FILE *fp, uint64_t *pos, uint64_t offset)
+{
+    static const char zeros[PACK_ALIGN] = { 0 };
+    while (*pos < offset) {
+        const size_t n = (offset - *pos < PACK_ALIGN) ? (size_t)(offset - *pos) : PACK_ALIGN;
+        fwrite(zeros, 1, n, fp);
+        *pos += n;
+    }
+}
+
+// decoded and scaled down so that the longer side is at most max_size (0 - as is), uint8 HWC
+static unsigned char *pack_load_image(char *path, int max_size, int channels, int *w, int *h)
+{
+    image im = load_image(path, 0, 0, channels);
+    int x, y, k;
+    if (max_size > 0 && (im.w > max_size || im.h > max_size)) {
+        const float scale = (float)max_size / (im.w > im.h ? im.w : im.h);
+        int sw = (int)(im.w * scale + .5f), sh = (int)(im.h * scale + .5f);
+        image sized = resize_image(im, sw > 0 ? sw : 1, sh > 0 ? sh : 1);
+        free_image(im);
+        im = sized;
+    }
+    unsigned char *pixels = (unsigned char*)xcalloc((size_t)im.w * im.h * im.c, 1);
+    for (y = 0; y < im.h; ++y) {
+        for (x = 0; x < im.w; ++x) {
+            for (k = 0; k < im.c; ++k) {
+                const float v = im.data[k*im.w*im.h + y*im.w + x] * 255.f + .5f;
+                pixels[(y*im.w + x)*im.c + k] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+            }
+        }
+    }
+    *w = im.w;
+    *h = im.h;
+    free_image(im);
+    return pixels;
+}
+
+void pack_detection_dataset(char *datacfg, char *outfile, int max_size, int shard_mb, int channels)
+{
+    list *options = read_data_cfg(datacfg);
+    char *train_images = option_find_str(options, "train", "data/train.txt");
+    list *plist = get_paths(train_images);
+    char **paths = (char **)list_to_array(plist);
+    const int count = plist->size;
+    const uint64_t shard_limit = (uint64_t)(shard_mb > 0 ? shard_mb : 1024) * 1024 * 1024;
+    pack_sample *samples = (pack_sample*)xcalloc(count > 0 ? count : 1, sizeof(pack_sample));
+    unsigned char *pixels[PACK_CHUNK];
+    box_label *boxes[PACK_CHUNK];
+    int ws[PACK_CHUNK], hs[PACK_CHUNK], ns[PACK_CHUNK];
+    uint64_t pos = 0, paths_size = 0, total = 0;
+    int shard = -1, i, j, b;
+    FILE *fp = NULL;
+    char buff[4096];
+
+    if (is_packed_dataset(train_images)) error("Error: the train list is already packed", DARKNET_LOC);
+    if (channels != 1 && channels != 3) channels = 3;
+    printf(" Packing %d images of %s: longer side up to %d, %d channels, shards of %d MB \n", count, train_images, max_size, channels, (int)(shard_limit >> 20));
+    double start = get_time_point();
+
+    for (i = 0; i < count; i += PACK_CHUNK) {
+        const int n = (count - i < PACK_CHUNK) ? count - i : PACK_CHUNK;
+        #pragma omp parallel for
+        for (j = 0; j < n; ++j) {
+            char labelpath[4096];
+            pixels[j] = pack_load_image(paths[i + j], max_size, channels, &ws[j], &hs[j]);
+            replace_image_to_label(paths[i + j], labelpath);
+            boxes[j] = read_boxes(labelpath, &ns[j]);
+        }
+        for (j = 0; j < n; ++j) {
+            pack_sample *s = &samples[i + j];
+            const uint64_t image_size = (uint64_t)ws[j] * hs[j] * channels;
+            const uint64_t size = pack_align(image_size) + ns[j] * sizeof(pack_box);
+            if (!fp || (pos > 0 && pos + size > shard_limit)) {
+                if (fp) fclose(fp);
+                pack_shard_name(buff, sizeof(buff), outfile, ++shard);
+                fp = fopen(buff, "wb");
+                if (!fp) file_error(buff);
+                pos = 0;
+            }
+            s->shard = shard;
+            s->w = ws[j];
+            s->h = hs[j];
+            s->boxes = ns[j];
+            s->offset = pos;
+            s->path = paths_size;
+            paths_size += strlen(paths[i + j]) + 1;
+
+            fwrite(pixels[j], 1, (size_t)image_size, fp);
+            pos += image_size;
+            pack_write_padding(fp, &pos, pack_align(pos));
+            for (b = 0; b < ns[j]; ++b) {
+                pack_box box;
+                box.id = boxes[j][b].id;
+                box.x = boxes[j][b].x;
+                box.y = boxes[j][b].y;
+                box.w = boxes[j][b].w;
+                box.h = boxes[j][b].h;
+                fwrite(&box, sizeof(box), 1, fp);
+            }
+            pos += ns[j] * sizeof(pack_box);
+            pack_write_padding(fp, &pos, pack_align(pos));
+            total += size;
+            free(pixels[j]);
+            free(boxes[j]);
+        }
+        printf("\r %d / %d", i + n, count);
+        fflush(stdout);
+    }
+    if (fp) fclose(fp);
+
+    pack_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.header_size = sizeof(header);
+    header.count = count;
+    header.shards = shard + 1;
+    header.channels = channels;
+    header.max_size = max_size;
+    header.paths_size = paths_size;
+    fp = fopen(outfile, "wb");
+    if (!fp) file_error(outfile);
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(samples, sizeof(pack_sample), count, fp);
+    for (i = 0; i < count; ++i) fwrite(paths[i], 1, strlen(paths[i]) + 1, fp);
+    fclose(fp);
+
+    printf("\n Packed %d images into %d shards, %.1f MB, %.1f s -> %s \n", count, shard + 1, total / (1024. * 1024.), (get_time_point() - start) / 1e6, outfile);
+    free(samples);
+    free(paths);
+    free_list_contents(plist);
+    free_list(plist);
+    free_list_contents_kvp(options);
+    free_list(options);
+}
+
+int is_packed_dataset(char *filename)
+{
+    char magic[8];
+    int ok = 0;
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return 0;
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic)) ok = !memcmp(magic, PACK_MAGIC, sizeof(magic));
+    fclose(fp);
+    return ok;
+}
+
+static int packed_find(const char *path)
+{
+    uint32_t i = (uint32_t)custom_hash((char*)path) & packed->table_mask;
+    while (packed->table[i]) {
+        const int index = packed->table[i] - 1;
+        if (!strcmp(packed->paths + packed->samples[index].path, path)) return index;
+        i = (i + 1) & packed->table_mask;
+    }
+    return -1;
+}
+
+static void packed_invalid(char *filename, const char *what)
+{
+    printf(" %s: %s \n", filename, what);
+    error("Error: invalid packed dataset", DARKNET_LOC);
+}
+
+list *open_packed_dataset(char *filename)
+{
+    packed_dataset *p = (packed_dataset*)xcalloc(1, sizeof(packed_dataset));
+    list *paths = make_list();
+    char buff[4096];
+    uint32_t i, size;
+
+    close_packed_dataset();
+    p->index = (char*)map_file(filename, &p->index_size, 0);
+    if (!p->index) file_error(filename);
+    if (p->index_size < sizeof(pack_header)) packed_invalid(filename, "truncated header");
+    memcpy(&p->header, p->index, sizeof(pack_header));
+    if (memcmp(p->header.magic, PACK_MAGIC, sizeof(p->header.magic)) || p->header.version != PACK_VERSION || p->header.header_size != sizeof(pack_header)) {
+        packed_invalid(filename, "unsupported version");
+    }
+    if (sizeof(pack_header) + (uint64_t)p->header.count * sizeof(pack_sample) + p->header.paths_size > p->index_size) {
+        packed_invalid(filename, "truncated index");
+    }
+    p->samples = (const pack_sample*)(p->index + sizeof(pack_header));
+    p->paths = (const char*)(p->samples + p->header.count);
+
+    p->shards = (unsigned char**)xcalloc(p->header.shards + 1, sizeof(unsigned char*));
+    p->shard_sizes = (size_t*)xcalloc(p->header.shards + 1, sizeof(size_t));
+    for (i = 0; i < p->header.shards; ++i) {
+        pack_shard_name(buff, sizeof(buff), filename, i);
+        p->shards[i] = (unsigned char*)map_file(buff, &p->shard_sizes[i], 0);
+        if (!p->shards[i]) file_error(buff);
+    }
+
+    for (size = 1; size < 2 * p->header.count; size *= 2);
+    p->table = (uint32_t*)xcalloc(size, sizeof(uint32_t));
+    p->table_mask = size - 1;
+    packed = p;
+    for (i = 0; i < p->header.count; ++i) {
+        const pack_sample s = p->samples[i];
+        const uint64_t image_size = (uint64_t)s.w * s.h * p->header.channels;
+        if (s.path >= p->header.paths_size || s.shard >= p->header.shards ||
+            s.offset + pack_align(image_size) + s.boxes * sizeof(pack_box) > p->shard_sizes[s.shard]) {
+            packed_invalid(filename, "sample out of range");
+        }
+        const char *path = p->paths + s.path;
+        if (packed_find(path) < 0) {
+            uint32_t h = (uint32_t)custom_hash((char*)path) & p->table_mask;
+            while (p->table[h]) h = (h + 1) & p->table_mask;
+            p->table[h] = i + 1;
+        }
+        list_insert(paths, copy_string((char*)path));
+    }
+    printf(" Packed dataset %s: %d images in %d shards, %d channels \n", filename, p->header.count, p->header.shards, p->header.channels);
+    return paths;
+}
+
+void close_packed_dataset(void)
+{
+    uint32_t i;
+    if (!packed) return;
+    for (i = 0; i < packed->header.shards; ++i) unmap_file(packed->shards[i], packed->shard_sizes[i]);
+    unmap_file(packed->index, packed->index_size);
+    free(packed->shards);
+    free(packed->shard_sizes);
+    free(packed->table);
+    free(packed);
+    packed = NULL;
+}
+
+static const pack_sample *packed_sample(const char *path, int c)
+{
+    int index;
+    if (!packed || (c && c != (int)packed->header.channels)) return NULL;
+    index = packed_find(path);
+    return (index < 0) ? NULL : &packed->samples[index];
+}
+
+int load_packed_image(const char *path, int c, image *im)
+{
+    const pack_sample *s = packed_sample(path, c);
+    int x, y, k;
+    if (!s) return 0;
+    const int w = s->w, h = s->h;
+    c = packed->header.channels;
+    const unsigned char *pixels = packed->shards[s->shard] + s->offset;
+    *im = make_image(w, h, c);
+    for (k = 0; k < c; ++k) {
+        float *dst = im->data + k*w*h;
+        for (y = 0; y < h; ++y) {
+            const unsigned char *src = pixels + (size_t)y*w*c + k;
+            for (x = 0; x < w; ++x) dst[y*w + x] = (float)src[x*c] / 255.;  // as load_image_stb()
+        }
+    }
+    return 1;
+}
+
+const unsigned char *load_packed_image_u8(const char *path, int c, int *w, int *h)
+{
+    const pack_sample *s = packed_sample(path, c);
+    if (!s) return NULL;
+    *w = s->w;
+    *h = s->h;
+    return packed->shards[s->shard] + s->offset;
+}
+
+#ifdef OPENCV
+mat_cv *load_packed_image_mat(const char *path, int c)
+{
+    const pack_sample *s = packed_sample(path, c);
+    if (!s) return NULL;
+    return make_mat_cv_from_data(packed->shards[s->shard] + s->offset, s->w, s->h, packed->header.channels);
+}
+#endif
+
+box_label *load_packed_boxes(const char *path, char *labelpath, int *n)
+{
+    const pack_sample *s = packed_sample(path, 0);
+    uint32_t i;
+    if (!s) return NULL;
+    const pack_box *src = (const pack_box*)(packed->shards[s->shard] + s->offset + pack_align((uint64_t)s->w * s->h * packed->header.channels));
+    box_label *boxes = (box_label*)xcalloc(s->boxes ? s->boxes : 1, sizeof(box_label));
+    // the same track ids as read_boxes()
+    const int max_obj_img = 4000;
+    const int img_hash = (custom_hash(labelpath) % max_obj_img)*max_obj_img;
+    for (i = 0; i < s->boxes; ++i) {
+        const pack_box b = src[i];
+        boxes[i].track_id = i + img_hash;
+        boxes[i].id = b.id;
+        boxes[i].x = b.x;
+        boxes[i].y = b.y;
+        boxes[i].w = b.w;
+        boxes[i].h = b.h;
+        boxes[i].left   = b.x - b.w/2;
+        boxes[i].right  = b.x + b.w/2;
+        boxes[i].top    = b.y - b.h/2;
+        boxes[i].bottom = b.y + b.h/2;
+    }
+    *n = s->boxes;
+    return boxes;
+}
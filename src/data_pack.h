@@ -0,0 +1,40 @@
+#ifndef DATA_PACK_H
+#define DATA_PACK_H
+#include "darknet.h"
+#include "data.h"
+#include "image_opencv.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Packed training set: the images of a train list decoded once, scaled down to
+// max_size and stored as uint8 HWC (RGB) with their boxes in shard files of
+// about shard_mb, and an index file with the paths and where each sample is:
+//   <output>:   header | samples | paths
+//   <output>.N: image | boxes, 64-byte aligned
+// Set train=<output> in the .data file: training maps the shards and
+// load_data_detection() takes the images and boxes of the paths from them
+// instead of decoding JPEGs and parsing the label files.
+
+// darknet detector pack <data> <output> [-size N] [-shard_mb N] [-channels N]
+void pack_detection_dataset(char *datacfg, char *outfile, int max_size, int shard_mb, int channels);
+int is_packed_dataset(char *filename);
+// maps the dataset for the loaders and returns its paths (for get_paths())
+list *open_packed_dataset(char *filename);
+void close_packed_dataset(void);
+
+// the image of the path in the open packed dataset with c channels, 0 - not there
+int load_packed_image(const char *path, int c, image *im);
+// the HWC uint8 pixels of the path, they point into the mapping: read-only, NULL - not there
+const unsigned char *load_packed_image_u8(const char *path, int c, int *w, int *h);
+#ifdef OPENCV
+// the mat points into the mapping: read-only
+mat_cv *load_packed_image_mat(const char *path, int c);
+#endif
+// as read_boxes() of the label file of the path, NULL - not there
+box_label *load_packed_boxes(const char *path, char *labelpath, int *n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -9,7 +9,6 @@
 #include "image.h"
 #include "demo.h"
 #include "darknet.h"
-#include <unistd.h> // For usleep
 #ifdef WIN32
 #include <time.h>
 #include "gettimeofday.h"
@@ -17,161 +16,222 @@
 #include <sys/time.h>
 #endif
 
+// frames each queue between two stages of the demo pipeline holds
+static int demo_pipeline_depth = 2;
+
+void set_demo_pipeline_depth(int depth)
+{
+    demo_pipeline_depth = depth > 0 ? depth : 1;
+}
+
 #ifdef OPENCV
 
 #include "http_stream.h"
+#include "frame_pipeline.h"
+#include "json_writer.h"
+
+// capture -> resize/letterbox -> inference -> NMS/tracking -> draw/show/send (main thread),
+// every stage is a thread and the stages are connected by bounded SPSC rings of frames.
+// For live streams the capture and resize stages drop the oldest queued frame instead
+// of waiting, so the network always gets the newest frame and the latency stays bounded.
+
+typedef struct demo_frame
+{
+    mat_cv *mat;     // the captured frame, the detections are drawn on it
+    image in;        // network input
+    detection *dets;
+    int nboxes;
+    double time;     // get_time_point() when it was captured
+} demo_frame;
+
+enum
+{
+    STAGE_CAPTURE,
+    STAGE_RESIZE,
+    STAGE_DETECT,
+    STAGE_NMS,
+    STAGE_SHOW,
+    STAGE_LATENCY,   // capture to shown
+    STAGES
+};
 
 static char **demo_names;
-static image **demo_alphabet;
 static int demo_classes;
 
-static int nboxes = 0;
-static detection *dets = NULL;
-
 static network net;
-static image in_s;
-static image det_s;
+static layer demo_l; // the last yolo layer
 
 static cap_cv *cap;
-static float fps = 0;
 static float demo_thresh = 0;
-static int demo_ext_output = 0;
-static long long int frame_id = 0;
-static int demo_json_port = -1;
-static bool demo_skip_frame = false;
-
-static int avg_frames;
-static int demo_index = 0;
-static mat_cv **cv_images;
-
-mat_cv *in_img;
-mat_cv *det_img;
-mat_cv *show_img;
+static int demo_benchmark = 0;
+static int demo_live = 0;
 
 static volatile int flag_exit;
 static int letter_box = 0;
 
-static const int thread_wait_ms = 1;
-static volatile int run_fetch_in_thread = 0;
-static volatile int run_detect_in_thread = 0;
+static spsc_ring *captured_frames;
+static spsc_ring *resized_frames;
+static spsc_ring *detected_frames;
+static spsc_ring *ready_frames;
+static spsc_ring *free_inputs; // network inputs the inference stage gives back to the resize stage
+static pipeline_stage *stages[STAGES];
 
-void *fetch_in_thread(void *ptr)
+static void free_demo_frame(demo_frame *frame)
 {
-    while (!custom_atomic_load_int(&flag_exit))
+    if (!frame)
+        return;
+    release_mat(&frame->mat);
+    free_image(frame->in);
+    release_network_boxes(frame->dets);
+    free(frame);
+}
+
+// waits while the next stage is busy, or drops the oldest frame of a live stream; 0 - the pipeline is closed
+// the network input of a dropped frame is kept in *spare_input, if it is given
+static int push_demo_frame(spsc_ring *ring, demo_frame *frame, pipeline_stage *stage, int drop_oldest, float **spare_input)
+{
+    if (drop_oldest)
     {
-        while (!custom_atomic_load_int(&run_fetch_in_thread))
+        demo_frame *dropped = (demo_frame *)spsc_ring_push_drop_oldest(ring, frame);
+        if (dropped)
         {
-            if (custom_atomic_load_int(&flag_exit))
-                return 0;
-            if (demo_skip_frame)
-                consume_frame(cap);
-            this_thread_yield();
+            pipeline_stage_dropped(stage);
+            if (spare_input && dropped->in.data)
+            {
+                free(*spare_input);
+                *spare_input = dropped->in.data;
+                dropped->in = make_empty_image(0, 0, 0);
+            }
+            free_demo_frame(dropped);
         }
-        int dont_close_stream = 0; // set 1 if your IP-camera periodically turns off and turns on video-stream
-        if (letter_box)
-            in_s = get_image_from_stream_letterbox(cap, net.w, net.h, net.c, &in_img, dont_close_stream);
+        return 1;
+    }
+    if (!spsc_ring_push(ring, frame))
+    {
+        free_demo_frame(frame);
+        return 0;
+    }
+    return 1;
+}
+
+static void *capture_thread(void *ptr)
+{
+    mat_cv *benchmark_frame = NULL;
+    while (!custom_atomic_load_int(&flag_exit))
+    {
+        const double start = get_time_point();
+        mat_cv *mat = NULL;
+        if (benchmark_frame)
+            mat = clone_mat_cv(benchmark_frame);
         else
-            in_s = get_image_from_stream_resize(cap, net.w, net.h, net.c, &in_img, dont_close_stream);
-        if (!in_s.data)
+            mat = get_capture_frame_cv(cap);
+        if (!mat || get_width_mat(mat) < 1 || get_height_mat(mat) < 1)
         {
+            release_mat(&mat);
+            // the stream may start with empty frames
+            if (!pipeline_stage_items(stages[STAGE_CAPTURE]))
+                continue;
             printf("Stream closed.\n");
-            custom_atomic_store_int(&flag_exit, 1);
-            custom_atomic_store_int(&run_fetch_in_thread, 0);
-            return 0;
+            break;
         }
-        // in_s = resize_image(in, net.w, net.h);
-
-        custom_atomic_store_int(&run_fetch_in_thread, 0);
+        if (!pipeline_stage_items(stages[STAGE_CAPTURE]))
+            printf("Video stream: %d x %d \n", get_width_mat(mat), get_height_mat(mat));
+        // -benchmark: detect the first frame over and over
+        if (demo_benchmark && !benchmark_frame)
+            benchmark_frame = clone_mat_cv(mat);
+
+        demo_frame *frame = (demo_frame *)xcalloc(1, sizeof(demo_frame));
+        frame->mat = mat;
+        frame->time = start;
+        pipeline_stage_done(stages[STAGE_CAPTURE], get_time_point() - start);
+        if (!push_demo_frame(captured_frames, frame, stages[STAGE_CAPTURE], demo_live, NULL))
+            break;
     }
+    release_mat(&benchmark_frame);
+    spsc_ring_close(captured_frames);
     return 0;
 }
 
-void *fetch_in_thread_sync(void *ptr)
+static void *resize_thread(void *ptr)
 {
-    custom_atomic_store_int(&run_fetch_in_thread, 1);
-    while (custom_atomic_load_int(&run_fetch_in_thread))
-        this_thread_sleep_for(thread_wait_ms);
+    demo_frame *frame;
+    float *spare_input = NULL;
+    while ((frame = (demo_frame *)spsc_ring_pop(captured_frames)))
+    {
+        const double start = get_time_point();
+        // the inputs go round between this stage and the inference, a new one only while they are all in flight
+        float *data = spare_input ? spare_input : (float *)spsc_ring_try_pop(free_inputs);
+        spare_input = NULL;
+        frame->in = data ? float_to_image(net.w, net.h, net.c, data) : make_image(net.w, net.h, net.c);
+        get_image_from_mat_into(frame->mat, letter_box, frame->in);
+        pipeline_stage_done(stages[STAGE_RESIZE], get_time_point() - start);
+        if (!push_demo_frame(resized_frames, frame, stages[STAGE_RESIZE], demo_live, &spare_input))
+            break;
+    }
+    free(spare_input);
+    spsc_ring_close(resized_frames);
     return 0;
 }
 
-void *detect_in_thread(void *ptr)
+static void *detect_thread(void *ptr)
 {
-    while (!custom_atomic_load_int(&flag_exit))
+    demo_frame *frame;
+    while ((frame = (demo_frame *)spsc_ring_pop(resized_frames)))
     {
-        while (!custom_atomic_load_int(&run_detect_in_thread))
-        {
-            if (custom_atomic_load_int(&flag_exit))
-                return 0;
-            this_thread_yield();
-        }
-
-        // layer l = net.layers[net.n - 1];
-        float *X = det_s.data;
-        // float *prediction =
-        network_predict(net, X);
-
-        cv_images[demo_index] = det_img;
-        det_img = cv_images[(demo_index + avg_frames / 2 + 1) % avg_frames];
-        demo_index = (demo_index + 1) % avg_frames;
-
+        const double start = get_time_point();
+        network_predict(net, frame->in.data);
         if (letter_box)
-            dets = get_network_boxes(&net, get_width_mat(in_img), get_height_mat(in_img), demo_thresh, demo_thresh, 0, 1, &nboxes, 1); // letter box
+            frame->dets = get_network_boxes_pooled(&net, get_width_mat(frame->mat), get_height_mat(frame->mat), demo_thresh, demo_thresh, 0, 1, &frame->nboxes, 1); // letter box
         else
-            dets = get_network_boxes(&net, net.w, net.h, demo_thresh, demo_thresh, 0, 1, &nboxes, 0); // resized
-
-        // const float nms = .45;
-        // if (nms) {
-        //     if (l.nms_kind == DEFAULT_NMS) do_nms_sort(dets, nboxes, l.classes, nms);
-        //     else diounms_sort(dets, nboxes, l.classes, nms, l.nms_kind, l.beta_nms);
-        // }
-
-        custom_atomic_store_int(&run_detect_in_thread, 0);
+            frame->dets = get_network_boxes_pooled(&net, net.w, net.h, demo_thresh, demo_thresh, 0, 1, &frame->nboxes, 0); // resized
+        if (!spsc_ring_try_push(free_inputs, frame->in.data))
+            free_image(frame->in);
+        frame->in = make_empty_image(0, 0, 0);
+        pipeline_stage_done(stages[STAGE_DETECT], get_time_point() - start);
+        if (!push_demo_frame(detected_frames, frame, stages[STAGE_DETECT], 0, NULL))
+            break;
     }
-
+    spsc_ring_close(detected_frames);
     return 0;
 }
 
-void *detect_in_thread_sync(void *ptr)
+static void *nms_thread(void *ptr)
 {
-    custom_atomic_store_int(&run_detect_in_thread, 1);
-    while (custom_atomic_load_int(&run_detect_in_thread))
-        this_thread_sleep_for(thread_wait_ms);
-    return 0;
-}
-
-double get_wall_time()
-{
-    struct timeval walltime;
-    if (gettimeofday(&walltime, NULL))
+    const float nms = .45; // 0.4F
+    demo_frame *frame;
+    while ((frame = (demo_frame *)spsc_ring_pop(detected_frames)))
     {
-        return 0;
+        const double start = get_time_point();
+        // if (nms) do_nms_obj(frame->dets, frame->nboxes, demo_l.classes, nms);    // bad results
+        if (nms)
+        {
+            if (demo_l.nms_kind == DEFAULT_NMS)
+                do_nms_sort(frame->dets, frame->nboxes, demo_l.classes, nms);
+            else
+                diounms_sort(frame->dets, frame->nboxes, demo_l.classes, nms, demo_l.nms_kind, demo_l.beta_nms);
+        }
+        if (demo_l.embedding_size)
+            set_track_id(frame->dets, frame->nboxes, demo_thresh, demo_l.sim_thresh, demo_l.track_ciou_norm, demo_l.track_history_size, demo_l.dets_for_track, demo_l.dets_for_show);
+        pipeline_stage_done(stages[STAGE_NMS], get_time_point() - start);
+        if (!push_demo_frame(ready_frames, frame, stages[STAGE_NMS], 0, NULL))
+            break;
     }
-    return (double)walltime.tv_sec + (double)walltime.tv_usec * .000001;
+    spsc_ring_close(ready_frames);
+    return 0;
 }
 
-const int target_fps = 10;
-const double target_frame_time_s = 1.0 / target_fps; // Target time per frame in seconds
-double last_frame_time = 0.0;
-
 void demo(char *cfgfile, char *weightfile, float thresh, float hier_thresh, int cam_index, const char *filename, char **names, int classes, int avgframes,
           int frame_skip, char *prefix, char *out_filename, int mjpeg_port, int dontdraw_bbox, int json_port, int dont_show, int ext_output, int letter_box_in, int time_limit_sec, char *http_post_host,
           int benchmark, int benchmark_layers, char *json_file_output)
 {
-    if (avgframes < 1)
-        avgframes = 1;
-    avg_frames = avgframes;
     letter_box = letter_box_in;
-    in_img = det_img = show_img = NULL;
-    // skip = frame_skip;
     image **alphabet = load_alphabet();
     int delay = frame_skip;
     demo_names = names;
-    demo_alphabet = alphabet;
     demo_classes = classes;
     demo_thresh = thresh;
-    demo_ext_output = ext_output;
-    demo_json_port = json_port;
-    char *json_buf = NULL;
+    demo_benchmark = benchmark;
+    json_writer json = { 0 };
     FILE *json_file = NULL;
 
     if (json_file_output)
@@ -192,20 +252,25 @@ void demo(char *cfgfile, char *weightfile, float thresh, float hier_thresh, int
     net.benchmark_layers = benchmark_layers;
     fuse_conv_batchnorm(net);
     calculate_binary_weights(net);
+    prepare_network_for_inference(&net);
+    print_cpu_conv_algorithms(net);
     srand(2222222);
 
     if (filename)
     {
         printf("video file: %s\n", filename);
         cap = get_capture_video_stream(filename);
-        demo_skip_frame = is_live_stream(filename);
+        demo_live = is_live_stream(filename);
     }
     else
     {
         printf("Webcam index: %d\n", cam_index);
         cap = get_capture_webcam(cam_index);
-        demo_skip_frame = true;
+        demo_live = 1;
     }
+    // every frame of a file is detected
+    if (benchmark)
+        demo_live = 0;
 
     if (!cap)
     {
@@ -215,55 +280,41 @@ void demo(char *cfgfile, char *weightfile, float thresh, float hier_thresh, int
         error("Couldn't connect to webcam.", DARKNET_LOC);
     }
 
-    layer l = net.layers[net.n - 1];
-    int j;
-
-    cv_images = (mat_cv **)xcalloc(avg_frames, sizeof(mat_cv));
-
+    demo_l = net.layers[net.n - 1];
     int i;
     for (i = 0; i < net.n; ++i)
     {
-        layer lc = net.layers[i];
-        if (lc.type == YOLO)
-        {
-            lc.mean_alpha = 1.0 / avg_frames;
-            l = lc;
-        }
+        if (net.layers[i].type == YOLO)
+            demo_l = net.layers[i];
     }
 
-    if (l.classes != demo_classes)
+    if (demo_l.classes != demo_classes)
     {
-        printf("\n Parameters don't match: in cfg-file classes=%d, in data-file classes=%d \n", l.classes, demo_classes);
+        printf("\n Parameters don't match: in cfg-file classes=%d, in data-file classes=%d \n", demo_l.classes, demo_classes);
         error("Error!", DARKNET_LOC);
     }
 
     flag_exit = 0;
-
-    custom_thread_t fetch_thread = NULL;
-    custom_thread_t detect_thread = NULL;
-    if (custom_create_thread(&fetch_thread, 0, fetch_in_thread, 0))
-        error("Thread creation failed", DARKNET_LOC);
-    if (custom_create_thread(&detect_thread, 0, detect_in_thread, 0))
+    printf(" Pipeline: %d frames per queue%s \n", demo_pipeline_depth, demo_live ? ", drop oldest" : "");
+    captured_frames = make_spsc_ring(demo_pipeline_depth);
+    resized_frames = make_spsc_ring(demo_pipeline_depth);
+    detected_frames = make_spsc_ring(demo_pipeline_depth);
+    ready_frames = make_spsc_ring(demo_pipeline_depth);
+    free_inputs = make_spsc_ring(demo_pipeline_depth + 2);
+    stages[STAGE_CAPTURE] = make_pipeline_stage("capture");
+    stages[STAGE_RESIZE] = make_pipeline_stage(letter_box ? "letterbox" : "resize");
+    stages[STAGE_DETECT] = make_pipeline_stage("inference");
+    stages[STAGE_NMS] = make_pipeline_stage("nms");
+    stages[STAGE_SHOW] = make_pipeline_stage("show/send");
+    stages[STAGE_LATENCY] = make_pipeline_stage("end-to-end");
+
+    custom_thread_t threads[4] = {NULL};
+    if (custom_create_thread(&threads[0], 0, capture_thread, 0) ||
+        custom_create_thread(&threads[1], 0, resize_thread, 0) ||
+        custom_create_thread(&threads[2], 0, detect_thread, 0) ||
+        custom_create_thread(&threads[3], 0, nms_thread, 0))
         error("Thread creation failed", DARKNET_LOC);
 
-    fetch_in_thread_sync(0); // fetch_in_thread(0);
-    det_img = in_img;
-    det_s = in_s;
-
-    fetch_in_thread_sync(0);  // fetch_in_thread(0);
-    detect_in_thread_sync(0); // fetch_in_thread(0);
-    det_img = in_img;
-    det_s = in_s;
-
-    for (j = 0; j < avg_frames / 2; ++j)
-    {
-        free_detections(dets, nboxes);
-        fetch_in_thread_sync(0);  // fetch_in_thread(0);
-        detect_in_thread_sync(0); // fetch_in_thread(0);
-        det_img = in_img;
-        det_s = in_s;
-    }
-
     int count = 0;
     if (!prefix && !dont_show)
     {
@@ -272,245 +323,151 @@ void demo(char *cfgfile, char *weightfile, float thresh, float hier_thresh, int
     }
 
     write_cv *output_video_writer = NULL;
-    if (out_filename && !flag_exit)
-    {
-        int src_fps = 25;
-        src_fps = get_stream_fps_cpp_cv(cap);
-        output_video_writer =
-            create_video_writer(out_filename, 'D', 'I', 'V', 'X', src_fps, get_width_mat(det_img), get_height_mat(det_img), 1);
-
-        //'H', '2', '6', '4'
-        //'D', 'I', 'V', 'X'
-        //'M', 'J', 'P', 'G'
-        //'M', 'P', '4', 'V'
-        //'M', 'P', '4', '2'
-        //'X', 'V', 'I', 'D'
-        //'W', 'M', 'V', '2'
-    }
-
     int send_http_post_once = 0;
     const double start_time_lim = get_time_point();
     double before = get_time_point();
     double start_time = get_time_point();
+    float fps = 0;
     float avg_fps = 0;
     int frame_counter = 0;
     int global_frame_counter = 0;
+    long long frame_id = 0;
 
-    // Define the DetectionResult struct
-    typedef struct
+    demo_frame *frame;
+    while ((frame = (demo_frame *)spsc_ring_pop(ready_frames)))
     {
-        int class_id;      // Class ID
-        float prob;        // Detection probability
-        int x, y;          // Top-left coordinates of bounding box
-        int width, height; // Width and height of bounding box
-    } DetectionResult;
-
-    // Variables to store detected objects
-    DetectionResult ball = {0};
-    DetectionResult ballnet = {0};
-    DetectionResult table = {0};
-
-    double current_time = get_wall_time(); // Track the current time
-    double last_frame_time = current_time;
+        const double start = get_time_point();
+        mat_cv *show_img = frame->mat;
+        detection *local_dets = frame->dets;
+        int local_nboxes = frame->nboxes;
+        ++count;
 
-    while (1)
-    {
-        current_time = get_wall_time();
-        double elapsed_time = current_time - last_frame_time;
+        printf("\033[H\033[J");
+        printf("Objects:\n\n");
 
-        // Skip frames if processing too fast
-        if (elapsed_time < target_frame_time_s)
+        ++frame_id;
+        if (json_port > 0)
         {
-            usleep((target_frame_time_s - elapsed_time) * 1e6); // Sleep for remaining time
-            continue;
+            int timeout = 400000;
+            send_json(local_dets, local_nboxes, demo_l.classes, demo_names, frame_id, json_port, timeout);
         }
 
-        last_frame_time = current_time; // Update the last frame time
-        ++count;
+        if (json_file_output)
         {
-            const float nms = .45; // 0.4F
-            int local_nboxes = nboxes;
-            detection *local_dets = dets;
-            this_thread_yield();
-
-            if (!benchmark)
-                custom_atomic_store_int(&run_fetch_in_thread, 1); // if (custom_create_thread(&fetch_thread, 0, fetch_in_thread, 0)) error("Thread creation failed", DARKNET_LOC);
-            custom_atomic_store_int(&run_detect_in_thread, 1);    // if (custom_create_thread(&detect_thread, 0, detect_in_thread, 0)) error("Thread creation failed", DARKNET_LOC);
-
-            // if (nms) do_nms_obj(local_dets, local_nboxes, l.classes, nms);    // bad results
-            if (nms)
+            if (json.len)
             {
-                if (l.nms_kind == DEFAULT_NMS)
-                    do_nms_sort(local_dets, local_nboxes, l.classes, nms);
-                else
-                    diounms_sort(local_dets, local_nboxes, l.classes, nms, l.nms_kind, l.beta_nms);
+                char *tmp = ", \n";
+                fwrite(tmp, sizeof(char), strlen(tmp), json_file);
             }
+            json_writer_reset(&json);
+            json_write_detections(&json, local_dets, local_nboxes, demo_l.classes, demo_names, frame_id, NULL);
+            fwrite(json.buf, sizeof(char), json.len, json_file);
+        }
 
-            if (l.embedding_size)
-                set_track_id(local_dets, local_nboxes, demo_thresh, l.sim_thresh, l.track_ciou_norm, l.track_history_size, l.dets_for_track, l.dets_for_show);
-
-            printf("\033[H\033[J");
-            // printf("\nFPS:%.1f\n", fps);
-            printf("Objects:\n\n");
-
-            ++frame_id;
-            if (demo_json_port > 0)
+        // char *http_post_server = "webhook.site/898bbd9b-0ddd-49cf-b81d-1f56be98d870";
+        if (http_post_host && !send_http_post_once)
+        {
+            int timeout = 3;         // 3 seconds
+            int http_post_port = 80; // 443 https, 80 http
+            if (send_http_post_request(http_post_host, http_post_port, filename,
+                                       local_dets, local_nboxes, classes, names, frame_id, ext_output, timeout))
             {
-                int timeout = 400000;
-                send_json(local_dets, local_nboxes, l.classes, demo_names, frame_id, demo_json_port, timeout);
+                if (time_limit_sec > 0)
+                    send_http_post_once = 1;
             }
+        }
 
-            if (json_file_output)
-            {
-                if (json_buf)
-                {
-                    char *tmp = ", \n";
-                    fwrite(tmp, sizeof(char), strlen(tmp), json_file);
-                }
-                json_buf = detection_to_json(local_dets, local_nboxes, l.classes, demo_names, frame_id, NULL);
-                fwrite(json_buf, sizeof(char), strlen(json_buf), json_file);
-                free(json_buf);
-            }
+        // if (!benchmark && !dontdraw_bbox) draw_detections_cv_v3(show_img, local_dets, local_nboxes, demo_thresh, demo_names, demo_alphabet, demo_classes, ext_output);
 
-            // char *http_post_server = "webhook.site/898bbd9b-0ddd-49cf-b81d-1f56be98d870";
-            if (http_post_host && !send_http_post_once)
-            {
-                int timeout = 3;         // 3 seconds
-                int http_post_port = 80; // 443 https, 80 http
-                if (send_http_post_request(http_post_host, http_post_port, filename,
-                                           local_dets, nboxes, classes, names, frame_id, ext_output, timeout))
-                {
-                    if (time_limit_sec > 0)
-                        send_http_post_once = 1;
-                }
-            }
+        if (!benchmark && !dontdraw_bbox)
+        {
+            process_frame(show_img, local_dets, local_nboxes, demo_thresh, demo_names, demo_classes);
+        }
 
-            // if (!benchmark && !dontdraw_bbox) draw_detections_cv_v3(show_img, local_dets, local_nboxes, demo_thresh, demo_names, demo_alphabet, demo_classes, demo_ext_output);
+        printf("\nFPS:%.1f \t AVG_FPS:%.1f\n", fps, avg_fps);
+        print_pipeline_stages(stages, STAGES, get_time_point() - start_time_lim);
 
-            if (!benchmark && !dontdraw_bbox)
+        if (!prefix)
+        {
+            if (!dont_show && delay == 0)
             {
-
-                if (!show_img)
+                const int each_frame = max_val_cmp(1, avg_fps / 60);
+                if (global_frame_counter % each_frame == 0)
+                    show_image_mat(show_img, "Demo");
+                int c = wait_key_cv(1);
+                if (c == 10)
                 {
-                    printf("Error: show_img is null!\n");
-                }
-                if (!local_dets)
-                {
-                    printf("Error: local_dets is null!\n");
-                }
-                if (!demo_names)
-                {
-                    printf("Error: demo_names is null!\n");
-                }
-                if (local_nboxes <= 0)
-                {
-                    printf("Error: local_nboxes is invalid: %d\n", local_nboxes);
+                    if (frame_skip == 0)
+                        frame_skip = 60;
+                    else if (frame_skip == 4)
+                        frame_skip = 0;
+                    else if (frame_skip == 60)
+                        frame_skip = 4;
+                    else
+                        frame_skip = 0;
                 }
-                if (demo_classes <= 0)
+                else if (c == 27 || c == 1048603) // ESC - exit (OpenCV 2.x / 3.x)
                 {
-                    printf("Error: demo_classes is invalid: %d\n", demo_classes);
+                    custom_atomic_store_int(&flag_exit, 1);
                 }
-
-                process_frame(show_img, local_dets, local_nboxes, demo_thresh, demo_names, demo_classes);
-            }
-
-            free_detections(local_dets, local_nboxes);
-
-            printf("\nFPS:%.1f \t AVG_FPS:%.1f\n", fps, avg_fps);
-
-            if (!prefix)
-            {
-                if (!dont_show)
-                {
-                    const int each_frame = max_val_cmp(1, avg_fps / 60);
-                    if (global_frame_counter % each_frame == 0)
-                        show_image_mat(show_img, "Demo");
-                    int c = wait_key_cv(1);
-                    if (c == 10)
-                    {
-                        if (frame_skip == 0)
-                            frame_skip = 60;
-                        else if (frame_skip == 4)
-                            frame_skip = 0;
-                        else if (frame_skip == 60)
-                            frame_skip = 4;
-                        else
-                            frame_skip = 0;
-                    }
-                    else if (c == 27 || c == 1048603) // ESC - exit (OpenCV 2.x / 3.x)
-                    {
-                        flag_exit = 1;
-                    }
-                }
-            }
-            else
-            {
-                char buff[256];
-                sprintf(buff, "%s_%08d.jpg", prefix, count);
-                if (show_img)
-                    save_cv_jpg(show_img, buff);
             }
+        }
+        else
+        {
+            char buff[256];
+            sprintf(buff, "%s_%08d.jpg", prefix, count);
+            save_cv_jpg(show_img, buff);
+        }
 
-            // if you run it with param -mjpeg_port 8090  then open URL in your web-browser: http://localhost:8090
-            if (mjpeg_port > 0 && show_img)
-            {
-                int port = mjpeg_port;
-                int timeout = 400000;
-                int jpeg_quality = 40; // 1 - 100
-                send_mjpeg(show_img, port, timeout, jpeg_quality);
-            }
+        // if you run it with param -mjpeg_port 8090  then open URL in your web-browser: http://localhost:8090
+        if (mjpeg_port > 0)
+        {
+            int port = mjpeg_port;
+            int timeout = 400000;
+            int jpeg_quality = 40; // 1 - 100
+            send_mjpeg(show_img, port, timeout, jpeg_quality);
+        }
 
-            // save video file
-            if (output_video_writer && show_img)
-            {
-                write_frame_cv(output_video_writer, show_img);
-                printf("\n cvWriteFrame \n");
-            }
+        // save video file
+        if (out_filename && !output_video_writer)
+        {
+            int src_fps = 25;
+            src_fps = get_stream_fps_cpp_cv(cap);
+            output_video_writer =
+                create_video_writer(out_filename, 'D', 'I', 'V', 'X', src_fps, get_width_mat(show_img), get_height_mat(show_img), 1);
+
+            //'H', '2', '6', '4'
+            //'D', 'I', 'V', 'X'
+            //'M', 'J', 'P', 'G'
+            //'M', 'P', '4', 'V'
+            //'M', 'P', '4', '2'
+            //'X', 'V', 'I', 'D'
+            //'W', 'M', 'V', '2'
+        }
+        if (output_video_writer)
+        {
+            write_frame_cv(output_video_writer, show_img);
+            printf("\n cvWriteFrame \n");
+        }
 
-            while (custom_atomic_load_int(&run_detect_in_thread))
-            {
-                if (avg_fps > 50)
-                    this_thread_yield();
-                else
-                    this_thread_sleep_for(thread_wait_ms); // custom_join(detect_thread, 0);
-            }
-            if (!benchmark)
-            {
-                while (custom_atomic_load_int(&run_fetch_in_thread))
-                {
-                    if (avg_fps > 50)
-                        this_thread_yield();
-                    else
-                        this_thread_sleep_for(thread_wait_ms); // custom_join(fetch_thread, 0);
-                }
-                free_image(det_s);
-            }
+        pipeline_stage_done(stages[STAGE_SHOW], get_time_point() - start);
+        pipeline_stage_done(stages[STAGE_LATENCY], get_time_point() - frame->time);
+        free_demo_frame(frame);
 
-            if (time_limit_sec > 0 && (get_time_point() - start_time_lim) / 1000000 > time_limit_sec)
-            {
-                printf(" start_time_lim = %f, get_time_point() = %f, time spent = %f \n", start_time_lim, get_time_point(), get_time_point() - start_time_lim);
-                break;
-            }
+        if (time_limit_sec > 0 && (get_time_point() - start_time_lim) / 1000000 > time_limit_sec)
+        {
+            printf(" start_time_lim = %f, get_time_point() = %f, time spent = %f \n", start_time_lim, get_time_point(), get_time_point() - start_time_lim);
+            break;
+        }
 
-            if (flag_exit == 1)
-                break;
+        if (custom_atomic_load_int(&flag_exit))
+            break;
 
-            if (delay == 0)
-            {
-                if (!benchmark)
-                    release_mat(&show_img);
-                show_img = det_img;
-            }
-            det_img = in_img;
-            det_s = in_s;
-        }
         --delay;
         if (delay < 0)
         {
             delay = frame_skip;
 
-            // double after = get_wall_time();
-            // float curr = 1./(after - before);
             double after = get_time_point(); // more accurate time measurements
             float curr = 1000000. / (after - before);
             fps = fps * 0.9 + curr * 0.1;
@@ -521,7 +478,6 @@ void demo(char *cfgfile, char *weightfile, float thresh, float hier_thresh, int
             global_frame_counter++;
             if (spent_time >= 3.0f)
             {
-                // printf(" spent_time = %f \n", spent_time);
                 avg_fps = frame_counter / spent_time;
                 frame_counter = 0;
                 start_time = get_time_point();
@@ -529,6 +485,36 @@ void demo(char *cfgfile, char *weightfile, float thresh, float hier_thresh, int
         }
     }
     printf("input video stream closed. \n");
+
+    // stop the stages: the pushes fail, the pops return what is left
+    custom_atomic_store_int(&flag_exit, 1);
+    spsc_ring_close(captured_frames);
+    spsc_ring_close(resized_frames);
+    spsc_ring_close(detected_frames);
+    spsc_ring_close(ready_frames);
+    for (i = 0; i < 4; ++i)
+        custom_join(threads[i], 0);
+    while ((frame = (demo_frame *)spsc_ring_try_pop(captured_frames)))
+        free_demo_frame(frame);
+    while ((frame = (demo_frame *)spsc_ring_try_pop(resized_frames)))
+        free_demo_frame(frame);
+    while ((frame = (demo_frame *)spsc_ring_try_pop(detected_frames)))
+        free_demo_frame(frame);
+    while ((frame = (demo_frame *)spsc_ring_try_pop(ready_frames)))
+        free_demo_frame(frame);
+    float *input;
+    while ((input = (float *)spsc_ring_try_pop(free_inputs)))
+        free(input);
+    free_spsc_ring(captured_frames);
+    free_spsc_ring(resized_frames);
+    free_spsc_ring(detected_frames);
+    free_spsc_ring(ready_frames);
+    free_spsc_ring(free_inputs);
+
+    print_pipeline_stages(stages, STAGES, get_time_point() - start_time_lim);
+    for (i = 0; i < STAGES; ++i)
+        free_pipeline_stage(stages[i]);
+
     if (output_video_writer)
     {
         release_video_writer(&output_video_writer);
@@ -540,22 +526,10 @@ void demo(char *cfgfile, char *weightfile, float thresh, float hier_thresh, int
         char *tmp = "\n]";
         fwrite(tmp, sizeof(char), strlen(tmp), json_file);
         fclose(json_file);
+        json_writer_free(&json);
     }
-    this_thread_sleep_for(thread_wait_ms);
 
-    custom_join(detect_thread, 0);
-    custom_join(fetch_thread, 0);
-
-    // free memory
-    free_image(in_s);
-    free_detections(dets, nboxes);
-
-    demo_index = (avg_frames + demo_index - 1) % avg_frames;
-    for (j = 0; j < avg_frames; ++j)
-    {
-        release_mat(&cv_images[j]);
-    }
-    free(cv_images);
+    release_capture(cap);
 
     // free_ptrs((void **)names, net.layers[net.n - 1].classes);
     free_ptrs((void **)names, demo_classes); // Use demo_classes instead of net.layers[net.n - 1].classes
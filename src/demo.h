@@ -7,6 +7,8 @@ extern "C" {
 #endif
 void demo(char *cfgfile, char *weightfile, float thresh, float hier_thresh, int cam_index, const char *filename, char **names, int classes, int avgframes,
     int frame_skip, char *prefix, char *out_filename, int mjpeg_port, int dontdraw_bbox, int json_port, int dont_show, int ext_output, int letter_box_in, int time_limit_sec, char *http_post_host, int benchmark, int benchmark_layers, char *json_file_output);
+// frames each queue of the demo pipeline holds (-pipeline_depth), 2 by default
+void set_demo_pipeline_depth(int depth);
 #ifdef __cplusplus
 }
 #endif
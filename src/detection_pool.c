@@ -0,0 +1,147 @@
+#include "detection_pool.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define POOL_ALIGN 64
+#define POOL_MAGIC 0x44455453   // "DETS"
+
+// in front of the detections of every block
+typedef struct pool_block {
+    struct pool_block *next;    // free list
+    detection_pool *pool;
+    size_t capacity;            // bytes after the header
+    int magic;
+} pool_block;
+
+struct detection_pool {
+    pthread_mutex_t mutex;
+    pool_block *free_list;
+    int in_flight;
+    int closed;
+    long long allocations;
+};
+
+static size_t pool_header_size(void)
+{
+    return (sizeof(pool_block) + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+}
+
+static pool_block *pool_block_of(detection *dets)
+{
+    return (pool_block*)((char*)dets - pool_header_size());
+}
+
+detection_pool *make_detection_pool(void)
+{
+    detection_pool *p = (detection_pool*)xcalloc(1, sizeof(detection_pool));
+    pthread_mutex_init(&p->mutex, 0);
+    return p;
+}
+
+static void pool_destroy(detection_pool *p)
+{
+    while (p->free_list) {
+        pool_block *b = p->free_list;
+        p->free_list = b->next;
+        free(b);
+    }
+    pthread_mutex_destroy(&p->mutex);
+    free(p);
+}
+
+void free_detection_pool(detection_pool *p)
+{
+    int destroy;
+    if (!p) return;
+    pthread_mutex_lock(&p->mutex);
+    p->closed = 1;
+    destroy = (p->in_flight == 0);
+    while (p->free_list) {
+        pool_block *b = p->free_list;
+        p->free_list = b->next;
+        free(b);
+    }
+    pthread_mutex_unlock(&p->mutex);
+    if (destroy) pool_destroy(p);
+}
+
+detection *detection_pool_get(detection_pool *p, int count, int classes, int uc, int mask, int embedding_size)
+{
+    const size_t per_det = (size_t)classes + (uc ? 4 : 0) + mask + embedding_size;
+    const size_t dets_size = ((size_t)count * sizeof(detection) + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    const size_t size = dets_size + (size_t)count * per_det * sizeof(float);
+    pool_block *b, **link;
+    int i;
+
+    pthread_mutex_lock(&p->mutex);
+    // the first free block that is big enough, or grow the first one
+    for (link = &p->free_list; *link && (*link)->capacity < size; link = &(*link)->next);
+    if (!*link) link = &p->free_list;
+    b = *link;
+    if (b) *link = b->next;
+    if (!b || b->capacity < size) {
+        const size_t capacity = size + size / 4;    // headroom, the count varies from frame to frame
+        b = (pool_block*)xrealloc(b, pool_header_size() + capacity);
+        b->capacity = capacity;
+        b->pool = p;
+        b->magic = POOL_MAGIC;
+        p->allocations++;
+    }
+    b->next = NULL;
+    p->in_flight++;
+    pthread_mutex_unlock(&p->mutex);
+
+    detection *dets = (detection*)((char*)b + pool_header_size());
+    float *data = (float*)((char*)dets + dets_size);
+    memset(dets, 0, size);
+    for (i = 0; i < count; ++i) {
+        dets[i].prob = data;
+        data += classes;
+        if (uc) {
+            dets[i].uc = data;
+            data += 4;
+        }
+        if (mask) {
+            dets[i].mask = data;
+            data += mask;
+        }
+        if (embedding_size) {
+            dets[i].embeddings = data;
+            data += embedding_size;
+        }
+        dets[i].embedding_size = embedding_size;
+    }
+    return dets;
+}
+
+void detection_pool_release(detection *dets)
+{
+    pool_block *b;
+    detection_pool *p;
+    int destroy;
+    if (!dets) return;
+    b = pool_block_of(dets);
+    if (b->magic != POOL_MAGIC) error("Error: the detections are not from a detection pool", DARKNET_LOC);
+    p = b->pool;
+    pthread_mutex_lock(&p->mutex);
+    p->in_flight--;
+    destroy = p->closed && p->in_flight == 0;
+    if (p->closed) free(b);
+    else {
+        b->next = p->free_list;
+        p->free_list = b;
+    }
+    pthread_mutex_unlock(&p->mutex);
+    if (destroy) pool_destroy(p);
+}
+
+long long detection_pool_allocations(detection_pool *p)
+{
+    long long allocations;
+    pthread_mutex_lock(&p->mutex);
+    allocations = p->allocations;
+    pthread_mutex_unlock(&p->mutex);
+    return allocations;
+}
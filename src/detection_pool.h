@@ -0,0 +1,33 @@
+#ifndef DETECTION_POOL_H
+#define DETECTION_POOL_H
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reusable detection arrays: one block holds the detections and, contiguous
+// after them, the prob of all the detections, then the uc, mask and embeddings.
+// A released block goes back to the free list of its pool and is reset and
+// reused by the next frame, grown only when a frame has more candidates than
+// any before, so in steady state get_network_boxes_pooled() / release_network_boxes()
+// don't allocate. Blocks in flight (pipelined frames) are independent of each
+// other; the pool is thread-safe and a block may be released by any thread,
+// also after free_network() (the pool is freed with its last block).
+
+typedef struct detection_pool detection_pool;
+
+detection_pool *make_detection_pool(void);
+// frees the free blocks now, the pool itself when the last block in flight is released
+void free_detection_pool(detection_pool *p);
+// count zeroed detections, each with classes prob, and 4 uc / coords - 4 mask / embedding_size
+// embeddings when they are not 0
+detection *detection_pool_get(detection_pool *p, int count, int classes, int uc, int mask, int embedding_size);
+// any detections of detection_pool_get(), NULL is ignored
+void detection_pool_release(detection *dets);
+// blocks allocated or grown so far
+long long detection_pool_allocations(detection_pool *p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -7,7 +7,12 @@
 #include "parser.h"
 #include "box.h"
 #include "demo.h"
+#include "stream_server.h"
 #include "option_list.h"
+#include "quantize.h"
+#include "data_loader.h"
+#include "data_pack.h"
+#include "json_writer.h"
 
 #ifndef __COMPAR_FN_T
 #define __COMPAR_FN_T
@@ -114,7 +119,8 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
 
     int classes = l.classes;
 
-    list *plist = get_paths(train_images);
+    const int packed_train = is_packed_dataset(train_images);
+    list *plist = packed_train ? open_packed_dataset(train_images) : get_paths(train_images);
     int train_images_num = plist->size;
     char **paths = (char **)list_to_array(plist);
 
@@ -186,7 +192,12 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
     }
     //printf(" imgs = %d \n", imgs);
 
-    pthread_t load_thread = load_data(args);
+    // tracking loads sequences, a thread each
+    data_loader *loader = NULL;
+    pthread_t load_thread;
+    memset(&load_thread, 0, sizeof(load_thread));  // joined only when tracking
+    if (net.track) load_thread = load_data(args);
+    else loader = make_data_loader(args, net.prefetch);
 
     int count = 0;
     double time_remaining, avg_time = -1, alpha_time = 0.01;
@@ -237,10 +248,13 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             else
                 printf("\n %d x %d \n", dim_w, dim_h);
 
-            pthread_join(load_thread, 0);
-            train = buffer;
-            free_data(train);
-            load_thread = load_data(args);
+            if (loader) data_loader_reset(loader, args);
+            else {
+                pthread_join(load_thread, 0);
+                train = buffer;
+                free_data(train);
+                load_thread = load_data(args);
+            }
 
             for (k = 0; k < ngpus; ++k) {
                 resize_network(nets + k, dim_w, dim_h);
@@ -248,14 +262,15 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
             net = nets[0];
         }
         double time = what_time_is_it_now();
-        pthread_join(load_thread, 0);
-        train = buffer;
-        if (net.track) {
+        if (loader) train = data_loader_next(loader);
+        else {
+            pthread_join(load_thread, 0);
+            train = buffer;
             net.sequential_subdivisions = get_current_seq_subdivisions(net);
             args.threads = net.sequential_subdivisions * ngpus;
             printf(" sequential_subdivisions = %d, sequence = %d \n", net.sequential_subdivisions, get_sequence_value(net));
+            load_thread = load_data(args);
         }
-        load_thread = load_data(args);
         //wait_key_cv(500);
 
         /*
@@ -279,6 +294,7 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
         printf("Loaded: %lf seconds", load_time);
         if (load_time > 0.1 && avg_loss > 0) printf(" - performance bottleneck on CPU or Disk HDD/SSD");
         printf("\n");
+        if (loader) print_data_loader_stats(loader);
 
         time = what_time_is_it_now();
         float loss = 0;
@@ -346,10 +362,13 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
                     args.n = imgs;
                     printf("\n %d x %d  (batch = %d) \n", init_w, init_h, init_b);
                 }
-                pthread_join(load_thread, 0);
-                free_data(train);
-                train = buffer;
-                load_thread = load_data(args);
+                if (loader) data_loader_reset(loader, args);
+                else {
+                    pthread_join(load_thread, 0);
+                    free_data(train);
+                    train = buffer;
+                    load_thread = load_data(args);
+                }
                 for (k = 0; k < ngpus; ++k) {
                     resize_network(nets + k, init_w, init_h);
                 }
@@ -431,10 +450,13 @@ void train_detector(char *datacfg, char *cfgfile, char *weightfile, int *gpus, i
 #endif
 
     // free memory
-    pthread_join(load_thread, 0);
-    free_data(buffer);
-
-    free_load_threads(&args);
+    if (loader) free_data_loader(loader);
+    else {
+        pthread_join(load_thread, 0);
+        free_data(buffer);
+        free_load_threads(&args);
+    }
+    if (packed_train) close_packed_dataset();
 
     free(base);
     free(paths);
@@ -463,7 +485,8 @@ static int get_coco_image_id(char *filename)
     return atoi(p + 1);
 }
 
-static void print_cocos(FILE *fp, char *image_path, detection *dets, int num_boxes, int classes, int w, int h)
+// json: reused from image to image
+static void print_cocos(FILE *fp, json_writer *json, char *image_path, detection *dets, int num_boxes, int classes, int w, int h)
 {
     int i, j;
     //int image_id = get_coco_image_id(image_path);
@@ -486,14 +509,11 @@ static void print_cocos(FILE *fp, char *image_path, detection *dets, int num_box
         float bh = ymax - ymin;
 
         for (j = 0; j < classes; ++j) {
-            if (dets[i].prob[j] > 0) {
-                char buff[1024];
-                sprintf(buff, "{\"image_id\":%d, \"category_id\":%d, \"bbox\":[%f, %f, %f, %f], \"score\":%f},\n", image_id, coco_ids[j], bx, by, bw, bh, dets[i].prob[j]);
-                fprintf(fp, "%s", buff);
-                //printf("%s", buff);
-            }
+            if (dets[i].prob[j] > 0) json_write_coco(json, image_id, coco_ids[j], bx, by, bw, bh, dets[i].prob[j]);
         }
     }
+    fwrite(json->buf, sizeof(char), json->len, fp);
+    json_writer_reset(json);
 }
 
 void print_detector_detections(FILE **fps, char *id, detection *dets, int total, int classes, int w, int h)
@@ -656,6 +676,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     //set_batch_network(&net, 1);
     fuse_conv_batchnorm(net);
     calculate_binary_weights(net);
+    prepare_network_for_inference(&net);
     fprintf(stderr, "Learning Rate: %g, Momentum: %g, Decay: %g\n", net.learning_rate, net.momentum, net.decay);
     srand(time(0));
 
@@ -677,6 +698,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     char *type = option_find_str(options, "eval", "voc");
     FILE *fp = 0;
     FILE **fps = 0;
+    json_writer json = { 0 };
     int coco = 0;
     int imagenet = 0;
     int bdd = 0;
@@ -774,14 +796,14 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
             int w = val[t].w;
             int h = val[t].h;
             int nboxes = 0;
-            detection *dets = get_network_boxes(&net, w, h, thresh, .5, map, 0, &nboxes, letter_box);
+            detection *dets = get_network_boxes_pooled(&net, w, h, thresh, .5, map, 0, &nboxes, letter_box);
             if (nms) {
                 if (l.nms_kind == DEFAULT_NMS) do_nms_sort(dets, nboxes, l.classes, nms);
                 else diounms_sort(dets, nboxes, l.classes, nms, l.nms_kind, l.beta_nms);
             }
 
             if (coco) {
-                print_cocos(fp, path, dets, nboxes, classes, w, h);
+                print_cocos(fp, &json, path, dets, nboxes, classes, w, h);
             }
             else if (imagenet) {
                 print_imagenet_detections(fp, i + t - nthreads + 1, dets, nboxes, classes, w, h);
@@ -796,7 +818,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
                 print_detector_detections(fps, id, dets, nboxes, classes, w, h);
             }
 
-            free_detections(dets, nboxes);
+            release_network_boxes(dets);
             free(id);
             free_image(val[t]);
             free_image(val_resized[t]);
@@ -828,6 +850,7 @@ void validate_detector(char *datacfg, char *cfgfile, char *weightfile, char *out
     }
 
     if (fp) fclose(fp);
+    json_writer_free(&json);
 
     if (val) free(val);
     if (val_resized) free(val_resized);
@@ -846,6 +869,7 @@ void validate_detector_recall(char *datacfg, char *cfgfile, char *weightfile)
     }
     //set_batch_network(&net, 1);
     fuse_conv_batchnorm(net);
+    prepare_network_for_inference(&net);
     srand(time(0));
 
     //list *plist = get_paths("data/coco_val_5k.list");
@@ -965,6 +989,7 @@ float validate_detector_map(char *datacfg, char *cfgfile, char *weightfile, floa
         //set_batch_network(&net, 1);
         fuse_conv_batchnorm(net);
         calculate_binary_weights(net);
+        prepare_network_for_inference(&net);
     }
     if (net.layers[net.n - 1].classes != names_size) {
         printf("\n Error: in the file %s number of names %d that isn't equal to classes=%d in the file %s \n",
@@ -1066,10 +1091,10 @@ float validate_detector_map(char *datacfg, char *cfgfile, char *weightfile, floa
             float hier_thresh = 0;
             detection *dets;
             if (args.type == LETTERBOX_DATA) {
-                dets = get_network_boxes(&net, val[t].w, val[t].h, thresh, hier_thresh, 0, 1, &nboxes, letter_box);
+                dets = get_network_boxes_pooled(&net, val[t].w, val[t].h, thresh, hier_thresh, 0, 1, &nboxes, letter_box);
             }
             else {
-                dets = get_network_boxes(&net, 1, 1, thresh, hier_thresh, 0, 0, &nboxes, letter_box);
+                dets = get_network_boxes_pooled(&net, 1, 1, thresh, hier_thresh, 0, 0, &nboxes, letter_box);
             }
             //detection *dets = get_network_boxes(&net, val[t].w, val[t].h, thresh, hier_thresh, 0, 1, &nboxes, letter_box); // for letter_box=1
             if (nms) {
@@ -1187,7 +1212,7 @@ float validate_detector_map(char *datacfg, char *cfgfile, char *weightfile, floa
             //sprintf(buff, "%s\n", path);
             //if(errors_in_this_image > 0) fwrite(buff, sizeof(char), strlen(buff), reinforcement_fd);
 
-            free_detections(dets, nboxes);
+            release_network_boxes(dets);
             free(truth);
             free(truth_dif);
             free(id);
@@ -1634,6 +1659,8 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
     net.benchmark_layers = benchmark_layers;
     fuse_conv_batchnorm(net);
     calculate_binary_weights(net);
+    prepare_network_for_inference(&net);
+    print_cpu_conv_algorithms(net);
     if (net.layers[net.n - 1].classes != names_size) {
         printf("\n Error: in the file %s number of names %d that isn't equal to classes=%d in the file %s \n",
             name_list, names_size, net.layers[net.n - 1].classes, cfgfile);
@@ -1641,7 +1668,7 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
     srand(2222222);
     char buff[256];
     char *input = buff;
-    char *json_buf = NULL;
+    json_writer json = { 0 };
     int json_image_id = 0;
     FILE* json_file = NULL;
     if (outfile) {
@@ -1710,15 +1737,15 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
         }
 
         if (json_file) {
-            if (json_buf) {
+            if (json.len) {
                 char *tmp = ", \n";
                 fwrite(tmp, sizeof(char), strlen(tmp), json_file);
             }
             ++json_image_id;
-            json_buf = detection_to_json(dets, nboxes, l.classes, names, json_image_id, input);
+            json_writer_reset(&json);
+            json_write_detections(&json, dets, nboxes, l.classes, names, json_image_id, input);
 
-            fwrite(json_buf, sizeof(char), strlen(json_buf), json_file);
-            free(json_buf);
+            fwrite(json.buf, sizeof(char), json.len, json_file);
         }
 
         // pseudo labeling concept - fast.ai
@@ -1764,6 +1791,7 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
         fwrite(tmp, sizeof(char), strlen(tmp), json_file);
         fclose(json_file);
     }
+    json_writer_free(&json);
 
     // free memory
     free_ptrs((void**)names, net.layers[net.n - 1].classes);
@@ -1944,6 +1972,58 @@ void draw_object(char *datacfg, char *cfgfile, char *weightfile, char *filename,
 }
 #endif // defined(OPENCV) && defined(GPU)
 
+// INT8 post-training quantization: per-channel ranges of every convolutional input
+// over the validation images, see quantize.h
+void calibrate_detector(char *datacfg, char *cfgfile, char *weightfile, char *outfile, int max_images, int letter_box)
+{
+    list *options = read_data_cfg(datacfg);
+    char *valid_images = option_find_str(options, "valid", "data/train.txt");
+    if (!outfile) outfile = "int8_table.txt";
+
+    network net = parse_network_cfg_custom(cfgfile, 1, 1);    // set batch=1
+    if (weightfile) {
+        load_weights(&net, weightfile);
+    }
+    fuse_conv_batchnorm(net);
+    calculate_binary_weights(net);
+    if (net.letter_box) letter_box = 1;
+
+    list *plist = get_paths(valid_images);
+    char **paths = (char **)list_to_array(plist);
+    int m = plist->size;
+    if (max_images > 0 && m > max_images) m = max_images;
+    if (m == 0) error("Error: no calibration images in the valid list", DARKNET_LOC);
+
+    int8_calibration *cal = make_int8_calibration(net);
+    double start = what_time_is_it_now();
+    int i;
+    for (i = 0; i < m; ++i) {
+        image im = load_image(paths[i], 0, 0, net.c);
+        image sized;
+        if (letter_box) sized = letterbox_image(im, net.w, net.h);
+        else sized = resize_image(im, net.w, net.h);
+        network_predict(net, sized.data);
+        update_int8_calibration(cal, net, sized.data);
+        free_image(im);
+        free_image(sized);
+        if ((i + 1) % 10 == 0 || i + 1 == m) {
+            printf("\r calibration %d/%d images", i + 1, m);
+            fflush(stdout);
+        }
+    }
+    printf("\n calibration took %.1f seconds \n", what_time_is_it_now() - start);
+    save_int8_calibration(cal, outfile, cfgfile);
+    printf(" accuracy check: darknet detector map %s %s %s -int8 %s \n", datacfg, cfgfile, weightfile ? weightfile : "", outfile);
+
+    free_int8_calibration(cal);
+    free(paths);
+    free_list_contents(plist);
+    free_list(plist);
+    free_list_contents_kvp(options);
+    free_list(options);
+    free_network(net);
+}
+
 void run_detector(int argc, char **argv)
 {
     int dont_show = find_arg(argc, argv, "-dont_show");
@@ -1971,6 +2051,9 @@ void run_detector(int argc, char **argv)
     float hier_thresh = find_float_arg(argc, argv, "-hier", .5);
     int cam_index = find_int_arg(argc, argv, "-c", 0);
     int frame_skip = find_int_arg(argc, argv, "-s", 0);
+    int pipeline_depth = find_int_arg(argc, argv, "-pipeline_depth", 2);
+    int max_batch = find_int_arg(argc, argv, "-max_batch", 4);
+    int max_wait_ms = find_int_arg(argc, argv, "-max_wait_ms", 10);
     int num_of_clusters = find_int_arg(argc, argv, "-num_of_clusters", 5);
     int width = find_int_arg(argc, argv, "-width", -1);
     int height = find_int_arg(argc, argv, "-height", -1);
@@ -1981,8 +2064,12 @@ void run_detector(int argc, char **argv)
     char* chart_path = find_char_arg(argc, argv, "-chart", 0);
     // While training, decide after how many epochs mAP will be calculated. Default value is 4 which means the mAP will be calculated after each 4 epochs
     int mAP_epochs = find_int_arg(argc, argv, "-mAP_epochs", 4);
+    int calib_images = find_int_arg(argc, argv, "-calib_images", 200);
+    int pack_size = find_int_arg(argc, argv, "-size", 1024);
+    int pack_shard_mb = find_int_arg(argc, argv, "-shard_mb", 1024);
+    int pack_channels = find_int_arg(argc, argv, "-channels", 3);
     if (argc < 4) {
-        fprintf(stderr, "usage: %s %s [train/test/valid/demo/map] [data] [cfg] [weights (optional)]\n", argv[0], argv[1]);
+        fprintf(stderr, "usage: %s %s [train/test/valid/demo/streams/map/calibrate/pack] [data] [cfg] [weights (optional)]\n", argv[0], argv[1]);
         return;
     }
     char *gpu_list = find_char_arg(argc, argv, "-gpus", 0);
@@ -2023,11 +2110,20 @@ void run_detector(int argc, char **argv)
     else if (0 == strcmp(argv[2], "valid")) validate_detector(datacfg, cfg, weights, outfile);
     else if (0 == strcmp(argv[2], "recall")) validate_detector_recall(datacfg, cfg, weights);
     else if (0 == strcmp(argv[2], "map")) validate_detector_map(datacfg, cfg, weights, thresh, iou_thresh, map_points, letter_box, NULL);
+    else if (0 == strcmp(argv[2], "calibrate")) calibrate_detector(datacfg, cfg, weights, outfile, calib_images, letter_box);
     else if (0 == strcmp(argv[2], "calc_anchors")) calc_anchors(datacfg, num_of_clusters, width, height, show);
+    else if (0 == strcmp(argv[2], "pack")) {
+        if (argc < 5) fprintf(stderr, "usage: %s %s pack [data] [output] [-size N] [-shard_mb N] [-channels N]\n", argv[0], argv[1]);
+        else pack_detection_dataset(datacfg, cfg, pack_size, pack_shard_mb, pack_channels);
+    }
     else if (0 == strcmp(argv[2], "draw")) {
         int it_num = 100;
         draw_object(datacfg, cfg, weights, filename, thresh, dont_show, it_num, letter_box, benchmark_layers);
     }
+    else if (0 == strcmp(argv[2], "streams")) {
+        run_stream_server(datacfg, cfg, weights, filename, thresh, hier_thresh, max_batch, max_wait_ms, pipeline_depth,
+            mjpeg_port, json_port, letter_box, time_limit_sec, benchmark_layers);
+    }
     else if (0 == strcmp(argv[2], "demo")) {
         list *options = read_data_cfg(datacfg);
         int classes = option_find_int(options, "classes", 20);
@@ -2036,6 +2132,7 @@ void run_detector(int argc, char **argv)
         if (filename)
             if (strlen(filename) > 0)
                 if (filename[strlen(filename) - 1] == 0x0d) filename[strlen(filename) - 1] = 0;
+        set_demo_pipeline_depth(pipeline_depth);
         demo(cfg, weights, thresh, hier_thresh, cam_index, filename, names, classes, avgframes, frame_skip, prefix, out_filename,
             mjpeg_port, dontdraw_bbox, json_port, dont_show, ext_output, letter_box, time_limit_sec, http_post_host, benchmark, benchmark_layers, json_file_output);
 
@@ -0,0 +1,399 @@
+#include "fast_activations.h"
+#include "gemm.h"
+#include <math.h>
+#include <string.h>
+#include <float.h>
+
+// the error bounds need the operations as written: -Ofast (the default build)
+// would merge the split ln2 constants and replace the divisions with rcp14 estimates
+#if defined(__clang__) || defined(_MSC_VER)
+#pragma float_control(precise, on)
+#elif defined(__GNUC__)
+#pragma GCC optimize ("no-unsafe-math-optimizations")
+#endif
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define FAST_ACT_X86
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define FAST_TARGET_AVX2 __attribute__((target("avx,avx2,fma")))
+#define FAST_TARGET_AVX512 __attribute__((target("avx,avx2,fma,avx512f")))
+#else
+#define FAST_TARGET_AVX2
+#define FAST_TARGET_AVX512
+#endif
+#endif
+
+// exp: x = n*ln2 + r, ln2 split in two for the reduction (C1 exact in float)
+#define EXP_HI 88.3762626647949f
+#define EXP_LO -87.3365447504f      // 2^-126, the smallest exponent the bits can hold
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_C1 0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500E-4f
+#define EXP_P1 1.3981999507E-3f
+#define EXP_P2 8.3334519073E-3f
+#define EXP_P3 4.1665795894E-2f
+#define EXP_P4 1.6666665459E-1f
+#define EXP_P5 5.0000001201E-1f
+// tanh(x) = x + x*z*P(z), z = x*x, for |x| < TANH_SMALL (Cephes tanhf)
+#define TANH_SMALL 0.625f
+#define TANH_P0 -5.70498872745E-3f
+#define TANH_P1 2.06390887954E-2f
+#define TANH_P2 -5.37397155531E-2f
+#define TANH_P3 1.33314422036E-1f
+#define TANH_P4 -3.33332819422E-1f
+#define MISH_THRESHOLD 20.f     // mish(x) = x above, as softplus_activate()
+
+#define FAST_CHUNK 4096
+
+typedef enum {
+    FAST_EXP, FAST_LOGISTIC, FAST_TANH, FAST_SWISH, FAST_MISH
+} fast_op;
+
+typedef void (*fast_row_t)(float *x, int n, float bias, fast_op op);
+
+static int fast_activations_enabled = 0;
+
+void set_fast_activations(int enable)
+{
+    fast_activations_enabled = enable;
+}
+
+int get_fast_activations(void)
+{
+    return fast_activations_enabled;
+}
+
+static int get_fast_op(ACTIVATION a)
+{
+    switch (a) {
+    case LOGISTIC: return FAST_LOGISTIC;
+    case TANH: return FAST_TANH;
+    case SWISH: return FAST_SWISH;
+    case MISH: return FAST_MISH;
+    default: return -1;
+    }
+}
+
+int is_fast_activation(ACTIVATION a)
+{
+    return get_fast_op(a) >= 0;
+}
+
+// ----------------------------------------------------------------------------
+// scalar reference
+// ----------------------------------------------------------------------------
+
+float fast_expf(float x)
+{
+    union { int i; float f; } pow2n;
+    x = (x > EXP_HI) ? EXP_HI : ((x < EXP_LO) ? EXP_LO : x);
+    const float fx = floorf(x * EXP_LOG2E + .5f);
+    float r = x - fx * EXP_C1;
+    r = r - fx * EXP_C2;
+    float p = EXP_P0;
+    p = p * r + EXP_P1;
+    p = p * r + EXP_P2;
+    p = p * r + EXP_P3;
+    p = p * r + EXP_P4;
+    p = p * r + EXP_P5;
+    p = p * r * r + r + 1;
+    pow2n.i = ((int)fx + 127) << 23;
+    return p * pow2n.f;
+}
+
+static float fast_tanhf(float x)
+{
+    const float ax = fabsf(x);
+    if (ax < TANH_SMALL) {
+        const float z = x * x;
+        float p = TANH_P0;
+        p = p * z + TANH_P1;
+        p = p * z + TANH_P2;
+        p = p * z + TANH_P3;
+        p = p * z + TANH_P4;
+        return x + x * z * p;
+    }
+    const float t = 1 - 2 / (fast_expf(2 * ax) + 1);
+    return (x < 0) ? -t : t;
+}
+
+static float fast_op_scalar(float x, fast_op op)
+{
+    switch (op) {
+    case FAST_EXP: return fast_expf(x);
+    case FAST_LOGISTIC: return 1 / (1 + fast_expf(-x));
+    case FAST_TANH: return fast_tanhf(x);
+    case FAST_SWISH: return x / (1 + fast_expf(-x));
+    case FAST_MISH: {
+        if (x > MISH_THRESHOLD) return x;
+        const float e = fast_expf(x);
+        const float n = e * (e + 2);
+        return x * n / (n + 2);
+    }
+    }
+    return x;
+}
+
+float fast_activate(float x, ACTIVATION a)
+{
+    const int op = get_fast_op(a);
+    return (op < 0) ? activate(x, a) : fast_op_scalar(x, (fast_op)op);
+}
+
+static void fast_row_scalar(float *x, int n, float bias, fast_op op)
+{
+    int i;
+    for (i = 0; i < n; ++i) x[i] = fast_op_scalar(x[i] + bias, op);
+}
+
+#ifdef FAST_ACT_X86
+
+// ----------------------------------------------------------------------------
+// AVX2 + FMA
+// ----------------------------------------------------------------------------
+
+FAST_TARGET_AVX2
+static inline __m256 exp_avx2(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_LO)), _mm256_set1_ps(EXP_HI));
+    const __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(EXP_LOG2E), _mm256_set1_ps(.5f)));
+    __m256 r = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C1), x);
+    r = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C2), r);
+    __m256 p = _mm256_set1_ps(EXP_P0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P5));
+    p = _mm256_add_ps(_mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r), _mm256_set1_ps(1));
+    const __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(pow2n));
+}
+
+FAST_TARGET_AVX2
+static inline __m256 op_avx2(__m256 x, fast_op op)
+{
+    const __m256 one = _mm256_set1_ps(1);
+    const __m256 sign = _mm256_set1_ps(-0.f);
+    switch (op) {
+    case FAST_EXP:
+        return exp_avx2(x);
+    case FAST_LOGISTIC:
+        return _mm256_div_ps(one, _mm256_add_ps(one, exp_avx2(_mm256_xor_ps(x, sign))));
+    case FAST_SWISH:
+        return _mm256_div_ps(x, _mm256_add_ps(one, exp_avx2(_mm256_xor_ps(x, sign))));
+    case FAST_TANH: {
+        const __m256 ax = _mm256_andnot_ps(sign, x);
+        const __m256 z = _mm256_mul_ps(x, x);
+        __m256 p = _mm256_set1_ps(TANH_P0);
+        p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(TANH_P1));
+        p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(TANH_P2));
+        p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(TANH_P3));
+        p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(TANH_P4));
+        const __m256 small = _mm256_fmadd_ps(_mm256_mul_ps(x, z), p, x);
+        const __m256 e = exp_avx2(_mm256_add_ps(ax, ax));
+        __m256 big = _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2), _mm256_add_ps(e, one)));
+        big = _mm256_or_ps(big, _mm256_and_ps(x, sign));
+        return _mm256_blendv_ps(big, small, _mm256_cmp_ps(ax, _mm256_set1_ps(TANH_SMALL), _CMP_LT_OQ));
+    }
+    case FAST_MISH: {
+        const __m256 e = exp_avx2(x);
+        const __m256 n = _mm256_mul_ps(e, _mm256_add_ps(e, _mm256_set1_ps(2)));
+        const __m256 y = _mm256_div_ps(_mm256_mul_ps(x, n), _mm256_add_ps(n, _mm256_set1_ps(2)));
+        return _mm256_blendv_ps(y, x, _mm256_cmp_ps(x, _mm256_set1_ps(MISH_THRESHOLD), _CMP_GT_OQ));
+    }
+    }
+    return x;
+}
+
+FAST_TARGET_AVX2
+static void fast_row_avx2(float *x, int n, float bias, fast_op op)
+{
+    const __m256 b = _mm256_set1_ps(bias);
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, op_avx2(_mm256_add_ps(_mm256_loadu_ps(x + i), b), op));
+    }
+    if (i < n) {
+        const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        _mm256_maskstore_ps(x + i, mask, op_avx2(_mm256_add_ps(_mm256_maskload_ps(x + i, mask), b), op));
+    }
+}
+
+// ----------------------------------------------------------------------------
+// AVX-512
+// ----------------------------------------------------------------------------
+
+FAST_TARGET_AVX512
+static inline __m512 exp_avx512(__m512 x)
+{
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_LO)), _mm512_set1_ps(EXP_HI));
+    const __m512 fx = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(EXP_LOG2E), _mm512_set1_ps(.5f)),
+        _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C1), x);
+    r = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C2), r);
+    __m512 p = _mm512_set1_ps(EXP_P0);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P5));
+    p = _mm512_add_ps(_mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r), _mm512_set1_ps(1));
+    const __m512i pow2n = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(p, _mm512_castsi512_ps(pow2n));
+}
+
+FAST_TARGET_AVX512
+static inline __m512 op_avx512(__m512 x, fast_op op)
+{
+    const __m512 one = _mm512_set1_ps(1);
+    const __m512i sign = _mm512_set1_epi32(0x80000000);
+    const __m512 neg_x = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x), sign));
+    switch (op) {
+    case FAST_EXP:
+        return exp_avx512(x);
+    case FAST_LOGISTIC:
+        return _mm512_div_ps(one, _mm512_add_ps(one, exp_avx512(neg_x)));
+    case FAST_SWISH:
+        return _mm512_div_ps(x, _mm512_add_ps(one, exp_avx512(neg_x)));
+    case FAST_TANH: {
+        const __m512 ax = _mm512_castsi512_ps(_mm512_andnot_si512(sign, _mm512_castps_si512(x)));
+        const __m512 z = _mm512_mul_ps(x, x);
+        __m512 p = _mm512_set1_ps(TANH_P0);
+        p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(TANH_P1));
+        p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(TANH_P2));
+        p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(TANH_P3));
+        p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(TANH_P4));
+        const __m512 small = _mm512_fmadd_ps(_mm512_mul_ps(x, z), p, x);
+        const __m512 e = exp_avx512(_mm512_add_ps(ax, ax));
+        const __m512 big = _mm512_sub_ps(one, _mm512_div_ps(_mm512_set1_ps(2), _mm512_add_ps(e, one)));
+        const __m512 signed_big = _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(big),
+            _mm512_and_si512(_mm512_castps_si512(x), sign)));
+        return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(ax, _mm512_set1_ps(TANH_SMALL), _CMP_LT_OQ), signed_big, small);
+    }
+    case FAST_MISH: {
+        const __m512 e = exp_avx512(x);
+        const __m512 n = _mm512_mul_ps(e, _mm512_add_ps(e, _mm512_set1_ps(2)));
+        const __m512 y = _mm512_div_ps(_mm512_mul_ps(x, n), _mm512_add_ps(n, _mm512_set1_ps(2)));
+        return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, _mm512_set1_ps(MISH_THRESHOLD), _CMP_GT_OQ), y, x);
+    }
+    }
+    return x;
+}
+
+FAST_TARGET_AVX512
+static void fast_row_avx512(float *x, int n, float bias, fast_op op)
+{
+    const __m512 b = _mm512_set1_ps(bias);
+    int i;
+    for (i = 0; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(x + i, op_avx512(_mm512_add_ps(_mm512_loadu_ps(x + i), b), op));
+    }
+    if (i < n) {
+        const __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+        _mm512_mask_storeu_ps(x + i, mask, op_avx512(_mm512_add_ps(_mm512_maskz_loadu_ps(mask, x + i), b), op));
+    }
+}
+#endif  // FAST_ACT_X86
+
+// ----------------------------------------------------------------------------
+// dispatch
+// ----------------------------------------------------------------------------
+
+static fast_row_t fast_row_kernel(const char **name)
+{
+    static fast_row_t kernel = NULL;
+    static const char *kernel_name = "scalar";
+    if (!kernel) {
+        fast_row_t k = fast_row_scalar;
+#ifdef FAST_ACT_X86
+        if (is_cpu_avx512()) {
+            k = fast_row_avx512;
+            kernel_name = "avx512";
+        }
+        else if (is_cpu_fma_avx2()) {
+            k = fast_row_avx2;
+            kernel_name = "avx2_fma";
+        }
+#endif
+        kernel = k;
+    }
+    if (name) *name = kernel_name;
+    return kernel;
+}
+
+const char *fast_activations_kernel_name(void)
+{
+    const char *name;
+    fast_row_kernel(&name);
+    return name;
+}
+
+static void fast_op_array(float *x, const int n, fast_op op)
+{
+    const fast_row_t row = fast_row_kernel(NULL);
+    const int chunks = (n + FAST_CHUNK - 1) / FAST_CHUNK;
+    int c;
+    #pragma omp parallel for
+    for (c = 0; c < chunks; ++c) {
+        const int start = c * FAST_CHUNK;
+        const int size = (n - start < FAST_CHUNK) ? (n - start) : FAST_CHUNK;
+        row(x + start, size, 0, op);
+    }
+}
+
+void fast_activate_array(float *x, const int n, const ACTIVATION a)
+{
+    const int op = get_fast_op(a);
+    if (op < 0) activate_array_cpu_custom(x, n, a);
+    else fast_op_array(x, n, (fast_op)op);
+}
+
+void fast_bias_activate_array(float *x, const int n, const float bias, const ACTIVATION a)
+{
+    const int op = get_fast_op(a);
+    if (op < 0) bias_activate_array(x, n, bias, a);
+    else fast_row_kernel(NULL)(x, n, bias, (fast_op)op);
+}
+
+void fast_exp_array(float *x, const int n)
+{
+    fast_op_array(x, n, FAST_EXP);
+}
+
+void fast_softmax(float *input, int n, float temp, float *output, int stride)
+{
+    int i;
+    float sum = 0;
+    float largest = -FLT_MAX;
+    for (i = 0; i < n; ++i) {
+        if (input[i*stride] > largest) largest = input[i*stride];
+    }
+    if (stride == 1) {
+        for (i = 0; i < n; ++i) output[i] = input[i] / temp - largest / temp;
+        fast_row_kernel(NULL)(output, n, 0, FAST_EXP);
+        for (i = 0; i < n; ++i) sum += output[i];
+    }
+    else {
+        for (i = 0; i < n; ++i) {
+            const float e = fast_expf(input[i*stride] / temp - largest / temp);
+            sum += e;
+            output[i*stride] = e;
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        output[i*stride] /= sum;
+    }
+}
+
+void fast_softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, int group_offset, int stride, float temp, float *output)
+{
+    int g, b;
+    for (b = 0; b < batch; ++b) {
+        for (g = 0; g < groups; ++g) {
+            fast_softmax(input + b*batch_offset + g*group_offset, n, temp, output + b*batch_offset + g*group_offset, stride);
+        }
+    }
+}
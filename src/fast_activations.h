@@ -0,0 +1,51 @@
+#ifndef FAST_ACTIVATIONS_H
+#define FAST_ACTIVATIONS_H
+#include "activations.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Polynomial exp() (Cephes expf: range reduction to [-ln2/2, ln2/2], degree 5
+// polynomial, 2^n through the exponent bits) and the activations built on it,
+// AVX-512 / AVX2+FMA / scalar picked once at runtime. Not bit-identical to libm;
+// max error vs the exact result in float ulp (darknet bench activations),
+// |x| <= 80 and normal results, the same for the scalar and SIMD kernels:
+//   exp       1.01 ulp
+//   logistic  2.44 ulp  1 / (1 + exp(-x))
+//   tanh      1.26 ulp  odd polynomial for |x| < 0.625, 1 - 2 / (exp(2|x|) + 1) above
+//   swish     2.35 ulp  x / (1 + exp(-x))
+//   mish      4.35 ulp  x * n / (n + 2), n = exp(x) * (exp(x) + 2), = x * tanh(softplus(x))
+// The libm based activations of activations.h: expf() 0.5, logistic 2.44, swish 2.87 ulp;
+// tanh_activate() and mish lose all the digits near 0 and for large negative x (cancellation).
+// Used in CPU inference with [net] fast_activations=1 or the -fast_activations flag;
+// compare the mAP with: darknet detector map <data> <cfg> <weights> [-fast_activations]
+#define FAST_EXP_MAX_ULP 1.5
+#define FAST_LOGISTIC_MAX_ULP 3
+#define FAST_TANH_MAX_ULP 1.5
+#define FAST_SWISH_MAX_ULP 3
+#define FAST_MISH_MAX_ULP 5
+
+// LOGISTIC, TANH, SWISH and MISH
+int is_fast_activation(ACTIVATION a);
+// in place, OpenMP; other activations go to activate_array_cpu_custom()
+void fast_activate_array(float *x, const int n, const ACTIVATION a);
+// x = activation(x + bias), no OpenMP: the GEMM epilogue, other activations go to bias_activate_array()
+void fast_bias_activate_array(float *x, const int n, const float bias, const ACTIVATION a);
+void fast_exp_array(float *x, const int n);
+// softmax() / softmax_cpu() of blas.c
+void fast_softmax(float *input, int n, float temp, float *output, int stride);
+void fast_softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, int group_offset, int stride, float temp, float *output);
+
+// scalar reference of the SIMD kernels
+float fast_expf(float x);
+float fast_activate(float x, ACTIVATION a);
+const char *fast_activations_kernel_name(void);
+
+// -fast_activations: enabled for every network by prepare_network_for_inference()
+void set_fast_activations(int enable);
+int get_fast_activations(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,281 @@
+#include "frame_pipeline.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// cache line, head and tail are written by different threads
+#define RING_PAD 64
+// polls before a waiting call goes to sleep
+#define RING_SPINS 64
+
+struct spsc_ring {
+    std::atomic<uint64_t> head;     // next item to pop
+    char pad_head[RING_PAD];
+    std::atomic<uint64_t> tail;     // next free slot, written by the producer only
+    char pad_tail[RING_PAD];
+    std::atomic<int> closed;
+    std::atomic<int> waiters;
+    uint64_t capacity;
+    std::atomic<void*> *slots;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+extern "C" spsc_ring *make_spsc_ring(int capacity)
+{
+    if (capacity < 1) capacity = 1;
+    spsc_ring *ring = new spsc_ring;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->closed = 0;
+    ring->waiters = 0;
+    ring->capacity = capacity;
+    ring->slots = new std::atomic<void*>[capacity];
+    for (int i = 0; i < capacity; ++i) ring->slots[i] = NULL;
+    return ring;
+}
+
+extern "C" void free_spsc_ring(spsc_ring *ring)
+{
+    if (!ring) return;
+    delete[] ring->slots;
+    delete ring;
+}
+
+static void spsc_ring_wake(spsc_ring *ring)
+{
+    // orders the index store before the waiters load, see spsc_ring_wait()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring->waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(ring->mutex);
+        ring->cond.notify_all();
+    }
+}
+
+// waits until ready() or the ring is closed
+template<typename F>
+static void spsc_ring_wait(spsc_ring *ring, F ready)
+{
+    for (int i = 0; i < RING_SPINS; ++i) {
+        if (ready() || ring->closed.load(std::memory_order_acquire)) return;
+        std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(ring->mutex);
+    ring->waiters.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!ready() && !ring->closed.load(std::memory_order_acquire)) {
+        // the timeout only covers a wake-up that races with the waiters counter
+        ring->cond.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    ring->waiters.fetch_sub(1);
+}
+
+static int spsc_ring_full(spsc_ring *ring)
+{
+    const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    return tail - ring->head.load(std::memory_order_acquire) >= ring->capacity;
+}
+
+static int spsc_ring_empty(spsc_ring *ring)
+{
+    return ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_acquire);
+}
+
+static void spsc_ring_publish(spsc_ring *ring, void *item)
+{
+    const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    ring->slots[tail % ring->capacity].store(item, std::memory_order_relaxed);
+    ring->tail.store(tail + 1, std::memory_order_release);
+    spsc_ring_wake(ring);
+}
+
+extern "C" int spsc_ring_try_push(spsc_ring *ring, void *item)
+{
+    if (spsc_ring_full(ring)) return 0;
+    spsc_ring_publish(ring, item);
+    return 1;
+}
+
+extern "C" int spsc_ring_push(spsc_ring *ring, void *item)
+{
+    if (spsc_ring_full(ring)) {
+        spsc_ring_wait(ring, [ring]() { return !spsc_ring_full(ring); });
+    }
+    if (ring->closed.load(std::memory_order_acquire)) return 0;
+    spsc_ring_publish(ring, item);
+    return 1;
+}
+
+extern "C" void *spsc_ring_push_drop_oldest(spsc_ring *ring, void *item)
+{
+    void *dropped = NULL;
+    const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    while (tail - head >= ring->capacity) {
+        // the consumer may pop this item first, then the CAS fails and there is room
+        void *oldest = ring->slots[head % ring->capacity].load(std::memory_order_relaxed);
+        if (ring->head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            dropped = oldest;
+            break;
+        }
+    }
+    spsc_ring_publish(ring, item);
+    return dropped;
+}
+
+extern "C" void *spsc_ring_try_pop(spsc_ring *ring)
+{
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    while (head != ring->tail.load(std::memory_order_acquire)) {
+        // a dropping producer may advance head and reuse the slot: then the CAS fails
+        void *item = ring->slots[head % ring->capacity].load(std::memory_order_relaxed);
+        if (ring->head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            spsc_ring_wake(ring);
+            return item;
+        }
+    }
+    return NULL;
+}
+
+extern "C" void *spsc_ring_pop(spsc_ring *ring)
+{
+    void *item = spsc_ring_try_pop(ring);
+    while (!item) {
+        spsc_ring_wait(ring, [ring]() { return !spsc_ring_empty(ring); });
+        item = spsc_ring_try_pop(ring);
+        if (!item && ring->closed.load(std::memory_order_acquire) && spsc_ring_empty(ring)) return NULL;
+    }
+    return item;
+}
+
+extern "C" void spsc_ring_close(spsc_ring *ring)
+{
+    {
+        std::lock_guard<std::mutex> lock(ring->mutex);
+        ring->closed.store(1, std::memory_order_release);
+    }
+    ring->cond.notify_all();
+}
+
+extern "C" int spsc_ring_is_closed(spsc_ring *ring)
+{
+    return ring->closed.load(std::memory_order_acquire);
+}
+
+extern "C" int spsc_ring_size(spsc_ring *ring)
+{
+    const uint64_t head = ring->head.load(std::memory_order_acquire);
+    const uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    return tail > head ? (int)(tail - head) : 0;
+}
+
+struct pipeline_signal {
+    std::atomic<long long> value;
+    std::atomic<int> waiters;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+extern "C" pipeline_signal *make_pipeline_signal(void)
+{
+    pipeline_signal *signal = new pipeline_signal;
+    signal->value = 0;
+    signal->waiters = 0;
+    return signal;
+}
+
+extern "C" void free_pipeline_signal(pipeline_signal *signal)
+{
+    delete signal;
+}
+
+extern "C" void pipeline_signal_notify(pipeline_signal *signal)
+{
+    signal->value.fetch_add(1);
+    if (signal->waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(signal->mutex);
+        signal->cond.notify_all();
+    }
+}
+
+extern "C" long long pipeline_signal_value(pipeline_signal *signal)
+{
+    return signal->value.load(std::memory_order_acquire);
+}
+
+extern "C" long long pipeline_signal_wait(pipeline_signal *signal, long long value, int timeout_us)
+{
+    std::unique_lock<std::mutex> lock(signal->mutex);
+    signal->waiters.fetch_add(1);
+    signal->cond.wait_for(lock, std::chrono::microseconds(timeout_us), [signal, value]() { return signal->value.load() != value; });
+    signal->waiters.fetch_sub(1);
+    return signal->value.load();
+}
+
+struct pipeline_stage {
+    std::string name;
+    std::atomic<long long> items;
+    std::atomic<long long> dropped;
+    std::atomic<long long> total_us;
+    std::atomic<long long> max_us;
+};
+
+extern "C" pipeline_stage *make_pipeline_stage(const char *name)
+{
+    pipeline_stage *stage = new pipeline_stage;
+    stage->name = name ? name : "";
+    stage->items = 0;
+    stage->dropped = 0;
+    stage->total_us = 0;
+    stage->max_us = 0;
+    return stage;
+}
+
+extern "C" void free_pipeline_stage(pipeline_stage *stage)
+{
+    delete stage;
+}
+
+extern "C" void pipeline_stage_done(pipeline_stage *stage, double latency_us)
+{
+    const long long us = (long long)latency_us;
+    stage->items.fetch_add(1, std::memory_order_relaxed);
+    stage->total_us.fetch_add(us, std::memory_order_relaxed);
+    long long max_us = stage->max_us.load(std::memory_order_relaxed);
+    while (us > max_us && !stage->max_us.compare_exchange_weak(max_us, us, std::memory_order_relaxed));
+}
+
+extern "C" void pipeline_stage_dropped(pipeline_stage *stage)
+{
+    stage->dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" long long pipeline_stage_items(pipeline_stage *stage)
+{
+    return stage->items.load(std::memory_order_relaxed);
+}
+
+extern "C" long long pipeline_stage_drops(pipeline_stage *stage)
+{
+    return stage->dropped.load(std::memory_order_relaxed);
+}
+
+extern "C" void print_pipeline_stages(pipeline_stage **stages, int n, double elapsed_us)
+{
+    printf(" %-12s %8s %8s %9s %9s %8s \n", "stage", "items", "items/s", "avg ms", "max ms", "dropped");
+    for (int i = 0; i < n; ++i) {
+        const long long items = stages[i]->items.load(std::memory_order_relaxed);
+        const double total_ms = stages[i]->total_us.load(std::memory_order_relaxed) / 1000.;
+        printf(" %-12s %8lld %8.1f %9.2f %9.2f %8lld \n", stages[i]->name.c_str(), items,
+            elapsed_us > 0 ? items * 1000000. / elapsed_us : 0.,
+            items ? total_ms / items : 0.,
+            stages[i]->max_us.load(std::memory_order_relaxed) / 1000.,
+            stages[i]->dropped.load(std::memory_order_relaxed));
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bounded lock-free single-producer single-consumer ring of pointers, the queue
+// between two stages of a frame pipeline (e.g. capture -> resize -> detect -> draw).
+// Indices are 64-bit and only grow: the producer owns tail, the consumer advances
+// head with a CAS, so that a producer which drops the oldest item (live streams)
+// can advance it too. The blocking calls spin briefly and then sleep on a
+// condition variable, they never busy-wait for a whole frame.
+
+typedef struct spsc_ring spsc_ring;
+
+spsc_ring *make_spsc_ring(int capacity);
+// the ring must be empty or the items owned elsewhere
+void free_spsc_ring(spsc_ring *ring);
+
+// 1 - pushed, 0 - full
+int spsc_ring_try_push(spsc_ring *ring, void *item);
+// waits while the ring is full, 0 - the ring was closed and the item is not pushed
+int spsc_ring_push(spsc_ring *ring, void *item);
+// never waits: when the ring is full the oldest item is removed and returned, the caller frees it
+void *spsc_ring_push_drop_oldest(spsc_ring *ring, void *item);
+
+// NULL - empty
+void *spsc_ring_try_pop(spsc_ring *ring);
+// waits while the ring is empty, NULL - the ring is closed and empty
+void *spsc_ring_pop(spsc_ring *ring);
+
+// wakes up both sides: pushes fail, pops return what is left and then NULL
+void spsc_ring_close(spsc_ring *ring);
+int spsc_ring_is_closed(spsc_ring *ring);
+int spsc_ring_size(spsc_ring *ring);
+
+// Wakes up a consumer of several rings (e.g. a scheduler that batches frames of
+// many streams): producers notify after a push, the consumer reads the value,
+// polls its rings and then waits for a change of the value or the timeout.
+
+typedef struct pipeline_signal pipeline_signal;
+
+pipeline_signal *make_pipeline_signal(void);
+void free_pipeline_signal(pipeline_signal *signal);
+void pipeline_signal_notify(pipeline_signal *signal);
+long long pipeline_signal_value(pipeline_signal *signal);
+// waits until the value is not value or for timeout_us, returns the current value
+long long pipeline_signal_wait(pipeline_signal *signal, long long value, int timeout_us);
+
+// Per-stage counters, written by the stage thread and read by any thread:
+// items, dropped items, total and max latency (time spent in the stage).
+
+typedef struct pipeline_stage pipeline_stage;
+
+pipeline_stage *make_pipeline_stage(const char *name);
+void free_pipeline_stage(pipeline_stage *stage);
+// one item done, latency in microseconds (get_time_point())
+void pipeline_stage_done(pipeline_stage *stage, double latency_us);
+void pipeline_stage_dropped(pipeline_stage *stage);
+long long pipeline_stage_items(pipeline_stage *stage);
+long long pipeline_stage_drops(pipeline_stage *stage);
+// one line per stage: items/s over elapsed_us, avg and max latency, drops
+void print_pipeline_stages(pipeline_stage **stages, int n, double elapsed_us);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
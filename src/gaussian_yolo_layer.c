@@ -6,6 +6,7 @@
 
 #include "gaussian_yolo_layer.h"
 #include "activations.h"
+#include "fast_activations.h"
 #include "blas.h"
 #include "box.h"
 #include "dark_cuda.h"
@@ -415,25 +416,27 @@ void forward_gaussian_yolo_layer(const layer l, network_state state)
     memcpy(l.output, state.input, l.outputs*l.batch*sizeof(float));
 
 #ifndef GPU
+    void (*logistic_array)(float *, const int, const ACTIVATION) =
+        (!state.train && state.net.fast_activations) ? fast_activate_array : activate_array;
     for (b = 0; b < l.batch; ++b){
         for(n = 0; n < l.n; ++n){
             // x : mu, sigma
             int index = entry_gaussian_index(l, b, n*l.w*l.h, 0);
-            activate_array(l.output + index, 2*l.w*l.h, LOGISTIC);
+            logistic_array(l.output + index, 2*l.w*l.h, LOGISTIC);
             scal_add_cpu(l.w*l.h, l.scale_x_y, -0.5*(l.scale_x_y - 1), l.output + index, 1);    // scale x
             // y : mu, sigma
             index = entry_gaussian_index(l, b, n*l.w*l.h, 2);
-            activate_array(l.output + index, 2*l.w*l.h, LOGISTIC);
+            logistic_array(l.output + index, 2*l.w*l.h, LOGISTIC);
             scal_add_cpu(l.w*l.h, l.scale_x_y, -0.5*(l.scale_x_y - 1), l.output + index, 1);    // scale y
             // w : sigma
             index = entry_gaussian_index(l, b, n*l.w*l.h, 5);
-            activate_array(l.output + index, l.w*l.h, LOGISTIC);
+            logistic_array(l.output + index, l.w*l.h, LOGISTIC);
             // h : sigma
             index = entry_gaussian_index(l, b, n*l.w*l.h, 7);
-            activate_array(l.output + index, l.w*l.h, LOGISTIC);
+            logistic_array(l.output + index, l.w*l.h, LOGISTIC);
             // objectness & class
             index = entry_gaussian_index(l, b, n*l.w*l.h, 8);
-            activate_array(l.output + index, (1+l.classes)*l.w*l.h, LOGISTIC);
+            logistic_array(l.output + index, (1+l.classes)*l.w*l.h, LOGISTIC);
         }
     }
 #endif
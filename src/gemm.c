@@ -2,6 +2,7 @@
 #include "utils.h"
 #include "im2col.h"
 #include "dark_cuda.h"
+#include "gemm_packed.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
@@ -523,91 +524,16 @@ void transpose_bin(uint32_t *A, uint32_t *B, const int n, const int m,
     }
 }
 
-#if (defined(__AVX__) && defined(__x86_64__)) || (defined(_WIN64) && !defined(__MINGW32__) && !defined(_M_ARM64))
-
-#if (defined(_WIN64) && !defined(__MINGW64__))
-#include <intrin.h>
-#include <ammintrin.h>
-#include <immintrin.h>
-#include <smmintrin.h>
-
-#if defined(_MSC_VER) && _MSC_VER <= 1900
-static inline __int32 _mm256_extract_epi64(__m256i a, const int index) {
-    return a.m256i_i64[index];
-}
-
-static inline __int32 _mm256_extract_epi32(__m256i a, const int index) {
-    return a.m256i_i32[index];
-}
-#endif
-
-static inline float _dn_castu32_f32(uint32_t a) {
-    return *((float *)&a);
-}
-
-static inline float _mm256_extract_float32(__m256 a, const int index) {
-    return a.m256_f32[index];
-}
-
-#else    // Linux GCC/Clang
-#include <x86intrin.h>
-#include <ammintrin.h>
-#include <immintrin.h>
-#include <smmintrin.h>
-#include <cpuid.h>
-
-static inline float _dn_castu32_f32(uint32_t a) {
-    return *((float *)&a);
-}
-
-static inline float _mm256_extract_float32(__m256 a, const int index) {
-    switch(index) {
-    case 0:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 0));
-    case 1:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 1));
-    case 2:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 2));
-    case 3:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 3));
-    case 4:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 4));
-    case 5:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 5));
-    case 6:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 6));
-    case 7:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 7));
-    default:
-      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 0));
-    }
-}
-
-void asm_cpuid(uint32_t* abcd, uint32_t eax)
-{
-    uint32_t ebx = 0, edx = 0, ecx = 0;
-
-    // EBX is saved to EDI and later restored
-    __asm__("movl %%ebx, %%edi;"
-        "cpuid;"
-        "xchgl %%ebx, %%edi;"
-        : "=D"(ebx),
-        "+a"(eax), "+c"(ecx), "=d"(edx));
-
-    abcd[0] = eax;
-    abcd[1] = ebx;
-    abcd[2] = ecx;
-    abcd[3] = edx;
-}
-#endif
-
-
+// CPU feature detection doesn't need -mavx, so it is available on any x86-64 build
+#if defined(__x86_64__) || (defined(_WIN64) && !defined(_M_ARM64))
 
 #ifdef _WIN32
 //  Windows
+#include <intrin.h>
 #define cpuid(info, x)    __cpuidex(info, x, 0)
 #else
 //  GCC Intrinsics
+#include <cpuid.h>
 void cpuid(int info[4], int InfoType) {
     __cpuid_count(InfoType, 0, info[0], info[1], info[2], info[3]);
 }
@@ -634,6 +560,7 @@ static int HW_AVX512BW;   //  AVX512 Byte + Word
 static int HW_AVX512DQ;   //  AVX512 Doubleword + Quadword
 static int HW_AVX512IFMA; //  AVX512 Integer 52-bit Fused Multiply-Add
 static int HW_AVX512VBMI; //  AVX512 Vector Byte Manipulation Instructions
+static int HW_AVX512VNNI; //  AVX512 Vector Neural Network Instructions
 
 // https://stackoverflow.com/questions/6121792/how-to-check-if-a-cpu-supports-the-sse3-instruction-set
 void check_cpu_features(void) {
@@ -681,6 +608,7 @@ void check_cpu_features(void) {
         HW_AVX512DQ = (info[1] & ((uint32_t)1 << 17)) != 0;
         HW_AVX512IFMA = (info[1] & ((uint32_t)1 << 21)) != 0;
         HW_AVX512VBMI = (info[2] & ((uint32_t)1 << 1)) != 0;
+        HW_AVX512VNNI = (info[2] & ((uint32_t)1 << 11)) != 0;
     }
     if (nExIds >= 0x80000001) {
         cpuid(info, 0x80000001);
@@ -692,6 +620,120 @@ void check_cpu_features(void) {
     }
 }
 
+// Unlike is_avx()/is_fma_avx2() these only ask the CPU: the packed GEMM kernels
+// carry their own target attributes, so they can be used in builds without -mavx*
+int is_cpu_fma_avx2() {
+    check_cpu_features();
+    return HW_FMA3 && HW_AVX2;
+}
+
+int is_cpu_avx512() {
+    check_cpu_features();
+    return HW_AVX512F && HW_FMA3 && HW_AVX2;
+}
+
+int is_cpu_avx512_vnni() {
+    check_cpu_features();
+    return HW_AVX512F && HW_AVX512BW && HW_AVX512VNNI;
+}
+
+#else
+
+int is_cpu_fma_avx2() {
+    return 0;
+}
+
+int is_cpu_avx512() {
+    return 0;
+}
+
+int is_cpu_avx512_vnni() {
+    return 0;
+}
+
+#endif  // x86-64
+
+#if (defined(__AVX__) && defined(__x86_64__)) || (defined(_WIN64) && !defined(__MINGW32__) && !defined(_M_ARM64))
+
+#if (defined(_WIN64) && !defined(__MINGW64__))
+#include <intrin.h>
+#include <ammintrin.h>
+#include <immintrin.h>
+#include <smmintrin.h>
+
+#if defined(_MSC_VER) && _MSC_VER <= 1900
+static inline __int32 _mm256_extract_epi64(__m256i a, const int index) {
+    return a.m256i_i64[index];
+}
+
+static inline __int32 _mm256_extract_epi32(__m256i a, const int index) {
+    return a.m256i_i32[index];
+}
+#endif
+
+static inline float _dn_castu32_f32(uint32_t a) {
+    return *((float *)&a);
+}
+
+static inline float _mm256_extract_float32(__m256 a, const int index) {
+    return a.m256_f32[index];
+}
+
+#else    // Linux GCC/Clang
+#include <x86intrin.h>
+#include <ammintrin.h>
+#include <immintrin.h>
+#include <smmintrin.h>
+#include <cpuid.h>
+
+static inline float _dn_castu32_f32(uint32_t a) {
+    return *((float *)&a);
+}
+
+static inline float _mm256_extract_float32(__m256 a, const int index) {
+    switch(index) {
+    case 0:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 0));
+    case 1:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 1));
+    case 2:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 2));
+    case 3:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 3));
+    case 4:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 4));
+    case 5:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 5));
+    case 6:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 6));
+    case 7:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 7));
+    default:
+      return _dn_castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), 0));
+    }
+}
+
+void asm_cpuid(uint32_t* abcd, uint32_t eax)
+{
+    uint32_t ebx = 0, edx = 0, ecx = 0;
+
+    // EBX is saved to EDI and later restored
+    __asm__("movl %%ebx, %%edi;"
+        "cpuid;"
+        "xchgl %%ebx, %%edi;"
+        : "=D"(ebx),
+        "+a"(eax), "+c"(ecx), "=d"(edx));
+
+    abcd[0] = eax;
+    abcd[1] = ebx;
+    abcd[2] = ecx;
+    abcd[3] = edx;
+}
+#endif
+
+
+
+
 int is_avx() {
     static int result = -1;
     if (result == -1) {
@@ -2629,7 +2671,8 @@ void gemm_tt(int M, int N, int K, float ALPHA,
 }
 
 
-void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
+// previous row-parallel implementation, kept for small products and as a baseline for "darknet bench gemm"
+void gemm_cpu_legacy(int TA, int TB, int M, int N, int K, float ALPHA,
         float *A, int lda,
         float *B, int ldb,
         float BETA,
@@ -2665,6 +2708,21 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
     }
 }
 
+void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    // packing doesn't pay off for tiny products (e.g. connected layers with batch=1)
+    if (M < 4 || (double)M*N*K < GEMM_PACKED_MIN_OPS) {
+        gemm_cpu_legacy(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc);
+    }
+    else {
+        gemm_packed(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, BETA, C, ldc);
+    }
+}
+
 #ifdef GPU
 
 #include <math.h>
@@ -2847,4 +2905,5 @@ int test_gpu_blas()
 void init_cpu() {
     is_avx();
     is_fma_avx2();
+    gemm_packed_init();
 }
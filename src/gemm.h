@@ -27,6 +27,9 @@ static inline unsigned char get_bit(unsigned char const*const src, size_t index)
 
 int is_avx();
 int is_fma_avx2();
+int is_cpu_fma_avx2();
+int is_cpu_avx512();
+int is_cpu_avx512_vnni();
 
 void float_to_bit(float *src, unsigned char *dst, size_t size);
 
@@ -100,6 +103,14 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+float *random_matrix(int rows, int cols);
+
+void gemm_cpu_legacy(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+
 #ifdef GPU
 void gemm_ongpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float *A_gpu, int lda,
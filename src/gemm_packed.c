@@ -0,0 +1,588 @@
+#include "gemm_packed.h"
+#include "gemm.h"
+#include "fast_activations.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+
+// The engine follows the usual Goto/BLIS decomposition:
+//
+//  for jc in N step NC           - B block of KC x NC lives in L3
+//    for pc in K step KC         - pack A (all of M x KC) and B (KC x NC)
+//      for tiles (ic, jr-chunk)  - split between OpenMP threads
+//        for jr in chunk step NR - B micro-panel of KC x NR stays in L1
+//          for ir in MC step MR  - A block of MC x KC stays in L2
+//            micro-kernel MR x NR
+//
+// ALPHA is folded into the packed A panels, BETA is applied to C once
+// before the first K block, so the micro-kernels only do C += A*B
+// (or C = A*B in the first K block when BETA == 0). The optional epilogue
+// (bias + activation) runs on each tile after its last K block.
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define GEMM_PACKED_X86
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define GEMM_TARGET_AVX2 __attribute__((target("avx,avx2,fma")))
+#define GEMM_TARGET_AVX512 __attribute__((target("avx,avx2,fma,avx512f")))
+#else
+#define GEMM_TARGET_AVX2
+#define GEMM_TARGET_AVX512
+#endif
+#endif
+
+#define GEMM_ALIGN 64
+#define GEMM_MAX_MR 12
+#define GEMM_MAX_NR 32
+
+// store: C = A*B instead of C += A*B
+typedef void (*gemm_micro_kernel_t)(int kc, const float *a, const float *b, float *c, int ldc, int m, int n, int store);
+
+typedef struct gemm_kernel_desc {
+    const char *name;
+    int mr;
+    int nr;
+    gemm_micro_kernel_t kernel;
+} gemm_kernel_desc;
+
+typedef struct gemm_blocking {
+    int kc;
+    int mc;
+    int nc;
+    size_t l1, l2, l3;
+} gemm_blocking;
+
+static gemm_kernel_desc gemm_kernel;
+static gemm_blocking gemm_block;
+static pthread_once_t gemm_once = PTHREAD_ONCE_INIT;
+
+void *gemm_aligned_alloc(size_t size)
+{
+    void *ptr = NULL;
+    if (size == 0) size = GEMM_ALIGN;
+#ifdef _WIN32
+    ptr = _aligned_malloc(size, GEMM_ALIGN);
+#else
+    if (posix_memalign(&ptr, GEMM_ALIGN, size)) ptr = NULL;
+#endif
+    if (!ptr) malloc_error(size, DARKNET_LOC);
+    return ptr;
+}
+
+void gemm_aligned_free(void *ptr)
+{
+    if (!ptr) return;
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// micro-kernels: C[m x n] (+)= A_panel[kc x MR] * B_panel[kc x NR]
+// ----------------------------------------------------------------------------
+
+#define GENERIC_MR 4
+#define GENERIC_NR 16
+
+static void gemm_kernel_generic_4x16(int kc, const float *a, const float *b, float *c, int ldc, int m, int n, int store)
+{
+    float acc[GENERIC_MR][GENERIC_NR] = { { 0 } };
+    int i, j, k;
+    for (k = 0; k < kc; ++k) {
+        for (i = 0; i < GENERIC_MR; ++i) {
+            const float a_val = a[i];
+            for (j = 0; j < GENERIC_NR; ++j) {
+                acc[i][j] += a_val * b[j];
+            }
+        }
+        a += GENERIC_MR;
+        b += GENERIC_NR;
+    }
+    for (i = 0; i < m; ++i) {
+        for (j = 0; j < n; ++j) {
+            c[i*ldc + j] = store ? acc[i][j] : c[i*ldc + j] + acc[i][j];
+        }
+    }
+}
+
+#ifdef GEMM_PACKED_X86
+
+#define AVX2_MR 6
+#define AVX2_NR 16
+
+GEMM_TARGET_AVX2
+static void gemm_kernel_avx2_6x16(int kc, const float *a, const float *b, float *c, int ldc, int m, int n, int store)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    int k;
+    for (k = 0; k < kc; ++k) {
+        const __m256 b0 = _mm256_load_ps(b);
+        const __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 a_val;
+        a_val = _mm256_broadcast_ss(a + 0);
+        c00 = _mm256_fmadd_ps(a_val, b0, c00);
+        c01 = _mm256_fmadd_ps(a_val, b1, c01);
+        a_val = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(a_val, b0, c10);
+        c11 = _mm256_fmadd_ps(a_val, b1, c11);
+        a_val = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(a_val, b0, c20);
+        c21 = _mm256_fmadd_ps(a_val, b1, c21);
+        a_val = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(a_val, b0, c30);
+        c31 = _mm256_fmadd_ps(a_val, b1, c31);
+        a_val = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(a_val, b0, c40);
+        c41 = _mm256_fmadd_ps(a_val, b1, c41);
+        a_val = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(a_val, b0, c50);
+        c51 = _mm256_fmadd_ps(a_val, b1, c51);
+        a += AVX2_MR;
+        b += AVX2_NR;
+    }
+
+    if (m == AVX2_MR && n == AVX2_NR && store) {
+#define GEMM_AVX2_STORE_ROW(r, lo, hi) \
+        _mm256_storeu_ps(c + r*ldc, lo); \
+        _mm256_storeu_ps(c + r*ldc + 8, hi);
+        GEMM_AVX2_STORE_ROW(0, c00, c01);
+        GEMM_AVX2_STORE_ROW(1, c10, c11);
+        GEMM_AVX2_STORE_ROW(2, c20, c21);
+        GEMM_AVX2_STORE_ROW(3, c30, c31);
+        GEMM_AVX2_STORE_ROW(4, c40, c41);
+        GEMM_AVX2_STORE_ROW(5, c50, c51);
+#undef GEMM_AVX2_STORE_ROW
+    }
+    else if (m == AVX2_MR && n == AVX2_NR) {
+#define GEMM_AVX2_STORE_ROW(r, lo, hi) \
+        _mm256_storeu_ps(c + r*ldc, _mm256_add_ps(_mm256_loadu_ps(c + r*ldc), lo)); \
+        _mm256_storeu_ps(c + r*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + r*ldc + 8), hi));
+        GEMM_AVX2_STORE_ROW(0, c00, c01);
+        GEMM_AVX2_STORE_ROW(1, c10, c11);
+        GEMM_AVX2_STORE_ROW(2, c20, c21);
+        GEMM_AVX2_STORE_ROW(3, c30, c31);
+        GEMM_AVX2_STORE_ROW(4, c40, c41);
+        GEMM_AVX2_STORE_ROW(5, c50, c51);
+#undef GEMM_AVX2_STORE_ROW
+    }
+    else {
+        float tile[AVX2_MR*AVX2_NR];
+        int i, j;
+        _mm256_storeu_ps(tile + 0 * AVX2_NR, c00); _mm256_storeu_ps(tile + 0 * AVX2_NR + 8, c01);
+        _mm256_storeu_ps(tile + 1 * AVX2_NR, c10); _mm256_storeu_ps(tile + 1 * AVX2_NR + 8, c11);
+        _mm256_storeu_ps(tile + 2 * AVX2_NR, c20); _mm256_storeu_ps(tile + 2 * AVX2_NR + 8, c21);
+        _mm256_storeu_ps(tile + 3 * AVX2_NR, c30); _mm256_storeu_ps(tile + 3 * AVX2_NR + 8, c31);
+        _mm256_storeu_ps(tile + 4 * AVX2_NR, c40); _mm256_storeu_ps(tile + 4 * AVX2_NR + 8, c41);
+        _mm256_storeu_ps(tile + 5 * AVX2_NR, c50); _mm256_storeu_ps(tile + 5 * AVX2_NR + 8, c51);
+        for (i = 0; i < m; ++i) {
+            for (j = 0; j < n; ++j) {
+                c[i*ldc + j] = store ? tile[i*AVX2_NR + j] : c[i*ldc + j] + tile[i*AVX2_NR + j];
+            }
+        }
+    }
+}
+
+#define AVX512_MR 12
+#define AVX512_NR 32
+
+GEMM_TARGET_AVX512
+static void gemm_kernel_avx512_12x32(int kc, const float *a, const float *b, float *c, int ldc, int m, int n, int store)
+{
+    __m512 acc[AVX512_MR][2];
+    int i, k;
+    for (i = 0; i < AVX512_MR; ++i) {
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+    for (k = 0; k < kc; ++k) {
+        const __m512 b0 = _mm512_load_ps(b);
+        const __m512 b1 = _mm512_load_ps(b + 16);
+        for (i = 0; i < AVX512_MR; ++i) {
+            const __m512 a_val = _mm512_set1_ps(a[i]);
+            acc[i][0] = _mm512_fmadd_ps(a_val, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(a_val, b1, acc[i][1]);
+        }
+        a += AVX512_MR;
+        b += AVX512_NR;
+    }
+
+    if (n == AVX512_NR && store) {
+        for (i = 0; i < m; ++i) {
+            _mm512_storeu_ps(c + i*ldc, acc[i][0]);
+            _mm512_storeu_ps(c + i*ldc + 16, acc[i][1]);
+        }
+    }
+    else if (n == AVX512_NR) {
+        for (i = 0; i < m; ++i) {
+            float *c_row = c + i*ldc;
+            _mm512_storeu_ps(c_row, _mm512_add_ps(_mm512_loadu_ps(c_row), acc[i][0]));
+            _mm512_storeu_ps(c_row + 16, _mm512_add_ps(_mm512_loadu_ps(c_row + 16), acc[i][1]));
+        }
+    }
+    else {
+        // masked stores for the right edge
+        const __mmask16 mask0 = (n >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << n) - 1);
+        const __mmask16 mask1 = (n <= 16) ? (__mmask16)0 : (__mmask16)((1u << (n - 16)) - 1);
+        for (i = 0; i < m; ++i) {
+            float *c_row = c + i*ldc;
+            if (store) {
+                _mm512_mask_storeu_ps(c_row, mask0, acc[i][0]);
+                _mm512_mask_storeu_ps(c_row + 16, mask1, acc[i][1]);
+                continue;
+            }
+            _mm512_mask_storeu_ps(c_row, mask0, _mm512_add_ps(_mm512_maskz_loadu_ps(mask0, c_row), acc[i][0]));
+            _mm512_mask_storeu_ps(c_row + 16, mask1, _mm512_add_ps(_mm512_maskz_loadu_ps(mask1, c_row + 16), acc[i][1]));
+        }
+    }
+}
+#endif  // GEMM_PACKED_X86
+
+// ----------------------------------------------------------------------------
+// runtime configuration
+// ----------------------------------------------------------------------------
+
+static size_t gemm_cache_size(int level, size_t default_size)
+{
+    long size = -1;
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+    if (level == 1) size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    else if (level == 2) size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    else if (level == 3) size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    if (size <= 0) return default_size;
+    return (size_t)size;
+}
+
+static int round_down_to(int val, int step)
+{
+    int r = (val / step) * step;
+    return (r < step) ? step : r;
+}
+
+// kernel and blocking, once per process
+static void gemm_packed_select(void)
+{
+    gemm_kernel_desc kd = { "generic", GENERIC_MR, GENERIC_NR, gemm_kernel_generic_4x16 };
+#ifdef GEMM_PACKED_X86
+    if (is_cpu_avx512()) {
+        kd.name = "avx512";
+        kd.mr = AVX512_MR;
+        kd.nr = AVX512_NR;
+        kd.kernel = gemm_kernel_avx512_12x32;
+    }
+    else if (is_cpu_fma_avx2()) {
+        kd.name = "avx2_fma";
+        kd.mr = AVX2_MR;
+        kd.nr = AVX2_NR;
+        kd.kernel = gemm_kernel_avx2_6x16;
+    }
+#endif
+
+    gemm_blocking bl;
+    bl.l1 = gemm_cache_size(1, 32 * 1024);
+    bl.l2 = gemm_cache_size(2, 512 * 1024);
+    bl.l3 = gemm_cache_size(3, 8 * 1024 * 1024);
+
+    // B micro-panel (KC x NR) takes half of L1, the other half streams A
+    int kc = (int)(bl.l1 / (2 * sizeof(float) * kd.nr));
+    kc = round_down_to(kc, 8);
+    if (kc < 64) kc = 64;
+    if (kc > 512) kc = 512;
+
+    // A block (MC x KC) takes half of L2
+    int mc = (int)(bl.l2 / (2 * sizeof(float) * kc));
+    mc = round_down_to(mc, kd.mr);
+    if (mc > 1024) mc = round_down_to(1024, kd.mr);
+
+    // B block (KC x NC) takes half of L3
+    int nc = (int)(bl.l3 / (2 * sizeof(float) * kc));
+    nc = round_down_to(nc, kd.nr);
+    if (nc > 8192) nc = round_down_to(8192, kd.nr);
+
+    bl.kc = kc;
+    bl.mc = mc;
+    bl.nc = nc;
+
+    gemm_kernel = kd;
+    gemm_block = bl;
+}
+
+void gemm_packed_init(void)
+{
+    pthread_once(&gemm_once, gemm_packed_select);
+}
+
+const char *gemm_packed_kernel_name(void)
+{
+    gemm_packed_init();
+    return gemm_kernel.name;
+}
+
+unsigned int gemm_packed_layout(void)
+{
+    gemm_packed_init();
+    return (unsigned int)gemm_kernel.mr << 16 | (unsigned int)gemm_block.kc;
+}
+
+void gemm_packed_print_info(void)
+{
+    gemm_packed_init();
+    printf(" packed GEMM: kernel = %s (%dx%d), KC = %d, MC = %d, NC = %d, L1 = %zu KB, L2 = %zu KB, L3 = %zu KB \n",
+        gemm_kernel.name, gemm_kernel.mr, gemm_kernel.nr, gemm_block.kc, gemm_block.mc, gemm_block.nc,
+        gemm_block.l1 / 1024, gemm_block.l2 / 1024, gemm_block.l3 / 1024);
+}
+
+// ----------------------------------------------------------------------------
+// packing
+// ----------------------------------------------------------------------------
+
+// one MR x kc panel of alpha*op(A), rows past M are zero-filled
+static void pack_a_panel(int TA, int m, int kc, float ALPHA, const float *A, int lda, int i0, int k0, int mr, float *dst)
+{
+    int i, k;
+    if (m < mr) memset(dst, 0, (size_t)kc * mr * sizeof(float));
+    if (!TA) {
+        for (i = 0; i < m; ++i) {
+            const float *src = A + (size_t)(i0 + i)*lda + k0;
+            for (k = 0; k < kc; ++k) dst[k*mr + i] = ALPHA * src[k];
+        }
+    }
+    else {
+        for (k = 0; k < kc; ++k) {
+            const float *src = A + (size_t)(k0 + k)*lda + i0;
+            for (i = 0; i < m; ++i) dst[k*mr + i] = ALPHA * src[i];
+        }
+    }
+}
+
+// one kc x NR panel of op(B), columns past N are zero-filled
+static void pack_b_panel(int TB, int n, int kc, const float *B, int ldb, int k0, int j0, int nr, float *dst)
+{
+    int j, k;
+    if (!TB) {
+        if (n == nr) {
+            for (k = 0; k < kc; ++k) {
+                memcpy(dst + k*nr, B + (size_t)(k0 + k)*ldb + j0, nr * sizeof(float));
+            }
+        }
+        else {
+            for (k = 0; k < kc; ++k) {
+                const float *src = B + (size_t)(k0 + k)*ldb + j0;
+                for (j = 0; j < n; ++j) dst[k*nr + j] = src[j];
+                for (; j < nr; ++j) dst[k*nr + j] = 0;
+            }
+        }
+    }
+    else {
+        if (n < nr) memset(dst, 0, (size_t)kc * nr * sizeof(float));
+        for (j = 0; j < n; ++j) {
+            const float *src = B + (size_t)(j0 + j)*ldb + k0;
+            for (k = 0; k < kc; ++k) dst[k*nr + j] = src[k];
+        }
+    }
+}
+
+static void scale_c(int M, int N, float BETA, float *C, int ldc)
+{
+    int i, j;
+    if (BETA == 1) return;
+    for (i = 0; i < M; ++i) {
+        float *c_row = C + (size_t)i*ldc;
+        if (BETA == 0) memset(c_row, 0, N * sizeof(float));
+        else for (j = 0; j < N; ++j) c_row[j] *= BETA;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// pre-packed A (static weights)
+// ----------------------------------------------------------------------------
+
+// Layout: for every KC block pc, all MR panels of that block follow each other,
+// the block starts at (pc * Mpad) where Mpad = M rounded up to MR - exactly
+// the buffer the driver would produce for that block.
+
+size_t gemm_packed_a_size(int M, int K)
+{
+    gemm_packed_init();
+    const int mr = gemm_kernel.mr;
+    return (size_t)((M + mr - 1) / mr) * mr * K;
+}
+
+void gemm_pack_a(int TA, int M, int K, float ALPHA, float *A, int lda, float *packed)
+{
+    gemm_packed_init();
+    const int mr = gemm_kernel.mr;
+    const int m_panels = (M + mr - 1) / mr;
+    int pc;
+    for (pc = 0; pc < K; pc += gemm_block.kc) {
+        const int kc = (K - pc < gemm_block.kc) ? (K - pc) : gemm_block.kc;
+        float *block = packed + (size_t)pc * m_panels * mr;
+        int p;
+        #pragma omp parallel for
+        for (p = 0; p < m_panels; ++p) {
+            const int i0 = p * mr;
+            const int m = (M - i0 < mr) ? (M - i0) : mr;
+            pack_a_panel(TA, m, kc, ALPHA, A, lda, i0, pc, mr, block + (size_t)p*mr*kc);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// driver
+// ----------------------------------------------------------------------------
+
+// A_packed != NULL: A is already in the gemm_pack_a() layout (ALPHA included)
+// store: BETA == 0, the first K block overwrites C
+static void gemm_packed_run(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda, const float *A_packed,
+        float *B, int ldb,
+        float *C, int ldc, int store, const gemm_epilogue *epilogue)
+{
+
+    const gemm_kernel_desc kd = gemm_kernel;
+    const gemm_blocking bl = gemm_block;
+    const int mr = kd.mr, nr = kd.nr;
+    const int m_panels = (M + mr - 1) / mr;
+    const int nc_max = (N < bl.nc) ? N : bl.nc;
+    const int n_panels_max = (nc_max + nr - 1) / nr;
+    const int m_blocks = (M + bl.mc - 1) / bl.mc;
+
+    int threads = 1;
+#if defined(_OPENMP)
+    threads = omp_get_max_threads();
+#endif
+    // split the N direction too when there are fewer M blocks than threads
+    int j_parts = (2 * threads + m_blocks - 1) / m_blocks;
+    if (j_parts < 1) j_parts = 1;
+    if (j_parts > n_panels_max) j_parts = n_panels_max;
+
+    float *a_pack = A_packed ? NULL : (float*)gemm_aligned_alloc((size_t)m_panels * mr * bl.kc * sizeof(float));
+    float *b_pack = (float*)gemm_aligned_alloc((size_t)n_panels_max * nr * bl.kc * sizeof(float));
+
+    #pragma omp parallel
+    {
+        int jc, pc;
+        for (jc = 0; jc < N; jc += bl.nc) {
+            const int nc = (N - jc < bl.nc) ? (N - jc) : bl.nc;
+            const int n_panels = (nc + nr - 1) / nr;
+            const int q_per_part = (n_panels + j_parts - 1) / j_parts;
+
+            for (pc = 0; pc < K; pc += bl.kc) {
+                const int kc = (K - pc < bl.kc) ? (K - pc) : bl.kc;
+                const float *a_block = A_packed ? A_packed + (size_t)pc * m_panels * mr : a_pack;
+                const int first = store && pc == 0;
+                const int last = epilogue && pc + kc >= K;
+                int p, q, t;
+
+                if (!A_packed) {
+                    #pragma omp for
+                    for (p = 0; p < m_panels; ++p) {
+                        const int i0 = p * mr;
+                        const int m = (M - i0 < mr) ? (M - i0) : mr;
+                        pack_a_panel(TA, m, kc, ALPHA, A, lda, i0, pc, mr, a_pack + (size_t)p*mr*kc);
+                    }
+                }
+
+                #pragma omp for
+                for (q = 0; q < n_panels; ++q) {
+                    const int j0 = jc + q * nr;
+                    const int n = (jc + nc - j0 < nr) ? (jc + nc - j0) : nr;
+                    pack_b_panel(TB, n, kc, B, ldb, pc, j0, nr, b_pack + (size_t)q*nr*kc);
+                }
+
+                #pragma omp for
+                for (t = 0; t < m_blocks * j_parts; ++t) {
+                    const int ib = t / j_parts;
+                    const int jp = t % j_parts;
+                    const int i_start = ib * bl.mc;
+                    const int i_end = (i_start + bl.mc < M) ? (i_start + bl.mc) : M;
+                    const int q_start = jp * q_per_part;
+                    const int q_end = (q_start + q_per_part < n_panels) ? (q_start + q_per_part) : n_panels;
+                    int qq, ir;
+                    for (qq = q_start; qq < q_end; ++qq) {
+                        const int j0 = jc + qq * nr;
+                        const int n = (jc + nc - j0 < nr) ? (jc + nc - j0) : nr;
+                        const float *b_panel = b_pack + (size_t)qq*nr*kc;
+                        for (ir = i_start; ir < i_end; ir += mr) {
+                            const int m = (M - ir < mr) ? (M - ir) : mr;
+                            float *c_tile = C + (size_t)ir*ldc + j0;
+                            kd.kernel(kc, a_block + (size_t)(ir / mr)*mr*kc, b_panel, c_tile, ldc, m, n, first);
+                            if (last) {
+                                int i;
+                                for (i = 0; i < m; ++i) {
+                                    (epilogue->fast ? fast_bias_activate_array : bias_activate_array)(c_tile + (size_t)i*ldc, n, epilogue->bias[ir + i], epilogue->activation);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    gemm_aligned_free(a_pack);
+    gemm_aligned_free(b_pack);
+}
+
+void gemm_packed(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    if (M <= 0 || N <= 0) return;
+    gemm_packed_init();
+    if (K <= 0 || ALPHA == 0) {
+        scale_c(M, N, BETA, C, ldc);
+        return;
+    }
+    if (BETA != 0) scale_c(M, N, BETA, C, ldc);
+    gemm_packed_run(TA, TB, M, N, K, ALPHA, A, lda, NULL, B, ldb, C, ldc, BETA == 0, NULL);
+}
+
+void gemm_prepacked(int TB, int M, int N, int K,
+        const float *A_packed,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc)
+{
+    gemm_prepacked_epilogue(TB, M, N, K, A_packed, B, ldb, BETA, C, ldc, NULL);
+}
+
+void gemm_prepacked_epilogue(int TB, int M, int N, int K,
+        const float *A_packed,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        const gemm_epilogue *epilogue)
+{
+    if (M <= 0 || N <= 0) return;
+    gemm_packed_init();
+    if (K <= 0) {
+        scale_c(M, N, BETA, C, ldc);
+        if (epilogue) {
+            int i;
+            for (i = 0; i < M; ++i) (epilogue->fast ? fast_bias_activate_array : bias_activate_array)(C + (size_t)i*ldc, N, epilogue->bias[i], epilogue->activation);
+        }
+        return;
+    }
+    if (BETA != 0) scale_c(M, N, BETA, C, ldc);
+    gemm_packed_run(0, TB, M, N, K, 1, NULL, 0, A_packed, B, ldb, C, ldc, BETA == 0, epilogue);
+}
@@ -0,0 +1,68 @@
+#ifndef GEMM_PACKED_H
+#define GEMM_PACKED_H
+#include "activations.h"
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Packed, cache-blocked SGEMM (Goto/BLIS style) for the CPU path:
+//   C = ALPHA * op(A) * op(B) + BETA * C
+// A is packed into MR-row micro-panels, B into NR-column micro-panels,
+// blocking (KC/MC/NC) is derived from the L1/L2/L3 sizes and the micro-kernel
+// (scalar, AVX2+FMA or AVX-512) is picked once at runtime.
+// BETA == 0 doesn't clear C first: the first K block stores instead of accumulating.
+// products smaller than this (M*N*K) stay on gemm_cpu_legacy()
+#define GEMM_PACKED_MIN_OPS (32.0*32.0*32.0)
+
+void gemm_packed(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+
+// Static A (e.g. conv weights) can be packed once and reused:
+// gemm_packed_a_size() returns the number of floats gemm_pack_a() writes,
+// gemm_prepacked() then computes C = A_packed * op(B) + BETA * C.
+// The layout depends on the selected micro-kernel and KC, so it is only
+// valid within the process that packed it.
+size_t gemm_packed_a_size(int M, int K);
+void gemm_pack_a(int TA, int M, int K, float ALPHA, float *A, int lda, float *packed);
+void gemm_prepacked(int TB, int M, int N, int K,
+        const float *A_packed,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc);
+
+// Convolution epilogue, applied to every MR x NR tile of C right after its
+// last K block, while the tile is still in L1:
+//   C[i][j] = activation(C[i][j] + bias[i])
+// so the layer doesn't need separate add_bias() / activation passes.
+// The activation has to be element-wise (is_activation_elementwise()).
+typedef struct gemm_epilogue {
+    const float *bias;      // one per row of C (output channel)
+    ACTIVATION activation;
+    int fast;               // fast_bias_activate_array() instead of bias_activate_array()
+} gemm_epilogue;
+
+void gemm_prepacked_epilogue(int TB, int M, int N, int K,
+        const float *A_packed,
+        float *B, int ldb,
+        float BETA,
+        float *C, int ldc,
+        const gemm_epilogue *epilogue);
+
+// identifies the gemm_pack_a() layout of this process (MR and KC), e.g. to check packed weights saved to a file
+unsigned int gemm_packed_layout(void);
+
+void gemm_packed_init(void);
+const char *gemm_packed_kernel_name(void);
+void gemm_packed_print_info(void);
+
+void *gemm_aligned_alloc(size_t size);
+void gemm_aligned_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,9 +1,10 @@
 #define _XOPEN_SOURCE
 #include "image.h"
 #include "http_stream.h"
+#include "json_writer.h"
 
 //
-// a single-threaded, multi client(using select), debug webserver - streaming out mjpg.
+// a single-threaded, multi client (epoll, poll elsewhere) webserver - streaming out mjpg and json.
 //  on win, _WIN32 has to be defined, must link against ws2_32.lib (socks on linux are for free)
 //
 
@@ -11,11 +12,15 @@
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <condition_variable>
 #include <atomic>
 #include <ctime>
+#include <chrono>
+#include <string>
 using std::cerr;
 using std::endl;
 
@@ -40,20 +45,6 @@ struct _INIT_W32DATA
     _INIT_W32DATA() { WSAStartup(MAKEWORD(2, 1), &w); }
 } _init_once;
 
-// Graceful closes will first close their output channels and then wait for the peer
-// on the other side of the connection to close its output channels. When both sides are done telling
-// each other they won,t be sending any more data (i.e., closing output channels),
-// the connection can be closed fully, with no risk of reset.
-static int close_socket(SOCKET s) {
-    int close_output = ::shutdown(s, 1); // 0 close input, 1 close output, 2 close both
-    char *buf = (char *)calloc(1024, sizeof(char));
-    ::recv(s, buf, 1024, 0);
-    free(buf);
-    int close_input = ::shutdown(s, 0);
-    int result = ::closesocket(s);
-    cerr << "Close socket: out = " << close_output << ", in = " << close_input << " \n";
-    return result;
-}
 #else   // _WIN32 - else: nix
 #include "darkunistd.h"
 #include <fcntl.h>
@@ -87,223 +78,755 @@ struct _IGNORE_PIPE_SIGNAL
         // sigaction (SIGPIPE, &old_actn, NULL); // - to restore the previous signal handling
     }
 } _init_once;
+#endif // _WIN32
+
+
+// ----------------------------------------
+// streaming server: one thread serves all the MJPEG and JSON streams
+// ----------------------------------------
 
-static int close_socket(SOCKET s) {
-    int close_output = ::shutdown(s, 1); // 0 close input, 1 close output, 2 close both
-    char *buf = (char *)calloc(1024, sizeof(char));
-    ::recv(s, buf, 1024, 0);
-    free(buf);
-    int close_input = ::shutdown(s, 0);
-    int result = close(s);
-    std::cerr << "Close socket: out = " << close_output << ", in = " << close_input << " \n";
-    return result;
+#ifdef __linux__
+#define HTTP_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifndef _WIN32
+#include <poll.h>
+#include <errno.h>
+#define HTTP_SEND_FLAGS MSG_NOSIGNAL
+#define HTTP_POLL_MS 100    // the stall check; publishing wakes the thread up
+#else
+#define poll WSAPoll
+#define HTTP_SEND_FLAGS 0
+#define HTTP_POLL_MS 10     // no wake up: publishing waits for the next poll
+#endif
+
+#define HTTP_MAX_REQUEST 4096
+#define HTTP_REQUEST_TIMEOUT 10e6   // usec for the request of a client on a port of several streams
+#define HTTP_JSON_SEPARATOR ", \n"
+
+static const char http_mjpeg_header[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Server: Mozarella/2.2\r\n"
+    "Accept-Range: bytes\r\n"
+    "Connection: close\r\n"
+    "Max-Age: 0\r\n"
+    "Expires: 0\r\n"
+    "Cache-Control: no-cache, private\r\n"
+    "Pragma: no-cache\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=mjpegstream\r\n"
+    "\r\n";
+static const char http_json_header[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Server: Mozarella/2.2\r\n"
+    "Accept-Range: bytes\r\n"
+    "Connection: close\r\n"
+    "Max-Age: 0\r\n"
+    "Expires: 0\r\n"
+    "Cache-Control: no-cache, private\r\n"
+    "Pragma: no-cache\r\n"
+    "Content-Type: application/json\r\n"
+    "\r\n"
+    "[\n";  // open JSON array
+static const char http_not_found[] = "HTTP/1.0 404 Not Found\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+
+static double http_now_us()
+{
+    return (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void http_set_nonblocking(SOCKET s)
+{
+#ifdef _WIN32
+    unsigned long i_mode = 1;
+    ioctlsocket(s, FIONBIO, &i_mode);
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, flags | O_NONBLOCK);
+#endif
 }
-#endif // _WIN32
 
+static bool http_would_block()
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
 
-class JSON_sender
+static void http_close_socket(SOCKET s)
 {
-    SOCKET sock;
-    SOCKET maxfd;
-    fd_set master;
-    int timeout; // master sock timeout, shutdown after timeout usec.
-    int close_all_sockets;
+#ifdef _WIN32
+    ::closesocket(s);
+#else
+    ::close(s);
+#endif
+}
+
+// a published frame, shared by all the clients of the stream: MJPEG - the part
+// header and the JPEG, JSON - the separator and the object. The body is handed
+// over as it is, the encoder gets its buffer back when the last client is done.
+struct http_frame_data {
+    std::string head;
+    std::vector<unsigned char> body;
 
-    int _write(int sock, char const*const s, int len)
+    size_t size() const { return head.size() + body.size(); }
+    // the bytes from offset on, up to the end of the head or the body
+    const char *at(size_t offset, size_t *left) const
     {
-        if (len < 1) { len = strlen(s); }
-        return ::send(sock, s, len, 0);
+        if (offset < head.size()) {
+            *left = head.size() - offset;
+            return head.data() + offset;
+        }
+        *left = size() - offset;
+        return (const char*)body.data() + (offset - head.size());
     }
+};
+typedef std::shared_ptr<const http_frame_data> http_frame;
+
+struct http_stream_state {
+    int port;
+    std::string path;
+    http_stream_type type;
+    double timeout;             // usec a client may make no progress
+    bool closed;
+    // guarded by the server mutex
+    http_frame latest;
+    long long seq;
+    // read by get_http_stream_stats()
+    std::atomic<int> clients;
+    std::atomic<long long> connections, frames, frames_sent, frames_dropped, bytes_sent;
+    http_stream_state() : port(0), type(HTTP_STREAM_MJPEG), timeout(0), closed(false), seq(0), clients(0),
+        connections(0), frames(0), frames_sent(0), frames_dropped(0), bytes_sent(0) {}
+};
+
+// the write queue of a client: the response header, the frame being sent and the
+// latest frame after it; a newer frame replaces the latest (drop-to-latest)
+struct http_client {
+    SOCKET fd;
+    int port;
+    int stream;                 // -1 until the request is routed
+    std::string request;
+    std::string head;
+    size_t head_sent;
+    http_frame current;
+    size_t sent;
+    http_frame next;
+    long long seq;              // of the last frame queued
+    bool started;               // JSON: the first frame goes without the separator
+    bool close_after_flush;
+    bool want_write;
+    double progress;            // last write, or when the queue got data
+    http_client() : fd(INVALID_SOCKET), port(0), stream(-1), head_sent(0), sent(0), seq(0), started(false),
+        close_after_flush(false), want_write(false), progress(0) {}
+};
+
+struct http_listener {
+    SOCKET fd;
+    int port;
+    bool registered;
+    bool closed;
+};
+
+struct http_event {
+    SOCKET fd;
+    bool in, out, err;
+};
+
+// epoll, or poll() rebuilt from the sockets of every wait
+class http_poller
+{
+#ifdef HTTP_USE_EPOLL
+    int ep;
+    int wake_fd;
+#else
+    std::map<SOCKET, short> fds;
+    std::vector<struct pollfd> pfds;
+#endif
 
 public:
+    http_poller()
+    {
+#ifdef HTTP_USE_EPOLL
+        ep = epoll_create1(0);
+        wake_fd = eventfd(0, EFD_NONBLOCK);
+        struct epoll_event e = { 0 };
+        e.events = EPOLLIN;
+        e.data.fd = wake_fd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, wake_fd, &e);
+#endif
+    }
 
-    JSON_sender(int port = 0, int _timeout = 400000)
-        : sock(INVALID_SOCKET)
-        , timeout(_timeout)
+    void set(SOCKET s, bool write, int op)
     {
-        close_all_sockets = 0;
-        FD_ZERO(&master);
-        if (port)
-            open(port);
+#ifdef HTTP_USE_EPOLL
+        struct epoll_event e = { 0 };
+        e.events = EPOLLIN | (write ? EPOLLOUT : 0);
+        e.data.fd = s;
+        epoll_ctl(ep, op, s, &e);
+#else
+        (void)op;
+        fds[s] = POLLIN | (write ? POLLOUT : 0);
+#endif
     }
 
-    ~JSON_sender()
+#ifdef HTTP_USE_EPOLL
+    void add(SOCKET s) { set(s, false, EPOLL_CTL_ADD); }
+    void modify(SOCKET s, bool write) { set(s, write, EPOLL_CTL_MOD); }
+    void remove(SOCKET s) { epoll_ctl(ep, EPOLL_CTL_DEL, s, NULL); }
+    void wake()
     {
-        close_all();
-        release();
+        uint64_t one = 1;
+        if (::write(wake_fd, &one, sizeof(one)) < 0) {}
+    }
+#else
+    void add(SOCKET s) { set(s, false, 0); }
+    void modify(SOCKET s, bool write) { set(s, write, 0); }
+    void remove(SOCKET s) { fds.erase(s); }
+    void wake() {}
+#endif
+
+    void wait(std::vector<http_event> &events, int timeout_ms)
+    {
+        events.clear();
+#ifdef HTTP_USE_EPOLL
+        struct epoll_event ready[64];
+        int i, n = epoll_wait(ep, ready, 64, timeout_ms);
+        for (i = 0; i < n; ++i) {
+            if (ready[i].data.fd == wake_fd) {
+                uint64_t count;
+                if (::read(wake_fd, &count, sizeof(count)) < 0) {}
+                continue;
+            }
+            http_event e = { ready[i].data.fd, (ready[i].events & EPOLLIN) != 0, (ready[i].events & EPOLLOUT) != 0,
+                (ready[i].events & (EPOLLERR | EPOLLHUP)) != 0 };
+            events.push_back(e);
+        }
+#else
+        pfds.clear();
+        for (auto &f : fds) {
+            struct pollfd p;
+            p.fd = f.first;
+            p.events = f.second;
+            p.revents = 0;
+            pfds.push_back(p);
+        }
+        if (pfds.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            return;
+        }
+        if (poll(pfds.data(), (unsigned long)pfds.size(), timeout_ms) <= 0) return;
+        for (auto &p : pfds) {
+            if (!p.revents) continue;
+            http_event e = { (SOCKET)p.fd, (p.revents & POLLIN) != 0, (p.revents & POLLOUT) != 0,
+                (p.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0 };
+            events.push_back(e);
+        }
+#endif
     }
+};
 
-    bool release()
+class http_server
+{
+    std::mutex mtx;             // streams, listeners
+    std::vector<std::unique_ptr<http_stream_state>> streams;
+    std::vector<http_listener> listeners;
+    std::thread thread;
+    http_poller poller;
+    // the server thread only
+    std::map<SOCKET, http_client> clients;
+    std::vector<http_stream_state*> states;     // of streams, the states don't move
+    std::vector<long long> delivered;           // seq of the frame last queued per stream
+
+    http_stream_state &state(int stream)
     {
-        if (sock != INVALID_SOCKET)
-            ::shutdown(sock, 2);
-        sock = (INVALID_SOCKET);
-        return false;
+        if (stream >= (int)states.size()) {
+            std::lock_guard<std::mutex> lock(mtx);
+            states.clear();
+            for (auto &s : streams) states.push_back(s.get());
+        }
+        return *states[stream];
     }
 
-    void close_all()
+    http_listener *find_listener(int port)
     {
-        close_all_sockets = 1;
-        write("\n]");   // close JSON array
+        for (auto &l : listeners) {
+            if (l.port == port && !l.closed) return &l;
+        }
+        return NULL;
     }
 
-    bool open(int port)
+    // the open streams of a port
+    int port_streams(int port, int *stream)
     {
-        sock = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int count = 0;
+        for (size_t i = 0; i < streams.size(); ++i) {
+            if (streams[i]->port == port && !streams[i]->closed) {
+                if (stream) *stream = (int)i;
+                ++count;
+            }
+        }
+        return count;
+    }
 
+    static SOCKET listen_port(int port)
+    {
+        SOCKET sock = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
         SOCKADDR_IN address;
+        memset(&address, 0, sizeof(address));
         address.sin_addr.s_addr = INADDR_ANY;
         address.sin_family = AF_INET;
-        address.sin_port = htons(port);    // ::htons(port);
+        address.sin_port = htons(port);
         int reuse = 1;
         if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) < 0)
             cerr << "setsockopt(SO_REUSEADDR) failed" << endl;
-
-        // Non-blocking sockets
-        // Windows: ioctlsocket() and FIONBIO
-        // Linux: fcntl() and O_NONBLOCK
-#ifdef WIN32
-        unsigned long i_mode = 1;
-        int result = ioctlsocket(sock, FIONBIO, &i_mode);
-        if (result != NO_ERROR) {
-            std::cerr << "ioctlsocket(FIONBIO) failed with error: " << result << std::endl;
-        }
-#else // WIN32
-        int flags = fcntl(sock, F_GETFL, 0);
-        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
-#endif // WIN32
-
-#ifdef SO_REUSEPORT
-        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0)
-            cerr << "setsockopt(SO_REUSEPORT) failed" << endl;
-#endif
-        if (::bind(sock, (SOCKADDR*)&address, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
-        {
-            cerr << "error JSON_sender: couldn't bind sock " << sock << " to port " << port << "!" << endl;
-            return release();
+        http_set_nonblocking(sock);
+        if (::bind(sock, (SOCKADDR*)&address, sizeof(SOCKADDR_IN)) == SOCKET_ERROR) {
+            cerr << "error http_server: couldn't bind sock " << sock << " to port " << port << "!" << endl;
+            http_close_socket(sock);
+            return INVALID_SOCKET;
         }
-        if (::listen(sock, 10) == SOCKET_ERROR)
-        {
-            cerr << "error JSON_sender: couldn't listen on sock " << sock << " on port " << port << " !" << endl;
-            return release();
+        if (::listen(sock, 64) == SOCKET_ERROR) {
+            cerr << "error http_server: couldn't listen on sock " << sock << " on port " << port << " !" << endl;
+            http_close_socket(sock);
+            return INVALID_SOCKET;
         }
-        FD_ZERO(&master);
-        FD_SET(sock, &master);
-        maxfd = sock;
-        return true;
+        return sock;
     }
 
-    bool isOpened()
+    void close_client(http_client &c)
     {
-        return sock != INVALID_SOCKET;
+        if (c.stream >= 0) state(c.stream).clients--;
+        poller.remove(c.fd);
+        http_close_socket(c.fd);
+        c.fd = INVALID_SOCKET;
     }
 
-    bool write(char const* outputbuf)
+    void queue(http_client &c, const http_frame &frame, double now)
     {
-        fd_set rread = master;
-        struct timeval select_timeout = { 0, 0 };
-        struct timeval socket_timeout = { 0, timeout };
-        if (::select(maxfd + 1, &rread, NULL, NULL, &select_timeout) <= 0)
-            return true; // nothing broken, there's just noone listening
+        http_stream_state &s = state(c.stream);
+        if (!c.current) {
+            if (c.head_sent == c.head.size()) c.progress = now;
+            c.current = frame;
+            c.sent = (s.type == HTTP_STREAM_JSON && !c.started) ? sizeof(HTTP_JSON_SEPARATOR) - 1 : 0;
+            c.started = true;
+        }
+        else {
+            if (c.next) s.frames_dropped++;
+            c.next = frame;
+        }
+    }
 
-        int outlen = static_cast<int>(strlen(outputbuf));
+    void subscribe(http_client &c, int stream, double now)
+    {
+        http_stream_state &s = state(stream);
+        c.stream = stream;
+        c.head = (s.type == HTTP_STREAM_JSON) ? http_json_header : http_mjpeg_header;
+        c.head_sent = 0;
+        c.progress = now;
+        s.clients++;
+        s.connections++;
+        http_frame latest;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            latest = s.latest;
+            c.seq = s.seq;
+        }
+        if (latest) queue(c, latest, now);
+    }
 
+    // writes what the socket takes; false - the client is gone
+    bool flush(http_client &c, double now)
+    {
+        for (;;) {
+            const char *p;
+            size_t left;
+            const bool head = c.head_sent < c.head.size();
+            if (head) {
+                p = c.head.data() + c.head_sent;
+                left = c.head.size() - c.head_sent;
+            }
+            else if (c.current) {
+                p = c.current->at(c.sent, &left);
+            }
+            else break;
+            const int n = ::send(c.fd, p, (int)left, HTTP_SEND_FLAGS);
+            if (n < 0) {
+                if (http_would_block()) break;
+                return false;
+            }
+            c.progress = now;
+            if (c.stream >= 0) state(c.stream).bytes_sent += n;
+            if (head) c.head_sent += n;
+            else if ((c.sent += n) == c.current->size()) {
+                state(c.stream).frames_sent++;
+                c.current = c.next;
+                c.next.reset();
+                c.sent = 0;
+            }
+        }
+        const bool pending = c.head_sent < c.head.size() || c.current;
+        if (!pending && c.close_after_flush) return false;
+        if (pending != c.want_write) {
+            poller.modify(c.fd, pending);
+            c.want_write = pending;
+        }
+        return true;
+    }
+
+    void accept_clients(SOCKET listener, int port, double now)
+    {
+        for (;;) {
+            SOCKADDR_IN address;
 #ifdef _WIN32
-        for (unsigned i = 0; i<rread.fd_count; i++)
-        {
-            int addrlen = sizeof(SOCKADDR);
-            SOCKET s = rread.fd_array[i];    // fd_set on win is an array, while ...
+            int addrlen = sizeof(address);
 #else
-        for (int s = 0; s <= maxfd; s++)
-        {
-            socklen_t addrlen = sizeof(SOCKADDR);
-            if (!FD_ISSET(s, &rread))      // ... on linux it's a bitmask ;)
-                continue;
+            socklen_t addrlen = sizeof(address);
 #endif
-            if (s == sock) // request on master socket, accept and send main header.
+            SOCKET fd = ::accept(listener, (SOCKADDR*)&address, &addrlen);
+            if (fd == INVALID_SOCKET) return;
+            http_set_nonblocking(fd);
+            http_client &c = clients[fd];
+            c = http_client();
+            c.fd = fd;
+            c.port = port;
+            c.progress = now;
+            poller.add(fd);
+            int stream = -1;
+            int count;
             {
-                SOCKADDR_IN address = { 0 };
-                SOCKET      client = ::accept(sock, (SOCKADDR*)&address, &addrlen);
-                if (client == SOCKET_ERROR)
-                {
-                    cerr << "error JSON_sender: couldn't accept connection on sock " << sock << " !" << endl;
-                    return false;
+                std::lock_guard<std::mutex> lock(mtx);
+                count = port_streams(port, &stream);
+            }
+            // a single stream on the port is sent right away, as the old senders did
+            if (count == 1) {
+                subscribe(c, stream, now);
+                if (!flush(c, now)) {
+                    close_client(c);
+                    clients.erase(fd);
                 }
-                if (setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (char *)&socket_timeout, sizeof(socket_timeout)) < 0) {
-                    cerr << "error JSON_sender: SO_RCVTIMEO setsockopt failed\n";
+            }
+        }
+    }
+
+    // false - the client is gone
+    bool read_client(http_client &c, double now)
+    {
+        char buf[1024];
+        for (;;) {
+            const int n = ::recv(c.fd, buf, sizeof(buf), 0);
+            if (n == 0) return false;
+            if (n < 0) {
+                if (http_would_block()) break;
+                return false;
+            }
+            if (c.stream >= 0 || c.close_after_flush) continue;     // nothing else is read
+            c.request.append(buf, n);
+            if (c.request.size() > HTTP_MAX_REQUEST) return false;
+        }
+        if (c.stream >= 0 || c.close_after_flush || c.request.find("\r\n\r\n") == std::string::npos) return true;
+
+        // GET /path[?query] HTTP/1.x
+        const size_t start = c.request.find(' ');
+        const size_t end = (start == std::string::npos) ? start : c.request.find_first_of(" ?", start + 1);
+        const std::string path = (end == std::string::npos) ? std::string() : c.request.substr(start + 1, end - start - 1);
+        int stream = -1;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (size_t i = 0; i < streams.size(); ++i) {
+                if (streams[i]->port == c.port && !streams[i]->closed && streams[i]->path == path) stream = (int)i;
+            }
+        }
+        if (stream < 0) {
+            c.head = http_not_found;
+            c.head_sent = 0;
+            c.close_after_flush = true;
+        }
+        else subscribe(c, stream, now);
+        return flush(c, now);
+    }
+
+    void run()
+    {
+        std::vector<http_event> events;
+        struct published_frame {
+            int stream;
+            long long seq;
+            http_frame frame;
+        };
+        std::vector<published_frame> published;
+        while (!exit_flag) {
+            poller.wait(events, HTTP_POLL_MS);
+            const double now = http_now_us();
+
+            // new and closed listeners, new frames, closed streams
+            std::vector<int> closing;
+            published.clear();
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                for (auto &l : listeners) {
+                    if (!l.registered && !l.closed) {
+                        poller.add(l.fd);
+                        l.registered = true;
+                    }
+                    if (l.closed && l.fd != INVALID_SOCKET) {
+                        if (l.registered) poller.remove(l.fd);
+                        http_close_socket(l.fd);
+                        l.fd = INVALID_SOCKET;
+                    }
                 }
-                if (setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (char *)&socket_timeout, sizeof(socket_timeout)) < 0) {
-                    cerr << "error JSON_sender: SO_SNDTIMEO setsockopt failed\n";
+                delivered.resize(streams.size(), 0);
+                states.clear();
+                for (auto &st : streams) states.push_back(st.get());
+                for (size_t i = 0; i < streams.size(); ++i) {
+                    if (streams[i]->closed && delivered[i] >= 0) {
+                        closing.push_back((int)i);
+                        delivered[i] = -1;
+                    }
+                    else if (!streams[i]->closed && streams[i]->seq != delivered[i]) {
+                        published_frame f = { (int)i, streams[i]->seq, streams[i]->latest };
+                        published.push_back(f);
+                        delivered[i] = streams[i]->seq;
+                    }
                 }
-                maxfd = (maxfd>client ? maxfd : client);
-                FD_SET(client, &master);
-                _write(client, "HTTP/1.0 200 OK\r\n", 0);
-                _write(client,
-                    "Server: Mozarella/2.2\r\n"
-                    "Accept-Range: bytes\r\n"
-                    "Connection: close\r\n"
-                    "Max-Age: 0\r\n"
-                    "Expires: 0\r\n"
-                    "Cache-Control: no-cache, private\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Content-Type: application/json\r\n"
-                    //"Content-Type: multipart/x-mixed-replace; boundary=boundary\r\n"
-                    "\r\n", 0);
-                _write(client, "[\n", 0);   // open JSON array
-                int n = _write(client, outputbuf, outlen);
-                cerr << "JSON_sender: new client " << client << endl;
             }
-            else // existing client, just stream pix
-            {
-                //char head[400];
-                // application/x-resource+json or application/x-collection+json -  when you are representing REST resources and collections
-                // application/json or text/json or text/javascript or text/plain.
-                // https://stackoverflow.com/questions/477816/what-is-the-correct-json-content-type
-                //sprintf(head, "\r\nContent-Length: %zu\r\n\r\n", outlen);
-                //sprintf(head, "--boundary\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n", outlen);
-                //_write(s, head, 0);
-                if (!close_all_sockets) _write(s, ", \n", 0);
-                int n = _write(s, outputbuf, outlen);
-                if (n < (int)outlen)
+
+            for (auto &e : events) {
+                int port = -1;
                 {
-                    cerr << "JSON_sender: kill client " << s << endl;
-                    close_socket(s);
-                    //::shutdown(s, 2);
-                    FD_CLR(s, &master);
+                    std::lock_guard<std::mutex> lock(mtx);
+                    for (auto &l : listeners) {
+                        if (l.fd == e.fd && !l.closed) port = l.port;
+                    }
                 }
-
-                if (close_all_sockets) {
-                    int result = close_socket(s);
-                    cerr << "JSON_sender: close clinet: " << result << " \n";
+                if (port >= 0) {
+                    accept_clients(e.fd, port, now);
                     continue;
                 }
+                auto it = clients.find(e.fd);
+                if (it == clients.end()) continue;
+                http_client &c = it->second;
+                bool alive = !e.err || e.in;
+                if (alive && e.in) alive = read_client(c, now);
+                if (alive && e.out) alive = flush(c, now);
+                if (!alive) {
+                    close_client(c);
+                    clients.erase(it);
+                }
+            }
+
+            for (auto it = clients.begin(); it != clients.end();) {
+                http_client &c = it->second;
+                bool alive = true;
+                if (c.stream >= 0) {
+                    for (auto &f : published) {
+                        if (f.stream != c.stream || f.seq <= c.seq) continue;
+                        queue(c, f.frame, now);
+                        c.seq = f.seq;
+                    }
+                    for (int s : closing) {
+                        if (s != c.stream) continue;
+                        // the JSON array is closed
+                        if (state(s).type == HTTP_STREAM_JSON && c.started) {
+                            std::shared_ptr<http_frame_data> close_array = std::make_shared<http_frame_data>();
+                            close_array->head = "\n]";
+                            queue(c, close_array, now);
+                        }
+                        c.close_after_flush = true;
+                    }
+                    alive = flush(c, now);
+                }
+                const bool pending = c.head_sent < c.head.size() || c.current;
+                if (alive && (c.stream >= 0 ? pending && now - c.progress > state(c.stream).timeout : now - c.progress > HTTP_REQUEST_TIMEOUT)) {
+                    cerr << "http_server: kill client " << c.fd << endl;
+                    alive = false;
+                }
+                if (!alive) {
+                    close_client(c);
+                    it = clients.erase(it);
+                }
+                else ++it;
             }
         }
-        if (close_all_sockets) {
-            int result = close_socket(sock);
-            cerr << "JSON_sender: close acceptor: " << result << " \n\n";
+    }
+
+public:
+    std::atomic<int> exit_flag;
+
+    http_server() : exit_flag(0) {}
+
+    void start()
+    {
+        thread = std::thread([this]() { run(); });
+    }
+
+    void stop()
+    {
+        exit_flag = 1;
+        poller.wake();
+        if (thread.joinable()) thread.join();
+    }
+
+    int open(int port, const char *path, http_stream_type type, int timeout)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t i = 0; i < streams.size(); ++i) {
+            const http_stream_state &s = *streams[i];
+            if (s.port == port && s.path == path && !s.closed) return s.type == type ? (int)i : -1;
         }
-        return true;
+        if (!find_listener(port)) {
+            http_listener l;
+            l.fd = listen_port(port);
+            if (l.fd == INVALID_SOCKET) return -1;
+            l.port = port;
+            l.registered = false;
+            l.closed = false;
+            listeners.push_back(l);
+        }
+        std::unique_ptr<http_stream_state> s(new http_stream_state);
+        s->port = port;
+        s->path = path;
+        s->type = type;
+        s->timeout = timeout > 0 ? timeout : 400000;
+        streams.push_back(std::move(s));
+        poller.wake();
+        return (int)streams.size() - 1;
+    }
+
+    void close(int stream)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stream < 0 || stream >= (int)streams.size() || streams[stream]->closed) return;
+        streams[stream]->closed = true;
+        if (!port_streams(streams[stream]->port, NULL)) {
+            http_listener *l = find_listener(streams[stream]->port);
+            if (l) l->closed = true;
+        }
+        poller.wake();
+    }
+
+    http_stream_state *get(int stream)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return (stream >= 0 && stream < (int)streams.size()) ? streams[stream].get() : NULL;
+    }
+
+    int count()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return (int)streams.size();
+    }
+
+    // the body of the frame is sent as it is, the head is set here
+    void publish(int stream, std::shared_ptr<http_frame_data> frame)
+    {
+        http_stream_state *s = get(stream);
+        if (!s) return;
+        if (s->type == HTTP_STREAM_MJPEG) {
+            char head[128];
+            sprintf(head, "--mjpegstream\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n", (int)frame->body.size());
+            frame->head = head;
+        }
+        else frame->head = HTTP_JSON_SEPARATOR;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            s->latest = frame;
+            s->seq++;
         }
+        s->frames++;
+        poller.wake();
+    }
 };
+
+static http_server *get_http_server()
+{
+    static std::mutex mtx_server;
+    static http_server *server = NULL;
+    std::lock_guard<std::mutex> lock(mtx_server);
+    if (!server) {
+        server = new http_server;
+        server->start();
+    }
+    return server;
+}
+
+int http_stream_open(int port, const char *path, http_stream_type type, int timeout)
+{
+    return get_http_server()->open(port, path ? path : "/", type, timeout);
+}
+
+void http_stream_close(int stream)
+{
+    get_http_server()->close(stream);
+}
+
+int http_stream_clients(int stream)
+{
+    http_stream_state *s = get_http_server()->get(stream);
+    return s ? s->clients.load() : 0;
+}
+
+void http_stream_publish(int stream, const char *data, size_t size)
+{
+    std::shared_ptr<http_frame_data> frame = std::make_shared<http_frame_data>();
+    frame->body.assign((const unsigned char*)data, (const unsigned char*)data + size);
+    get_http_server()->publish(stream, frame);
+}
+
+http_stream_stats get_http_stream_stats(int stream)
+{
+    http_server *server = get_http_server();
+    http_stream_stats stats = { 0 };
+    const int count = server->count();
+    for (int i = 0; i < count; ++i) {
+        if (stream >= 0 && i != stream) continue;
+        http_stream_state *s = server->get(i);
+        stats.clients += s->clients;
+        stats.connections += s->connections;
+        stats.frames += s->frames;
+        stats.frames_sent += s->frames_sent;
+        stats.frames_dropped += s->frames_dropped;
+        stats.bytes_sent += s->bytes_sent;
+    }
+    return stats;
+}
 // ----------------------------------------
 
-static std::unique_ptr<JSON_sender> js_ptr;
+// the JSON stream of a port, with the writer send_json() reuses frame after frame
+struct json_port_stream {
+    int stream;
+    json_writer json{};
+    std::mutex mtx;
+    ~json_port_stream() { json_writer_free(&json); }
+};
+static std::map<int, std::unique_ptr<json_port_stream>> json_streams;
 static std::mutex mtx;
 
+// the timeout of the first call on a port is used
+static json_port_stream *get_json_stream(int port, int timeout)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    std::unique_ptr<json_port_stream> &js = json_streams[port];
+    if (!js) {
+        js.reset(new json_port_stream);
+        js->stream = http_stream_open(port, "/", HTTP_STREAM_JSON, timeout);
+    }
+    return js.get();
+}
+
 void delete_json_sender()
 {
     std::lock_guard<std::mutex> lock(mtx);
-    js_ptr.release();
+    for (auto &js : json_streams) http_stream_close(js.second->stream);
+    json_streams.clear();
 }
 
 void send_json_custom(char const* send_buf, int port, int timeout)
 {
     try {
-        std::lock_guard<std::mutex> lock(mtx);
-        if(!js_ptr) js_ptr.reset(new JSON_sender(port, timeout));
-
-        js_ptr->write(send_buf);
+        json_port_stream *js = get_json_stream(port, timeout);
+        if (js->stream >= 0) http_stream_publish(js->stream, send_buf, strlen(send_buf));
     }
     catch (...) {
         cerr << " Error in send_json_custom() function \n";
@@ -313,12 +836,13 @@ void send_json_custom(char const* send_buf, int port, int timeout)
 void send_json(detection *dets, int nboxes, int classes, char **names, long long int frame_id, int port, int timeout)
 {
     try {
-        char *send_buf = detection_to_json(dets, nboxes, classes, names, frame_id, NULL);
-
-        send_json_custom(send_buf, port, timeout);
+        json_port_stream *js = get_json_stream(port, timeout);
+        if (js->stream < 0 || !http_stream_clients(js->stream)) return;
+        std::lock_guard<std::mutex> lock(js->mtx);
+        json_writer_reset(&js->json);
+        json_write_detections(&js->json, dets, nboxes, classes, names, frame_id, NULL);
+        http_stream_publish(js->stream, js->json.buf, js->json.len);
         std::cout << " JSON-stream sent. \n";
-
-        free(send_buf);
     }
     catch (...) {
         cerr << " Error in send_json() function \n";
@@ -326,226 +850,334 @@ void send_json(detection *dets, int nboxes, int classes, char **names, long long
 }
 // ----------------------------------------
 
+// ----------------------------------------
+// MJPEG encoding stage: send_mjpeg_frame() copies the frame and returns, a pool of
+// threads downscales and encodes it and publishes the JPEG in the buffer it was
+// encoded into. Drop-to-latest: a frame no thread has taken yet is replaced by the
+// next one, and a JPEG finished after a newer one was published is dropped.
+// ----------------------------------------
 
-#ifdef OPENCV
-
-#include <opencv2/opencv.hpp>
-#include <opencv2/highgui/highgui.hpp>
-#include <opencv2/highgui/highgui_c.h>
-#include <opencv2/imgproc/imgproc_c.h>
-#ifndef CV_VERSION_EPOCH
-#include <opencv2/videoio/videoio.hpp>
-#endif
-using namespace cv;
+#define MJPEG_DEFAULT_THREADS 2
+#define MJPEG_MAX_SPARE 8       // recycled JPEG buffers kept per port
 
+static int mjpeg_threads = MJPEG_DEFAULT_THREADS;
+static int mjpeg_max_width = 0;
 
+void set_mjpeg_encoder(int threads, int max_width)
+{
+    mjpeg_threads = (threads < 0) ? MJPEG_DEFAULT_THREADS : threads;
+    mjpeg_max_width = (max_width < 0) ? 0 : max_width;
+}
 
-class MJPG_sender
+// the size the frame is encoded at: max_width wide, the aspect ratio kept
+static void mjpeg_encoded_size(int w, int h, int max_width, int *nw, int *nh)
 {
-    SOCKET sock;
-    SOCKET maxfd;
-    fd_set master;
-    int timeout; // master sock timeout, shutdown after timeout usec.
-    int quality; // jpeg compression [1..100]
-    int close_all_sockets;
+    *nw = w;
+    *nh = h;
+    if (max_width <= 0 || w <= max_width) return;
+    *nw = max_width;
+    *nh = std::max(1, (int)(((long long)h * max_width + w / 2) / w));
+}
 
-    int _write(int sock, char const*const s, int len)
-    {
-        if (len < 1) { len = strlen(s); }
-        return ::send(sock, s, len, 0);
-    }
+static bool mjpeg_encode(const unsigned char *data, int w, int h, int c, int step, int quality, int max_width,
+    std::vector<unsigned char> &scratch, std::vector<unsigned char> &out);
 
-public:
+// a frame waiting for an encoder thread, copied from the caller's
+struct mjpeg_raw {
+    std::vector<unsigned char> pixels;  // packed rows of w * c
+    int w, h, c;
+    long long seq;
+};
 
-    MJPG_sender(int port = 0, int _timeout = 400000, int _quality = 30)
-        : sock(INVALID_SOCKET)
-        , timeout(_timeout)
-        , quality(_quality)
-    {
-        close_all_sockets = 0;
-        FD_ZERO(&master);
-        if (port)
-            open(port);
-    }
+// the JPEG buffers of a port, back from the server when a frame is done with
+struct mjpeg_buffer_pool {
+    std::mutex mtx;
+    std::vector<std::vector<unsigned char>> spare;
+};
 
-    ~MJPG_sender()
+static std::shared_ptr<http_frame_data> mjpeg_frame_from(const std::shared_ptr<mjpeg_buffer_pool> &pool)
+{
+    http_frame_data *frame = new http_frame_data;
     {
-        close_all();
-        release();
+        std::lock_guard<std::mutex> lock(pool->mtx);
+        if (!pool->spare.empty()) {
+            frame->body.swap(pool->spare.back());
+            pool->spare.pop_back();
+        }
     }
+    return std::shared_ptr<http_frame_data>(frame, [pool](http_frame_data *f) {
+        {
+            std::lock_guard<std::mutex> lock(pool->mtx);
+            if (pool->spare.size() < MJPEG_MAX_SPARE) pool->spare.push_back(std::move(f->body));
+        }
+        delete f;
+    });
+}
 
-    bool release()
+struct mjpeg_port_encoder {
+    int stream;
+    int quality;
+    int max_width;
+    int threads;                // 0 - encoded on the caller's thread
+    std::vector<std::thread> workers;
+    std::shared_ptr<mjpeg_buffer_pool> buffers;
+    std::vector<unsigned char> scratch;     // threads 0, under mtx
+
+    std::mutex mtx;             // everything below
+    std::condition_variable work, idle;
+    std::unique_ptr<mjpeg_raw> pending;     // the latest frame no thread has taken
+    std::vector<std::unique_ptr<mjpeg_raw>> spare;
+    long long seq;              // of the last frame handed in
+    long long published;        // seq of the last JPEG published
+    int busy;
+    mjpeg_encoder_stats stats;
+
+    mjpeg_port_encoder() : stream(-1), quality(0), max_width(0), threads(0), buffers(std::make_shared<mjpeg_buffer_pool>()),
+        seq(0), published(0), busy(0), stats() {}
+
+    // under mtx, in the order of seq: a JPEG can't be replaced by an older one
+    void publish(std::shared_ptr<http_frame_data> &frame, long long frame_seq, double encode_ms)
     {
-        if (sock != INVALID_SOCKET)
-            ::shutdown(sock, 2);
-        sock = (INVALID_SOCKET);
-        return false;
+        stats.encode_ms += encode_ms;
+        if (frame_seq <= published) {
+            stats.late++;
+            return;
+        }
+        published = frame_seq;
+        stats.encoded++;
+        get_http_server()->publish(stream, frame);
     }
 
-    void close_all()
+    void run()
     {
-        close_all_sockets = 1;
-        cv::Mat tmp(cv::Size(10, 10), CV_8UC3);
-        write(tmp);
+        std::vector<unsigned char> worker_scratch;
+        std::unique_lock<std::mutex> lock(mtx);
+        for (;;) {
+            work.wait(lock, [this]() { return (bool)pending; });
+            std::unique_ptr<mjpeg_raw> raw = std::move(pending);
+            busy++;
+            lock.unlock();
+
+            std::shared_ptr<http_frame_data> frame = mjpeg_frame_from(buffers);
+            const double start = http_now_us();
+            const bool ok = mjpeg_encode(raw->pixels.data(), raw->w, raw->h, raw->c, raw->w * raw->c, quality, max_width,
+                worker_scratch, frame->body);
+            const double encode_ms = (http_now_us() - start) / 1000;
+
+            lock.lock();
+            if (ok) publish(frame, raw->seq, encode_ms);
+            spare.push_back(std::move(raw));
+            busy--;
+            if (!pending && !busy) idle.notify_all();
+        }
     }
 
-    bool open(int port)
+    // true - the frame is encoded or queued
+    bool push(const unsigned char *data, int w, int h, int c, int step)
     {
-        sock = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-
-        SOCKADDR_IN address;
-        address.sin_addr.s_addr = INADDR_ANY;
-        address.sin_family = AF_INET;
-        address.sin_port = htons(port);    // ::htons(port);
-        int reuse = 1;
-        if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) < 0)
-            cerr << "setsockopt(SO_REUSEADDR) failed" << endl;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stats.frames++;
+            if (!http_stream_clients(stream)) {
+                stats.skipped++;
+                return false;
+            }
+        }
+        if (threads == 0) {
+            std::lock_guard<std::mutex> lock(mtx);
+            std::shared_ptr<http_frame_data> frame = mjpeg_frame_from(buffers);
+            const double start = http_now_us();
+            if (!mjpeg_encode(data, w, h, c, step, quality, max_width, scratch, frame->body)) return false;
+            publish(frame, ++seq, (http_now_us() - start) / 1000);
+            return true;
+        }
 
-        // Non-blocking sockets
-        // Windows: ioctlsocket() and FIONBIO
-        // Linux: fcntl() and O_NONBLOCK
-#ifdef WIN32
-        unsigned long i_mode = 1;
-        int result = ioctlsocket(sock, FIONBIO, &i_mode);
-        if (result != NO_ERROR) {
-            std::cerr << "ioctlsocket(FIONBIO) failed with error: " << result << std::endl;
-        }
-#else // WIN32
-        int flags = fcntl(sock, F_GETFL, 0);
-        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
-#endif // WIN32
-
-#ifdef SO_REUSEPORT
-        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0)
-            cerr << "setsockopt(SO_REUSEPORT) failed" << endl;
-#endif
-        if (::bind(sock, (SOCKADDR*)&address, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+        std::unique_ptr<mjpeg_raw> raw;
         {
-            cerr << "error MJPG_sender: couldn't bind sock " << sock << " to port " << port << "!" << endl;
-            return release();
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!spare.empty()) {
+                raw = std::move(spare.back());
+                spare.pop_back();
+            }
         }
-        if (::listen(sock, 10) == SOCKET_ERROR)
+        if (!raw) raw.reset(new mjpeg_raw);
+        // the only work left on the caller's thread
+        const size_t row = (size_t)w * c;
+        raw->pixels.resize(row * h);
+        for (int y = 0; y < h; ++y) memcpy(raw->pixels.data() + row * y, data + (size_t)step * y, row);
+        raw->w = w;
+        raw->h = h;
+        raw->c = c;
         {
-            cerr << "error MJPG_sender: couldn't listen on sock " << sock << " on port " << port << " !" << endl;
-            return release();
+            std::lock_guard<std::mutex> lock(mtx);
+            raw->seq = ++seq;
+            if (pending) {
+                stats.dropped++;
+                spare.push_back(std::move(pending));
+            }
+            pending = std::move(raw);
         }
-        FD_ZERO(&master);
-        FD_SET(sock, &master);
-        maxfd = sock;
+        work.notify_one();
         return true;
     }
 
-    bool isOpened()
+    void wait_idle()
     {
-        return sock != INVALID_SOCKET;
+        std::unique_lock<std::mutex> lock(mtx);
+        idle.wait(lock, [this]() { return !pending && !busy; });
     }
+};
 
-    bool write(const Mat & frame)
-    {
-        fd_set rread = master;
-        struct timeval select_timeout = { 0, 0 };
-        struct timeval socket_timeout = { 0, timeout };
-        if (::select(maxfd + 1, &rread, NULL, NULL, &select_timeout) <= 0)
-            return true; // nothing broken, there's just noone listening
-
-        std::vector<uchar> outbuf;
-        std::vector<int> params;
-        params.push_back(IMWRITE_JPEG_QUALITY);
-        params.push_back(quality);
-        cv::imencode(".jpg", frame, outbuf, params);  //REMOVED FOR COMPATIBILITY
-        // https://docs.opencv.org/3.4/d4/da8/group__imgcodecs.html#ga292d81be8d76901bff7988d18d2b42ac
-        //std::cerr << "cv::imencode call disabled!" << std::endl;
-        int outlen = static_cast<int>(outbuf.size());
+// as the server, the encoders and their threads live until the process exits
+static std::map<int, mjpeg_port_encoder*> mjpeg_encoders;
+static std::mutex mtx_mjpeg;
 
-#ifdef _WIN32
-        for (unsigned i = 0; i<rread.fd_count; i++)
-        {
-            int addrlen = sizeof(SOCKADDR);
-            SOCKET s = rread.fd_array[i];    // fd_set on win is an array, while ...
-#else
-        for (int s = 0; s <= maxfd; s++)
-        {
-            socklen_t addrlen = sizeof(SOCKADDR);
-            if (!FD_ISSET(s, &rread))      // ... on linux it's a bitmask ;)
-                continue;
-#endif
-            if (s == sock) // request on master socket, accept and send main header.
-            {
-                SOCKADDR_IN address = { 0 };
-                SOCKET      client = ::accept(sock, (SOCKADDR*)&address, &addrlen);
-                if (client == SOCKET_ERROR)
-                {
-                    cerr << "error MJPG_sender: couldn't accept connection on sock " << sock << " !" << endl;
-                    return false;
-                }
-                if (setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (char *)&socket_timeout, sizeof(socket_timeout)) < 0) {
-                    cerr << "error MJPG_sender: SO_RCVTIMEO setsockopt failed\n";
-                }
-                if (setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (char *)&socket_timeout, sizeof(socket_timeout)) < 0) {
-                    cerr << "error MJPG_sender: SO_SNDTIMEO setsockopt failed\n";
-                }
-                maxfd = (maxfd>client ? maxfd : client);
-                FD_SET(client, &master);
-                _write(client, "HTTP/1.0 200 OK\r\n", 0);
-                _write(client,
-                    "Server: Mozarella/2.2\r\n"
-                    "Accept-Range: bytes\r\n"
-                    "Connection: close\r\n"
-                    "Max-Age: 0\r\n"
-                    "Expires: 0\r\n"
-                    "Cache-Control: no-cache, private\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Content-Type: multipart/x-mixed-replace; boundary=mjpegstream\r\n"
-                    "\r\n", 0);
-                cerr << "MJPG_sender: new client " << client << endl;
-            }
-            else // existing client, just stream pix
-            {
-                if (close_all_sockets) {
-                    int result = close_socket(s);
-                    cerr << "MJPG_sender: close clinet: " << result << " \n";
-                    continue;
-                }
+// the settings of set_mjpeg_encoder(), the quality and timeout of the first call on a port are used
+static mjpeg_port_encoder *get_mjpeg_encoder(int port, int timeout, int quality, bool create)
+{
+    std::lock_guard<std::mutex> lock(mtx_mjpeg);
+    auto it = mjpeg_encoders.find(port);
+    if (it != mjpeg_encoders.end()) return it->second;
+    if (!create) return NULL;
+    mjpeg_port_encoder *e = new mjpeg_port_encoder;
+    e->stream = http_stream_open(port, "/", HTTP_STREAM_MJPEG, timeout);
+    e->quality = quality;
+    e->max_width = mjpeg_max_width;
+    e->threads = mjpeg_threads;
+    if (e->stream >= 0) {
+        for (int i = 0; i < e->threads; ++i) e->workers.push_back(std::thread([e]() { e->run(); }));
+    }
+    mjpeg_encoders[port] = e;
+    return e;
+}
 
-                char head[400];
-                sprintf(head, "--mjpegstream\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n", outlen);
-                _write(s, head, 0);
-                int n = _write(s, (char*)(&outbuf[0]), outlen);
-                cerr << "known client: " << s << ", sent = " << n << ", must be sent outlen = " << outlen << endl;
-                if (n < (int)outlen)
-                {
-                    cerr << "MJPG_sender: kill client " << s << endl;
-                    //::shutdown(s, 2);
-                    close_socket(s);
-                    FD_CLR(s, &master);
+int send_mjpeg_frame(const unsigned char *data, int w, int h, int c, int step, int port, int timeout, int quality)
+{
+    try {
+        mjpeg_port_encoder *e = get_mjpeg_encoder(port, timeout, quality, true);
+        return e->stream >= 0 && e->push(data, w, h, c, step);
+    }
+    catch (...) {
+        cerr << " Error in send_mjpeg_frame() function \n";
+    }
+    return 0;
+}
+
+void wait_mjpeg_encoder(int port)
+{
+    mjpeg_port_encoder *e = get_mjpeg_encoder(port, 0, 0, false);
+    if (e) e->wait_idle();
+}
+
+mjpeg_encoder_stats get_mjpeg_encoder_stats(int port)
+{
+    mjpeg_encoder_stats stats = { 0 };
+    mjpeg_port_encoder *e = get_mjpeg_encoder(port, 0, 0, false);
+    if (e) {
+        std::lock_guard<std::mutex> lock(e->mtx);
+        stats = e->stats;
+    }
+    return stats;
+}
+
+#ifndef OPENCV
+#include "stb_image_write.h"
+
+static void mjpeg_write(void *context, void *data, int size)
+{
+    std::vector<unsigned char> *out = (std::vector<unsigned char>*)context;
+    out->insert(out->end(), (unsigned char*)data, (unsigned char*)data + size);
+}
+
+// the channel of the RGB(A) of stb for channel k of BGR(A)
+static inline int mjpeg_rgb_channel(int k, int c)
+{
+    return (c >= 3 && k < 3) ? 2 - k : k;
+}
+
+// box filter to nw x nh, BGR(A) to RGB(A)
+static void mjpeg_resize_rgb(const unsigned char *src, int w, int h, int c, int step, int nw, int nh, unsigned char *dst)
+{
+    for (int y = 0; y < nh; ++y) {
+        const int y0 = (int)((long long)y * h / nh);
+        const int y1 = std::max(y0 + 1, (int)((long long)(y + 1) * h / nh));
+        for (int x = 0; x < nw; ++x) {
+            const int x0 = (int)((long long)x * w / nw);
+            const int x1 = std::max(x0 + 1, (int)((long long)(x + 1) * w / nw));
+            const int area = (y1 - y0) * (x1 - x0);
+            unsigned char *d = dst + ((size_t)y * nw + x) * c;
+            for (int k = 0; k < c; ++k) {
+                int sum = 0;
+                for (int sy = y0; sy < y1; ++sy) {
+                    const unsigned char *s = src + (size_t)sy * step + (size_t)x0 * c + k;
+                    for (int sx = x0; sx < x1; ++sx, s += c) sum += *s;
                 }
+                d[mjpeg_rgb_channel(k, c)] = (unsigned char)((sum + area / 2) / area);
             }
         }
-        if (close_all_sockets) {
-            int result = close_socket(sock);
-            cerr << "MJPG_sender: close acceptor: " << result << " \n\n";
+    }
+}
+
+static bool mjpeg_encode(const unsigned char *data, int w, int h, int c, int step, int quality, int max_width,
+    std::vector<unsigned char> &scratch, std::vector<unsigned char> &out)
+{
+    int nw, nh;
+    mjpeg_encoded_size(w, h, max_width, &nw, &nh);
+    scratch.resize((size_t)nw * nh * c);
+    if (nw == w && nh == h) {
+        for (int y = 0; y < h; ++y) {
+            const unsigned char *s = data + (size_t)step * y;
+            unsigned char *d = scratch.data() + (size_t)w * c * y;
+            if (c < 3) memcpy(d, s, (size_t)w * c);
+            else for (int x = 0; x < w * c; x += c) {
+                for (int k = 0; k < c; ++k) d[x + mjpeg_rgb_channel(k, c)] = s[x + k];
+            }
         }
-        return true;
     }
-};
+    else mjpeg_resize_rgb(data, w, h, c, step, nw, nh, scratch.data());
+    out.clear();
+    return stbi_write_jpg_to_func(mjpeg_write, &out, nw, nh, c, scratch.data(), quality) != 0;
+}
+#endif  // OPENCV
 // ----------------------------------------
 
-static std::mutex mtx_mjpeg;
+
+#ifdef OPENCV
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+#include <opencv2/imgproc/imgproc_c.h>
+#ifndef CV_VERSION_EPOCH
+#include <opencv2/videoio/videoio.hpp>
+#endif
+using namespace cv;
+
+
+
+static bool mjpeg_encode(const unsigned char *data, int w, int h, int c, int step, int quality, int max_width,
+    std::vector<unsigned char> &scratch, std::vector<unsigned char> &out)
+{
+    int nw, nh;
+    mjpeg_encoded_size(w, h, max_width, &nw, &nh);
+    cv::Mat src(h, w, CV_8UC(c), (void*)data, step);
+    std::vector<int> params;
+    params.push_back(IMWRITE_JPEG_QUALITY);
+    params.push_back(quality);
+    if (nw == w && nh == h) return cv::imencode(".jpg", src, out, params);
+    scratch.resize((size_t)nw * nh * c);
+    cv::Mat small(nh, nw, CV_8UC(c), scratch.data());
+    cv::resize(src, small, small.size(), 0, 0, INTER_AREA);
+    return cv::imencode(".jpg", small, out, params);
+}
 
 //struct mat_cv : cv::Mat { int a[0]; };
 
 void send_mjpeg(mat_cv* mat, int port, int timeout, int quality)
 {
-    try {
-        std::lock_guard<std::mutex> lock(mtx_mjpeg);
-        static MJPG_sender wri(port, timeout, quality);
-        //cv::Mat mat = cv::cvarrToMat(ipl);
-        wri.write(*(cv::Mat*)mat);
+    const cv::Mat &m = *(cv::Mat*)mat;
+    if (send_mjpeg_frame(m.data, m.cols, m.rows, m.channels(), (int)m.step, port, timeout, quality))
         std::cout << " MJPEG-stream sent. \n";
-    }
-    catch (...) {
-        cerr << " Error in send_mjpeg() function \n";
-    }
 }
 // ----------------------------------------
 
@@ -8,8 +8,61 @@ extern "C" {
 #include "image.h"
 #include <stdint.h>
 
+// Streaming server: one thread serves every MJPEG and JSON stream over non-blocking
+// sockets (epoll, poll elsewhere), so a slow client never holds up the caller. A frame
+// is published once and shared by all the clients of the stream; each client has a
+// write queue of the frame being sent and the latest one after it, a newer frame
+// replaces that one (drop-to-latest). A client that makes no progress for the timeout
+// is closed. The streams of a port are told apart by the path of the request; a port
+// with a single stream sends it to every client right away.
+typedef enum {
+    HTTP_STREAM_MJPEG, HTTP_STREAM_JSON
+} http_stream_type;
+
+typedef struct http_stream_stats {
+    int clients;                // connected now
+    long long connections;      // accepted so far
+    long long frames;           // published
+    long long frames_sent;      // to a client, whole
+    long long frames_dropped;   // replaced by a newer frame before a slow client got them
+    long long bytes_sent;
+} http_stream_stats;
+
+// the stream of port/path (the server thread is started on first use), -1 if the port
+// can't be opened or has the path with the other type; timeout in usec
+int http_stream_open(int port, const char *path, http_stream_type type, int timeout);
+// JSON: the array is closed for the clients, then they are
+void http_stream_close(int stream);
+int http_stream_clients(int stream);
+// a JPEG or a JSON object, copied
+void http_stream_publish(int stream, const char *data, size_t size);
+// stream -1: all the streams
+http_stream_stats get_http_stream_stats(int stream);
+
 void send_json(detection *dets, int nboxes, int classes, char **names, long long int frame_id, int port, int timeout);
 
+// MJPEG encoding off the caller's thread: a pool of threads per port downscales and
+// encodes the frames, the caller only copies the frame when the port has clients.
+// A frame not taken by a thread yet is replaced by the next one; the JPEGs are
+// published in order, each in the buffer it was encoded into (recycled).
+typedef struct mjpeg_encoder_stats {
+    long long frames;       // handed in
+    long long skipped;      // no clients, not encoded
+    long long dropped;      // replaced before a thread took them
+    long long late;         // encoded after a newer one was published
+    long long encoded;      // published
+    double encode_ms;       // in total
+} mjpeg_encoder_stats;
+
+// for the ports opened after: encoder threads (0 - the caller encodes, < 0 - the default 2)
+// and the width frames are downscaled to (0 - the full size)
+void set_mjpeg_encoder(int threads, int max_width);
+// packed BGR(A) or gray rows of step bytes; 1 - encoded or queued, 0 - skipped
+int send_mjpeg_frame(const unsigned char *data, int w, int h, int c, int step, int port, int timeout, int quality);
+// until the frames handed in are encoded or dropped
+void wait_mjpeg_encoder(int port);
+mjpeg_encoder_stats get_mjpeg_encoder_stats(int port);
+
 #ifdef OPENCV
 void send_mjpeg(mat_cv* mat, int port, int timeout, int quality);
 
@@ -91,3 +91,52 @@ void im2col_cpu_ext(const float* data_im, const int channels,
         }
     }
 }
+
+// im2col_cpu_ext() limited to the output rows [row_start, row_end), so the
+// column buffer can be filled (and multiplied) in chunks:
+// data_col is [channels*kernel_h*kernel_w] x [(row_end - row_start)*output_w]
+void im2col_cpu_ext_rows(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int row_start, const int row_end,
+    float* data_col)
+{
+    const int output_w = (width + 2 * pad_w -
+        (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+    const int channel_size = height * width;
+    const size_t col_size = (size_t)(row_end - row_start) * output_w;
+    int channel;
+    #pragma omp parallel for
+    for (channel = 0; channel < channels; ++channel) {
+        const float *im = data_im + (size_t)channel * channel_size;
+        float *col = data_col + (size_t)channel * kernel_h * kernel_w * col_size;
+        int kernel_row, kernel_col, output_row, output_col;
+        for (kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
+            for (kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
+                int input_row = -pad_h + kernel_row * dilation_h + row_start * stride_h;
+                for (output_row = row_start; output_row < row_end; output_row++) {
+                    if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
+                        for (output_col = output_w; output_col; output_col--) {
+                            *(col++) = 0;
+                        }
+                    }
+                    else {
+                        int input_col = -pad_w + kernel_col * dilation_w;
+                        for (output_col = output_w; output_col; output_col--) {
+                            if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
+                                *(col++) = im[input_row * width + input_col];
+                            }
+                            else {
+                                *(col++) = 0;
+                            }
+                            input_col += stride_w;
+                        }
+                    }
+                    input_row += stride_h;
+                }
+            }
+        }
+    }
+}
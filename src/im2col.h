@@ -21,6 +21,14 @@ void im2col_cpu_ext(const float* data_im, const int channels,
     const int dilation_h, const int dilation_w,
     float* data_col);
 
+void im2col_cpu_ext_rows(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int row_start, const int row_end,
+    float* data_col);
+
 #ifdef GPU
 
 void im2col_ongpu(float *im,
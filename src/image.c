@@ -1526,6 +1526,26 @@ image load_image_stb(char *filename, int channels)
     return im;
 }
 
+unsigned char *load_image_stb_u8(char *filename, int channels, int *w, int *h)
+{
+    int c;
+    unsigned char *data = stbi_load(filename, w, h, &c, channels);
+    if (!data) {
+        char shrinked_filename[1024];
+        if (strlen(filename) >= 1024) sprintf(shrinked_filename, "name is too long");
+        else sprintf(shrinked_filename, "%s", filename);
+        fprintf(stderr, "Cannot load image \"%s\"\nSTB Reason: %s\n", shrinked_filename, stbi_failure_reason());
+        FILE* fw = fopen("bad.list", "a");
+        fwrite(shrinked_filename, sizeof(char), strlen(shrinked_filename), fw);
+        char *new_line = "\n";
+        fwrite(new_line, sizeof(char), strlen(new_line), fw);
+        fclose(fw);
+        *w = *h = 10;
+        return (unsigned char*)xcalloc(10 * 10 * (channels ? channels : 3), sizeof(unsigned char));
+    }
+    return data;
+}
+
 image load_image_stb_resize(char *filename, int w, int h, int c)
 {
     image out = load_image_stb(filename, c);
@@ -86,6 +86,8 @@ image copy_image(image p);
 void copy_image_inplace(image src, image dst);
 image load_image(char *filename, int w, int h, int c);
 image load_image_stb_resize(char *filename, int w, int h, int c);
+// HWC uint8 as decoded, free() it
+unsigned char *load_image_stb_u8(char *filename, int channels, int *w, int *h);
 //LIB_API image load_image_color(char *filename, int w, int h);
 image **load_alphabet();
 void free_alphabet(image **alphabet);
@@ -6,6 +6,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <string>
 #include <vector>
@@ -63,6 +64,7 @@ using std::endl;
 #endif // CV_VERSION_EPOCH
 
 #include "http_stream.h"
+#include "augment.h"
 
 #ifndef CV_RGB
 #define CV_RGB(r, g, b) cvScalar((b), (g), (r), 0)
@@ -201,6 +203,12 @@ extern "C"
     }
     // ----------------------------------------
 
+    extern "C" mat_cv *make_mat_cv_from_data(unsigned char *data, int w, int h, int c)
+    {
+        return (mat_cv *)new cv::Mat(h, w, CV_8UC(c), data);
+    }
+    // ----------------------------------------
+
     extern "C" int get_width_mat(mat_cv *mat)
     {
         if (mat == NULL)
@@ -955,6 +963,60 @@ extern "C"
     }
     // ----------------------------------------
 
+    // the network input of a captured frame, the frame itself is not changed
+    extern "C" image get_image_from_mat_resize(mat_cv *mat, int w, int h, int c)
+    {
+        c = c ? c : 3;
+        cv::Mat *src = (cv::Mat *)mat;
+        cv::Mat new_img = cv::Mat(h, w, CV_8UC(c));
+        cv::resize(*src, new_img, new_img.size(), 0, 0, cv::INTER_LINEAR);
+        if (c > 1)
+            cv::cvtColor(new_img, new_img, cv::COLOR_RGB2BGR);
+        return mat_to_image(new_img);
+    }
+    // ----------------------------------------
+
+    extern "C" image get_image_from_mat_letterbox(mat_cv *mat, int w, int h, int c)
+    {
+        c = c ? c : 3;
+        cv::Mat *src = (cv::Mat *)mat;
+        cv::Mat rgb;
+        if (c > 1)
+            cv::cvtColor(*src, rgb, cv::COLOR_RGB2BGR);
+        else
+            rgb = *src;
+        image tmp = mat_to_image(rgb);
+        image im = letterbox_image(tmp, w, h);
+        free_image(tmp);
+        return im;
+    }
+    // ----------------------------------------
+
+    extern "C" void get_image_from_mat_into(mat_cv *mat, int letter_box, image dst)
+    {
+        cv::Mat *src = (cv::Mat *)mat;
+        if (src->depth() != CV_8U || src->channels() != dst.c)
+        {
+            image im = letter_box ? get_image_from_mat_letterbox(mat, dst.w, dst.h, dst.c) : get_image_from_mat_resize(mat, dst.w, dst.h, dst.c);
+            memcpy(dst.data, im.data, (size_t)dst.w * dst.h * dst.c * sizeof(float));
+            free_image(im);
+            return;
+        }
+        if (letter_box)
+            letterbox_image_u8_into(src->data, src->cols, src->rows, src->step, dst.c > 1, dst);
+        else
+            resize_image_u8_into(src->data, src->cols, src->rows, src->step, dst.c > 1, dst);
+    }
+    // ----------------------------------------
+
+    extern "C" mat_cv *clone_mat_cv(mat_cv *mat)
+    {
+        if (!mat)
+            return NULL;
+        return (mat_cv *)new cv::Mat(((cv::Mat *)mat)->clone());
+    }
+    // ----------------------------------------
+
     // ====================================================================
     // Image Saving
     // ====================================================================
@@ -23,6 +23,8 @@ typedef void* write_cv;
 mat_cv *load_image_mat_cv(const char *filename, int flag);
 image load_image_cv(char *filename, int channels);
 image load_image_resize(char *filename, int w, int h, int c, image *im);
+// wraps the uint8 HWC pixels without a copy, they must outlive the mat
+mat_cv *make_mat_cv_from_data(unsigned char *data, int w, int h, int c);
 int get_width_mat(mat_cv *mat);
 int get_height_mat(mat_cv *mat);
 void release_mat(mat_cv **mat);
@@ -85,6 +87,11 @@ image get_image_from_stream_cpp(cap_cv *cap);
 image get_image_from_stream_resize(cap_cv *cap, int w, int h, int c, mat_cv** in_img, int dont_close);
 image get_image_from_stream_letterbox(cap_cv *cap, int w, int h, int c, mat_cv** in_img, int dont_close);
 void consume_frame(cap_cv *cap);
+image get_image_from_mat_resize(mat_cv *mat, int w, int h, int c);
+image get_image_from_mat_letterbox(mat_cv *mat, int w, int h, int c);
+// the same into dst (net.w x net.h x net.c) in one pass over the frame, nothing is allocated
+void get_image_from_mat_into(mat_cv *mat, int letter_box, image dst);
+mat_cv *clone_mat_cv(mat_cv *mat);
 
 // Image Saving
 void save_cv_png(mat_cv *img, const char *name);
@@ -0,0 +1,219 @@
+#include "json_writer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define JSON_MIN_SIZE 4096
+#define JSON_FLOAT_DIRECT_MAX 1e12f     // larger, inf and nan go through snprintf()
+
+static void json_reserve(json_writer *w, size_t n)
+{
+    size_t size = w->size ? w->size : JSON_MIN_SIZE;
+    if (w->len + n + 1 <= w->size) return;
+    while (w->len + n + 1 > size) size *= 2;
+    w->buf = (char*)xrealloc(w->buf, size);
+    w->size = size;
+}
+
+static void json_free_names(json_writer *w)
+{
+    int j;
+    for (j = 0; j < w->classes && w->quoted; ++j) free(w->quoted[j]);
+    free(w->quoted);
+    free(w->quoted_len);
+    free(w->show);
+    w->quoted = NULL;
+    w->quoted_len = NULL;
+    w->show = NULL;
+    w->names = NULL;
+    w->classes = 0;
+}
+
+void json_writer_reset(json_writer *w)
+{
+    w->len = 0;
+    if (w->buf) w->buf[0] = 0;
+}
+
+void json_writer_free(json_writer *w)
+{
+    json_free_names(w);
+    free(w->buf);
+    w->buf = NULL;
+    w->len = w->size = 0;
+}
+
+char *json_writer_detach(json_writer *w)
+{
+    char *buf;
+    json_reserve(w, 0);
+    buf = w->buf;
+    buf[w->len] = 0;
+    w->buf = NULL;
+    json_writer_free(w);
+    return buf;
+}
+
+void json_write_n(json_writer *w, const char *s, size_t n)
+{
+    json_reserve(w, n);
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+    w->buf[w->len] = 0;
+}
+
+void json_write(json_writer *w, const char *s)
+{
+    json_write_n(w, s, strlen(s));
+}
+
+// the digits of v backwards from end, with at least min_digits
+static char *json_format_digits(char *end, unsigned long long v, int min_digits)
+{
+    do {
+        *--end = '0' + (char)(v % 10);
+        v /= 10;
+    } while (--min_digits > 0 || v);
+    return end;
+}
+
+void json_write_int(json_writer *w, long long v)
+{
+    char tmp[32];
+    char *end = tmp + sizeof(tmp);
+    const unsigned long long u = (v < 0) ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    char *p = json_format_digits(end, u, 1);
+    if (v < 0) *--p = '-';
+    json_write_n(w, p, end - p);
+}
+
+void json_write_float(json_writer *w, float v)
+{
+    char tmp[64];
+    char *end = tmp + sizeof(tmp);
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    const float a = fabsf(v);
+    // by the bits, -Ofast assumes there are no nan/inf
+    if ((bits & 0x7f800000) == 0x7f800000 || a >= JSON_FLOAT_DIRECT_MAX) {
+        const int n = snprintf(tmp, sizeof(tmp), "%f", v);
+        json_write_n(w, tmp, n);
+        return;
+    }
+    // a * 10^6 is exact in double (24 + 20 bits), rint() rounds the ties to even as printf()
+    const unsigned long long scaled = (unsigned long long)rint((double)a * 1e6);
+    char *p = json_format_digits(end, scaled % 1000000, 6);
+    *--p = '.';
+    p = json_format_digits(p, scaled / 1000000, 1);
+    if (bits >> 31) *--p = '-';
+    json_write_n(w, p, end - p);
+}
+
+void json_write_string(json_writer *w, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+    json_write_n(w, "\"", 1);
+    for (; *s; ++s) {
+        const unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        json_write_n(w, run, s - run);
+        run = s + 1;
+        if (c == '"') json_write_n(w, "\\\"", 2);
+        else if (c == '\\') json_write_n(w, "\\\\", 2);
+        else if (c == '\n') json_write_n(w, "\\n", 2);
+        else if (c == '\r') json_write_n(w, "\\r", 2);
+        else if (c == '\t') json_write_n(w, "\\t", 2);
+        else {
+            char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            json_write_n(w, u, sizeof(u));
+        }
+    }
+    json_write_n(w, run, s - run);
+    json_write_n(w, "\"", 1);
+}
+
+static void json_cache_names(json_writer *w, char **names, int classes)
+{
+    json_writer q = { 0 };
+    int j;
+    if (w->names == names && w->classes == classes) return;
+    json_free_names(w);
+    w->quoted = (char**)xcalloc(classes, sizeof(char*));
+    w->quoted_len = (int*)xcalloc(classes, sizeof(int));
+    w->show = (char*)xcalloc(classes, sizeof(char));
+    for (j = 0; j < classes; ++j) {
+        json_writer_reset(&q);
+        json_write_string(&q, names[j]);
+        w->quoted[j] = (char*)xcalloc(q.len + 1, sizeof(char));
+        memcpy(w->quoted[j], q.buf, q.len);
+        w->quoted_len[j] = (int)q.len;
+        w->show[j] = strncmp(names[j], "dont_show", 9) != 0;
+    }
+    json_writer_free(&q);
+    w->names = names;
+    w->classes = classes;
+}
+
+#define JSON_LITERAL(w, s) json_write_n(w, s, sizeof(s) - 1)
+
+void json_write_detections(json_writer *w, detection *dets, int nboxes, int classes, char **names, long long frame_id, const char *filename)
+{
+    const float thresh = 0.005; // function get_network_boxes() has already filtred dets by actual threshold
+    int i, j, first = 1;
+    json_cache_names(w, names, classes);
+
+    JSON_LITERAL(w, "{\n \"frame_id\":");
+    json_write_int(w, frame_id);
+    if (filename) {
+        JSON_LITERAL(w, ", \n \"filename\":");
+        json_write_string(w, filename);
+    }
+    JSON_LITERAL(w, ", \n \"objects\": [ \n");
+    for (i = 0; i < nboxes; ++i) {
+        const box b = dets[i].bbox;
+        for (j = 0; j < classes; ++j) {
+            if (!(dets[i].prob[j] > thresh) || !w->show[j]) continue;
+            if (!first) JSON_LITERAL(w, ", \n");
+            first = 0;
+            JSON_LITERAL(w, "  {\"class_id\":");
+            json_write_int(w, j);
+            JSON_LITERAL(w, ", \"name\":");
+            json_write_n(w, w->quoted[j], w->quoted_len[j]);
+            JSON_LITERAL(w, ", \"relative_coordinates\":{\"center_x\":");
+            json_write_float(w, b.x);
+            JSON_LITERAL(w, ", \"center_y\":");
+            json_write_float(w, b.y);
+            JSON_LITERAL(w, ", \"width\":");
+            json_write_float(w, b.w);
+            JSON_LITERAL(w, ", \"height\":");
+            json_write_float(w, b.h);
+            JSON_LITERAL(w, "}, \"confidence\":");
+            json_write_float(w, dets[i].prob[j]);
+            JSON_LITERAL(w, "}");
+        }
+    }
+    JSON_LITERAL(w, "\n ] \n}");
+}
+
+void json_write_coco(json_writer *w, int image_id, int category_id, float x, float y, float bw, float bh, float score)
+{
+    JSON_LITERAL(w, "{\"image_id\":");
+    json_write_int(w, image_id);
+    JSON_LITERAL(w, ", \"category_id\":");
+    json_write_int(w, category_id);
+    JSON_LITERAL(w, ", \"bbox\":[");
+    json_write_float(w, x);
+    JSON_LITERAL(w, ", ");
+    json_write_float(w, y);
+    JSON_LITERAL(w, ", ");
+    json_write_float(w, bw);
+    JSON_LITERAL(w, ", ");
+    json_write_float(w, bh);
+    JSON_LITERAL(w, "], \"score\":");
+    json_write_float(w, score);
+    JSON_LITERAL(w, "},\n");
+}
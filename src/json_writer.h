@@ -0,0 +1,51 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+#include "darknet.h"
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Growable output buffer for the JSON of the detections: appends in amortized
+// O(1), no strlen/strcat over what is already written, and is reused frame after
+// frame (json_writer_reset() keeps the memory). Floats are formatted as printf("%f")
+// without printf. The class names are quoted and escaped once and cached in the
+// writer, with their dont_show flag, for as long as the same names array is passed.
+// A writer is not thread-safe: one per thread / output.
+
+typedef struct json_writer {
+    char *buf;          // NUL-terminated
+    size_t len;
+    size_t size;
+    // cached class names
+    char **names;       // the array they are of
+    int classes;
+    char **quoted;      // "name", escaped
+    int *quoted_len;
+    char *show;         // 0 - dont_show
+} json_writer;
+
+// a zeroed json_writer is empty and valid
+void json_writer_reset(json_writer *w);
+void json_writer_free(json_writer *w);
+// the buffer, to be freed by the caller; the writer is freed
+char *json_writer_detach(json_writer *w);
+
+void json_write_n(json_writer *w, const char *s, size_t n);
+void json_write(json_writer *w, const char *s);
+void json_write_int(json_writer *w, long long v);
+// as "%f"
+void json_write_float(json_writer *w, float v);
+// quoted and escaped
+void json_write_string(json_writer *w, const char *s);
+
+// the frame of detection_to_json(): frame_id, filename (if not NULL) and the
+// objects with prob > 0.005 of the classes that aren't dont_show
+void json_write_detections(json_writer *w, detection *dets, int nboxes, int classes, char **names, long long frame_id, const char *filename);
+// one line of the COCO results: {"image_id":..., "category_id":..., "bbox":[...], "score":...},
+void json_write_coco(json_writer *w, int image_id, int category_id, float x, float y, float bw, float bh, float score);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,5 +1,7 @@
 #include "layer.h"
 #include "dark_cuda.h"
+#include "gemm_packed.h"
+#include "prepared.h"
 #include <stdlib.h>
 
 void free_sublayer(layer *l)
@@ -88,15 +90,24 @@ void free_layer_custom(layer l, int keep_cudnn_desc)
     if (l.concat)             free(l.concat);
     if (l.concat_delta)       free(l.concat_delta);
     if (l.binary_weights)     free(l.binary_weights);
-    if (l.biases)             free(l.biases), l.biases = NULL;
+    if (l.biases && layer_owns_weights(l, l.biases)) free(l.biases), l.biases = NULL;
     if (l.bias_updates)       free(l.bias_updates), l.bias_updates = NULL;
-    if (l.scales)             free(l.scales), l.scales = NULL;
+    if (l.scales && layer_owns_weights(l, l.scales)) free(l.scales), l.scales = NULL;
     if (l.scale_updates)      free(l.scale_updates), l.scale_updates = NULL;
     if (l.biases_ema)         free(l.biases_ema), l.biases_ema = NULL;
     if (l.scales_ema)         free(l.scales_ema), l.scales_ema = NULL;
     if (l.weights_ema)        free(l.weights_ema), l.weights_ema = NULL;
-    if (l.weights)            free(l.weights), l.weights = NULL;
+    if (l.weights && layer_owns_weights(l, l.weights)) free(l.weights), l.weights = NULL;
     if (l.weight_updates)     free(l.weight_updates), l.weight_updates = NULL;
+    if (l.weights_packed && layer_owns_weights(l, l.weights_packed)) gemm_aligned_free(l.weights_packed), l.weights_packed = NULL;
+    if (l.weights_winograd && layer_owns_weights(l, l.weights_winograd)) gemm_aligned_free(l.weights_winograd), l.weights_winograd = NULL;
+    if (l.weights_nchwc)      gemm_aligned_free(l.weights_nchwc), l.weights_nchwc = NULL;
+    if (l.biases_nchwc)       gemm_aligned_free(l.biases_nchwc), l.biases_nchwc = NULL;
+    if (l.weights_int8)       gemm_aligned_free(l.weights_int8), l.weights_int8 = NULL;
+    if (l.int8_scales)        free(l.int8_scales), l.int8_scales = NULL;
+    if (l.int8_offsets)       free(l.int8_offsets), l.int8_offsets = NULL;
+    if (l.int8_input_scales)  free(l.int8_input_scales), l.int8_input_scales = NULL;
+    if (l.int8_input_zero)    free(l.int8_input_zero), l.int8_input_zero = NULL;
     if (l.align_bit_weights)  free(l.align_bit_weights);
     if (l.mean_arr)           free(l.mean_arr);
 #ifdef GPU
@@ -119,8 +130,8 @@ void free_layer_custom(layer l, int keep_cudnn_desc)
     if (l.variance)           free(l.variance), l.variance = NULL;
     if (l.mean_delta)         free(l.mean_delta), l.mean_delta = NULL;
     if (l.variance_delta)     free(l.variance_delta), l.variance_delta = NULL;
-    if (l.rolling_mean)       free(l.rolling_mean), l.rolling_mean = NULL;
-    if (l.rolling_variance)   free(l.rolling_variance), l.rolling_variance = NULL;
+    if (l.rolling_mean && layer_owns_weights(l, l.rolling_mean)) free(l.rolling_mean), l.rolling_mean = NULL;
+    if (l.rolling_variance && layer_owns_weights(l, l.rolling_variance)) free(l.rolling_variance), l.rolling_variance = NULL;
     if (l.x)                  free(l.x);
     if (l.x_norm)             free(l.x_norm);
     if (l.m)                  free(l.m);
@@ -0,0 +1,306 @@
+#include "layer_graph.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+struct layer_graph {
+    int n;
+    int *deps;          // layers each layer waits for
+    int *succ_start;    // successors of layer j: succ[succ_start[j] .. succ_start[j + 1])
+    int *succ;
+    int threads;        // the calling thread + workers
+    int cores;          // OpenMP threads split between the running layers
+    pthread_t *workers;
+    float **workspaces; // one per worker, the calling thread uses net.workspace
+
+    // everything below is guarded by mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t work;    // layers are ready, the pass is done or exit
+    int *remaining;         // deps not done yet in this pass
+    int *ready;             // ready layers, sorted by index
+    int ready_count;
+    int done;               // layers done in this pass
+    int running;
+    int exit;
+    network net;            // of the current pass
+    network_state state;
+};
+
+typedef struct layer_graph_worker_args {
+    layer_graph *g;
+    int slot;
+} layer_graph_worker_args;
+
+static int parallel_branches = 0;
+
+void set_parallel_branches(int enable)
+{
+    parallel_branches = enable;
+}
+
+int get_parallel_branches(void)
+{
+    return parallel_branches;
+}
+
+// layers whose forward reads only state.input and the layers of get_layer_inputs()
+static int layer_graph_supported(layer l)
+{
+    switch (l.type) {
+    case CONVOLUTIONAL:
+    case CONNECTED:
+    case MAXPOOL:
+    case LOCAL_AVGPOOL:
+    case AVGPOOL:
+    case SOFTMAX:
+    case ROUTE:
+    case SHORTCUT:
+    case SCALE_CHANNELS:
+    case SAM:
+    case ACTIVE:
+    case BATCHNORM:
+    case REORG:
+    case REORG_OLD:
+    case UPSAMPLE:
+    case YOLO:
+    case GAUSSIAN_YOLO:
+    case REGION:
+    case DETECTION:
+    case DROPOUT:
+    case EMPTY:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// layers the forward of layer j reads, returns the count
+static int get_layer_inputs(network net, int j, int *inputs)
+{
+    const layer l = net.layers[j];
+    int count = 0, i, k;
+    if (j > 0 && l.type != ROUTE) inputs[count++] = j - 1;
+    if (l.type == ROUTE || l.type == SHORTCUT) {
+        for (i = 0; i < l.n; ++i) inputs[count++] = l.input_layers[i];
+    }
+    if (l.type == SAM || l.type == SCALE_CHANNELS) inputs[count++] = l.index;
+    // unique
+    for (i = 0; i < count; ++i) {
+        for (k = 0; k < i; ++k) {
+            if (inputs[k] == inputs[i]) {
+                inputs[i--] = inputs[--count];
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+static void layer_graph_push_ready(layer_graph *g, int j)
+{
+    int k;
+    for (k = g->ready_count; k > 0 && g->ready[k - 1] > j; --k) g->ready[k] = g->ready[k - 1];
+    g->ready[k] = j;
+    g->ready_count++;
+}
+
+// runs ready layers, the lowest index first: that is the order of the cfg, so the
+// backbone goes ahead of the side branches. The caller returns when the pass is done,
+// the workers when the graph is freed.
+static void layer_graph_work(layer_graph *g, int slot)
+{
+    const int caller = (slot == 0);
+    int s;
+    pthread_mutex_lock(&g->mutex);
+    for (;;) {
+        if (caller ? g->done == g->n : g->exit) break;
+        if (g->ready_count == 0) {
+            pthread_cond_wait(&g->work, &g->mutex);
+            continue;
+        }
+        const int j = g->ready[0];
+        memmove(g->ready, g->ready + 1, --g->ready_count * sizeof(int));
+        g->running++;
+        const int layer_threads = (g->cores / g->running > 1) ? g->cores / g->running : 1;
+        network_state state = g->state;
+        const layer l = g->net.layers[j];
+        pthread_mutex_unlock(&g->mutex);
+
+#ifdef _OPENMP
+        omp_set_num_threads(layer_threads);
+#else
+        (void)layer_threads;
+#endif
+        state.index = j;
+        if (j > 0) state.input = g->net.layers[j - 1].output;
+        if (!caller) state.workspace = g->workspaces[slot];
+        l.forward(l, state);
+
+        pthread_mutex_lock(&g->mutex);
+        g->running--;
+        g->done++;
+        for (s = g->succ_start[j]; s < g->succ_start[j + 1]; ++s) {
+            if (--g->remaining[g->succ[s]] == 0) layer_graph_push_ready(g, g->succ[s]);
+        }
+        if (g->ready_count || g->done == g->n) pthread_cond_broadcast(&g->work);
+    }
+    pthread_mutex_unlock(&g->mutex);
+}
+
+static void *layer_graph_worker(void *ptr)
+{
+    layer_graph_worker_args args = *(layer_graph_worker_args*)ptr;
+    free(ptr);
+    layer_graph_work(args.g, args.slot);
+    return 0;
+}
+
+layer_graph *make_layer_graph(network net, int threads)
+{
+    const int n = net.n;
+    int *inputs, *level, *level_width;
+    float *path_flops;
+    float total_flops = 0, critical_flops = 0;
+    size_t workspace_size = 0;
+    int width = 0, edges = 0, i, j, k;
+
+#ifdef GPU
+    if (gpu_index >= 0) return NULL;
+#endif
+    if (net.memory_arena || net.nchwc_block) {
+        printf(" Layer graph: not used with the %s \n", net.memory_arena ? "memory plan" : "NCHWc layout");
+        return NULL;
+    }
+    for (j = 0; j < n; ++j) {
+        if (!layer_graph_supported(net.layers[j])) {
+            printf(" Layer graph: not used, layer %d is not supported \n", j);
+            return NULL;
+        }
+        if (net.layers[j].workspace_size > workspace_size) workspace_size = net.layers[j].workspace_size;
+    }
+
+    layer_graph *g = (layer_graph*)xcalloc(1, sizeof(layer_graph));
+    g->n = n;
+    g->deps = (int*)xcalloc(n, sizeof(int));
+    g->succ_start = (int*)xcalloc(n + 1, sizeof(int));
+    g->remaining = (int*)xcalloc(n, sizeof(int));
+    g->ready = (int*)xcalloc(n, sizeof(int));
+    inputs = (int*)xcalloc(n + 1, sizeof(int));
+    level = (int*)xcalloc(n, sizeof(int));
+    level_width = (int*)xcalloc(n, sizeof(int));
+    path_flops = (float*)xcalloc(n, sizeof(float));
+
+    // successors in CSR form; the longest path in layers (level) and in FLOPs, the cfg order is topological
+    for (j = 0; j < n; ++j) {
+        const int count = get_layer_inputs(net, j, inputs);
+        g->deps[j] = count;
+        for (i = 0; i < count; ++i) {
+            g->succ_start[inputs[i] + 1]++;
+            if (level[inputs[i]] + 1 > level[j]) level[j] = level[inputs[i]] + 1;
+            if (path_flops[inputs[i]] > path_flops[j]) path_flops[j] = path_flops[inputs[i]];
+        }
+        path_flops[j] += net.layers[j].bflops;
+        total_flops += net.layers[j].bflops;
+        if (path_flops[j] > critical_flops) critical_flops = path_flops[j];
+        if (++level_width[level[j]] > width) width = level_width[level[j]];
+        edges += count;
+    }
+    for (j = 0; j < n; ++j) g->succ_start[j + 1] += g->succ_start[j];
+    g->succ = (int*)xcalloc(edges + 1, sizeof(int));
+    memset(level_width, 0, n * sizeof(int));
+    for (j = 0; j < n; ++j) {
+        const int count = get_layer_inputs(net, j, inputs);
+        for (i = 0; i < count; ++i) {
+            k = inputs[i];
+            g->succ[g->succ_start[k] + level_width[k]++] = j;
+        }
+    }
+    free(inputs);
+    free(level);
+    free(level_width);
+    free(path_flops);
+
+#ifdef _OPENMP
+    g->cores = omp_get_max_threads();
+#else
+    g->cores = 1;
+#endif
+    if (threads <= 0) threads = g->cores;
+    g->threads = (threads < width) ? threads : width;
+    printf(" Layer graph: %d layers, width %d, critical path %.1f of %.1f BFLOPs, %d threads \n",
+        n, width, critical_flops, total_flops, g->threads);
+    if (g->threads < 2) {
+        free_layer_graph(g);
+        return NULL;
+    }
+
+    pthread_mutex_init(&g->mutex, 0);
+    pthread_cond_init(&g->work, 0);
+    g->workspaces = (float**)xcalloc(g->threads, sizeof(float*));
+    g->workers = (pthread_t*)xcalloc(g->threads, sizeof(pthread_t));
+    for (i = 1; i < g->threads; ++i) {
+        layer_graph_worker_args *args = (layer_graph_worker_args*)xcalloc(1, sizeof(layer_graph_worker_args));
+        args->g = g;
+        args->slot = i;
+        g->workspaces[i] = (float*)xcalloc(1, workspace_size);
+        if (pthread_create(&g->workers[i], 0, layer_graph_worker, args)) error("Thread creation failed", DARKNET_LOC);
+    }
+    return g;
+}
+
+void free_layer_graph(layer_graph *g)
+{
+    int i;
+    if (!g) return;
+    if (g->workers) {
+        pthread_mutex_lock(&g->mutex);
+        g->exit = 1;
+        pthread_cond_broadcast(&g->work);
+        pthread_mutex_unlock(&g->mutex);
+        for (i = 1; i < g->threads; ++i) {
+            pthread_join(g->workers[i], 0);
+            free(g->workspaces[i]);
+        }
+        pthread_mutex_destroy(&g->mutex);
+        pthread_cond_destroy(&g->work);
+        free(g->workers);
+        free(g->workspaces);
+    }
+    free(g->deps);
+    free(g->succ_start);
+    free(g->succ);
+    free(g->remaining);
+    free(g->ready);
+    free(g);
+}
+
+int layer_graph_threads(layer_graph *g)
+{
+    return g ? g->threads : 0;
+}
+
+void forward_network_graph(layer_graph *g, network net, network_state state)
+{
+    int j;
+    pthread_mutex_lock(&g->mutex);
+    g->net = net;
+    g->state = state;
+    g->done = 0;
+    g->ready_count = 0;
+    for (j = 0; j < g->n; ++j) {
+        g->remaining[j] = g->deps[j];
+        if (g->deps[j] == 0) layer_graph_push_ready(g, j);
+    }
+    pthread_cond_broadcast(&g->work);
+    pthread_mutex_unlock(&g->mutex);
+
+    layer_graph_work(g, 0);
+#ifdef _OPENMP
+    omp_set_num_threads(g->cores);
+#endif
+}
@@ -0,0 +1,35 @@
+#ifndef LAYER_GRAPH_H
+#define LAYER_GRAPH_H
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Dependency-graph executor for CPU inference: a layer waits only for the layers
+// it reads (the previous layer, route/shortcut input_layers, sam/scale_channels
+// index), so independent branches of CSP blocks and the yolo heads run at the
+// same time on a pool of threads. Each running layer keeps its OpenMP parallelism,
+// with the cores split between the layers that run at once; every thread has its
+// own workspace. Not used with the memory plan (outputs share the arena in
+// sequential order), the NCHWc layout (shared scratch) or the layer profiler.
+//   [net] parallel_branches=1 or the -parallel_branches flag
+
+typedef struct layer_graph layer_graph;
+
+// threads: layers that may run at once, 0 - the number of cores; capped at the
+// width of the graph. NULL when the network has no independent layers or a layer
+// type that isn't supported.
+layer_graph *make_layer_graph(network net, int threads);
+void free_layer_graph(layer_graph *g);
+int layer_graph_threads(layer_graph *g);
+// forward_network() with net.graph, !state.train
+void forward_network_graph(layer_graph *g, network net, network_state state);
+
+// -parallel_branches: enabled for every network by prepare_network_for_inference()
+void set_parallel_branches(int enable);
+int get_parallel_branches(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
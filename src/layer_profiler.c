@@ -0,0 +1,338 @@
+#include "layer_profiler.h"
+#include "network.h"
+#include "parser.h"
+#include "utils.h"
+#include "gemm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the trace keeps the first events, the totals count all of them
+#define PROFILE_MAX_EVENTS (1 << 20)
+
+typedef struct profile_event {
+    int layer;
+    int phase;          // -1 - the layer itself
+    double start, dur;  // microseconds, start from the creation of the profiler
+} profile_event;
+
+struct layer_profiler {
+    int n;
+    double origin;
+    double *time;       // per layer, microseconds
+    double *phases;     // per layer and phase
+    int *calls;
+    profile_event *events;
+    size_t events_count, events_size;
+    size_t events_lost;
+    int current;
+    double current_start;
+};
+
+static layer_profiler *active_profiler;
+
+static const char *profile_phase_names[PROFILE_PHASES] = { "im2col", "gemm", "activation" };
+
+layer_profiler *make_layer_profiler(network net)
+{
+    layer_profiler *p = (layer_profiler*)xcalloc(1, sizeof(layer_profiler));
+    p->n = net.n;
+    p->origin = get_time_point();
+    p->time = (double*)xcalloc(net.n, sizeof(double));
+    p->phases = (double*)xcalloc((size_t)net.n * PROFILE_PHASES, sizeof(double));
+    p->calls = (int*)xcalloc(net.n, sizeof(int));
+    p->current = -1;
+    return p;
+}
+
+void free_layer_profiler(layer_profiler *p)
+{
+    if (!p) return;
+    if (active_profiler == p) active_profiler = NULL;
+    free(p->time);
+    free(p->phases);
+    free(p->calls);
+    free(p->events);
+    free(p);
+}
+
+static void add_profile_event(layer_profiler *p, int layer, int phase, double start, double end)
+{
+    if (p->events_count == p->events_size) {
+        if (p->events_size >= PROFILE_MAX_EVENTS) {
+            ++p->events_lost;
+            return;
+        }
+        p->events_size = p->events_size ? p->events_size * 2 : 4096;
+        p->events = (profile_event*)xrealloc(p->events, p->events_size * sizeof(profile_event));
+    }
+    profile_event *e = &p->events[p->events_count++];
+    e->layer = layer;
+    e->phase = phase;
+    e->start = start - p->origin;
+    e->dur = end - start;
+}
+
+void profile_layer_begin(layer_profiler *p, int index)
+{
+    p->current = index;
+    active_profiler = p;
+    p->current_start = get_time_point();
+}
+
+void profile_layer_end(layer_profiler *p, int index)
+{
+    const double end = get_time_point();
+    active_profiler = NULL;
+    p->current = -1;
+    p->time[index] += end - p->current_start;
+    ++p->calls[index];
+    add_profile_event(p, index, -1, p->current_start, end);
+}
+
+double profile_phase_begin(void)
+{
+    return active_profiler ? get_time_point() : 0;
+}
+
+void profile_phase_end(profile_phase phase, double start)
+{
+    layer_profiler *p = active_profiler;
+    if (!p || !start) return;
+    const double end = get_time_point();
+    p->phases[(size_t)p->current * PROFILE_PHASES + phase] += end - start;
+    add_profile_event(p, p->current, phase, start, end);
+}
+
+static double layer_flop(layer l)
+{
+    if (l.type == CONNECTED) return 2. * l.inputs * l.outputs * l.batch;
+    return l.bflops * 1e9 * l.batch;
+}
+
+// what the layer reads and writes at least once: input, output, weights and biases,
+// and the im2col buffer (written, then read by the GEMM) if it was used
+static double layer_bytes(layer_profiler *p, layer l, int index)
+{
+    double bytes = 4. * ((double)l.inputs + l.outputs) * l.batch;
+    if (l.type == CONVOLUTIONAL) {
+        bytes += (l.weights_int8 ? 1. : 4.) * l.nweights + 4. * l.n;
+        if (p->phases[(size_t)index * PROFILE_PHASES + PROFILE_IM2COL] > 0) {
+            bytes += 2 * 4. * l.size * l.size * l.c * l.out_h * l.out_w * l.batch;
+        }
+    }
+    else if (l.type == CONNECTED) bytes += 4. * l.inputs * l.outputs + 4. * l.outputs;
+    return bytes;
+}
+
+static int is_yolo_head(layer l)
+{
+    return l.type == YOLO || l.type == GAUSSIAN_YOLO || l.type == REGION || l.type == DETECTION;
+}
+
+static void layer_description(layer l, char *buff, size_t size)
+{
+    if (l.type == CONVOLUTIONAL) {
+        snprintf(buff, size, "conv %dx%d/%d %d%s", l.size, l.size, l.stride, l.n, l.groups > 1 ? " groups" : "");
+    }
+    else snprintf(buff, size, "%s", get_layer_string(l.type));
+}
+
+typedef struct layer_roofline {
+    double ms;          // per call
+    double gflop, mbytes;
+    double gflops, gbs; // achieved
+    double intensity;   // FLOP per byte
+    double attainable;  // GFLOP/s the roofline allows at this intensity
+    const char *bound;
+} layer_roofline;
+
+static layer_roofline get_layer_roofline(layer_profiler *p, network net, int index, float peak_gflops, float peak_gbs)
+{
+    layer_roofline r = { 0 };
+    const layer l = net.layers[index];
+    const double flop = layer_flop(l);
+    const double bytes = layer_bytes(p, l, index);
+    const double us = p->calls[index] ? p->time[index] / p->calls[index] : 0;
+    r.ms = us / 1000;
+    r.gflop = flop / 1e9;
+    r.mbytes = bytes / 1e6;
+    r.gflops = us > 0 ? flop / us / 1e3 : 0;
+    r.gbs = us > 0 ? bytes / us / 1e3 : 0;
+    r.intensity = bytes > 0 ? flop / bytes : 0;
+    r.attainable = r.intensity * peak_gbs;
+    if (r.attainable > peak_gflops) r.attainable = peak_gflops;
+    // the ridge point: peak GFLOP/s / peak GB/s
+    r.bound = (peak_gbs > 0 && r.intensity >= peak_gflops / peak_gbs) ? "compute" : "memory";
+    return r;
+}
+
+void print_layer_profile(layer_profiler *p, network net, float peak_gflops, float peak_gbs)
+{
+    double total = 0, yolo = 0, phases[PROFILE_PHASES] = { 0 };
+    int i, k, runs = 0;
+    char desc[64];
+    for (i = 0; i < p->n; ++i) {
+        total += p->time[i];
+        if (is_yolo_head(net.layers[i])) yolo += p->time[i];
+        for (k = 0; k < PROFILE_PHASES; ++k) phases[k] += p->phases[(size_t)i * PROFILE_PHASES + k];
+        if (p->calls[i] > runs) runs = p->calls[i];
+    }
+    if (!runs || total <= 0) {
+        printf(" No profiled forward passes \n");
+        return;
+    }
+    printf("\n peak %.1f GFLOP/s, %.1f GB/s, ridge point %.2f FLOP/byte \n", peak_gflops, peak_gbs, peak_gbs > 0 ? peak_gflops / peak_gbs : 0);
+    printf(" %5s %-20s %9s %7s %9s %9s %9s %9s %9s %8s \n", "layer", "type", "avg ms", "time %", "GFLOP", "MB", "GFLOP/s", "GB/s", "FLOP/B", "bound");
+    for (i = 0; i < p->n; ++i) {
+        const layer_roofline r = get_layer_roofline(p, net, i, peak_gflops, peak_gbs);
+        layer_description(net.layers[i], desc, sizeof(desc));
+        printf(" %5d %-20s %9.3f %7.2f %9.3f %9.2f %9.1f %9.2f %9.2f %8s \n", i, desc, r.ms, 100 * p->time[i] / total,
+            r.gflop, r.mbytes, r.gflops, r.gbs, r.intensity, r.bound);
+    }
+    printf("\n %d forward passes, %.2f ms each: ", runs, total / runs / 1000);
+    for (k = 0; k < PROFILE_PHASES; ++k) printf("%s %.1f%%, ", profile_phase_names[k], 100 * phases[k] / total);
+    printf("yolo head %.1f%%, ", 100 * yolo / total);
+    printf("other %.1f%% \n", 100 * (total - phases[0] - phases[1] - phases[2] - yolo) / total);
+    if (p->events_lost) printf(" The trace keeps the first %d events, %zu more are only in the totals \n", PROFILE_MAX_EVENTS, p->events_lost);
+}
+
+int save_layer_profile_trace(layer_profiler *p, network net, const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    size_t i;
+    char desc[64];
+    if (!fp) return 0;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"forward_network\"}}");
+    for (i = 0; i < p->events_count; ++i) {
+        const profile_event e = p->events[i];
+        const layer l = net.layers[e.layer];
+        if (e.phase < 0) {
+            layer_description(l, desc, sizeof(desc));
+            fprintf(fp, ",\n{\"name\":\"%d %s\",\"cat\":\"layer\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":0,"
+                "\"args\":{\"gflop\":%.6f,\"mbytes\":%.3f}}",
+                e.layer, desc, e.start, e.dur, layer_flop(l) / 1e9, layer_bytes(p, l, e.layer) / 1e6);
+        }
+        else {
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":0}",
+                profile_phase_names[e.phase], e.start, e.dur);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
+
+int save_layer_profile_csv(layer_profiler *p, network net, float peak_gflops, float peak_gbs, const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    double total = 0;
+    int i, k;
+    char desc[64];
+    if (!fp) return 0;
+    for (i = 0; i < p->n; ++i) total += p->time[i];
+    fprintf(fp, "layer,type,description,calls,avg_ms,time_share,gflop,mbytes,gflops_per_s,gbytes_per_s,flop_per_byte,"
+        "attainable_gflops_per_s,roofline_efficiency,bound,im2col_ms,gemm_ms,activation_ms,peak_gflops_per_s,peak_gbytes_per_s\n");
+    for (i = 0; i < p->n; ++i) {
+        const layer l = net.layers[i];
+        const layer_roofline r = get_layer_roofline(p, net, i, peak_gflops, peak_gbs);
+        layer_description(l, desc, sizeof(desc));
+        fprintf(fp, "%d,%s,%s,%d,%.4f,%.4f,%.6f,%.4f,%.3f,%.3f,%.4f,%.3f,%.4f,%s", i, get_layer_string(l.type), desc, p->calls[i],
+            r.ms, total > 0 ? p->time[i] / total : 0, r.gflop, r.mbytes, r.gflops, r.gbs, r.intensity,
+            r.attainable, r.attainable > 0 ? r.gflops / r.attainable : 0, r.bound);
+        for (k = 0; k < PROFILE_PHASES; ++k) {
+            fprintf(fp, ",%.4f", p->calls[i] ? p->phases[(size_t)i * PROFILE_PHASES + k] / p->calls[i] / 1000 : 0);
+        }
+        fprintf(fp, ",%.2f,%.2f\n", peak_gflops, peak_gbs);
+    }
+    return fclose(fp) == 0;
+}
+
+float measure_peak_gflops(void)
+{
+    const int size = 512;
+    float *a = (float*)xcalloc((size_t)size * size, sizeof(float));
+    float *b = (float*)xcalloc((size_t)size * size, sizeof(float));
+    float *c = (float*)xcalloc((size_t)size * size, sizeof(float));
+    int i, runs = 0;
+    for (i = 0; i < size * size; ++i) {
+        a[i] = rand_uniform(-1, 1);
+        b[i] = rand_uniform(-1, 1);
+    }
+    gemm(0, 0, size, size, size, 1, a, size, b, size, 0, c, size);
+    const double start = get_time_point();
+    double elapsed;
+    do {
+        gemm(0, 0, size, size, size, 1, a, size, b, size, 0, c, size);
+        ++runs;
+        elapsed = get_time_point() - start;
+    } while (elapsed < 300000);
+    free(a);
+    free(b);
+    free(c);
+    return 2. * size * size * size * runs / elapsed / 1e3;
+}
+
+float measure_peak_gbs(void)
+{
+    const size_t size = 64 * 1024 * 1024;
+    char *src = (char*)xcalloc(size, 1);
+    char *dst = (char*)xcalloc(size, 1);
+    int runs = 0;
+    memset(src, 1, size);
+    memcpy(dst, src, size);
+    const double start = get_time_point();
+    double elapsed;
+    do {
+        memcpy(dst, src, size);
+        ++runs;
+        elapsed = get_time_point() - start;
+    } while (elapsed < 300000);
+    free(src);
+    free(dst);
+    // read and written
+    return 2. * size * runs / elapsed / 1e3;
+}
+
+void run_profile(int argc, char **argv)
+{
+    const int iters = find_int_arg(argc, argv, "-iters", 10);
+    char *trace = find_char_arg(argc, argv, "-trace", "profile.json");
+    char *csv = find_char_arg(argc, argv, "-csv", "profile.csv");
+    float peak_gflops = find_float_arg(argc, argv, "-peak_gflops", 0);
+    float peak_gbs = find_float_arg(argc, argv, "-peak_gbs", 0);
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s profile <cfg> [weights] [-iters N] [-trace out.json] [-csv out.csv] [-peak_gflops N] [-peak_gbs N]\n", argv[0]);
+        return;
+    }
+    char *cfgfile = argv[2];
+    char *weightfile = (argc > 3) ? argv[3] : NULL;
+    int i;
+
+    init_cpu();
+    network net = parse_network_cfg_custom(cfgfile, 1, 1);
+    if (weightfile) load_weights(&net, weightfile);
+    fuse_conv_batchnorm(net);
+    calculate_binary_weights(net);
+    prepare_network_for_inference(&net);
+
+    float *input = (float*)xcalloc((size_t)net.w * net.h * net.c, sizeof(float));
+    for (i = 0; i < net.w * net.h * net.c; ++i) input[i] = rand_uniform(0, 1);
+    network_predict(net, input);
+
+    net.profiler = make_layer_profiler(net);
+    for (i = 0; i < iters; ++i) network_predict(net, input);
+
+    if (peak_gflops <= 0) peak_gflops = measure_peak_gflops();
+    if (peak_gbs <= 0) peak_gbs = measure_peak_gbs();
+    print_layer_profile(net.profiler, net, peak_gflops, peak_gbs);
+    if (save_layer_profile_trace(net.profiler, net, trace)) printf(" Trace: %s \n", trace);
+    else printf(" Couldn't write %s \n", trace);
+    if (save_layer_profile_csv(net.profiler, net, peak_gflops, peak_gbs, csv)) printf(" Roofline: %s \n", csv);
+    else printf(" Couldn't write %s \n", csv);
+
+    free_layer_profiler(net.profiler);
+    net.profiler = NULL;
+    free(input);
+    free_network(net);
+}
@@ -0,0 +1,51 @@
+#ifndef LAYER_PROFILER_H
+#define LAYER_PROFILER_H
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CPU layer profiler: with net.profiler set, forward_network() times every layer
+// and the convolutions time their im2col, GEMM and activation parts.
+// Per layer it reports the wall time, FLOPs (l.bflops), the bytes it has to move
+// at least (input, output, weights, im2col buffer), the achieved GFLOP/s and the
+// arithmetic intensity, and places the layer on the roofline of the CPU:
+// below the ridge point (peak GFLOP/s / peak GB/s) it is memory-bound.
+//   darknet profile <cfg> [weights] [-iters N] [-trace out.json] [-csv out.csv]
+//                   [-peak_gflops N] [-peak_gbs N]   (measured when not given)
+// The trace opens in chrome://tracing or https://ui.perfetto.dev.
+// One profiled network at a time: the phase timers are global.
+
+typedef enum profile_phase {
+    PROFILE_IM2COL,
+    PROFILE_GEMM,           // GEMM and the other convolution kernels (packed, winograd, int8, NCHWc),
+                            // with the bias + activation when they are fused into the GEMM epilogue
+    PROFILE_ACTIVATION,
+    PROFILE_PHASES
+} profile_phase;
+
+typedef struct layer_profiler layer_profiler;
+
+layer_profiler *make_layer_profiler(network net);
+void free_layer_profiler(layer_profiler *p);
+// called by forward_network() around l.forward()
+void profile_layer_begin(layer_profiler *p, int index);
+void profile_layer_end(layer_profiler *p, int index);
+// get_time_point() while a layer is profiled, 0 otherwise: the phase timers cost a branch when off
+double profile_phase_begin(void);
+void profile_phase_end(profile_phase phase, double start);
+
+void print_layer_profile(layer_profiler *p, network net, float peak_gflops, float peak_gbs);
+// Chrome trace event format, 0 - failed to write
+int save_layer_profile_trace(layer_profiler *p, network net, const char *filename);
+int save_layer_profile_csv(layer_profiler *p, network net, float peak_gflops, float peak_gbs, const char *filename);
+// the roofline of this CPU: GEMM of the repo and memcpy()
+float measure_peak_gflops(void);
+float measure_peak_gbs(void);
+
+void run_profile(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,245 @@
+#include "memory_plan.h"
+#include "gemm_packed.h"
+#include "nchwc.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PLAN_ALIGN 64
+
+typedef struct plan_buffer {
+    int layer;
+    int first, last;    // lifetime: the layers from the producer to the last reader
+    size_t size;        // bytes
+    size_t offset;
+} plan_buffer;
+
+static const char *memory_plan_unsupported(network *net, int j)
+{
+    const layer l = net->layers[j];
+    switch (l.type) {
+    case DROPOUT:
+    case EMPTY:
+        if (j == 0) return "no previous layer";
+        return NULL;
+    case CONVOLUTIONAL:
+    case CONNECTED:
+    case MAXPOOL:
+    case LOCAL_AVGPOOL:
+    case AVGPOOL:
+    case SOFTMAX:
+    case ROUTE:
+    case SHORTCUT:
+    case SCALE_CHANNELS:
+    case SAM:
+    case ACTIVE:
+    case BATCHNORM:
+    case REORG:
+    case REORG_OLD:
+    case UPSAMPLE:
+    case YOLO:
+    case GAUSSIAN_YOLO:
+    case REGION:
+    case DETECTION:
+    case COST:
+        if (!l.output) return "no output";
+        return NULL;
+    default:
+        // recurrent layers keep state in their outputs
+        return "layer type";
+    }
+}
+
+// the output is the buffer of the previous layer
+static int memory_plan_is_alias(layer l)
+{
+    return l.type == DROPOUT || l.type == EMPTY;
+}
+
+// read after the whole forward pass: detection heads, cost and the network output
+static int memory_plan_is_pinned(layer l)
+{
+    return l.type == YOLO || l.type == GAUSSIAN_YOLO || l.type == REGION || l.type == DETECTION || l.type == COST;
+}
+
+// floats of the output buffer
+static size_t memory_plan_output_size(layer l)
+{
+    if (l.nchwc) return nchwc_output_size(l);
+    return (size_t)l.outputs*l.batch;
+}
+
+static int memory_plan_has_activation_input(layer l)
+{
+    return (l.type == CONVOLUTIONAL || l.type == SHORTCUT) && l.activation_input;
+}
+
+static int memory_plan_in_arena(network *net, const float *ptr)
+{
+    return ptr && net->memory_arena && ptr >= net->memory_arena &&
+        (const char*)ptr < (const char*)net->memory_arena + net->memory_arena_size;
+}
+
+static void memory_plan_update_pointers(network *net, int output_layer)
+{
+    int j, i;
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        if (memory_plan_is_alias(*l)) l->output = net->layers[j - 1].output;
+    }
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        if (l->type != SHORTCUT || !l->layers_output) continue;
+        for (i = 0; i < l->n; ++i) l->layers_output[i] = net->layers[l->input_layers[i]].output;
+    }
+    net->output = net->layers[output_layer].output;
+}
+
+// as get_network_output()
+static int memory_plan_output_layer(network *net)
+{
+    int j;
+    for (j = net->n - 1; j > 0; --j) {
+        if (net->layers[j].type != COST) break;
+    }
+    return j;
+}
+
+// [a0, a1) and [b0, b1) intersect
+static int memory_plan_overlap(size_t a0, size_t a1, size_t b0, size_t b1)
+{
+    return a0 < b1 && b0 < a1;
+}
+
+size_t plan_network_memory(network *net)
+{
+#ifdef GPU
+    if (gpu_index >= 0) return 0;
+#endif
+    const int n = net->n;
+    const int output_layer = memory_plan_output_layer(net);
+    int *owner;
+    plan_buffer *buffers;
+    int count = 0, i, j, k, pinned_from;
+    size_t arena_size = 0, old_size = 0, activation_size = 0;
+
+    if (net->memory_arena) return net->memory_arena_size;
+    for (j = 0; j < n; ++j) {
+        const char *reason = memory_plan_unsupported(net, j);
+        if (reason) {
+            printf(" Memory plan: not used, layer %d is not supported (%s) \n", j, reason);
+            return 0;
+        }
+    }
+
+    owner = (int*)xcalloc(n, sizeof(int));
+    buffers = (plan_buffer*)xcalloc(n, sizeof(plan_buffer));
+    for (j = 0; j < n; ++j) {
+        layer l = net->layers[j];
+        if (memory_plan_is_alias(l)) {
+            owner[j] = owner[j - 1];
+            continue;
+        }
+        owner[j] = count;
+        buffers[count].layer = j;
+        buffers[count].first = buffers[count].last = j;
+        buffers[count].size = (memory_plan_output_size(l) * sizeof(float) + PLAN_ALIGN - 1) / PLAN_ALIGN * PLAN_ALIGN;
+        old_size += memory_plan_output_size(l) * sizeof(float);
+        if (memory_plan_has_activation_input(l)) {
+            const size_t size = (size_t)l.outputs*l.batch * sizeof(float);
+            old_size += size;
+            if (size > activation_size) activation_size = size;
+        }
+        ++count;
+    }
+
+    // lifetimes
+    pinned_from = output_layer;
+    for (j = 0; j < n; ++j) {
+        layer l = net->layers[j];
+        plan_buffer *b = &buffers[owner[j]];
+        if (j > 0 && buffers[owner[j - 1]].last < j) buffers[owner[j - 1]].last = j;
+        if (l.type == ROUTE || l.type == SHORTCUT) {
+            for (i = 0; i < l.n; ++i) {
+                plan_buffer *in = &buffers[owner[l.input_layers[i]]];
+                if (in->last < j) in->last = j;
+            }
+        }
+        if (l.type == SAM || l.type == SCALE_CHANNELS) {
+            plan_buffer *in = &buffers[owner[l.index]];
+            if (in->last < j) in->last = j;
+        }
+        if (memory_plan_is_pinned(l) || j >= pinned_from) b->last = n;
+    }
+
+    // largest first, at the lowest offset that no live buffer uses
+    for (i = 1; i < count; ++i) {
+        plan_buffer t = buffers[i];
+        for (k = i; k > 0 && buffers[k - 1].size < t.size; --k) buffers[k] = buffers[k - 1];
+        buffers[k] = t;
+    }
+    for (i = 0; i < count; ++i) {
+        plan_buffer *b = &buffers[i];
+        size_t offset = 0;
+        int moved = 1;
+        while (moved) {
+            moved = 0;
+            for (k = 0; k < i; ++k) {
+                const plan_buffer *p = &buffers[k];
+                if (p->last < b->first || b->last < p->first) continue;
+                if (memory_plan_overlap(offset, offset + b->size, p->offset, p->offset + p->size)) {
+                    offset = p->offset + p->size;
+                    moved = 1;
+                }
+            }
+        }
+        b->offset = offset;
+        if (offset + b->size > arena_size) arena_size = offset + b->size;
+    }
+
+    net->memory_arena_size = arena_size + activation_size;
+    net->memory_arena = (float*)gemm_aligned_alloc(net->memory_arena_size);
+    memset(net->memory_arena, 0, net->memory_arena_size);
+    for (i = 0; i < count; ++i) {
+        layer *l = &net->layers[buffers[i].layer];
+        free(l->output);
+        l->output = (float*)((char*)net->memory_arena + buffers[i].offset);
+    }
+    // only backward reads them
+    for (j = 0; j < n; ++j) {
+        layer *l = &net->layers[j];
+        if (!memory_plan_is_alias(*l) && memory_plan_has_activation_input(*l)) {
+            free(l->activation_input);
+            l->activation_input = (float*)((char*)net->memory_arena + arena_size);
+        }
+    }
+    memory_plan_update_pointers(net, output_layer);
+
+    printf(" Memory plan: %d outputs in a %.1f MB arena, was %.1f MB \n",
+        count, (float)net->memory_arena_size / (1024 * 1024), (float)old_size / (1024 * 1024));
+    free(owner);
+    free(buffers);
+    return net->memory_arena_size;
+}
+
+void release_network_memory_plan(network *net)
+{
+    const int output_layer = memory_plan_output_layer(net);
+    int j;
+    if (!net->memory_arena) return;
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        if (memory_plan_is_alias(*l)) continue;
+        if (memory_plan_in_arena(net, l->output)) {
+            l->output = (float*)xcalloc(memory_plan_output_size(*l), sizeof(float));
+        }
+        if (memory_plan_in_arena(net, l->activation_input)) {
+            l->activation_input = (float*)xcalloc((size_t)l->outputs*l->batch, sizeof(float));
+        }
+    }
+    memory_plan_update_pointers(net, output_layer);
+    gemm_aligned_free(net->memory_arena);
+    net->memory_arena = NULL;
+    net->memory_arena_size = 0;
+}
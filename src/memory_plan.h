@@ -0,0 +1,25 @@
+#ifndef MEMORY_PLAN_H
+#define MEMORY_PLAN_H
+#include <stddef.h>
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Inference-only memory planner: every layer output lives from the layer that
+// writes it to the last layer that reads it (the next layer, route/shortcut/sam/
+// scale_channels inputs), detection heads and the network output live to the end.
+// Outputs whose lifetimes don't overlap share memory: they are placed greedily,
+// largest first, at the lowest offset of one arena that is free for their lifetime.
+// The mish/swish activation_input copies, which only backward reads, share one buffer.
+
+// moves the layer outputs into the arena, returns its size in bytes
+// or 0 when some layer is not supported and nothing is changed
+size_t plan_network_memory(network *net);
+// back to a buffer per layer, e.g. before resize_network()
+void release_network_memory_plan(network *net);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
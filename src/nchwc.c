@@ -0,0 +1,845 @@
+#include "nchwc.h"
+#include "gemm.h"
+#include "gemm_packed.h"
+#include "network.h"
+#include "activations.h"
+#include "convolutional_layer.h"
+#include "maxpool_layer.h"
+#include "route_layer.h"
+#include "shortcut_layer.h"
+#include "upsample_layer.h"
+#include "yolo_layer.h"
+#include "utils.h"
+#include "layer_profiler.h"
+#include "fast_activations.h"
+#include <float.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Convolution in the blocked layout (cb input lanes x cb output lanes per step):
+//
+//  for output block pair (ocb, ocb+1)
+//    for output row oy, for tile of RW output pixels
+//      acc[RW][2] = bias
+//      for icb, ky, kx, ic in 0..cb-1
+//        acc[r][o] += broadcast(in[icb][iy][ix + r*stride][ic]) * w[ocb+o][icb][ky][kx][ic][:]
+//
+// The accumulators stay in registers (2*RW vectors), the input is zero-padded
+// once per band of rows into the workspace so the kernel never checks borders.
+// With stride 1 the tiles run over the padded rows as one long row (the outputs
+// that fall on padding columns are not stored), so small maps don't waste most
+// of the last tile of every row. 1x1 / stride 1 / pad 0 layers read the input
+// directly.
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define NCHWC_X86
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define NCHWC_TARGET_AVX2 __attribute__((target("avx,avx2,fma")))
+#define NCHWC_TARGET_AVX512 __attribute__((target("avx,avx2,fma,avx512f")))
+#else
+#define NCHWC_TARGET_AVX2
+#define NCHWC_TARGET_AVX512
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define NCHWC_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define NCHWC_INLINE static __forceinline
+#else
+#define NCHWC_INLINE static inline
+#endif
+
+// the kernels may read up to RW pixels past the end of a blocked tensor
+#define NCHWC_SLACK (16*16)
+
+typedef struct nchwc_conv_tile {
+    const float *in;    // first input pixel of the tile, channel block 0
+    size_t in_block;    // floats per input channel block
+    int row_stride;     // floats between kernel rows
+    int col_stride;     // floats between kernel columns
+    int px_stride;      // floats between output pixels
+    int in_blocks;
+    int last_lanes;     // input channels in the last block (the first layer has 3)
+    int ksize;
+    const float *w;     // [icb][ky][kx][ic][oc] of the first output block
+    size_t w_block;     // floats per output channel block of the weights
+    const float *bias;
+    float *out;
+    size_t out_block;   // floats per output channel block
+    int out_blocks;     // 1 or 2
+    int count;          // output pixels computed, <= RW
+    int col;            // column of the first pixel in rows of `row` pixels
+    int cols;           // columns that are stored, the rest are padding
+    int row;            // pixels per row, 0 - no padding columns
+} nchwc_conv_tile;
+
+typedef void(*nchwc_conv_kernel_t)(const nchwc_conv_tile *t);
+
+typedef struct nchwc_kernel_desc {
+    const char *name;
+    int cb;             // channel block
+    int rw;             // output pixels per tile
+    nchwc_conv_kernel_t kernel;
+} nchwc_kernel_desc;
+
+static nchwc_kernel_desc nchwc_kernel;
+
+#ifdef NCHWC_X86
+
+// AVX2: cb = 8, 6 pixels x 2 blocks = 12 ymm accumulators
+#define AVX2_CB 8
+#define AVX2_RW 6
+NCHWC_TARGET_AVX2
+NCHWC_INLINE void nchwc_conv_body_avx2(const nchwc_conv_tile *t, const int two, const int px)
+{
+    __m256 a0[AVX2_RW], a1[AVX2_RW];
+    int r, icb, ky, kx, ic;
+    for (r = 0; r < AVX2_RW; ++r) {
+        a0[r] = _mm256_loadu_ps(t->bias);
+        a1[r] = two ? _mm256_loadu_ps(t->bias + AVX2_CB) : _mm256_setzero_ps();
+    }
+    for (icb = 0; icb < t->in_blocks; ++icb) {
+        const int lanes = (icb == t->in_blocks - 1) ? t->last_lanes : AVX2_CB;
+        for (ky = 0; ky < t->ksize; ++ky) {
+            for (kx = 0; kx < t->ksize; ++kx) {
+                const float *s = t->in + icb*t->in_block + ky*t->row_stride + kx*t->col_stride;
+                const float *w0 = t->w + ((size_t)(icb*t->ksize + ky)*t->ksize + kx)*AVX2_CB*AVX2_CB;
+                const float *w1 = w0 + t->w_block;
+                for (ic = 0; ic < lanes; ++ic) {
+                    const __m256 b0 = _mm256_loadu_ps(w0 + ic*AVX2_CB);
+                    if (two) {
+                        const __m256 b1 = _mm256_loadu_ps(w1 + ic*AVX2_CB);
+                        for (r = 0; r < AVX2_RW; ++r) {
+                            const __m256 x = _mm256_broadcast_ss(s + r*px + ic);
+                            a0[r] = _mm256_fmadd_ps(x, b0, a0[r]);
+                            a1[r] = _mm256_fmadd_ps(x, b1, a1[r]);
+                        }
+                    }
+                    else {
+                        for (r = 0; r < AVX2_RW; ++r) {
+                            a0[r] = _mm256_fmadd_ps(_mm256_broadcast_ss(s + r*px + ic), b0, a0[r]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    {
+        float *out = t->out;
+        int col = t->col;
+        for (r = 0; r < AVX2_RW && r < t->count; ++r) {
+            if (col < t->cols) {
+                _mm256_storeu_ps(out, a0[r]);
+                if (two) _mm256_storeu_ps(out + t->out_block, a1[r]);
+                out += AVX2_CB;
+            }
+            if (++col == t->row) col = 0;
+        }
+    }
+}
+
+NCHWC_TARGET_AVX2
+static void nchwc_conv_kernel_avx2(const nchwc_conv_tile *t)
+{
+    if (t->out_blocks == 2) {
+        if (t->px_stride == AVX2_CB) nchwc_conv_body_avx2(t, 1, AVX2_CB);
+        else if (t->px_stride == 2 * AVX2_CB) nchwc_conv_body_avx2(t, 1, 2 * AVX2_CB);
+        else nchwc_conv_body_avx2(t, 1, t->px_stride);
+    }
+    else {
+        if (t->px_stride == AVX2_CB) nchwc_conv_body_avx2(t, 0, AVX2_CB);
+        else if (t->px_stride == 2 * AVX2_CB) nchwc_conv_body_avx2(t, 0, 2 * AVX2_CB);
+        else nchwc_conv_body_avx2(t, 0, t->px_stride);
+    }
+}
+
+// AVX-512: cb = 16, 12 pixels x 2 blocks = 24 zmm accumulators
+#define AVX512_CB 16
+#define AVX512_RW 12
+NCHWC_TARGET_AVX512
+NCHWC_INLINE void nchwc_conv_body_avx512(const nchwc_conv_tile *t, const int two, const int px)
+{
+    __m512 a0[AVX512_RW], a1[AVX512_RW];
+    int r, icb, ky, kx, ic;
+    for (r = 0; r < AVX512_RW; ++r) {
+        a0[r] = _mm512_loadu_ps(t->bias);
+        a1[r] = two ? _mm512_loadu_ps(t->bias + AVX512_CB) : _mm512_setzero_ps();
+    }
+    for (icb = 0; icb < t->in_blocks; ++icb) {
+        const int lanes = (icb == t->in_blocks - 1) ? t->last_lanes : AVX512_CB;
+        for (ky = 0; ky < t->ksize; ++ky) {
+            for (kx = 0; kx < t->ksize; ++kx) {
+                const float *s = t->in + icb*t->in_block + ky*t->row_stride + kx*t->col_stride;
+                const float *w0 = t->w + ((size_t)(icb*t->ksize + ky)*t->ksize + kx)*AVX512_CB*AVX512_CB;
+                const float *w1 = w0 + t->w_block;
+                for (ic = 0; ic < lanes; ++ic) {
+                    const __m512 b0 = _mm512_loadu_ps(w0 + ic*AVX512_CB);
+                    if (two) {
+                        const __m512 b1 = _mm512_loadu_ps(w1 + ic*AVX512_CB);
+                        for (r = 0; r < AVX512_RW; ++r) {
+                            const __m512 x = _mm512_set1_ps(s[r*px + ic]);
+                            a0[r] = _mm512_fmadd_ps(x, b0, a0[r]);
+                            a1[r] = _mm512_fmadd_ps(x, b1, a1[r]);
+                        }
+                    }
+                    else {
+                        for (r = 0; r < AVX512_RW; ++r) {
+                            a0[r] = _mm512_fmadd_ps(_mm512_set1_ps(s[r*px + ic]), b0, a0[r]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    {
+        float *out = t->out;
+        int col = t->col;
+        for (r = 0; r < AVX512_RW && r < t->count; ++r) {
+            if (col < t->cols) {
+                _mm512_storeu_ps(out, a0[r]);
+                if (two) _mm512_storeu_ps(out + t->out_block, a1[r]);
+                out += AVX512_CB;
+            }
+            if (++col == t->row) col = 0;
+        }
+    }
+}
+
+NCHWC_TARGET_AVX512
+static void nchwc_conv_kernel_avx512(const nchwc_conv_tile *t)
+{
+    if (t->out_blocks == 2) {
+        if (t->px_stride == AVX512_CB) nchwc_conv_body_avx512(t, 1, AVX512_CB);
+        else if (t->px_stride == 2 * AVX512_CB) nchwc_conv_body_avx512(t, 1, 2 * AVX512_CB);
+        else nchwc_conv_body_avx512(t, 1, t->px_stride);
+    }
+    else {
+        if (t->px_stride == AVX512_CB) nchwc_conv_body_avx512(t, 0, AVX512_CB);
+        else if (t->px_stride == 2 * AVX512_CB) nchwc_conv_body_avx512(t, 0, 2 * AVX512_CB);
+        else nchwc_conv_body_avx512(t, 0, t->px_stride);
+    }
+}
+
+#endif  // NCHWC_X86
+
+// there is no scalar kernel: without AVX2 the packed GEMM path is faster
+static void nchwc_init(void)
+{
+    if (nchwc_kernel.name) return;
+    nchwc_kernel_desc kd = { "none", 0, 0, NULL };
+#ifdef NCHWC_X86
+    if (is_cpu_avx512()) {
+        kd.name = "avx512";
+        kd.cb = AVX512_CB;
+        kd.rw = AVX512_RW;
+        kd.kernel = nchwc_conv_kernel_avx512;
+    }
+    else if (is_cpu_fma_avx2()) {
+        kd.name = "avx2_fma";
+        kd.cb = AVX2_CB;
+        kd.rw = AVX2_RW;
+        kd.kernel = nchwc_conv_kernel_avx2;
+    }
+#endif
+    nchwc_kernel = kd;
+}
+
+int nchwc_block_size(void)
+{
+    nchwc_init();
+    return nchwc_kernel.cb;
+}
+
+static inline int nchwc_blocks(int c, int cb)
+{
+    return (c + cb - 1) / cb;
+}
+
+size_t nchwc_size(int c, int h, int w, int cb)
+{
+    return (size_t)nchwc_blocks(c, cb) * cb * h * w;
+}
+
+size_t nchwc_output_size(layer l)
+{
+    return nchwc_size(l.out_c, l.out_h, l.out_w, l.nchwc)*l.batch + NCHWC_SLACK;
+}
+
+void nchwc_from_planar(const float *src, int c, int h, int w, int cb, float *dst)
+{
+    const int hw = h*w;
+    const int blocks = nchwc_blocks(c, cb);
+    int blk;
+    #pragma omp parallel for
+    for (blk = 0; blk < blocks; ++blk) {
+        float *d = dst + (size_t)blk*hw*cb;
+        int p, k;
+        for (p = 0; p < hw; ++p) {
+            for (k = 0; k < cb; ++k) {
+                const int ch = blk*cb + k;
+                d[(size_t)p*cb + k] = (ch < c) ? src[(size_t)ch*hw + p] : 0;
+            }
+        }
+    }
+}
+
+void nchwc_to_planar(const float *src, int c, int h, int w, int cb, float *dst)
+{
+    const int hw = h*w;
+    int ch;
+    #pragma omp parallel for
+    for (ch = 0; ch < c; ++ch) {
+        const float *s = src + (size_t)(ch / cb)*hw*cb + ch % cb;
+        float *d = dst + (size_t)ch*hw;
+        int p;
+        for (p = 0; p < hw; ++p) d[p] = s[(size_t)p*cb];
+    }
+}
+
+static void nchwc_activate(float *x, size_t n, ACTIVATION a, network net)
+{
+    const float MISH_THRESHOLD = 20;
+    int i;
+    if (net.fast_activations && is_fast_activation(a)) fast_activate_array(x, (int)n, a);
+    else if (a == SWISH) {
+        #pragma omp parallel for
+        for (i = 0; i < (int)n; ++i) x[i] = x[i] * logistic_activate(x[i]);
+    }
+    else if (a == MISH) {
+        #pragma omp parallel for
+        for (i = 0; i < (int)n; ++i) x[i] = x[i] * tanh_activate(softplus_activate(x[i], MISH_THRESHOLD));
+    }
+    else if (a == HARD_MISH) {
+        #pragma omp parallel for
+        for (i = 0; i < (int)n; ++i) {
+            const float v = x[i];
+            x[i] = (v > 0) ? v : ((v > -2) ? v * v / 2 + v : 0);
+        }
+    }
+    else activate_array_cpu_custom(x, (int)n, a);
+}
+
+// ---------------------------------------------------------------------------
+// convolutional
+
+static int nchwc_is_direct_input(layer l)
+{
+    return l.size == 1 && l.stride_x == 1 && l.stride_y == 1 && l.pad == 0;
+}
+
+static int nchwc_is_flat(layer l)
+{
+    return l.stride_x == 1 && l.stride_y == 1;
+}
+
+// padded input geometry (rows are counted from the top of the band)
+static void nchwc_conv_geometry(layer l, int *band_rows, int *in_rows, int *wp)
+{
+    nchwc_init();
+    const int cb = l.nchwc;
+    const int pad = l.pad*l.dilation;
+    const int extent = (l.size - 1)*l.dilation + 1;
+    const int tiles_x = (l.out_w + nchwc_kernel.rw - 1) / nchwc_kernel.rw;
+    const size_t row_size = (size_t)nchwc_blocks(l.c, cb)*cb*sizeof(float);
+    int w = nchwc_is_flat(l) ? (l.out_w - 1 + extent) : ((tiles_x*nchwc_kernel.rw - 1)*l.stride_x + extent);
+    if (w < pad + l.w) w = pad + l.w;
+
+    // bound the padded copy by the same limit as the other CPU algorithms
+    const int max_in_rows = (int)(CONV_INFERENCE_WORKSPACE / (row_size * w));
+    int rows = (max_in_rows < extent) ? 1 : (max_in_rows - extent) / l.stride_y + 1;
+    if (rows > l.out_h) rows = l.out_h;
+    *band_rows = rows;
+    *in_rows = (rows - 1)*l.stride_y + extent;
+    *wp = w;
+}
+
+size_t get_convolutional_nchwc_workspace_size(layer l)
+{
+    int band_rows, in_rows, wp;
+    if (nchwc_is_direct_input(l)) return 0;
+    nchwc_conv_geometry(l, &band_rows, &in_rows, &wp);
+    // + the last flat tile may read past the band
+    return ((size_t)nchwc_blocks(l.c, l.nchwc)*l.nchwc*in_rows*wp + NCHWC_SLACK)*sizeof(float);
+}
+
+// padded rows [y0, y0 + rows) of every input block -> dst [blocks][rows][wp][cb]
+static void nchwc_pad_input(const float *in, int blocks, int h, int w, int cb, int pad, int y0, int rows, int wp, float *dst)
+{
+    int k;
+    #pragma omp parallel for
+    for (k = 0; k < blocks*rows; ++k) {
+        const int blk = k / rows;
+        const int iy = y0 + k % rows - pad;
+        float *d = dst + (size_t)k*wp*cb;
+        if (iy < 0 || iy >= h) {
+            memset(d, 0, (size_t)wp*cb * sizeof(float));
+        }
+        else {
+            memset(d, 0, (size_t)pad*cb * sizeof(float));
+            memcpy(d + pad*cb, in + ((size_t)blk*h + iy)*w*cb, (size_t)w*cb * sizeof(float));
+            memset(d + (pad + w)*cb, 0, (size_t)(wp - pad - w)*cb * sizeof(float));
+        }
+    }
+}
+
+static void nchwc_prepare_convolutional(layer *l, int cb)
+{
+    const int in_blocks = nchwc_blocks(l->c, cb);
+    const int out_blocks = nchwc_blocks(l->n, cb);
+    const int ks = l->size;
+    const size_t w_block = (size_t)in_blocks*ks*ks*cb*cb;
+    int o;
+
+    free_convolutional_inference_weights(l);
+
+    l->weights_nchwc = (float*)gemm_aligned_alloc(out_blocks*w_block * sizeof(float));
+    l->biases_nchwc = (float*)gemm_aligned_alloc((size_t)out_blocks*cb * sizeof(float));
+    memset(l->weights_nchwc, 0, out_blocks*w_block * sizeof(float));
+    memset(l->biases_nchwc, 0, (size_t)out_blocks*cb * sizeof(float));
+
+    for (o = 0; o < l->n; ++o) {
+        float *dst = l->weights_nchwc + (o / cb)*w_block + o % cb;
+        int i, ky, kx;
+        for (i = 0; i < l->c; ++i) {
+            for (ky = 0; ky < ks; ++ky) {
+                for (kx = 0; kx < ks; ++kx) {
+                    dst[((size_t)((i / cb)*ks + ky)*ks + kx)*cb*cb + (i % cb)*cb] = l->weights[(((size_t)o*l->c + i)*ks + ky)*ks + kx];
+                }
+            }
+        }
+        l->biases_nchwc[o] = l->biases[o];
+    }
+}
+
+static void forward_convolutional_layer_nchwc(layer l, network_state state)
+{
+    const int cb = l.nchwc;
+    const int rw = nchwc_kernel.rw;
+    const int in_blocks = nchwc_blocks(l.c, cb);
+    const int out_blocks = nchwc_blocks(l.n, cb);
+    const int pairs = (out_blocks + 1) / 2;
+    const size_t in_size = nchwc_size(l.c, l.h, l.w, cb);
+    const size_t out_size = nchwc_size(l.n, l.out_h, l.out_w, cb);
+    const size_t out_block = (size_t)l.out_h*l.out_w*cb;
+    const size_t w_block = (size_t)in_blocks*l.size*l.size*cb*cb;
+    const int direct = nchwc_is_direct_input(l);
+    double t_phase = profile_phase_begin();
+    int b;
+
+    for (b = 0; b < l.batch; ++b) {
+        const float *in = state.input + b*in_size;
+        float *out = l.output + b*out_size;
+
+        if (direct) {
+            const int hw = l.out_h*l.out_w;
+            const int tiles = (hw + rw - 1) / rw;
+            int task;
+            #pragma omp parallel for
+            for (task = 0; task < pairs*tiles; ++task) {
+                const int ocb = (task / tiles) * 2;
+                const int p0 = (task % tiles) * rw;
+                nchwc_conv_tile t;
+                t.in = in + (size_t)p0*cb;
+                t.in_block = (size_t)l.h*l.w*cb;
+                t.row_stride = t.col_stride = 0;
+                t.px_stride = cb;
+                t.in_blocks = in_blocks;
+                t.last_lanes = l.c - (in_blocks - 1)*cb;
+                t.ksize = 1;
+                t.w = l.weights_nchwc + ocb*w_block;
+                t.w_block = w_block;
+                t.bias = l.biases_nchwc + ocb*cb;
+                t.out = out + ocb*out_block + (size_t)p0*cb;
+                t.out_block = out_block;
+                t.out_blocks = (ocb + 1 < out_blocks) ? 2 : 1;
+                t.count = (hw - p0 < rw) ? (hw - p0) : rw;
+                t.col = 0;
+                t.cols = INT_MAX;
+                t.row = 0;
+                nchwc_kernel.kernel(&t);
+            }
+        }
+        else {
+            const int pad = l.pad*l.dilation;
+            const int flat = nchwc_is_flat(l);
+            const int tiles_x = (l.out_w + rw - 1) / rw;
+            int band_rows, in_rows, wp, oy0;
+            nchwc_conv_geometry(l, &band_rows, &in_rows, &wp);
+            for (oy0 = 0; oy0 < l.out_h; oy0 += band_rows) {
+                const int rows = (oy0 + band_rows < l.out_h) ? band_rows : (l.out_h - oy0);
+                // flat: pixels of the padded rows, up to the last output of the band
+                const int pixels = (rows - 1)*wp + l.out_w;
+                const int tiles = flat ? (pixels + rw - 1) / rw : rows*tiles_x;
+                int task;
+                nchwc_pad_input(in, in_blocks, l.h, l.w, cb, pad, oy0*l.stride_y, in_rows, wp, state.workspace);
+                #pragma omp parallel for
+                for (task = 0; task < pairs*tiles; ++task) {
+                    const int ocb = (task / tiles) * 2;
+                    const int tile = task % tiles;
+                    nchwc_conv_tile t;
+                    if (flat) {
+                        const int q0 = tile*rw;
+                        const int oy = q0 / wp, col = q0 % wp;
+                        t.in = state.workspace + (size_t)q0*cb;
+                        t.out = out + ocb*out_block + ((size_t)(oy0 + oy)*l.out_w + (col < l.out_w ? col : l.out_w))*cb;
+                        t.count = (pixels - q0 < rw) ? (pixels - q0) : rw;
+                        t.col = col;
+                        t.cols = l.out_w;
+                        t.row = wp;
+                    }
+                    else {
+                        const int oy = tile / tiles_x;
+                        const int ox0 = (tile % tiles_x) * rw;
+                        t.in = state.workspace + ((size_t)oy*l.stride_y*wp + (size_t)ox0*l.stride_x)*cb;
+                        t.out = out + ocb*out_block + ((size_t)(oy0 + oy)*l.out_w + ox0)*cb;
+                        t.count = (l.out_w - ox0 < rw) ? (l.out_w - ox0) : rw;
+                        t.col = 0;
+                        t.cols = INT_MAX;
+                        t.row = 0;
+                    }
+                    t.in_block = (size_t)in_rows*wp*cb;
+                    t.row_stride = l.dilation*wp*cb;
+                    t.col_stride = l.dilation*cb;
+                    t.px_stride = l.stride_x*cb;
+                    t.in_blocks = in_blocks;
+                    t.last_lanes = l.c - (in_blocks - 1)*cb;
+                    t.ksize = l.size;
+                    t.w = l.weights_nchwc + ocb*w_block;
+                    t.w_block = w_block;
+                    t.bias = l.biases_nchwc + ocb*cb;
+                    t.out_block = out_block;
+                    t.out_blocks = (ocb + 1 < out_blocks) ? 2 : 1;
+                    nchwc_kernel.kernel(&t);
+                }
+            }
+        }
+    }
+    profile_phase_end(PROFILE_GEMM, t_phase);
+    t_phase = profile_phase_begin();
+    nchwc_activate(l.output, out_size*l.batch, l.activation, state.net);
+    profile_phase_end(PROFILE_ACTIVATION, t_phase);
+}
+
+// the first layer converts the planar network input
+static void forward_convolutional_layer_nchwc_input(layer l, network_state state)
+{
+    const size_t in_size = nchwc_size(l.c, l.h, l.w, l.nchwc);
+    int b;
+    for (b = 0; b < l.batch; ++b) {
+        nchwc_from_planar(state.input + b*l.inputs, l.c, l.h, l.w, l.nchwc, state.net.nchwc_scratch + b*in_size);
+    }
+    state.input = state.net.nchwc_scratch;
+    forward_convolutional_layer_nchwc(l, state);
+}
+
+// ---------------------------------------------------------------------------
+// maxpool: separable, max over the window columns into the workspace, then over rows
+
+NCHWC_INLINE void nchwc_maxpool(const layer l, const float *input, float *tmp, const int cb)
+{
+    const int blocks = nchwc_blocks(l.c, cb);
+    const int offset = -l.pad / 2;
+    const size_t in_size = nchwc_size(l.c, l.h, l.w, cb);
+    const size_t out_size = nchwc_size(l.out_c, l.out_h, l.out_w, cb);
+    int b, blk;
+    for (b = 0; b < l.batch; ++b) {
+        #pragma omp parallel for
+        for (blk = 0; blk < blocks; ++blk) {
+            const float *src = input + b*in_size + (size_t)blk*l.h*l.w*cb;
+            float *t = tmp + (size_t)blk*l.h*l.out_w*cb;
+            float *dst = l.output + b*out_size + (size_t)blk*l.out_h*l.out_w*cb;
+            int y, x, i, k;
+            for (y = 0; y < l.h; ++y) {
+                for (x = 0; x < l.out_w; ++x) {
+                    float *d = t + ((size_t)y*l.out_w + x)*cb;
+                    for (k = 0; k < cb; ++k) d[k] = -FLT_MAX;
+                    for (i = 0; i < l.size; ++i) {
+                        const int ix = offset + x*l.stride_x + i;
+                        if (ix >= 0 && ix < l.w) {
+                            const float *s = src + ((size_t)y*l.w + ix)*cb;
+                            for (k = 0; k < cb; ++k) d[k] = (s[k] > d[k]) ? s[k] : d[k];
+                        }
+                    }
+                }
+            }
+            for (y = 0; y < l.out_h; ++y) {
+                for (x = 0; x < l.out_w; ++x) {
+                    float *d = dst + ((size_t)y*l.out_w + x)*cb;
+                    for (k = 0; k < cb; ++k) d[k] = -FLT_MAX;
+                    for (i = 0; i < l.size; ++i) {
+                        const int iy = offset + y*l.stride_y + i;
+                        if (iy >= 0 && iy < l.h) {
+                            const float *s = t + ((size_t)iy*l.out_w + x)*cb;
+                            for (k = 0; k < cb; ++k) d[k] = (s[k] > d[k]) ? s[k] : d[k];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void forward_maxpool_layer_nchwc(const layer l, network_state state)
+{
+    if (l.nchwc == 16) nchwc_maxpool(l, state.input, state.workspace, 16);
+    else nchwc_maxpool(l, state.input, state.workspace, 8);
+}
+
+// ---------------------------------------------------------------------------
+// shortcut (single input, no weights, same shape), route and upsample
+
+static void forward_shortcut_layer_nchwc(const layer l, network_state state)
+{
+    const int size = (int)(nchwc_size(l.out_c, l.out_h, l.out_w, l.nchwc)*l.batch);
+    const float *from = state.net.layers[l.index].output;
+    int i;
+    #pragma omp parallel for
+    for (i = 0; i < size; ++i) l.output[i] = state.input[i] + from[i];
+    nchwc_activate(l.output, size, l.activation, state.net);
+}
+
+static void forward_route_layer_nchwc(const layer l, network_state state)
+{
+    const int cb = l.nchwc;
+    const size_t hw = (size_t)l.out_h*l.out_w;
+    const size_t out_size = nchwc_size(l.out_c, l.out_h, l.out_w, cb);
+    int i, b, offset = 0;
+    for (i = 0; i < l.n; ++i) {
+        const layer in = state.net.layers[l.input_layers[i]];
+        const size_t in_size = nchwc_size(in.out_c, in.out_h, in.out_w, cb);
+        const int part = in.out_c / l.groups;
+        const int first = part*l.group_id;
+        for (b = 0; b < l.batch; ++b) {
+            const float *src = in.output + b*in_size;
+            float *dst = l.output + b*out_size;
+            int ch = 0;
+            // whole blocks when both sides are block-aligned
+            if (first % cb == 0 && offset % cb == 0) {
+                const int whole = part / cb;
+                memcpy(dst + (offset / cb)*hw*cb, src + (first / cb)*hw*cb, whole*hw*cb * sizeof(float));
+                ch = whole*cb;
+            }
+            for (; ch < part; ++ch) {
+                const int sc = first + ch, dc = offset + ch;
+                const float *s = src + (sc / cb)*hw*cb + sc % cb;
+                float *d = dst + (dc / cb)*hw*cb + dc % cb;
+                size_t p;
+                for (p = 0; p < hw; ++p) d[p*cb] = s[p*cb];
+            }
+        }
+        offset += part;
+    }
+}
+
+static void forward_upsample_layer_nchwc(const layer l, network_state state)
+{
+    const int cb = l.nchwc;
+    const int s = l.stride;
+    const int blocks = nchwc_blocks(l.c, cb);
+    const size_t in_size = nchwc_size(l.c, l.h, l.w, cb);
+    const size_t out_size = nchwc_size(l.out_c, l.out_h, l.out_w, cb);
+    int b, row;
+    for (b = 0; b < l.batch; ++b) {
+        #pragma omp parallel for
+        for (row = 0; row < blocks*l.out_h; ++row) {
+            const int blk = row / l.out_h, y = row % l.out_h;
+            const float *src = state.input + b*in_size + ((size_t)blk*l.h + y / s)*l.w*cb;
+            float *dst = l.output + b*out_size + ((size_t)blk*l.out_h + y)*l.out_w*cb;
+            int x, k;
+            for (x = 0; x < l.out_w; ++x) {
+                const float *sp = src + (size_t)(x / s)*cb;
+                for (k = 0; k < cb; ++k) dst[(size_t)x*cb + k] = l.scale * sp[k];
+            }
+        }
+    }
+}
+
+// yolo heads get their input back in NCHW
+static void forward_yolo_layer_nchwc(const layer l, network_state state)
+{
+    const int cb = state.net.nchwc_block;
+    const size_t in_size = nchwc_size(l.c, l.h, l.w, cb);
+    int b;
+    for (b = 0; b < l.batch; ++b) {
+        nchwc_to_planar(state.input + b*in_size, l.c, l.h, l.w, cb, state.net.nchwc_scratch + b*l.inputs);
+    }
+    state.input = state.net.nchwc_scratch;
+    forward_yolo_layer(l, state);
+}
+
+// ---------------------------------------------------------------------------
+
+static int nchwc_is_yolo(network *net, int index)
+{
+    return index >= 0 && index < net->n && net->layers[index].type == YOLO;
+}
+
+// NULL if the layer can run in the blocked layout
+static const char *nchwc_unsupported(network *net, int j)
+{
+    const layer l = net->layers[j];
+    int i;
+    // the input of everything but route comes from the previous layer
+    if (j > 0 && nchwc_is_yolo(net, j - 1) && l.type != ROUTE) return "follows a yolo layer";
+    switch (l.type) {
+    case CONVOLUTIONAL:
+        if (l.forward != forward_convolutional_layer) return "custom forward";
+        if (l.xnor || l.binary) return "binary weights";
+        if (l.weights_int8) return "int8 weights";
+        if (l.groups != 1) return "grouped convolution";
+        if (l.antialiasing) return "antialiasing";
+        if (l.batch_normalize) return "batch normalization is not fused";
+        if (l.activation == NORM_CHAN || l.activation == NORM_CHAN_SOFTMAX || l.activation == NORM_CHAN_SOFTMAX_MAXVAL) return "normalize-channels activation";
+        return NULL;
+    case MAXPOOL:
+        if (l.forward != forward_maxpool_layer) return "custom forward";
+        if (l.maxpool_depth || l.antialiasing || l.out_c != l.c) return "depth/antialiasing maxpool";
+        return j > 0 ? NULL : "first layer";
+    case SHORTCUT:
+        if (l.forward != forward_shortcut_layer) return "custom forward";
+        if (l.nweights != 0 || l.n != 1) return "weighted or multi-input shortcut";
+        if (nchwc_is_yolo(net, l.index)) return "yolo input";
+        if (net->layers[l.index].out_w != l.w || net->layers[l.index].out_h != l.h || net->layers[l.index].out_c != l.c) return "different shapes";
+        return NULL;
+    case ROUTE:
+        if (l.forward != forward_route_layer) return "custom forward";
+        for (i = 0; i < l.n; ++i) {
+            if (nchwc_is_yolo(net, l.input_layers[i])) return "yolo input";
+        }
+        return NULL;
+    case UPSAMPLE:
+        if (l.forward != forward_upsample_layer) return "custom forward";
+        if (l.reverse) return "reverse upsample";
+        return j > 0 ? NULL : "first layer";
+    case YOLO:
+        if (l.forward != forward_yolo_layer) return "custom forward";
+        return j > 0 ? NULL : "first layer";
+    default:
+        return "layer type";
+    }
+}
+
+int enable_network_nchwc(network *net)
+{
+    size_t scratch = 0;
+    int j, cb, converted = 0;
+    if (net->nchwc_block) return net->nchwc_block;
+    if (!nchwc_block_size()) {
+        printf(" NCHWc: not used, it needs AVX2 or AVX-512 \n");
+        return 0;
+    }
+    if (net->n < 2 || net->layers[0].type != CONVOLUTIONAL || net->layers[net->n - 1].type != YOLO) {
+        printf(" NCHWc: not used, the network must start with a convolutional and end with a yolo layer \n");
+        return 0;
+    }
+    for (j = 0; j < net->n; ++j) {
+        const char *reason = nchwc_unsupported(net, j);
+        if (reason) {
+            printf(" NCHWc: not used, layer %d is not supported (%s) \n", j, reason);
+            return 0;
+        }
+    }
+
+    cb = nchwc_block_size();
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        size_t size;
+        if (l->type == YOLO) {
+            l->forward = forward_yolo_layer_nchwc;
+            if ((size_t)l->inputs*l->batch > scratch) scratch = (size_t)l->inputs*l->batch;
+            continue;
+        }
+        l->nchwc = cb;
+        size = nchwc_output_size(*l);
+        l->output = (float*)xrealloc(l->output, size * sizeof(float));
+        memset(l->output, 0, size * sizeof(float));
+        ++converted;
+
+        switch (l->type) {
+        case CONVOLUTIONAL:
+            nchwc_prepare_convolutional(l, cb);
+            if (j == 0) {
+                const size_t in_size = nchwc_size(l->c, l->h, l->w, cb)*l->batch + NCHWC_SLACK;
+                if (in_size > scratch) scratch = in_size;
+                l->forward = forward_convolutional_layer_nchwc_input;
+            }
+            else l->forward = forward_convolutional_layer_nchwc;
+            break;
+        case MAXPOOL:
+            l->workspace_size = nchwc_size(l->c, l->h, l->out_w, cb) * sizeof(float);
+            l->forward = forward_maxpool_layer_nchwc;
+            break;
+        case SHORTCUT:
+            l->forward = forward_shortcut_layer_nchwc;
+            break;
+        case ROUTE:
+            l->forward = forward_route_layer_nchwc;
+            break;
+        case UPSAMPLE:
+            l->forward = forward_upsample_layer_nchwc;
+            break;
+        default:
+            break;
+        }
+    }
+    // outputs moved
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        int i;
+        if (l->type != SHORTCUT || !l->layers_output) continue;
+        for (i = 0; i < l->n; ++i) l->layers_output[i] = net->layers[l->input_layers[i]].output;
+    }
+    net->output = net->layers[net->n - 1].output;
+
+    net->nchwc_scratch = (float*)xcalloc(scratch, sizeof(float));
+    net->nchwc_block = cb;
+    recalculate_workspace_size(net);
+    printf(" NCHWc: %d layers in %d-channel blocks (%s kernel) \n", converted, cb, nchwc_kernel.name);
+    return cb;
+}
+
+void disable_network_nchwc(network *net)
+{
+    int j;
+    if (!net->nchwc_block) return;
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        switch (l->type) {
+        case CONVOLUTIONAL:
+            if (l->weights_nchwc) {
+                gemm_aligned_free(l->weights_nchwc), l->weights_nchwc = NULL;
+                gemm_aligned_free(l->biases_nchwc), l->biases_nchwc = NULL;
+                set_convolutional_algorithm(l, select_convolutional_algorithm(*l));
+            }
+            l->forward = forward_convolutional_layer;
+            break;
+        case MAXPOOL:
+            l->workspace_size = 0;
+            l->forward = forward_maxpool_layer;
+            break;
+        case SHORTCUT:
+            l->forward = forward_shortcut_layer;
+            break;
+        case ROUTE:
+            l->forward = forward_route_layer;
+            break;
+        case UPSAMPLE:
+            l->forward = forward_upsample_layer;
+            break;
+        case YOLO:
+            l->forward = forward_yolo_layer;
+            break;
+        default:
+            break;
+        }
+        l->nchwc = 0;
+    }
+    free(net->nchwc_scratch);
+    net->nchwc_scratch = NULL;
+    net->nchwc_block = 0;
+    recalculate_workspace_size(net);
+}
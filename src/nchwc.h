@@ -0,0 +1,39 @@
+#ifndef NCHWC_H
+#define NCHWC_H
+#include <stddef.h>
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Blocked NCHWc layout for CPU inference: [C/cb][H][W][cb], cb = 16 (AVX-512) or 8 (AVX2).
+// Channels are padded up to a multiple of cb (the pad lanes stay finite, pad
+// weights are 0), so every pixel of a channel block is one SIMD vector and the
+// convolution becomes a register-tiled outer product: pixels x output lanes.
+// The planar network input is converted by the first convolution, the yolo heads
+// convert back to NCHW and every layer in between stays blocked.
+// Supported: convolutional, maxpool, shortcut, route, upsample and yolo layers.
+
+// channel block size the kernels of this CPU use, 0 - no kernel (no AVX2)
+int nchwc_block_size(void);
+// floats of a c x h x w tensor in the blocked layout
+size_t nchwc_size(int c, int h, int w, int cb);
+// floats of the output buffer of a blocked layer, with the slack the kernels may read
+size_t nchwc_output_size(layer l);
+
+void nchwc_from_planar(const float *src, int c, int h, int w, int cb, float *dst);
+void nchwc_to_planar(const float *src, int c, int h, int w, int cb, float *dst);
+
+// bytes of workspace the blocked convolution of this layer needs
+size_t get_convolutional_nchwc_workspace_size(layer l);
+
+// switch a prepared (fused) network to the blocked layout, returns the block size
+// or 0 when some layer is not supported and the network stays in NCHW
+int enable_network_nchwc(network *net);
+// back to NCHW, e.g. before resize_network()
+void disable_network_nchwc(network *net);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -38,6 +38,16 @@
 #include "gaussian_yolo_layer.h"
 #include "upsample_layer.h"
 #include "parser.h"
+#include "nchwc.h"
+#include "quantize.h"
+#include "memory_plan.h"
+#include "gemm_packed.h"
+#include "prepared.h"
+#include "layer_profiler.h"
+#include "fast_activations.h"
+#include "layer_graph.h"
+#include "detection_pool.h"
+#include "json_writer.h"
 
 load_args get_base_args(network *net)
 {
@@ -233,6 +243,16 @@ char *get_layer_string(LAYER_TYPE a)
             return "normalization";
         case BATCHNORM:
             return "batchnorm";
+        case UPSAMPLE:
+            return "upsample";
+        case LOCAL_AVGPOOL:
+            return "local_avgpool";
+        case CONV_LSTM:
+            return "conv_lstm";
+        case IMPLICIT:
+            return "implicit";
+        case EMPTY:
+            return "empty";
         default:
             break;
     }
@@ -270,6 +290,10 @@ void forward_network(network net, network_state state)
 {
     state.workspace = net.workspace;
     int i;
+    if (net.graph && !state.train && !net.profiler && !net.nchwc_block && !net.memory_arena) {
+        forward_network_graph(net.graph, net, state);
+        return;
+    }
     for(i = 0; i < net.n; ++i){
         state.index = i;
         layer l = net.layers[i];
@@ -277,7 +301,9 @@ void forward_network(network net, network_state state)
             scal_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
         //double time = get_time_point();
+        if (net.profiler) profile_layer_begin(net.profiler, i);
         l.forward(l, state);
+        if (net.profiler) profile_layer_end(net.profiler, i);
         //printf("%d - Predicted in %lf milli-seconds.\n", i, ((double)get_time_point() - time) / 1000);
         state.input = l.output;
 
@@ -576,6 +602,14 @@ int resize_network(network *net, int w, int h)
     }
 #endif
     int i;
+    // the memory plan and the blocked layout are rebuilt for the new sizes
+    const int memory_plan = (net->memory_arena != NULL);
+    if (memory_plan) release_network_memory_plan(net);
+    const int nchwc = net->nchwc_block;
+    if (nchwc) disable_network_nchwc(net);
+    const int graph_threads = layer_graph_threads(net->graph);
+    free_layer_graph(net->graph);
+    net->graph = NULL;
     //if(w == net->w && h == net->h) return 0;
     net->w = w;
     net->h = h;
@@ -675,6 +709,9 @@ int resize_network(network *net, int w, int h)
     free(net->workspace);
     net->workspace = (float*)xcalloc(1, workspace_size);
 #endif
+    if (nchwc) enable_network_nchwc(net);
+    if (memory_plan) plan_network_memory(net);
+    if (graph_threads) net->graph = make_layer_graph(*net, graph_threads);
     //fprintf(stderr, " Done!\n");
     return 0;
 }
@@ -776,6 +813,18 @@ float *network_predict(network net, float *input)
     return out;
 }
 
+void network_predict_batched(network *net, float *input, int batch)
+{
+    const int net_batch = net->batch;
+    int i;
+    // the outputs and the workspace stay allocated for the batch of the cfg
+    net->batch = batch;
+    for (i = 0; i < net->n; ++i) net->layers[i].batch = batch;
+    network_predict(*net, input);
+    net->batch = net_batch;
+    for (i = 0; i < net->n; ++i) net->layers[i].batch = net_batch;
+}
+
 #ifdef CUDA_OPENGL_INTEGRATION
 float *network_predict_gl_texture(network *net, uint32_t texture_id)
 {
@@ -826,17 +875,21 @@ int num_detections_batch(network *net, float thresh, int batch)
     return s;
 }
 
-detection *make_network_boxes(network *net, float thresh, int *num)
+// the first detection layer, it gives the arrays of every detection
+static layer get_network_boxes_layer(network *net)
 {
     int i;
-    layer l = net->layers[net->n - 1];
     for (i = 0; i < net->n; ++i) {
-        layer l_tmp = net->layers[i];
-        if (l_tmp.type == YOLO || l_tmp.type == GAUSSIAN_YOLO || l_tmp.type == DETECTION || l_tmp.type == REGION) {
-            l = l_tmp;
-            break;
-        }
+        layer l = net->layers[i];
+        if (l.type == YOLO || l.type == GAUSSIAN_YOLO || l.type == DETECTION || l.type == REGION) return l;
     }
+    return net->layers[net->n - 1];
+}
+
+detection *make_network_boxes(network *net, float thresh, int *num)
+{
+    int i;
+    layer l = get_network_boxes_layer(net);
 
     int nboxes = num_detections(net, thresh);
     if (num) *num = nboxes;
@@ -860,14 +913,7 @@ detection *make_network_boxes(network *net, float thresh, int *num)
 detection *make_network_boxes_batch(network *net, float thresh, int *num, int batch)
 {
     int i;
-    layer l = net->layers[net->n - 1];
-    for (i = 0; i < net->n; ++i) {
-        layer l_tmp = net->layers[i];
-        if (l_tmp.type == YOLO || l_tmp.type == GAUSSIAN_YOLO || l_tmp.type == DETECTION || l_tmp.type == REGION) {
-            l = l_tmp;
-            break;
-        }
-    }
+    layer l = get_network_boxes_layer(net);
 
     int nboxes = num_detections_batch(net, thresh, batch);
     assert(num != NULL);
@@ -983,6 +1029,42 @@ detection *get_network_boxes(network *net, int w, int h, float thresh, float hie
     return dets;
 }
 
+static detection *make_network_boxes_pooled(network *net, int nboxes)
+{
+    layer l = get_network_boxes_layer(net);
+    int i;
+    if (!net->detection_pool) net->detection_pool = make_detection_pool();
+    detection *dets = detection_pool_get(net->detection_pool, nboxes, l.classes, l.type == GAUSSIAN_YOLO,
+        (l.coords > 4) ? l.coords - 4 : 0, l.embedding_output ? l.embedding_size : 0);
+    if (!l.embedding_output) {
+        for (i = 0; i < nboxes; ++i) dets[i].embedding_size = l.embedding_size;
+    }
+    return dets;
+}
+
+detection *get_network_boxes_pooled(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter)
+{
+    const int nboxes = num_detections(net, thresh);
+    detection *dets = make_network_boxes_pooled(net, nboxes);
+    if (num) *num = nboxes;
+    fill_network_boxes(net, w, h, thresh, hier, map, relative, dets, letter);
+    return dets;
+}
+
+detection *get_network_boxes_batch_pooled(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter, int batch)
+{
+    const int nboxes = num_detections_batch(net, thresh, batch);
+    detection *dets = make_network_boxes_pooled(net, nboxes);
+    if (num) *num = nboxes;
+    fill_network_boxes_batch(net, w, h, thresh, hier, map, relative, dets, letter, batch);
+    return dets;
+}
+
+void release_network_boxes(detection *dets)
+{
+    detection_pool_release(dets);
+}
+
 void free_detections(detection *dets, int n)
 {
     int i;
@@ -1014,49 +1096,9 @@ void free_batch_detections(det_num_pair *det_num_pairs, int n)
 
 char *detection_to_json(detection *dets, int nboxes, int classes, char **names, long long int frame_id, char *filename)
 {
-    const float thresh = 0.005; // function get_network_boxes() has already filtred dets by actual threshold
-
-    char *send_buf = (char *)calloc(1024, sizeof(char));
-    if (!send_buf) return 0;
-    if (filename) {
-        sprintf(send_buf, "{\n \"frame_id\":%lld, \n \"filename\":\"%s\", \n \"objects\": [ \n", frame_id, filename);
-    }
-    else {
-        sprintf(send_buf, "{\n \"frame_id\":%lld, \n \"objects\": [ \n", frame_id);
-    }
-
-    int i, j;
-    int class_id = -1;
-    for (i = 0; i < nboxes; ++i) {
-        for (j = 0; j < classes; ++j) {
-            int show = strncmp(names[j], "dont_show", 9);
-            if (dets[i].prob[j] > thresh && show)
-            {
-                if (class_id != -1) strcat(send_buf, ", \n");
-                class_id = j;
-                char *buf = (char *)calloc(2048, sizeof(char));
-                if (!buf) return 0;
-                //sprintf(buf, "{\"image_id\":%d, \"category_id\":%d, \"bbox\":[%f, %f, %f, %f], \"score\":%f}",
-                //    image_id, j, dets[i].bbox.x, dets[i].bbox.y, dets[i].bbox.w, dets[i].bbox.h, dets[i].prob[j]);
-
-                sprintf(buf, "  {\"class_id\":%d, \"name\":\"%s\", \"relative_coordinates\":{\"center_x\":%f, \"center_y\":%f, \"width\":%f, \"height\":%f}, \"confidence\":%f}",
-                    j, names[j], dets[i].bbox.x, dets[i].bbox.y, dets[i].bbox.w, dets[i].bbox.h, dets[i].prob[j]);
-
-                int send_buf_len = strlen(send_buf);
-                int buf_len = strlen(buf);
-                int total_len = send_buf_len + buf_len + 100;
-                send_buf = (char *)realloc(send_buf, total_len * sizeof(char));
-                if (!send_buf) {
-                    if (buf) free(buf);
-                    return 0;
-                }
-                strcat(send_buf, buf);
-                free(buf);
-            }
-        }
-    }
-    strcat(send_buf, "\n ] \n}");
-    return send_buf;
+    json_writer w = { 0 };
+    json_write_detections(&w, dets, nboxes, classes, names, frame_id, filename);
+    return json_writer_detach(&w);
 }
 
 
@@ -1238,10 +1280,23 @@ void free_network_ptr(network* net)
 void free_network(network net)
 {
     int i;
+    free_layer_graph(net.graph);
+    free_detection_pool(net.detection_pool);
+    if (net.memory_arena) {
+        // the outputs in the arena aren't owned by the layers
+        const char *arena_end = (const char*)net.memory_arena + net.memory_arena_size;
+        for (i = 0; i < net.n; ++i) {
+            layer *l = &net.layers[i];
+            if (l->output >= net.memory_arena && (const char*)l->output < arena_end) l->output = NULL;
+            if (l->activation_input >= net.memory_arena && (const char*)l->activation_input < arena_end) l->activation_input = NULL;
+        }
+        gemm_aligned_free(net.memory_arena);
+    }
     for (i = 0; i < net.n; ++i) {
         free_layer(net.layers[i]);
     }
     free(net.layers);
+    unmap_prepared_model(&net);
 
     free(net.seq_scales);
     free(net.scales);
@@ -1255,6 +1310,7 @@ void free_network(network net)
     free(net.cur_iteration);
     free(net.total_bbox);
     free(net.rewritten_bbox);
+    free(net.nchwc_scratch);
 
 #ifdef GPU
     if (gpu_index >= 0) cuda_free(net.workspace);
@@ -1432,6 +1488,58 @@ void calculate_binary_weights(network net)
 
 }
 
+// One-time CPU inference preparation, after load_weights() + fuse_conv_batchnorm():
+// weights are converted to the layouts the inference kernels use directly.
+// Not for networks that are going to be trained further.
+void prepare_network_for_inference(network *net)
+{
+#ifdef GPU
+    if (gpu_index >= 0) return;
+#endif
+    int j;
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        // a prepared model already has the weights of its algorithm
+        if (l->type == CONVOLUTIONAL && !l->xnor && !l->weights_packed && !l->weights_winograd) {
+            set_convolutional_algorithm(l, select_convolutional_algorithm(*l));
+        }
+    }
+    recalculate_workspace_size(net);
+    if (get_int8_quantization_table()) {
+        int8_calibration *cal = load_int8_calibration(get_int8_quantization_table(), *net);
+        quantize_network_int8(net, cal);
+        free_int8_calibration(cal);
+    }
+    if (get_fast_activations()) net->fast_activations = 1;
+    if (net->fast_activations) printf(" fast activations: %s \n", fast_activations_kernel_name());
+    if (net->nchwc) enable_network_nchwc(net);
+    if (net->memory_plan) plan_network_memory(net);
+    if (get_yolo_decode()) net->yolo_decode = 1;
+    for (j = 0; j < net->n && net->yolo_decode; ++j) {
+        if (net->layers[j].type == YOLO) net->layers[j].output_logits = 1;
+    }
+    if (get_parallel_branches()) net->parallel_branches = 1;
+    if (net->parallel_branches && !net->graph) net->graph = make_layer_graph(*net, 0);
+}
+
+void print_cpu_conv_algorithms(network net)
+{
+#ifdef GPU
+    if (gpu_index >= 0) return;
+#endif
+    int algo_count[CONV_ALGO_WINOGRAD_4X4 + 1] = { 0 };
+    size_t workspace_size = 0;
+    int j;
+    for (j = 0; j < net.n; ++j) {
+        const layer l = net.layers[j];
+        if (l.type == CONVOLUTIONAL && !l.xnor) algo_count[l.conv_algo]++;
+        if (l.workspace_size > workspace_size) workspace_size = l.workspace_size;
+    }
+    printf(" CPU conv: %d im2col, %d direct 1x1, %d Winograd 2x2, %d Winograd 4x4; workspace %.1f MB \n",
+        algo_count[CONV_ALGO_IM2COL], algo_count[CONV_ALGO_DIRECT_1X1], algo_count[CONV_ALGO_WINOGRAD_2X2], algo_count[CONV_ALGO_WINOGRAD_4X4],
+        (float)workspace_size / (1024 * 1024));
+}
+
 void copy_cudnn_descriptors(layer src, layer *dst)
 {
 #ifdef CUDNN
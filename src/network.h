@@ -140,6 +140,11 @@ float train_network_datum(network net, float *x, float *y);
 matrix network_predict_data(network net, data test);
 //LIB_API float *network_predict(network net, float *input);
 //LIB_API float *network_predict_ptr(network *net, float *input);
+// the CPU conv algorithms of a network prepare_network_for_inference() has prepared
+void print_cpu_conv_algorithms(network net);
+// forward pass of the first batch images of input (net.w x net.h each)
+// by a network loaded with a bigger or the same batch, which it keeps
+void network_predict_batched(network *net, float *input, int batch);
 float network_accuracy(network net, data d);
 float *network_accuracies(network net, data d, int n);
 float network_accuracy_multi(network net, data d, int n);
@@ -156,12 +161,16 @@ int get_predicted_class_network(network net);
 void print_network(network net);
 void visualize_network(network net);
 int resize_network(network *net, int w, int h);
+int recalculate_workspace_size(network *net);
 //LIB_API void set_batch_network(network *net, int b);
 int get_network_input_size(network net);
 float get_network_cost(network net);
 //LIB_API layer* get_network_layer(network* net, int i);
 //LIB_API detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter);
 //LIB_API detection *make_network_boxes(network *net, float thresh, int *num);
+detection *make_network_boxes_batch(network *net, float thresh, int *num, int batch);
+void fill_network_boxes_batch(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection *dets, int letter, int batch);
+detection *get_network_boxes_batch_pooled(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter, int batch);
 //LIB_API void free_detections(detection *dets, int n);
 //LIB_API void reset_rnn(network *net);
 //LIB_API network *load_network_custom(char *cfg, char *weights, int clear, int batch);
@@ -0,0 +1,348 @@
+#include "nms.h"
+#include "box.h"
+#include "gemm.h"
+#include "utils.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define NMS_X86
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define NMS_TARGET_AVX2 __attribute__((target("avx,avx2")))
+#else
+#define NMS_TARGET_AVX2
+#endif
+#endif
+
+// a vector IoU within this of the threshold is decided by box_iou()
+#define NMS_EPS 1e-5f
+// kept boxes per grid cell the grid size aims at
+#define NMS_CELL_BOXES 16
+#define NMS_MAX_GRID 16
+
+typedef enum {
+    NMS_TEST_IOU, NMS_TEST_DIOU, NMS_TEST_DIOU_BETA
+} nms_test;
+
+typedef struct nms_query {
+    const detection *dets;
+    nms_test test;
+    float thresh;
+    float beta1;
+    int simd;
+} nms_query;
+
+// kept boxes of one grid cell, as edges (the same as overlap() computes) and areas
+typedef struct nms_bucket {
+    int n, cap;
+    float *l, *t, *r, *b, *area;
+    int *index;
+} nms_bucket;
+
+typedef struct nms_grid {
+    int g;
+    float x0, y0, inv_w, inv_h;
+    nms_bucket *buckets;
+} nms_grid;
+
+typedef struct nms_score {
+    float score;
+    int pos;        // in the previous order: ties keep it, as a stable sort
+    int index;
+} nms_score;
+
+static int nms_score_comparator(const void *pa, const void *pb)
+{
+    const nms_score *a = (const nms_score *)pa;
+    const nms_score *b = (const nms_score *)pb;
+    if (a->score > b->score) return -1;
+    if (a->score < b->score) return 1;
+    return a->pos - b->pos;
+}
+
+// the detections with objectness 0 go to the end, as the old functions did
+static int nms_partition(detection *dets, int total)
+{
+    int i, k = total - 1;
+    for (i = 0; i <= k; ++i) {
+        if (dets[i].objectness == 0) {
+            detection swap = dets[i];
+            dets[i] = dets[k];
+            dets[k] = swap;
+            --k;
+            --i;
+        }
+    }
+    return k + 1;
+}
+
+static int nms_exact(const nms_query *q, int i, box b)
+{
+    const box a = q->dets[i].bbox;
+    switch (q->test) {
+    case NMS_TEST_DIOU: return box_diou(a, b) > q->thresh;
+    case NMS_TEST_DIOU_BETA: return box_diounms(a, b, q->beta1) > q->thresh;
+    default: return box_iou(a, b) > q->thresh;
+    }
+}
+
+// without an overlap every test is <= 0, so only the overlapping boxes are tested
+static int nms_bucket_hit(const nms_query *q, const nms_bucket *k, int from, box b, float l, float t, float r, float bt)
+{
+    int i;
+    for (i = from; i < k->n; ++i) {
+        const float ow = (r < k->r[i] ? r : k->r[i]) - (l > k->l[i] ? l : k->l[i]);
+        const float oh = (bt < k->b[i] ? bt : k->b[i]) - (t > k->t[i] ? t : k->t[i]);
+        if (ow > 0 && oh > 0 && nms_exact(q, k->index[i], b)) return 1;
+    }
+    return 0;
+}
+
+#ifdef NMS_X86
+NMS_TARGET_AVX2
+static int nms_bucket_hit_avx2(const nms_query *q, const nms_bucket *k, box b, float l, float t, float r, float bt, float area)
+{
+    const __m256 vl = _mm256_set1_ps(l);
+    const __m256 vt = _mm256_set1_ps(t);
+    const __m256 vr = _mm256_set1_ps(r);
+    const __m256 vb = _mm256_set1_ps(bt);
+    const __m256 varea = _mm256_set1_ps(area);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 lo = _mm256_set1_ps(q->thresh - NMS_EPS);
+    // DIoU <= IoU: the vector IoU only tells which boxes to test
+    const __m256 hi = _mm256_set1_ps(q->test == NMS_TEST_IOU ? q->thresh + NMS_EPS : FLT_MAX);
+    int i, lane;
+    for (i = 0; i + 8 <= k->n; i += 8) {
+        const __m256 ow = _mm256_sub_ps(_mm256_min_ps(vr, _mm256_loadu_ps(k->r + i)), _mm256_max_ps(vl, _mm256_loadu_ps(k->l + i)));
+        const __m256 oh = _mm256_sub_ps(_mm256_min_ps(vb, _mm256_loadu_ps(k->b + i)), _mm256_max_ps(vt, _mm256_loadu_ps(k->t + i)));
+        const __m256 overlap = _mm256_and_ps(_mm256_cmp_ps(ow, zero, _CMP_GT_OQ), _mm256_cmp_ps(oh, zero, _CMP_GT_OQ));
+        const __m256 inter = _mm256_mul_ps(ow, oh);
+        const __m256 uni = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(k->area + i), varea), inter);
+        const __m256 iou = _mm256_div_ps(inter, uni);
+        int check;
+        if (_mm256_movemask_ps(_mm256_and_ps(overlap, _mm256_cmp_ps(iou, hi, _CMP_GT_OQ)))) return 1;
+        check = _mm256_movemask_ps(_mm256_and_ps(overlap, _mm256_cmp_ps(iou, lo, _CMP_GE_OQ)));
+        for (lane = 0; check; ++lane, check >>= 1) {
+            if ((check & 1) && nms_exact(q, k->index[i + lane], b)) return 1;
+        }
+    }
+    return nms_bucket_hit(q, k, i, b, l, t, r, bt);
+}
+#endif
+
+static void nms_bucket_push(nms_bucket *k, int index, float l, float t, float r, float bt, float area)
+{
+    if (k->n == k->cap) {
+        k->cap = k->cap ? 2 * k->cap : 8;
+        k->l = (float*)xrealloc(k->l, k->cap * sizeof(float));
+        k->t = (float*)xrealloc(k->t, k->cap * sizeof(float));
+        k->r = (float*)xrealloc(k->r, k->cap * sizeof(float));
+        k->b = (float*)xrealloc(k->b, k->cap * sizeof(float));
+        k->area = (float*)xrealloc(k->area, k->cap * sizeof(float));
+        k->index = (int*)xrealloc(k->index, k->cap * sizeof(int));
+    }
+    k->l[k->n] = l;
+    k->t[k->n] = t;
+    k->r[k->n] = r;
+    k->b[k->n] = bt;
+    k->area[k->n] = area;
+    k->index[k->n] = index;
+    ++k->n;
+}
+
+// cells of a coordinate, monotonic: boxes that overlap share a cell
+static int nms_cell(float v, float v0, float inv, int g)
+{
+    const int c = (int)((v - v0) * inv);
+    return c < 0 ? 0 : (c >= g ? g - 1 : c);
+}
+
+static void nms_grid_init(nms_grid *grid, const detection *dets, const int *list, int n)
+{
+    float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+    int i;
+    for (i = 0; i < n; ++i) {
+        const box b = dets[list[i]].bbox;
+        if (b.x - b.w / 2 < x0) x0 = b.x - b.w / 2;
+        if (b.y - b.h / 2 < y0) y0 = b.y - b.h / 2;
+        if (b.x + b.w / 2 > x1) x1 = b.x + b.w / 2;
+        if (b.y + b.h / 2 > y1) y1 = b.y + b.h / 2;
+    }
+    grid->g = (int)sqrtf((float)n / NMS_CELL_BOXES);
+    if (grid->g > NMS_MAX_GRID) grid->g = NMS_MAX_GRID;
+    if (grid->g < 1 || !(x1 > x0) || !(y1 > y0)) grid->g = 1;
+    grid->x0 = x0;
+    grid->y0 = y0;
+    grid->inv_w = grid->g > 1 ? grid->g / (x1 - x0) : 0;
+    grid->inv_h = grid->g > 1 ? grid->g / (y1 - y0) : 0;
+    grid->buckets = (nms_bucket*)xcalloc(grid->g * grid->g, sizeof(nms_bucket));
+}
+
+static void nms_grid_free(nms_grid *grid)
+{
+    int i;
+    for (i = 0; i < grid->g * grid->g; ++i) {
+        nms_bucket *k = &grid->buckets[i];
+        free(k->l);
+        free(k->t);
+        free(k->r);
+        free(k->b);
+        free(k->area);
+        free(k->index);
+    }
+    free(grid->buckets);
+}
+
+// list: by score, k: the class or -1 for objectness. A detection is suppressed
+// when a detection kept before it overlaps it more than the threshold.
+static void nms_suppress(detection *dets, const int *list, int n, int k, int classes, const nms_query *q)
+{
+    nms_grid grid;
+    int m, i, cx, cy;
+    if (n < 2) return;
+    nms_grid_init(&grid, dets, list, n);
+    for (m = 0; m < n; ++m) {
+        const int j = list[m];
+        const box b = dets[j].bbox;
+        const float l = b.x - b.w / 2, r = b.x + b.w / 2;
+        const float t = b.y - b.h / 2, bt = b.y + b.h / 2;
+        const float area = b.w*b.h;
+        const int cx0 = nms_cell(l, grid.x0, grid.inv_w, grid.g), cx1 = nms_cell(r, grid.x0, grid.inv_w, grid.g);
+        const int cy0 = nms_cell(t, grid.y0, grid.inv_h, grid.g), cy1 = nms_cell(bt, grid.y0, grid.inv_h, grid.g);
+        int hit = 0;
+        for (cy = cy0; cy <= cy1 && !hit; ++cy) {
+            for (cx = cx0; cx <= cx1 && !hit; ++cx) {
+                const nms_bucket *bucket = &grid.buckets[cy*grid.g + cx];
+#ifdef NMS_X86
+                if (q->simd) hit = nms_bucket_hit_avx2(q, bucket, b, l, t, r, bt, area);
+                else
+#endif
+                hit = nms_bucket_hit(q, bucket, 0, b, l, t, r, bt);
+            }
+        }
+        if (hit) {
+            if (k >= 0) dets[j].prob[k] = 0;
+            else {
+                dets[j].objectness = 0;
+                for (i = 0; i < classes; ++i) dets[j].prob[i] = 0;
+            }
+            continue;
+        }
+        for (cy = cy0; cy <= cy1; ++cy) {
+            for (cx = cx0; cx <= cx1; ++cx) {
+                nms_bucket_push(&grid.buckets[cy*grid.g + cx], j, l, t, r, bt, area);
+            }
+        }
+    }
+    nms_grid_free(&grid);
+}
+
+static void nms_query_init(nms_query *q, const detection *dets, float thresh, NMS_KIND nms_kind, float beta1)
+{
+    q->dets = dets;
+    q->test = nms_kind == GREEDY_NMS ? NMS_TEST_DIOU : (nms_kind == DIOU_NMS ? NMS_TEST_DIOU_BETA : NMS_TEST_IOU);
+    q->thresh = thresh;
+    q->beta1 = beta1;
+    q->simd = is_cpu_fma_avx2();
+}
+
+static void nms_permute(detection *dets, const int *order, int total, int sort_class)
+{
+    detection *copy = (detection*)xcalloc(total, sizeof(detection));
+    int i;
+    memcpy(copy, dets, total * sizeof(detection));
+    for (i = 0; i < total; ++i) {
+        dets[i] = copy[order[i]];
+        dets[i].sort_class = sort_class;
+    }
+    free(copy);
+}
+
+void nms_sort_classes(detection *dets, int total, int classes, float thresh, NMS_KIND nms_kind, float beta1)
+{
+    nms_query q;
+    int *counts, *offsets, *order, *rest, *lists;
+    nms_score *scores;
+    int i, k, n, m;
+
+    total = nms_partition(dets, total);
+    if (total <= 0 || classes <= 0) return;
+    nms_query_init(&q, dets, thresh, nms_kind, beta1);
+
+    counts = (int*)xcalloc(classes, sizeof(int));
+    offsets = (int*)xcalloc(classes + 1, sizeof(int));
+    for (i = 0; i < total; ++i) {
+        for (k = 0; k < classes; ++k) counts[k] += dets[i].prob[k] > 0;
+    }
+    for (k = 0; k < classes; ++k) offsets[k + 1] = offsets[k] + counts[k];
+
+    // the order of the old per-class sort of the whole array: the detections of
+    // class k by probability, ties and the zero ones in the order of class k-1
+    order = (int*)xcalloc(total, sizeof(int));
+    rest = (int*)xcalloc(total, sizeof(int));
+    scores = (nms_score*)xcalloc(total, sizeof(nms_score));
+    lists = (int*)xcalloc(offsets[classes] + 1, sizeof(int));
+    for (i = 0; i < total; ++i) order[i] = i;
+    for (k = 0; k < classes; ++k) {
+        if (!counts[k]) continue;
+        n = m = 0;
+        for (i = 0; i < total; ++i) {
+            const float p = dets[order[i]].prob[k];
+            if (p > 0) {
+                scores[n].score = p;
+                scores[n].pos = i;
+                scores[n].index = order[i];
+                ++n;
+            }
+            else rest[m++] = order[i];
+        }
+        qsort(scores, n, sizeof(nms_score), nms_score_comparator);
+        for (i = 0; i < n; ++i) order[i] = lists[offsets[k] + i] = scores[i].index;
+        memcpy(order + n, rest, m * sizeof(int));
+    }
+
+    // every class only writes its own probabilities
+    #pragma omp parallel for schedule(dynamic)
+    for (k = 0; k < classes; ++k) {
+        nms_suppress(dets, lists + offsets[k], counts[k], k, classes, &q);
+    }
+
+    nms_permute(dets, order, total, classes - 1);
+    free(counts);
+    free(offsets);
+    free(order);
+    free(rest);
+    free(scores);
+    free(lists);
+}
+
+void nms_sort_objectness(detection *dets, int total, int classes, float thresh)
+{
+    nms_query q;
+    nms_score *scores;
+    int *order;
+    int i;
+
+    total = nms_partition(dets, total);
+    if (total <= 0) return;
+    nms_query_init(&q, dets, thresh, DEFAULT_NMS, 0);
+
+    scores = (nms_score*)xcalloc(total, sizeof(nms_score));
+    order = (int*)xcalloc(total, sizeof(int));
+    for (i = 0; i < total; ++i) {
+        scores[i].score = dets[i].objectness;
+        scores[i].pos = i;
+        scores[i].index = i;
+    }
+    qsort(scores, total, sizeof(nms_score), nms_score_comparator);
+    for (i = 0; i < total; ++i) order[i] = scores[i].index;
+
+    nms_suppress(dets, order, total, -1, classes, &q);
+
+    nms_permute(dets, order, total, -1);
+    free(scores);
+    free(order);
+}
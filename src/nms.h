@@ -0,0 +1,28 @@
+#ifndef NMS_H
+#define NMS_H
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Greedy NMS engine behind do_nms_sort(), diounms_sort() and do_nms_obj().
+// Per class only the detections with a non-zero probability are sorted, in the
+// order the old per-class qsort of the whole array left them in (a stable sort,
+// as glibc's qsort). A detection is suppressed when it overlaps a detection
+// kept before it, so each one is tested against the kept ones only: they are
+// bucketed on a coarse grid over the class' boxes and the IoU against a bucket
+// is computed 8 boxes at a time (AVX2). Results close to the threshold, and
+// the DIoU variants, are decided by the scalar box_iou()/box_diou() so the
+// result is the same as the old functions'. Classes run in parallel (OpenMP).
+// On return dets are in the order the old functions left them in.
+
+// nms_kind: DEFAULT_NMS and CORNERS_NMS - IoU, GREEDY_NMS - DIoU, DIOU_NMS - DIoU with beta1;
+// thresh must not be negative
+void nms_sort_classes(detection *dets, int total, int classes, float thresh, NMS_KIND nms_kind, float beta1);
+// one pass over objectness, the suppressed detections get all probabilities 0
+void nms_sort_objectness(detection *dets, int total, int classes, float thresh);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
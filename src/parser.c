@@ -40,6 +40,7 @@
 #include "yolo_layer.h"
 #include "gaussian_yolo_layer.h"
 #include "representation_layer.h"
+#include "prepared.h"
 
 void empty_func(dropout_layer l, network_state state) {
     //l.output_gpu = state.input;
@@ -1206,7 +1207,13 @@ void parse_net_options(list *options, network *net)
     else if (cutmix) net->mixup = 2;
     else if (mosaic) net->mixup = 3;
     net->letter_box = option_find_int_quiet(options, "letter_box", 0);
+    net->nchwc = option_find_int_quiet(options, "nchwc", 0);
+    net->memory_plan = option_find_int_quiet(options, "memory_plan", 0);
+    net->fast_activations = option_find_int_quiet(options, "fast_activations", 0);
+    net->parallel_branches = option_find_int_quiet(options, "parallel_branches", 0);
+    net->yolo_decode = option_find_int_quiet(options, "yolo_decode", 0);
     net->mosaic_bound = option_find_int_quiet(options, "mosaic_bound", 0);
+    net->prefetch = option_find_int_quiet(options, "prefetch", 2);
     net->contrastive = option_find_int_quiet(options, "contrastive", 0);
     net->contrastive_jit_flip = option_find_int_quiet(options, "contrastive_jit_flip", 0);
     net->contrastive_color = option_find_int_quiet(options, "contrastive_color", 0);
@@ -2246,6 +2253,10 @@ void load_weights_upto(network *net, char *filename, int cutoff)
         cuda_set_device(net->gpu_index);
     }
 #endif
+    if (is_prepared_model(filename)) {
+        load_prepared_weights(net, filename, cutoff);
+        return;
+    }
     fprintf(stderr, "Loading weights from %s...", filename);
     fflush(stdout);
     FILE *fp = fopen(filename, "rb");
@@ -2370,6 +2381,7 @@ network *load_network_custom(char *cfg, char *weights, int clear, int batch)
         load_weights(net, weights);
     }
     fuse_conv_batchnorm(*net);
+    prepare_network_for_inference(net);
     if (clear) {
         (*net->seen) = 0;
         (*net->cur_iteration) = 0;
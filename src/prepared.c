@@ -0,0 +1,370 @@
+#include "prepared.h"
+#include "network.h"
+#include "parser.h"
+#include "utils.h"
+#include "gemm_packed.h"
+#include "winograd.h"
+#include "convolutional_layer.h"
+#include "connected_layer.h"
+#include "batchnorm_layer.h"
+#include "shortcut_layer.h"
+#include "representation_layer.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PREPARED_MAGIC "DARKPREP"
+#define PREPARED_VERSION 1
+#define PREPARED_ALIGN 64
+// the tensors start on a page
+#define PREPARED_DATA_ALIGN 4096
+#define PREPARED_MAX_SLOTS 5
+
+typedef struct prepared_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;       // sizeof(prepared_header)
+    uint32_t layers;
+    uint32_t tensors;
+    uint32_t packed_layout;     // gemm_packed_layout() of the exporter
+    uint32_t reserved;
+    uint64_t seen;
+    uint64_t file_size;
+} prepared_header;
+
+typedef struct prepared_layer {
+    int32_t type;
+    int32_t n, c, size, groups;
+    int32_t nweights;
+    int32_t conv_algo;          // of the packed copy, -1 - none
+    int32_t reserved;
+} prepared_layer;
+
+typedef enum {
+    PREPARED_BIASES, PREPARED_WEIGHTS, PREPARED_SCALES, PREPARED_ROLLING_MEAN, PREPARED_ROLLING_VARIANCE,
+    PREPARED_WEIGHTS_PACKED, PREPARED_WEIGHTS_WINOGRAD
+} prepared_kind;
+
+typedef struct prepared_tensor {
+    int32_t layer;
+    int32_t kind;               // prepared_kind
+    uint64_t offset;            // bytes from the start of the file
+    uint64_t count;             // floats
+} prepared_tensor;
+
+// a float buffer of a layer that is saved as is
+typedef struct prepared_slot {
+    prepared_kind kind;
+    float **ptr;
+    size_t count;
+} prepared_slot;
+
+static size_t prepared_align(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+static const char *prepared_unsupported(layer l)
+{
+    switch (l.type) {
+    case CONVOLUTIONAL:
+        if (l.share_layer) return "share_index";
+        return NULL;
+    case CRNN:
+    case RNN:
+    case GRU:
+    case LSTM:
+    case CONV_LSTM:
+    case LOCAL:
+        return "layer type";
+    default:
+        return NULL;
+    }
+}
+
+// the buffers load_weights() fills, after fuse_conv_batchnorm()
+static int prepared_layer_slots(layer *l, prepared_slot *slots)
+{
+    int n = 0;
+#define PREPARED_SLOT(k, p, c) slots[n].kind = k, slots[n].ptr = p, slots[n].count = c, ++n
+    switch (l->type) {
+    case CONVOLUTIONAL:
+        PREPARED_SLOT(PREPARED_BIASES, &l->biases, l->n);
+        PREPARED_SLOT(PREPARED_WEIGHTS, &l->weights, l->nweights);
+        break;
+    case CONNECTED:
+        PREPARED_SLOT(PREPARED_BIASES, &l->biases, l->outputs);
+        PREPARED_SLOT(PREPARED_WEIGHTS, &l->weights, (size_t)l->outputs*l->inputs);
+        if (l->batch_normalize) {
+            PREPARED_SLOT(PREPARED_SCALES, &l->scales, l->outputs);
+            PREPARED_SLOT(PREPARED_ROLLING_MEAN, &l->rolling_mean, l->outputs);
+            PREPARED_SLOT(PREPARED_ROLLING_VARIANCE, &l->rolling_variance, l->outputs);
+        }
+        break;
+    case BATCHNORM:
+        PREPARED_SLOT(PREPARED_BIASES, &l->biases, l->c);
+        PREPARED_SLOT(PREPARED_SCALES, &l->scales, l->c);
+        PREPARED_SLOT(PREPARED_ROLLING_MEAN, &l->rolling_mean, l->c);
+        PREPARED_SLOT(PREPARED_ROLLING_VARIANCE, &l->rolling_variance, l->c);
+        break;
+    case SHORTCUT:
+    case IMPLICIT:
+        if (l->nweights > 0) PREPARED_SLOT(PREPARED_WEIGHTS, &l->weights, l->nweights);
+        break;
+    default:
+        break;
+    }
+#undef PREPARED_SLOT
+    return n;
+}
+
+// the packed copy of a convolution, 0 - none
+static size_t prepared_packed_count(layer l, prepared_kind kind)
+{
+    if (l.type != CONVOLUTIONAL || l.xnor) return 0;
+    if (kind == PREPARED_WEIGHTS_PACKED && l.conv_algo != CONV_ALGO_WINOGRAD_2X2 && l.conv_algo != CONV_ALGO_WINOGRAD_4X4) {
+        return gemm_packed_a_size(l.n / l.groups, l.size*l.size*l.c / l.groups) * l.groups;
+    }
+    if (kind == PREPARED_WEIGHTS_WINOGRAD && (l.conv_algo == CONV_ALGO_WINOGRAD_2X2 || l.conv_algo == CONV_ALGO_WINOGRAD_4X4)) {
+        return winograd_weights_size(l.conv_algo == CONV_ALGO_WINOGRAD_2X2 ? 2 : 4, l.n, l.c);
+    }
+    return 0;
+}
+
+static prepared_layer prepared_layer_record(layer l)
+{
+    prepared_layer r;
+    memset(&r, 0, sizeof(r));
+    r.type = l.type;
+    r.n = l.n;
+    r.c = l.c;
+    r.size = l.size;
+    r.groups = l.groups;
+    r.nweights = l.nweights;
+    r.conv_algo = -1;
+    return r;
+}
+
+static void prepared_add_tensor(prepared_tensor *tensors, int *count, size_t *offset, int layer, prepared_kind kind, size_t floats)
+{
+    prepared_tensor *t = &tensors[(*count)++];
+    t->layer = layer;
+    t->kind = kind;
+    t->offset = *offset;
+    t->count = floats;
+    *offset = prepared_align(*offset + floats * sizeof(float), PREPARED_ALIGN);
+}
+
+static void prepared_write_padding(FILE *fp, size_t size)
+{
+    static const char zeros[PREPARED_DATA_ALIGN] = { 0 };
+    while (size > 0) {
+        const size_t chunk = size < sizeof(zeros) ? size : sizeof(zeros);
+        fwrite(zeros, 1, chunk, fp);
+        size -= chunk;
+    }
+}
+
+void export_prepared_model(char *cfgfile, char *weightfile, char *outfile)
+{
+    gpu_index = -1;
+    network net = parse_network_cfg_custom(cfgfile, 1, 1);
+    prepared_header header;
+    prepared_layer *records = (prepared_layer*)xcalloc(net.n, sizeof(prepared_layer));
+    prepared_tensor *tensors = (prepared_tensor*)xcalloc(net.n * (PREPARED_MAX_SLOTS + 1), sizeof(prepared_tensor));
+    prepared_slot slots[PREPARED_MAX_SLOTS];
+    int count = 0, packed = 0, i, j, s;
+    size_t offset, pos;
+    FILE *fp;
+
+    for (j = 0; j < net.n; ++j) {
+        const char *reason = prepared_unsupported(net.layers[j]);
+        if (reason) {
+            printf(" layer %d is not supported (%s) \n", j, reason);
+            error("Error: the network can't be exported as a prepared model", DARKNET_LOC);
+        }
+        records[j] = prepared_layer_record(net.layers[j]);
+    }
+    if (weightfile) load_weights(&net, weightfile);
+    fuse_conv_batchnorm(net);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PREPARED_MAGIC, sizeof(header.magic));
+    header.version = PREPARED_VERSION;
+    header.header_size = sizeof(prepared_header);
+    header.layers = net.n;
+    header.packed_layout = gemm_packed_layout();
+    header.seen = *net.seen;
+
+    offset = prepared_align(sizeof(header) + net.n * sizeof(prepared_layer) + net.n * (PREPARED_MAX_SLOTS + 1) * sizeof(prepared_tensor), PREPARED_DATA_ALIGN);
+    for (j = 0; j < net.n; ++j) {
+        layer *l = &net.layers[j];
+        const int n = prepared_layer_slots(l, slots);
+        for (s = 0; s < n; ++s) prepared_add_tensor(tensors, &count, &offset, j, slots[s].kind, slots[s].count);
+        // the input_layer of antialiasing is not in the file, its weights are fixed
+        if (l->type == CONVOLUTIONAL && !l->xnor && !l->antialiasing) {
+            set_convolutional_algorithm(l, select_convolutional_algorithm(*l));
+            if (l->weights_packed) {
+                prepared_add_tensor(tensors, &count, &offset, j, PREPARED_WEIGHTS_PACKED, prepared_packed_count(*l, PREPARED_WEIGHTS_PACKED));
+            }
+            else if (l->weights_winograd) {
+                prepared_add_tensor(tensors, &count, &offset, j, PREPARED_WEIGHTS_WINOGRAD, prepared_packed_count(*l, PREPARED_WEIGHTS_WINOGRAD));
+            }
+            else continue;
+            records[j].conv_algo = l->conv_algo;
+            ++packed;
+        }
+    }
+    header.tensors = count;
+    header.file_size = offset;
+
+    fp = fopen(outfile, "wb");
+    if (!fp) file_error(outfile);
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(records, sizeof(prepared_layer), net.n, fp);
+    fwrite(tensors, sizeof(prepared_tensor), net.n * (PREPARED_MAX_SLOTS + 1), fp);
+    pos = sizeof(header) + net.n * sizeof(prepared_layer) + net.n * (PREPARED_MAX_SLOTS + 1) * sizeof(prepared_tensor);
+    for (i = 0; i < count; ++i) {
+        const prepared_tensor t = tensors[i];
+        layer *l = &net.layers[t.layer];
+        const float *data = NULL;
+        if (t.kind == PREPARED_WEIGHTS_PACKED) data = l->weights_packed;
+        else if (t.kind == PREPARED_WEIGHTS_WINOGRAD) data = l->weights_winograd;
+        else {
+            const int n = prepared_layer_slots(l, slots);
+            for (s = 0; s < n; ++s) {
+                if (slots[s].kind == t.kind) data = *slots[s].ptr;
+            }
+        }
+        prepared_write_padding(fp, t.offset - pos);
+        fwrite(data, sizeof(float), t.count, fp);
+        pos = t.offset + t.count * sizeof(float);
+    }
+    prepared_write_padding(fp, header.file_size - pos);
+    fclose(fp);
+
+    printf(" Prepared model: %d layers, %d tensors (%d packed convolutions, %s), %.1f MB -> %s \n",
+        net.n, count, packed, gemm_packed_kernel_name(), (float)header.file_size / (1024 * 1024), outfile);
+    free(records);
+    free(tensors);
+    free_network(net);
+}
+
+int is_prepared_model(char *filename)
+{
+    char magic[8];
+    FILE *fp = fopen(filename, "rb");
+    int ok;
+    if (!fp) return 0;
+    ok = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && !memcmp(magic, PREPARED_MAGIC, sizeof(magic));
+    fclose(fp);
+    return ok;
+}
+
+static void prepared_mismatch(char *filename, int j, const char *what)
+{
+    printf("\n %s: layer %d doesn't match the cfg (%s) \n", filename, j, what);
+    error("Error: the prepared model was exported from another cfg", DARKNET_LOC);
+}
+
+void load_prepared_weights(network *net, char *filename, int cutoff)
+{
+    prepared_header header;
+    const prepared_layer *records;
+    const prepared_tensor *tensors;
+    prepared_slot slots[PREPARED_MAX_SLOTS];
+    size_t size = 0, table_size;
+    int i, j, s, mapped = 0, packed = 0;
+    char *map;
+
+    if (net->prepared_map) error("Error: the network has a prepared model already", DARKNET_LOC);
+    map = (char*)map_file(filename, &size, 1);
+    if (!map) file_error(filename);
+    if (size < sizeof(header)) prepared_mismatch(filename, -1, "file size");
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, PREPARED_MAGIC, sizeof(header.magic)) || header.version != PREPARED_VERSION ||
+        header.header_size != sizeof(prepared_header)) prepared_mismatch(filename, -1, "format version");
+    if (header.file_size != size) prepared_mismatch(filename, -1, "file size");
+    if ((int)header.layers != net->n) prepared_mismatch(filename, -1, "number of layers");
+    table_size = sizeof(header) + net->n * sizeof(prepared_layer) + (size_t)header.tensors * sizeof(prepared_tensor);
+    if (table_size > size) prepared_mismatch(filename, -1, "file size");
+    records = (const prepared_layer*)(map + sizeof(header));
+    tensors = (const prepared_tensor*)(records + net->n);
+
+    for (j = 0; j < net->n; ++j) {
+        const prepared_layer r = prepared_layer_record(net->layers[j]);
+        if (prepared_unsupported(net->layers[j])) prepared_mismatch(filename, j, prepared_unsupported(net->layers[j]));
+        if (r.type != records[j].type) prepared_mismatch(filename, j, "type");
+        if (r.n != records[j].n || r.c != records[j].c || r.size != records[j].size ||
+            r.groups != records[j].groups || r.nweights != records[j].nweights) prepared_mismatch(filename, j, "shape");
+    }
+
+    for (i = 0; i < (int)header.tensors; ++i) {
+        const prepared_tensor t = tensors[i];
+        layer *l;
+        float *data = (float*)(map + t.offset);
+        if (t.layer < 0 || t.layer >= net->n || t.offset % PREPARED_ALIGN || t.offset < table_size ||
+            t.offset > size || t.count > (size - t.offset) / sizeof(float)) prepared_mismatch(filename, t.layer, "tensor table");
+        l = &net->layers[t.layer];
+        if (t.layer >= cutoff || l->dontload) continue;
+
+        if (t.kind == PREPARED_WEIGHTS_PACKED || t.kind == PREPARED_WEIGHTS_WINOGRAD) {
+            const CONV_ALGO algo = (CONV_ALGO)records[t.layer].conv_algo;
+            if (gpu_index >= 0 || header.packed_layout != gemm_packed_layout() || l->antialiasing ||
+                select_convolutional_algorithm(*l) != algo) continue;
+            free_convolutional_inference_weights(l);
+            l->conv_algo = algo;
+            if (t.count != prepared_packed_count(*l, (prepared_kind)t.kind)) prepared_mismatch(filename, t.layer, "packed weights");
+            if (t.kind == PREPARED_WEIGHTS_PACKED) l->weights_packed = data;
+            else l->weights_winograd = data;
+            ++packed;
+            continue;
+        }
+        const int n = prepared_layer_slots(l, slots);
+        for (s = 0; s < n && slots[s].kind != (prepared_kind)t.kind; ++s);
+        if (s == n || slots[s].count != t.count) prepared_mismatch(filename, t.layer, "tensor size");
+        if (*slots[s].ptr && layer_owns_weights(*l, *slots[s].ptr)) free(*slots[s].ptr);
+        *slots[s].ptr = data;
+        ++mapped;
+    }
+
+    for (j = 0; j < net->n && j < cutoff; ++j) {
+        layer *l = &net->layers[j];
+        if (l->dontload) continue;
+        l->weights_map = map;
+        l->weights_map_size = size;
+        // the file has the weights fuse_conv_batchnorm() leaves
+        if (l->type == CONVOLUTIONAL && l->batch_normalize) {
+            free_convolutional_batchnorm(l);
+            l->batch_normalize = 0;
+        }
+        if (l->type == SHORTCUT) l->weights_normalization = NO_NORMALIZATION;
+#ifdef GPU
+        if (gpu_index >= 0) {
+            if (l->type == CONVOLUTIONAL) push_convolutional_layer(*l);
+            if (l->type == CONNECTED) push_connected_layer(*l);
+            if (l->type == BATCHNORM) push_batchnorm_layer(*l);
+            if (l->type == SHORTCUT && l->nweights > 0) push_shortcut_layer(*l);
+            if (l->type == IMPLICIT) push_implicit_layer(*l);
+        }
+#endif
+    }
+    net->prepared_map = map;
+    net->prepared_map_size = size;
+    *net->seen = header.seen;
+    *net->cur_iteration = get_current_batch(*net);
+    fprintf(stderr, "Done! Mapped %d tensors and %d packed convolutions from the prepared model \n", mapped, packed);
+}
+
+void unmap_prepared_model(network *net)
+{
+    if (!net->prepared_map) return;
+    unmap_file(net->prepared_map, net->prepared_map_size);
+    net->prepared_map = NULL;
+    net->prepared_map_size = 0;
+}
+
+int layer_owns_weights(layer l, const void *ptr)
+{
+    return !l.weights_map || (const char*)ptr < l.weights_map || (const char*)ptr >= l.weights_map + l.weights_map_size;
+}
@@ -0,0 +1,32 @@
+#ifndef PREPARED_H
+#define PREPARED_H
+#include <stdio.h>
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Prepared model: the weights of a network as inference uses them, after
+// fuse_conv_batchnorm() and with the packed GEMM / Winograd copies of the
+// convolutions, in one file:
+//   header | layer records | tensor table | tensors (64-byte aligned)
+// The layer records (type and weight shapes) are checked against the cfg.
+// Loading maps the file copy-on-write and points the layers into the mapping:
+// nothing is read or copied up front and the processes that load the same file
+// share its pages. The packed copies are used when this CPU has the exporter's
+// GEMM layout and the layer gets the same algorithm, otherwise they are built
+// as usual. load_weights() recognizes prepared files; they are for inference only.
+
+// darknet export_prepared <cfg> <weights> <output>
+void export_prepared_model(char *cfgfile, char *weightfile, char *outfile);
+int is_prepared_model(char *filename);
+// maps the file and points the weights of the first cutoff layers into it
+void load_prepared_weights(network *net, char *filename, int cutoff);
+void unmap_prepared_model(network *net);
+// 0 - the buffer is in the mapping of a prepared model and not freed with the layer
+int layer_owns_weights(layer l, const void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
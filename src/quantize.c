@@ -0,0 +1,589 @@
+#include "quantize.h"
+#include "gemm.h"
+#include "gemm_packed.h"
+#include "convolutional_layer.h"
+#include "utils.h"
+#include "network.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+// Layout (MR x NR micro-kernel, C padded to a multiple of 4, k = (ky, kx, c)):
+//   input - [C/4][H][W][4] u8, quantized per channel
+//   A - weights, [M/MR][K/4][MR][4] s8, packed once
+//   B - im2col of the input, [N/NR][K/4][NR][4] u8, packed per chunk of pixels
+// so one 32-bit lane holds 4 channels of one pixel, which is what vpdpbusd
+// multiplies with a broadcast quad of weights, and packing B is copying words.
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define INT8_X86
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define INT8_TARGET_AVX2 __attribute__((target("avx,avx2")))
+#define INT8_TARGET_VNNI __attribute__((target("avx,avx2,avx512f,avx512bw,avx512vnni")))
+#else
+#define INT8_TARGET_AVX2
+#define INT8_TARGET_VNNI
+#endif
+#endif
+
+#define INT8_MAX_MR 8
+#define INT8_MAX_NR 32
+// pixels packed at once per thread
+#define INT8_CHUNK 128
+
+typedef void(*int8_kernel_t)(int kq, const int8_t *a, const uint8_t *b, int32_t *c);
+
+typedef struct int8_kernel_desc {
+    const char *name;
+    int mr;
+    int nr;
+    int wmax;       // weights are quantized to [-wmax, wmax]
+    int8_kernel_t kernel;
+} int8_kernel_desc;
+
+static int8_kernel_desc int8_kernel;
+
+static char *int8_table_filename;
+
+void set_int8_quantization_table(char *filename)
+{
+    int8_table_filename = filename;
+}
+
+char *get_int8_quantization_table(void)
+{
+    return int8_table_filename;
+}
+
+// c: MR x NR int32, row-major
+static void int8_kernel_generic_4x8(int kq, const int8_t *a, const uint8_t *b, int32_t *c)
+{
+    int32_t acc[4][8] = { { 0 } };
+    int k, r, p, t;
+    for (k = 0; k < kq; ++k) {
+        for (r = 0; r < 4; ++r) {
+            for (p = 0; p < 8; ++p) {
+                for (t = 0; t < 4; ++t) acc[r][p] += (int32_t)a[r * 4 + t] * (int32_t)b[p * 4 + t];
+            }
+        }
+        a += 4 * 4;
+        b += 8 * 4;
+    }
+    memcpy(c, acc, sizeof(acc));
+}
+
+#ifdef INT8_X86
+
+// vpmaddubsw adds two u8 x s8 products in s16 with saturation, which can't
+// happen with 7-bit weights (2 * 255 * 63 < 32767), so the weights for this
+// kernel are quantized to [-63, 63] and the sums stay exact.
+INT8_TARGET_AVX2
+static void int8_kernel_avx2_6x16(int kq, const int8_t *a, const uint8_t *b, int32_t *c)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc0[6], acc1[6];
+    int k, r;
+    for (r = 0; r < 6; ++r) acc0[r] = acc1[r] = _mm256_setzero_si256();
+    for (k = 0; k < kq; ++k) {
+        const __m256i b0 = _mm256_loadu_si256((const __m256i*)b);
+        const __m256i b1 = _mm256_loadu_si256((const __m256i*)(b + 32));
+        for (r = 0; r < 6; ++r) {
+            int32_t w4;
+            memcpy(&w4, a + r * 4, sizeof(w4));
+            const __m256i w = _mm256_set1_epi32(w4);
+            acc0[r] = _mm256_add_epi32(acc0[r], _mm256_madd_epi16(_mm256_maddubs_epi16(b0, w), ones));
+            acc1[r] = _mm256_add_epi32(acc1[r], _mm256_madd_epi16(_mm256_maddubs_epi16(b1, w), ones));
+        }
+        a += 6 * 4;
+        b += 16 * 4;
+    }
+    for (r = 0; r < 6; ++r) {
+        _mm256_storeu_si256((__m256i*)(c + r * 16), acc0[r]);
+        _mm256_storeu_si256((__m256i*)(c + r * 16 + 8), acc1[r]);
+    }
+}
+
+INT8_TARGET_VNNI
+static void int8_kernel_vnni_8x32(int kq, const int8_t *a, const uint8_t *b, int32_t *c)
+{
+    __m512i acc0[8], acc1[8];
+    int k, r;
+    for (r = 0; r < 8; ++r) acc0[r] = acc1[r] = _mm512_setzero_si512();
+    for (k = 0; k < kq; ++k) {
+        const __m512i b0 = _mm512_loadu_si512((const void*)b);
+        const __m512i b1 = _mm512_loadu_si512((const void*)(b + 64));
+        for (r = 0; r < 8; ++r) {
+            int32_t w4;
+            memcpy(&w4, a + r * 4, sizeof(w4));
+            const __m512i w = _mm512_set1_epi32(w4);
+            acc0[r] = _mm512_dpbusd_epi32(acc0[r], b0, w);
+            acc1[r] = _mm512_dpbusd_epi32(acc1[r], b1, w);
+        }
+        a += 8 * 4;
+        b += 32 * 4;
+    }
+    for (r = 0; r < 8; ++r) {
+        _mm512_storeu_si512((void*)(c + r * 32), acc0[r]);
+        _mm512_storeu_si512((void*)(c + r * 32 + 16), acc1[r]);
+    }
+}
+
+#endif  // INT8_X86
+
+static void int8_init(void)
+{
+    if (int8_kernel.kernel) return;
+    int8_kernel_desc kd = { "generic", 4, 8, 127, int8_kernel_generic_4x8 };
+#ifdef INT8_X86
+    if (is_cpu_avx512_vnni()) {
+        kd.name = "avx512_vnni";
+        kd.mr = 8;
+        kd.nr = 32;
+        kd.wmax = 127;
+        kd.kernel = int8_kernel_vnni_8x32;
+    }
+    else if (is_cpu_fma_avx2()) {
+        kd.name = "avx2";
+        kd.mr = 6;
+        kd.nr = 16;
+        kd.wmax = 63;
+        kd.kernel = int8_kernel_avx2_6x16;
+    }
+#endif
+    int8_kernel = kd;
+}
+
+const char *int8_kernel_name(void)
+{
+    int8_init();
+    return int8_kernel.name;
+}
+
+// ---------------------------------------------------------------------------
+// calibration
+
+int8_calibration *make_int8_calibration(network net)
+{
+    int8_calibration *cal = (int8_calibration*)xcalloc(1, sizeof(int8_calibration));
+    int j, k;
+    cal->n = net.n;
+    cal->channels = (int*)xcalloc(net.n, sizeof(int));
+    cal->min = (float**)xcalloc(net.n, sizeof(float*));
+    cal->max = (float**)xcalloc(net.n, sizeof(float*));
+    for (j = 0; j < net.n; ++j) {
+        layer l = net.layers[j];
+        if (l.type != CONVOLUTIONAL) continue;
+        cal->channels[j] = l.c;
+        cal->min[j] = (float*)xcalloc(l.c, sizeof(float));
+        cal->max[j] = (float*)xcalloc(l.c, sizeof(float));
+        for (k = 0; k < l.c; ++k) {
+            cal->min[j][k] = FLT_MAX;
+            cal->max[j][k] = -FLT_MAX;
+        }
+    }
+    return cal;
+}
+
+void update_int8_calibration(int8_calibration *cal, network net, float *input)
+{
+    int j;
+    for (j = 0; j < cal->n; ++j) {
+        const layer l = net.layers[j];
+        const float *in = (j == 0) ? input : net.layers[j - 1].output;
+        const int size = l.h*l.w;
+        int k;
+        if (!cal->channels[j]) continue;
+        #pragma omp parallel for
+        for (k = 0; k < l.c; ++k) {
+            float lo = cal->min[j][k], hi = cal->max[j][k];
+            int b, i;
+            for (b = 0; b < l.batch; ++b) {
+                const float *x = in + ((size_t)b*l.c + k)*size;
+                for (i = 0; i < size; ++i) {
+                    lo = (x[i] < lo) ? x[i] : lo;
+                    hi = (x[i] > hi) ? x[i] : hi;
+                }
+            }
+            cal->min[j][k] = lo;
+            cal->max[j][k] = hi;
+        }
+    }
+    cal->images++;
+}
+
+void save_int8_calibration(int8_calibration *cal, char *filename, char *cfgfile)
+{
+    FILE *fp = fopen(filename, "w");
+    int j, k;
+    if (!fp) file_error(filename);
+    fprintf(fp, "# darknet int8 quantization table: %s, %d images\n", cfgfile, cal->images);
+    for (j = 0; j < cal->n; ++j) {
+        if (!cal->channels[j]) continue;
+        fprintf(fp, "conv %d %d", j, cal->channels[j]);
+        for (k = 0; k < cal->channels[j]; ++k) fprintf(fp, " %g %g", cal->min[j][k], cal->max[j][k]);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    printf(" INT8 quantization table (%d images) is saved to %s \n", cal->images, filename);
+}
+
+void free_int8_calibration(int8_calibration *cal)
+{
+    int j;
+    for (j = 0; j < cal->n; ++j) {
+        free(cal->min[j]);
+        free(cal->max[j]);
+    }
+    free(cal->channels);
+    free(cal->min);
+    free(cal->max);
+    free(cal);
+}
+
+// ---------------------------------------------------------------------------
+// quantization
+
+static int int8_is_supported(layer l)
+{
+    return l.type == CONVOLUTIONAL && !l.xnor && !l.binary && l.groups == 1;
+}
+
+// quads of k: kernel positions x channel quads
+static int int8_quads(layer l)
+{
+    return l.size*l.size*((l.c + 3) / 4);
+}
+
+void quantize_convolutional_layer(layer *l, const float *in_min, const float *in_max)
+{
+    const int M = l->n;
+    const int K = l->size*l->size*l->c;
+    const int ksq = l->size*l->size;
+    const int cp = (l->c + 3) / 4 * 4;
+    const int kq = int8_quads(*l);
+    float wmax;
+    int mr, panels, c, o;
+
+    int8_init();
+    mr = int8_kernel.mr;
+    wmax = (float)int8_kernel.wmax;
+    panels = (M + mr - 1) / mr;
+
+    l->int8_input_scales = (float*)xcalloc(cp, sizeof(float));
+    l->int8_input_zero = (uint8_t*)xcalloc(cp, sizeof(uint8_t));
+    for (c = 0; c < cp; ++c) {
+        // the range must contain 0: padding and the zero-point
+        const float lo = (c < l->c && in_min[c] < 0) ? in_min[c] : 0;
+        const float hi = (c < l->c && in_max[c] > 0) ? in_max[c] : 0;
+        float s = (hi - lo) / 255;
+        float z;
+        if (!(s > 1e-12f)) s = 1;
+        z = roundf(-lo / s);
+        l->int8_input_scales[c] = s;
+        l->int8_input_zero[c] = (uint8_t)((z < 0) ? 0 : (z > 255) ? 255 : z);
+    }
+
+    l->int8_scales = (float*)xcalloc(panels*mr, sizeof(float));
+    l->int8_offsets = (int32_t*)xcalloc(panels*mr, sizeof(int32_t));
+    l->weights_int8 = (int8_t*)gemm_aligned_alloc((size_t)panels*mr*kq * 4);
+    memset(l->weights_int8, 0, (size_t)panels*mr*kq * 4);
+
+    #pragma omp parallel for
+    for (o = 0; o < M; ++o) {
+        const float *w = l->weights + (size_t)o*K;
+        int8_t *dst = l->weights_int8 + (size_t)(o / mr)*mr*kq * 4 + (o % mr) * 4;
+        float max_w = 0, s;
+        int32_t offset = 0;
+        int k;
+        for (k = 0; k < K; ++k) {
+            const float v = fabsf(w[k] * l->int8_input_scales[k / ksq]);
+            if (v > max_w) max_w = v;
+        }
+        s = (max_w > 0) ? max_w / wmax : 1;
+        for (k = 0; k < K; ++k) {
+            // darknet weights are (c, ky, kx)
+            const int kc = k / ksq, kpos = k % ksq;
+            const int kk = kpos*cp + kc;
+            float q = roundf(w[k] * l->int8_input_scales[kc] / s);
+            int8_t qw = (int8_t)((q < -wmax) ? -wmax : (q > wmax) ? wmax : q);
+            dst[(size_t)(kk / 4)*mr * 4 + kk % 4] = qw;
+            offset += (int32_t)qw * l->int8_input_zero[kc];
+        }
+        l->int8_scales[o] = s;
+        l->int8_offsets[o] = offset;
+    }
+
+    // the int8 copy replaces the fp32 inference copies
+    free_convolutional_inference_weights(l);
+    l->conv_algo = CONV_ALGO_IM2COL;
+}
+
+static int int8_threads(void)
+{
+#if defined(_OPENMP)
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static size_t int8_align(size_t size)
+{
+    return (size + 63) & ~(size_t)63;
+}
+
+size_t get_convolutional_int8_workspace_size(layer l)
+{
+    const int cp = (l.c + 3) / 4 * 4;
+    int8_init();
+    return int8_align((size_t)cp*l.h*l.w) + (size_t)int8_threads()*int8_align((size_t)int8_quads(l) * 4 * INT8_CHUNK) + 64;
+}
+
+// one row of the im2col matrix for the pixels [n0, n0 + np): a quad of channels
+// (src, [H][W] words) at the kernel offset dy, dx, z - the padding word
+static void int8_im2col_row(layer l, const uint32_t *src, uint32_t z, int dy, int dx, int n0, int np, uint32_t *row)
+{
+    const int pad = l.pad*l.dilation;
+    int oy = n0 / l.out_w, ox = n0 % l.out_w, p = 0, i;
+    while (p < np) {
+        const int len = (l.out_w - ox < np - p) ? l.out_w - ox : np - p;
+        const int iy = oy*l.stride_y - pad + dy;
+        const int ix = ox*l.stride_x - pad + dx;
+        if ((unsigned)iy >= (unsigned)l.h) {
+            for (i = 0; i < len; ++i) row[p + i] = z;
+        }
+        else if (l.stride_x == 1) {
+            // left padding, the row of the input, right padding
+            const int lo = (ix < 0) ? ((-ix < len) ? -ix : len) : 0;
+            const int hi = (ix + len > l.w) ? ((l.w - ix > lo) ? l.w - ix : lo) : len;
+            for (i = 0; i < lo; ++i) row[p + i] = z;
+            memcpy(row + p + lo, src + iy*l.w + ix + lo, (hi - lo) * sizeof(uint32_t));
+            for (i = hi; i < len; ++i) row[p + i] = z;
+        }
+        else {
+            const uint32_t *s = src + iy*l.w;
+            for (i = 0; i < len; ++i) {
+                const int x = ix + i*l.stride_x;
+                row[p + i] = ((unsigned)x < (unsigned)l.w) ? s[x] : z;
+            }
+        }
+        p += len;
+        ox = 0;
+        ++oy;
+    }
+}
+
+// pixels [n0, n0 + INT8_CHUNK) of the im2col matrix -> B panels,
+// zero - the zero-points of the channel quads as words
+static void int8_pack_input(layer l, const uint32_t *xq, const uint32_t *zero, int n0, uint8_t *b)
+{
+    const int nr = int8_kernel.nr;
+    const int N = l.out_h*l.out_w;
+    const int hw = l.h*l.w;
+    const int cq = (l.c + 3) / 4;
+    const int kq = int8_quads(l);
+    const int np = (N - n0 < INT8_CHUNK) ? N - n0 : INT8_CHUNK;
+    const int direct = (l.size == 1 && l.stride_x == 1 && l.stride_y == 1 && l.pad == 0);
+    uint32_t row[INT8_CHUNK];
+    int q, p;
+
+    for (q = 0; q < kq; ++q) {
+        const int kpos = q / cq, c = q % cq;
+        const uint32_t *r = row;
+        if (direct) r = xq + (size_t)c*hw + n0;
+        else int8_im2col_row(l, xq + (size_t)c*hw, zero[c], (kpos / l.size)*l.dilation, (kpos % l.size)*l.dilation, n0, np, row);
+        for (p = 0; p < np; p += nr) {
+            uint32_t *d = (uint32_t*)b + ((size_t)(p / nr)*kq + q)*nr;
+            const int n = (np - p < nr) ? np - p : nr;
+            memcpy(d, r + p, n * sizeof(uint32_t));
+            if (n < nr) memset(d + n, 0, (nr - n) * sizeof(uint32_t));
+        }
+    }
+}
+
+void forward_convolutional_int8(layer l, float *input, float *workspace, float *output)
+{
+    const int M = l.n;
+    const int N = l.out_h*l.out_w;
+    const int kq = int8_quads(l);
+    const int hw = l.h*l.w;
+    const int cq = (l.c + 3) / 4;
+    const int mr = int8_kernel.mr, nr = int8_kernel.nr;
+    const int chunks = (N + INT8_CHUNK - 1) / INT8_CHUNK;
+    uint32_t *xq = (uint32_t*)workspace;
+    uint8_t *packed = (uint8_t*)xq + int8_align((size_t)cq * 4 * hw);
+    const size_t packed_size = int8_align((size_t)kq * 4 * INT8_CHUNK);
+    int c, chunk;
+
+    #pragma omp parallel for
+    for (c = 0; c < cq; ++c) {
+        // q = round(x / s_c) + z_c, clamped to [0, 255]: after the clamp rounding is +0.5 and truncation
+        const float *x[4];
+        float inv[4], z[4];
+        uint32_t *q = xq + (size_t)c*hw;
+        int i, t;
+        for (t = 0; t < 4; ++t) {
+            const int ch = c * 4 + t;
+            x[t] = (ch < l.c) ? input + (size_t)ch*hw : input;
+            inv[t] = (ch < l.c) ? 1.f / l.int8_input_scales[ch] : 0;
+            z[t] = (ch < l.c) ? (float)l.int8_input_zero[ch] + .5f : 0;
+        }
+        for (i = 0; i < hw; ++i) {
+            uint32_t word = 0;
+            for (t = 0; t < 4; ++t) {
+                float v = x[t][i] * inv[t] + z[t];
+                v = (v < 0) ? 0 : (v > 255) ? 255 : v;
+                word |= (uint32_t)v << (8 * t);
+            }
+            q[i] = word;
+        }
+    }
+
+    #pragma omp parallel for
+    for (chunk = 0; chunk < chunks; ++chunk) {
+#if defined(_OPENMP)
+        uint8_t *b = packed + omp_get_thread_num()*packed_size;
+#else
+        uint8_t *b = packed;
+#endif
+        const int n0 = chunk*INT8_CHUNK;
+        int32_t tile[INT8_MAX_MR*INT8_MAX_NR];
+        int m0, p0, r, p;
+        int8_pack_input(l, xq, (const uint32_t*)l.int8_input_zero, n0, b);
+        // a panel of weights is used for all the pixels of the chunk
+        for (m0 = 0; m0 < M; m0 += mr) {
+            const int mp = (M - m0 < mr) ? (M - m0) : mr;
+            const int8_t *ap = l.weights_int8 + (size_t)m0*kq * 4;
+            for (p0 = 0; p0 < INT8_CHUNK && n0 + p0 < N; p0 += nr) {
+                const int np = (N - n0 - p0 < nr) ? (N - n0 - p0) : nr;
+                int8_kernel.kernel(kq, ap, b + (size_t)(p0 / nr)*kq * 4 * nr, tile);
+                for (r = 0; r < mp; ++r) {
+                    const float s = l.int8_scales[m0 + r];
+                    const int32_t offset = l.int8_offsets[m0 + r];
+                    float *out = output + (size_t)(m0 + r)*N + n0 + p0;
+                    for (p = 0; p < np; ++p) out[p] = s * (float)(tile[r*nr + p] - offset);
+                }
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+int8_calibration *load_int8_calibration(char *filename, network net)
+{
+    FILE *fp = fopen(filename, "r");
+    int8_calibration *cal;
+    char kind[32];
+    if (!fp) file_error(filename);
+    cal = make_int8_calibration(net);
+    while (1) {
+        int index, channels, k, ok = 1;
+        int c = fgetc(fp);
+        if (c == EOF) break;
+        if (c == '#' || c == '\n' || c == '\r') {
+            while (c != '\n' && c != EOF) c = fgetc(fp);
+            continue;
+        }
+        ungetc(c, fp);
+        if (fscanf(fp, "%31s %d %d", kind, &index, &channels) != 3) break;
+        if (strcmp(kind, "conv") != 0 || index < 0 || index >= net.n || cal->channels[index] != channels) {
+            printf(" INT8: %s %d doesn't match the network, the layer stays fp32 \n", kind, index);
+            if (index >= 0 && index < net.n) cal->channels[index] = 0;
+            while (c != '\n' && c != EOF) c = fgetc(fp);
+            continue;
+        }
+        for (k = 0; k < channels; ++k) {
+            if (fscanf(fp, "%f %f", &cal->min[index][k], &cal->max[index][k]) != 2) ok = 0;
+        }
+        if (!ok) error("Error: broken INT8 quantization table", DARKNET_LOC);
+    }
+    fclose(fp);
+    cal->images = 1;
+    return cal;
+}
+
+// every input channel of layer j has seen a value
+static int int8_layer_calibrated(int8_calibration *cal, int j)
+{
+    int k;
+    for (k = 0; k < cal->channels[j]; ++k) {
+        if (!(cal->min[j][k] <= cal->max[j][k])) return 0;
+    }
+    return 1;
+}
+
+int quantize_network_int8(network *net, int8_calibration *cal)
+{
+    int quantized = 0, convs = 0, j;
+    size_t fp32_size = 0, int8_size = 0;
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        if (l->type != CONVOLUTIONAL) continue;
+        ++convs;
+        if (j >= cal->n || cal->channels[j] != l->c) continue;
+        if (!int8_layer_calibrated(cal, j)) {
+            printf(" INT8: conv layer %d has uncalibrated input channels, kept in fp32 \n", j);
+            continue;
+        }
+        if (!int8_is_supported(*l) || l->weights_int8) continue;
+        quantize_convolutional_layer(l, cal->min[j], cal->max[j]);
+        fp32_size += (size_t)l->nweights * sizeof(float);
+        int8_size += (size_t)l->nweights;
+        ++quantized;
+    }
+    if (quantized) recalculate_workspace_size(net);
+    printf(" INT8: %d of %d conv layers quantized (%s kernel), weights %.1f MB -> %.1f MB \n",
+        quantized, convs, int8_kernel_name(), (float)fp32_size / (1024 * 1024), (float)int8_size / (1024 * 1024));
+    return quantized;
+}
+
+// every kernel this CPU has against the scalar sums, returns the number of mismatches
+int test_int8_kernels(void)
+{
+    int8_kernel_desc kernels[3] = { { "generic", 4, 8, 127, int8_kernel_generic_4x8 } };
+    int count = 1, i, fails = 0;
+#ifdef INT8_X86
+    if (is_cpu_fma_avx2()) {
+        int8_kernel_desc kd = { "avx2", 6, 16, 63, int8_kernel_avx2_6x16 };
+        kernels[count++] = kd;
+    }
+    if (is_cpu_avx512_vnni()) {
+        int8_kernel_desc kd = { "avx512_vnni", 8, 32, 127, int8_kernel_vnni_8x32 };
+        kernels[count++] = kd;
+    }
+#endif
+    for (i = 0; i < count; ++i) {
+        const int8_kernel_desc kd = kernels[i];
+        const int kq = 291;     // 3x3x128 + 4 padded
+        int8_t *a = (int8_t*)xcalloc((size_t)kd.mr*kq * 4, sizeof(int8_t));
+        uint8_t *b = (uint8_t*)xcalloc((size_t)kd.nr*kq * 4, sizeof(uint8_t));
+        int32_t c[INT8_MAX_MR*INT8_MAX_NR];
+        int k, r, p, t, bad = 0;
+        // extremes included
+        for (k = 0; k < kd.mr*kq * 4; ++k) a[k] = (k % 7 == 0) ? -kd.wmax : (int8_t)(rand() % (2 * kd.wmax + 1) - kd.wmax);
+        for (k = 0; k < kd.nr*kq * 4; ++k) b[k] = (k % 5 == 0) ? 255 : (uint8_t)(rand() % 256);
+        kd.kernel(kq, a, b, c);
+        for (r = 0; r < kd.mr; ++r) {
+            for (p = 0; p < kd.nr; ++p) {
+                int32_t sum = 0;
+                for (k = 0; k < kq; ++k) {
+                    for (t = 0; t < 4; ++t) sum += (int32_t)a[(k*kd.mr + r) * 4 + t] * (int32_t)b[(k*kd.nr + p) * 4 + t];
+                }
+                if (sum != c[r*kd.nr + p]) ++bad;
+            }
+        }
+        printf(" INT8 kernel %s %dx%d: %s \n", kd.name, kd.mr, kd.nr, bad ? "FAIL" : "exact");
+        fails += bad;
+        free(a);
+        free(b);
+    }
+    return fails;
+}
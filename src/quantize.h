@@ -0,0 +1,55 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+#include <stddef.h>
+#include "darknet.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// INT8 post-training quantization of convolutional layers for CPU inference.
+//
+// Calibration runs the fp32 network over a list of images and records the
+// per-channel range of every convolutional input. The quantization table is a
+// text file with one line per layer:
+//   conv <layer index> <channels> <min> <max> ... (one pair per channel)
+//
+// Inputs are quantized per channel to u8 with a zero-point, x ~ s_c * (q - z_c),
+// and s_c is folded into the weights, which are quantized per output channel to
+// s8, w * s_c ~ s_o * q_w. The convolution becomes a u8 x s8 GEMM with int32 sums:
+//   y_o = s_o * (sum(q_w * q) - sum(q_w * z_c)) + bias_o
+// (AVX-512 VNNI, AVX2 or scalar kernel, all exact in int32; the AVX2 kernel uses
+// 7-bit weights so that vpmaddubsw can't saturate).
+
+typedef struct int8_calibration {
+    int n;              // layers of the network
+    int *channels;      // per layer, 0 - not a convolutional layer
+    float **min;
+    float **max;
+    int images;
+} int8_calibration;
+
+int8_calibration *make_int8_calibration(network net);
+// after network_predict(net, input)
+void update_int8_calibration(int8_calibration *cal, network net, float *input);
+void save_int8_calibration(int8_calibration *cal, char *filename, char *cfgfile);
+void free_int8_calibration(int8_calibration *cal);
+
+int8_calibration *load_int8_calibration(char *filename, network net);
+
+// table set by -int8 <file>, used by prepare_network_for_inference()
+char *get_int8_quantization_table(void);
+// quantizes the calibrated convolutional layers, returns how many
+int quantize_network_int8(network *net, int8_calibration *cal);
+void quantize_convolutional_layer(layer *l, const float *in_min, const float *in_max);
+
+size_t get_convolutional_int8_workspace_size(layer l);
+// output = s_o * (sum - offset_o) for one image and group, bias and activation are applied by the caller
+void forward_convolutional_int8(layer l, float *input, float *workspace, float *output);
+
+const char *int8_kernel_name(void);
+int test_int8_kernels(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -2,6 +2,7 @@
 #include "blas.h"
 #include "dark_cuda.h"
 #include "utils.h"
+#include "fast_activations.h"
 #include "blas.h"
 
 #include <float.h>
@@ -56,7 +57,9 @@ softmax_layer make_softmax_layer(int batch, int inputs, int groups)
 
 void forward_softmax_layer(const softmax_layer l, network_state net)
 {
-    if(l.softmax_tree){
+    if (!net.train && net.net.fast_activations && !l.softmax_tree) {
+        fast_softmax_cpu(net.input, l.inputs/l.groups, l.batch, l.inputs, l.groups, l.inputs/l.groups, 1, l.temperature, l.output);
+    } else if(l.softmax_tree){
         int i;
         int count = 0;
         for (i = 0; i < l.softmax_tree->groups; ++i) {
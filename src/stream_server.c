@@ -0,0 +1,470 @@
+#include "stream_server.h"
+#include "network.h"
+#include "parser.h"
+#include "option_list.h"
+#include "data.h"
+#include "list.h"
+#include "box.h"
+#include "image.h"
+#include "utils.h"
+#include "http_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// an idle scheduler looks at the closed streams this often
+#define STREAM_IDLE_WAIT_US 100000
+
+stream_frame *make_stream_frame(int stream, long long id, image in, int w, int h, void *mat)
+{
+    stream_frame *frame = (stream_frame*)xcalloc(1, sizeof(stream_frame));
+    frame->stream = stream;
+    frame->id = id;
+    frame->in = in;
+    frame->w = w;
+    frame->h = h;
+    frame->mat = mat;
+    frame->time = get_time_point();
+    return frame;
+}
+
+void free_stream_frame(stream_frame *frame)
+{
+    if (!frame) return;
+#ifdef OPENCV
+    release_mat((mat_cv**)&frame->mat);
+#endif
+    free_image(frame->in);
+    release_network_boxes(frame->dets);
+    free(frame);
+}
+
+static void free_stream_frames(spsc_ring *ring)
+{
+    stream_frame *frame;
+    while ((frame = (stream_frame*)spsc_ring_try_pop(ring))) free_stream_frame(frame);
+}
+
+stream_scheduler *make_stream_scheduler(network *net, int streams, int depth, int max_batch, int max_wait_ms)
+{
+    stream_scheduler *s = (stream_scheduler*)xcalloc(1, sizeof(stream_scheduler));
+    char buff[64];
+    int i;
+
+    for (i = 0; i < net->n; ++i) {
+        const LAYER_TYPE type = net->layers[i].type;
+        if (type == GAUSSIAN_YOLO || type == REGION || type == DETECTION) {
+            error("The multi-stream scheduler supports only [yolo] output layers", DARKNET_LOC);
+        }
+    }
+    if (max_batch < 1) max_batch = 1;
+    if (max_batch > net->batch) {
+        printf(" max_batch %d is bigger than the batch %d the network was loaded with \n", max_batch, net->batch);
+        max_batch = net->batch;
+    }
+
+    s->net = net;
+    s->streams = streams;
+    s->max_batch = max_batch;
+    s->max_wait_us = max_wait_ms > 0 ? max_wait_ms * 1000 : 0;
+    s->thresh = .5;
+    s->hier_thresh = .5;
+    s->in = (spsc_ring**)xcalloc(streams, sizeof(spsc_ring*));
+    s->out = (spsc_ring**)xcalloc(streams, sizeof(spsc_ring*));
+    s->spare = (spsc_ring**)xcalloc(streams, sizeof(spsc_ring*));
+    s->sources = (pipeline_stage**)xcalloc(streams, sizeof(pipeline_stage*));
+    s->outputs = (pipeline_stage**)xcalloc(streams, sizeof(pipeline_stage*));
+    for (i = 0; i < streams; ++i) {
+        s->in[i] = make_spsc_ring(depth);
+        s->out[i] = make_spsc_ring(depth);
+        s->spare[i] = make_spsc_ring(depth + max_batch);
+        sprintf(buff, "in %d", i);
+        s->sources[i] = make_pipeline_stage(buff);
+        sprintf(buff, "out %d", i);
+        s->outputs[i] = make_pipeline_stage(buff);
+    }
+    s->ready = make_pipeline_signal();
+    s->forward = make_pipeline_stage("batch");
+    s->input = (float*)xcalloc((size_t)max_batch * net->w * net->h * net->c, sizeof(float));
+    s->batch = (stream_frame**)xcalloc(max_batch, sizeof(stream_frame*));
+    return s;
+}
+
+void free_stream_scheduler(stream_scheduler *s)
+{
+    float *input;
+    int i;
+    for (i = 0; i < s->streams; ++i) {
+        free_stream_frames(s->in[i]);
+        free_stream_frames(s->out[i]);
+        while ((input = (float*)spsc_ring_try_pop(s->spare[i]))) free(input);
+        free_spsc_ring(s->in[i]);
+        free_spsc_ring(s->out[i]);
+        free_spsc_ring(s->spare[i]);
+        free_pipeline_stage(s->sources[i]);
+        free_pipeline_stage(s->outputs[i]);
+    }
+    free(s->in);
+    free(s->out);
+    free(s->spare);
+    free(s->sources);
+    free(s->outputs);
+    free_pipeline_signal(s->ready);
+    free_pipeline_stage(s->forward);
+    free(s->input);
+    free(s->batch);
+    free(s);
+}
+
+int push_stream_frame(stream_scheduler *s, stream_frame *frame, int drop_oldest)
+{
+    pipeline_stage *stage = s->sources[frame->stream];
+    spsc_ring *ring = s->in[frame->stream];
+    const double latency = get_time_point() - frame->time;
+    if (spsc_ring_is_closed(ring)) {
+        free_stream_frame(frame);
+        return 0;
+    }
+    if (drop_oldest) {
+        stream_frame *dropped = (stream_frame*)spsc_ring_push_drop_oldest(ring, frame);
+        if (dropped) {
+            pipeline_stage_dropped(stage);
+            free_stream_frame(dropped);
+        }
+    }
+    else if (!spsc_ring_push(ring, frame)) {
+        free_stream_frame(frame);
+        return 0;
+    }
+    pipeline_stage_done(stage, latency);
+    pipeline_signal_notify(s->ready);
+    return 1;
+}
+
+image get_stream_input(stream_scheduler *s, int stream)
+{
+    network *net = s->net;
+    float *data = (float*)spsc_ring_try_pop(s->spare[stream]);
+    if (data) return float_to_image(net->w, net->h, net->c, data);
+    return make_image(net->w, net->h, net->c);
+}
+
+void close_stream_input(stream_scheduler *s, int stream)
+{
+    spsc_ring_close(s->in[stream]);
+    pipeline_signal_notify(s->ready);
+}
+
+void stop_stream_scheduler(stream_scheduler *s)
+{
+    int i;
+    for (i = 0; i < s->streams; ++i) {
+        spsc_ring_close(s->in[i]);
+        spsc_ring_close(s->out[i]);
+    }
+    pipeline_signal_notify(s->ready);
+}
+
+// takes at most one frame of every stream per pass, round-robin, until the batch is full
+static int gather_stream_frames(stream_scheduler *s, int count)
+{
+    int added = 1, i;
+    while (count < s->max_batch && added) {
+        added = 0;
+        for (i = 0; i < s->streams && count < s->max_batch; ++i) {
+            stream_frame *frame = (stream_frame*)spsc_ring_try_pop(s->in[(s->next + i) % s->streams]);
+            if (!frame) continue;
+            s->batch[count++] = frame;
+            added = 1;
+        }
+    }
+    return count;
+}
+
+static int stream_inputs_open(stream_scheduler *s)
+{
+    int i;
+    for (i = 0; i < s->streams; ++i) {
+        if (!spsc_ring_is_closed(s->in[i]) || spsc_ring_size(s->in[i])) return 1;
+    }
+    return 0;
+}
+
+int run_stream_batch(stream_scheduler *s)
+{
+    network *net = s->net;
+    const size_t size = (size_t)net->w * net->h * net->c;
+    double first = 0, start;
+    int count = 0, b;
+
+    while (count < s->max_batch) {
+        const long long signal = pipeline_signal_value(s->ready);
+        const int before = count;
+        count = gather_stream_frames(s, count);
+        if (!before && count) first = get_time_point();
+        if (count == s->max_batch) break;
+        if (!stream_inputs_open(s)) {
+            if (count) break;
+            return 0;
+        }
+        if (count) {
+            const double left = s->max_wait_us - (get_time_point() - first);
+            if (left <= 0) break;
+            pipeline_signal_wait(s->ready, signal, (int)left);
+        }
+        else pipeline_signal_wait(s->ready, signal, STREAM_IDLE_WAIT_US);
+    }
+    s->next = (s->next + 1) % s->streams;
+
+    start = get_time_point();
+    for (b = 0; b < count; ++b) {
+        memcpy(s->input + b*size, s->batch[b]->in.data, size * sizeof(float));
+    }
+    network_predict_batched(net, s->input, count);
+    for (b = 0; b < count; ++b) {
+        stream_frame *frame = s->batch[b];
+        const int w = s->letter_box ? frame->w : net->w;
+        const int h = s->letter_box ? frame->h : net->h;
+        frame->dets = get_network_boxes_batch_pooled(net, w, h, s->thresh, s->hier_thresh, 0, 1, &frame->nboxes, s->letter_box, b);
+        if (frame->in.w != net->w || frame->in.h != net->h || frame->in.c != net->c ||
+            !spsc_ring_try_push(s->spare[frame->stream], frame->in.data)) free_image(frame->in);
+        frame->in = make_empty_image(0, 0, 0);
+    }
+    pipeline_stage_done(s->forward, get_time_point() - start);
+
+    // a slow consumer loses its oldest frames, it doesn't stall the other streams
+    for (b = 0; b < count; ++b) {
+        stream_frame *frame = s->batch[b];
+        pipeline_stage *stage = s->outputs[frame->stream];
+        stream_frame *dropped;
+        pipeline_stage_done(stage, get_time_point() - frame->time);
+        if (spsc_ring_is_closed(s->out[frame->stream])) {
+            free_stream_frame(frame);
+            continue;
+        }
+        dropped = (stream_frame*)spsc_ring_push_drop_oldest(s->out[frame->stream], frame);
+        if (dropped) {
+            pipeline_stage_dropped(stage);
+            free_stream_frame(dropped);
+        }
+    }
+    ++s->batches;
+    return count;
+}
+
+void print_stream_scheduler(stream_scheduler *s, double elapsed_us)
+{
+    const long long batches = pipeline_stage_items(s->forward);
+    long long frames = 0;
+    int i;
+    for (i = 0; i < s->streams; ++i) frames += pipeline_stage_items(s->outputs[i]);
+    printf(" %d streams, %lld frames in %lld batches (avg %.2f, max %d), %.1f frames/s \n",
+        s->streams, frames, batches, batches ? (float)frames / batches : 0.f, s->max_batch,
+        elapsed_us > 0 ? frames * 1000000. / elapsed_us : 0.);
+    print_pipeline_stages(&s->forward, 1, elapsed_us);
+    print_pipeline_stages(s->sources, s->streams, elapsed_us);
+    print_pipeline_stages(s->outputs, s->streams, elapsed_us);
+}
+
+#ifdef OPENCV
+
+typedef struct stream_source {
+    stream_scheduler *s;
+    int index;
+    cap_cv *cap;
+    int live;
+    int letter_box;
+    int mjpeg_port;
+    int json_port;
+    float thresh;
+    char **names;
+    int classes;
+    image **alphabet;
+    layer l;            // the last yolo layer, for NMS
+} stream_source;
+
+static volatile int streams_exit;
+
+static void *stream_capture_thread(void *ptr)
+{
+    stream_source *src = (stream_source*)ptr;
+    long long id = 0;
+    while (!custom_atomic_load_int(&streams_exit)) {
+        const double captured = get_time_point();
+        mat_cv *mat = get_capture_frame_cv(src->cap);
+        image in;
+        if (!mat || get_width_mat(mat) < 1 || get_height_mat(mat) < 1) {
+            release_mat(&mat);
+            // the stream may start with empty frames
+            if (!id) continue;
+            printf(" Stream %d closed. \n", src->index);
+            break;
+        }
+        in = get_stream_input(src->s, src->index);
+        get_image_from_mat_into(mat, src->letter_box, in);
+        stream_frame *frame = make_stream_frame(src->index, ++id, in, get_width_mat(mat), get_height_mat(mat), mat);
+        frame->time = captured;
+        if (!push_stream_frame(src->s, frame, src->live)) break;
+    }
+    close_stream_input(src->s, src->index);
+    return 0;
+}
+
+static void *stream_output_thread(void *ptr)
+{
+    stream_source *src = (stream_source*)ptr;
+    const float nms = .45;
+    layer l = src->l;
+    stream_frame *frame;
+    while ((frame = (stream_frame*)spsc_ring_pop(src->s->out[src->index]))) {
+        if (l.nms_kind == DEFAULT_NMS) do_nms_sort(frame->dets, frame->nboxes, l.classes, nms);
+        else diounms_sort(frame->dets, frame->nboxes, l.classes, nms, l.nms_kind, l.beta_nms);
+        if (src->json_port > 0) {
+            int timeout = 400000;
+            send_json(frame->dets, frame->nboxes, l.classes, src->names, frame->id, src->json_port, timeout);
+        }
+        if (src->mjpeg_port > 0) {
+            int timeout = 400000;
+            int jpeg_quality = 40;    // 1 - 100
+            draw_detections_cv_v3(frame->mat, frame->dets, frame->nboxes, src->thresh, src->names, src->alphabet, src->classes, 0);
+            send_mjpeg(frame->mat, src->mjpeg_port, timeout, jpeg_quality);
+        }
+        free_stream_frame(frame);
+    }
+    return 0;
+}
+
+static int is_webcam_index(const char *source)
+{
+    if (!*source) return 0;
+    for (; *source; ++source) {
+        if (!isdigit((unsigned char)*source)) return 0;
+    }
+    return 1;
+}
+
+void run_stream_server(char *datacfg, char *cfgfile, char *weightfile, char *sources, float thresh, float hier_thresh,
+    int max_batch, int max_wait_ms, int depth, int mjpeg_port, int json_port, int letter_box, int time_limit_sec, int benchmark_layers)
+{
+    list *options = read_data_cfg(datacfg);
+    int classes = option_find_int(options, "classes", 20);
+    char *name_list = option_find_str(options, "names", "data/names.list");
+    char **names = get_labels(name_list);
+    image **alphabet = load_alphabet();
+    list *plist;
+    char **paths;
+    int streams, i;
+
+    if (!sources) error("Multi-stream mode needs a file with one video source per line", DARKNET_LOC);
+    plist = get_paths(sources);
+    paths = (char **)list_to_array(plist);
+    streams = plist->size;
+    if (!streams) error("No video sources", DARKNET_LOC);
+
+    // one network for every stream, its buffers hold max_batch frames
+    if (max_batch < 1) max_batch = 1;
+    network net = parse_network_cfg_custom(cfgfile, max_batch, 1);
+    if (weightfile) load_weights(&net, weightfile);
+    if (net.letter_box) letter_box = 1;
+    net.benchmark_layers = benchmark_layers;
+    fuse_conv_batchnorm(net);
+    calculate_binary_weights(net);
+    prepare_network_for_inference(&net);
+    print_cpu_conv_algorithms(net);
+
+    stream_scheduler *s = make_stream_scheduler(&net, streams, depth, max_batch, max_wait_ms);
+    s->thresh = thresh;
+    s->hier_thresh = hier_thresh;
+    s->letter_box = letter_box;
+
+    stream_source *srcs = (stream_source*)xcalloc(streams, sizeof(stream_source));
+    custom_thread_t *capture_threads = (custom_thread_t*)xcalloc(streams, sizeof(custom_thread_t));
+    custom_thread_t *output_threads = (custom_thread_t*)xcalloc(streams, sizeof(custom_thread_t));
+    layer l = net.layers[net.n - 1];
+    for (i = 0; i < net.n; ++i) {
+        if (net.layers[i].type == YOLO) l = net.layers[i];
+    }
+    if (l.classes != classes) {
+        printf("\n Parameters don't match: in cfg-file classes=%d, in data-file classes=%d \n", l.classes, classes);
+        error("Error!", DARKNET_LOC);
+    }
+
+    streams_exit = 0;
+    for (i = 0; i < streams; ++i) {
+        stream_source *src = &srcs[i];
+        src->s = s;
+        src->index = i;
+        src->letter_box = letter_box;
+        src->mjpeg_port = mjpeg_port > 0 ? mjpeg_port + i : -1;
+        src->json_port = json_port > 0 ? json_port + i : -1;
+        src->thresh = thresh;
+        src->names = names;
+        src->classes = classes;
+        src->alphabet = alphabet;
+        src->l = l;
+        if (is_webcam_index(paths[i])) {
+            src->cap = get_capture_webcam(atoi(paths[i]));
+            src->live = 1;
+        }
+        else {
+            src->cap = get_capture_video_stream(paths[i]);
+            src->live = is_live_stream(paths[i]);
+        }
+        if (!src->cap) {
+            printf(" Couldn't open the video source %s \n", paths[i]);
+            error("Error!", DARKNET_LOC);
+        }
+        printf(" Stream %d: %s%s", i, paths[i], src->live ? ", live" : "");
+        if (src->mjpeg_port > 0) printf(", MJPEG port %d", src->mjpeg_port);
+        if (src->json_port > 0) printf(", JSON port %d", src->json_port);
+        printf(" \n");
+    }
+    printf(" Batches of up to %d frames, waiting at most %d ms, %d frames per queue \n", s->max_batch, max_wait_ms, depth);
+
+    for (i = 0; i < streams; ++i) {
+        if (custom_create_thread(&capture_threads[i], 0, stream_capture_thread, &srcs[i]) ||
+            custom_create_thread(&output_threads[i], 0, stream_output_thread, &srcs[i]))
+            error("Thread creation failed", DARKNET_LOC);
+    }
+
+    const double start = get_time_point();
+    double last_print = start;
+    while (run_stream_batch(s)) {
+        const double now = get_time_point();
+        if (now - last_print > 3000000) {
+            print_stream_scheduler(s, now - start);
+            last_print = now;
+        }
+        if (time_limit_sec > 0 && (now - start) / 1000000 > time_limit_sec) break;
+    }
+
+    custom_atomic_store_int(&streams_exit, 1);
+    stop_stream_scheduler(s);
+    for (i = 0; i < streams; ++i) {
+        custom_join(capture_threads[i], 0);
+        custom_join(output_threads[i], 0);
+        release_capture(srcs[i].cap);
+    }
+    print_stream_scheduler(s, get_time_point() - start);
+
+    free_stream_scheduler(s);
+    free(capture_threads);
+    free(output_threads);
+    free(srcs);
+    free_network(net);
+    free_alphabet(alphabet);
+    free_ptrs((void **)names, classes);
+    free(paths);
+    free_list_contents(plist);
+    free_list(plist);
+    free_list_contents_kvp(options);
+    free_list(options);
+}
+#else
+void run_stream_server(char *datacfg, char *cfgfile, char *weightfile, char *sources, float thresh, float hier_thresh,
+    int max_batch, int max_wait_ms, int depth, int mjpeg_port, int json_port, int letter_box, int time_limit_sec, int benchmark_layers)
+{
+    fprintf(stderr, "Multi-stream mode needs OpenCV for video capture.\n");
+}
+#endif
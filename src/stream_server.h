@@ -0,0 +1,72 @@
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+#include "darknet.h"
+#include "frame_pipeline.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Multi-stream inference: every source pushes its frames to its own SPSC ring,
+// one scheduler takes up to max_batch frames of different streams, runs them as
+// one batched forward pass of the shared network and pushes every frame with its
+// detections to the output ring of its stream. A batch is run as soon as it is
+// full or max_wait_ms after its first frame arrived, whichever comes first:
+// max_wait_ms = 0 never waits for more frames, a bigger one gives bigger batches.
+
+typedef struct stream_frame {
+    int stream;
+    long long id;
+    image in;           // network input, net.w x net.h
+    int w, h;           // source frame, the boxes are relative to it
+    void *mat;          // the source frame (mat_cv*), released with the frame
+    detection *dets;    // not suppressed, NMS is up to the consumer; from the network's detection pool
+    int nboxes;
+    double time;        // get_time_point() of the capture
+} stream_frame;
+
+typedef struct stream_scheduler {
+    network *net;       // loaded with batch = max_batch
+    int streams;
+    spsc_ring **in;     // per stream, frames to detect
+    spsc_ring **out;    // per stream, detected frames (the oldest is dropped when full)
+    spsc_ring **spare;  // per stream, network inputs of detected frames, back to the producer
+    pipeline_signal *ready; // notified by the producers after each push to in
+    int max_batch;
+    int max_wait_us;
+    int letter_box;
+    float thresh, hier_thresh;
+    int next;           // round-robin start
+    float *input;
+    stream_frame **batch;
+    pipeline_stage *forward;    // latency: batched forward and boxes
+    pipeline_stage **sources;   // per stream: pushed frames, capture to pushed, dropped from in
+    pipeline_stage **outputs;   // per stream: detected frames, capture to detected, dropped from out
+    long long batches;
+} stream_scheduler;
+
+stream_scheduler *make_stream_scheduler(network *net, int streams, int depth, int max_batch, int max_wait_ms);
+void free_stream_scheduler(stream_scheduler *s);
+// pushes a frame of a stream to the scheduler, 0 - the scheduler was stopped and the frame freed
+int push_stream_frame(stream_scheduler *s, stream_frame *frame, int drop_oldest);
+// a net.w x net.h x net.c input for the next frame of the stream: a spare one, or a new one
+// while all of them are in flight (called by the producer of the stream)
+image get_stream_input(stream_scheduler *s, int stream);
+// the source of the stream has ended
+void close_stream_input(stream_scheduler *s, int stream);
+// waits for a batch, runs it and fans the frames out,
+// returns their number or 0 once every stream is closed and drained
+int run_stream_batch(stream_scheduler *s);
+// closes every ring: producers and consumers stop
+void stop_stream_scheduler(stream_scheduler *s);
+void print_stream_scheduler(stream_scheduler *s, double elapsed_us);
+
+stream_frame *make_stream_frame(int stream, long long id, image in, int w, int h, void *mat);
+void free_stream_frame(stream_frame *frame);
+
+void run_stream_server(char *datacfg, char *cfgfile, char *weightfile, char *sources, float thresh, float hier_thresh,
+    int max_batch, int max_wait_ms, int depth, int mjpeg_port, int json_port, int letter_box, int time_limit_sec, int benchmark_layers);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -18,6 +18,8 @@
 #else
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <execinfo.h>
 #endif
 
@@ -1100,3 +1102,49 @@ bool is_live_stream(const char * path){
     const char *url_schema = "://";
     return (NULL != strstr(path, url_schema));
 }
+
+void *map_file(const char *filename, size_t *size, int copy_on_write)
+{
+#ifdef WIN32
+    LARGE_INTEGER file_size;
+    HANDLE mapping;
+    void *map;
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+    mapping = CreateFileMappingA(file, NULL, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) return NULL;
+    map = MapViewOfFile(mapping, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    *size = (size_t)file_size.QuadPart;
+    return map;
+#else
+    struct stat st;
+    void *map;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)st.st_size, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    *size = (size_t)st.st_size;
+    return map;
+#endif
+}
+
+void unmap_file(void *map, size_t size)
+{
+#ifdef WIN32
+    (void)size;
+    UnmapViewOfFile(map);
+#else
+    munmap(map, size);
+#endif
+}
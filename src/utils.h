@@ -107,6 +107,9 @@ int max_int_index(int *a, int n);
 boxabs box_to_boxabs(const box* b, const int img_w, const int img_h, const int bounds_check);
 int make_directory(char *path, int mode);
 unsigned long custom_hash(char *str);
+// maps the whole file read-only, or copy-on-write: writes stay private to the process; NULL - failed
+void *map_file(const char *filename, size_t *size, int copy_on_write);
+void unmap_file(void *map, size_t size);
 bool is_live_stream(const char * path);
 
 #define max_val_cmp(a,b) (((a) > (b)) ? (a) : (b))
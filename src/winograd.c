@@ -0,0 +1,244 @@
+#include "winograd.h"
+#include "gemm_packed.h"
+#include "fast_activations.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// 1D transforms (Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks"),
+// the 2D ones apply them to the columns and then to the rows of a tile.
+
+// F(2,3): B^T d, G g, A^T m
+static inline void wino2_input_1d(const float *d, int ds, float *r, int rs)
+{
+    const float d0 = d[0], d1 = d[ds], d2 = d[2 * ds], d3 = d[3 * ds];
+    r[0] = d0 - d2;
+    r[rs] = d1 + d2;
+    r[2 * rs] = d2 - d1;
+    r[3 * rs] = d1 - d3;
+}
+
+static inline void wino2_weight_1d(const float *g, int gs, float *u, int us)
+{
+    const float g0 = g[0], g1 = g[gs], g2 = g[2 * gs];
+    u[0] = g0;
+    u[us] = 0.5f * (g0 + g1 + g2);
+    u[2 * us] = 0.5f * (g0 - g1 + g2);
+    u[3 * us] = g2;
+}
+
+static inline void wino2_output_1d(const float *m, int ms, float *y, int ys)
+{
+    const float m0 = m[0], m1 = m[ms], m2 = m[2 * ms], m3 = m[3 * ms];
+    y[0] = m0 + m1 + m2;
+    y[ys] = m1 - m2 - m3;
+}
+
+// F(4,3)
+static inline void wino4_input_1d(const float *d, int ds, float *r, int rs)
+{
+    const float d0 = d[0], d1 = d[ds], d2 = d[2 * ds], d3 = d[3 * ds], d4 = d[4 * ds], d5 = d[5 * ds];
+    r[0] = 4 * d0 - 5 * d2 + d4;
+    r[rs] = -4 * (d1 + d2) + d3 + d4;
+    r[2 * rs] = 4 * (d1 - d2) - d3 + d4;
+    r[3 * rs] = 2 * (d3 - d1) - d2 + d4;
+    r[4 * rs] = 2 * (d1 - d3) - d2 + d4;
+    r[5 * rs] = 4 * d1 - 5 * d3 + d5;
+}
+
+static inline void wino4_weight_1d(const float *g, int gs, float *u, int us)
+{
+    const float g0 = g[0], g1 = g[gs], g2 = g[2 * gs];
+    u[0] = g0 / 4;
+    u[us] = -(g0 + g1 + g2) / 6;
+    u[2 * us] = -(g0 - g1 + g2) / 6;
+    u[3 * us] = g0 / 24 + g1 / 12 + g2 / 6;
+    u[4 * us] = g0 / 24 - g1 / 12 + g2 / 6;
+    u[5 * us] = g2;
+}
+
+static inline void wino4_output_1d(const float *m, int ms, float *y, int ys)
+{
+    const float m0 = m[0], m1 = m[ms], m2 = m[2 * ms], m3 = m[3 * ms], m4 = m[4 * ms], m5 = m[5 * ms];
+    const float a = m1 + m2, b = m1 - m2, c = m3 + m4, d = m3 - m4;
+    y[0] = m0 + a + c;
+    y[ys] = b + 2 * d;
+    y[2 * ys] = a + 4 * c;
+    y[3 * ys] = b + 8 * d + m5;
+}
+
+// tile (alpha x alpha, row-major) -> transformed tile (alpha x alpha)
+static void winograd_input_tile(int m, const float *d, float *v)
+{
+    float t[36];
+    int i;
+    if (m == 2) {
+        for (i = 0; i < 4; ++i) wino2_input_1d(d + i, 4, t + i, 4);
+        for (i = 0; i < 4; ++i) wino2_input_1d(t + i * 4, 1, v + i * 4, 1);
+    }
+    else {
+        for (i = 0; i < 6; ++i) wino4_input_1d(d + i, 6, t + i, 6);
+        for (i = 0; i < 6; ++i) wino4_input_1d(t + i * 6, 1, v + i * 6, 1);
+    }
+}
+
+// 3x3 kernel -> alpha x alpha
+static void winograd_weight_tile(int m, const float *g, float *u)
+{
+    float t[6 * 3];
+    int i;
+    if (m == 2) {
+        for (i = 0; i < 3; ++i) wino2_weight_1d(g + i, 3, t + i, 3);
+        for (i = 0; i < 4; ++i) wino2_weight_1d(t + i * 3, 1, u + i * 4, 1);
+    }
+    else {
+        for (i = 0; i < 3; ++i) wino4_weight_1d(g + i, 3, t + i, 3);
+        for (i = 0; i < 6; ++i) wino4_weight_1d(t + i * 3, 1, u + i * 6, 1);
+    }
+}
+
+// alpha x alpha -> m x m
+static void winograd_output_tile(int m, const float *mm, float *y)
+{
+    float t[4 * 6];
+    int i;
+    if (m == 2) {
+        for (i = 0; i < 4; ++i) wino2_output_1d(mm + i, 4, t + i, 4);
+        for (i = 0; i < 2; ++i) wino2_output_1d(t + i * 4, 1, y + i * 2, 1);
+    }
+    else {
+        for (i = 0; i < 6; ++i) wino4_output_1d(mm + i, 6, t + i, 6);
+        for (i = 0; i < 4; ++i) wino4_output_1d(t + i * 6, 1, y + i * 4, 1);
+    }
+}
+
+size_t winograd_weights_size(int m, int n, int c)
+{
+    const int alpha = m + 2;
+    return alpha * alpha * gemm_packed_a_size(n, c);
+}
+
+void winograd_transform_weights(int m, const float *weights, int n, int c, float *transformed)
+{
+    const int alpha = m + 2;
+    const int positions = alpha * alpha;
+    const size_t packed_size = gemm_packed_a_size(n, c);
+    float *u = (float*)xcalloc((size_t)positions * n * c, sizeof(float));
+    int k, p;
+
+    // u: [position][n][c]
+    #pragma omp parallel for
+    for (k = 0; k < n; ++k) {
+        float tile[36];
+        int ch, pp;
+        for (ch = 0; ch < c; ++ch) {
+            winograd_weight_tile(m, weights + ((size_t)k*c + ch) * 9, tile);
+            for (pp = 0; pp < positions; ++pp) u[((size_t)pp*n + k)*c + ch] = tile[pp];
+        }
+    }
+    for (p = 0; p < positions; ++p) {
+        gemm_pack_a(0, n, c, 1, u + (size_t)p*n*c, c, transformed + p*packed_size);
+    }
+    free(u);
+}
+
+static int winograd_chunk_rows(int m, int n, int c, int out_h, int out_w, size_t max_workspace)
+{
+    const int alpha = m + 2;
+    const int tiles_x = (out_w + m - 1) / m;
+    const int tiles_y = (out_h + m - 1) / m;
+    const size_t row_size = (size_t)alpha * alpha * (c + n) * tiles_x * sizeof(float);
+    int rows = (int)(max_workspace / row_size);
+    if (rows < 1) rows = 1;
+    if (rows > tiles_y) rows = tiles_y;
+    return rows;
+}
+
+size_t winograd_workspace_size(int m, int n, int c, int out_h, int out_w, size_t max_workspace)
+{
+    const int alpha = m + 2;
+    const int tiles_x = (out_w + m - 1) / m;
+    const int rows = winograd_chunk_rows(m, n, c, out_h, out_w, max_workspace);
+    return (size_t)alpha * alpha * (c + n) * tiles_x * rows * sizeof(float);
+}
+
+void winograd_convolution(int m, const float *input, int c, int h, int w, int pad,
+    const float *transformed, int n, float *output, int out_h, int out_w,
+    float *workspace, size_t max_workspace, const gemm_epilogue *epilogue)
+{
+    const int alpha = m + 2;
+    const int positions = alpha * alpha;
+    const int tiles_x = (out_w + m - 1) / m;
+    const int tiles_y = (out_h + m - 1) / m;
+    const int chunk_rows = winograd_chunk_rows(m, n, c, out_h, out_w, max_workspace);
+    const size_t packed_size = gemm_packed_a_size(n, c);
+    int ty0;
+
+    for (ty0 = 0; ty0 < tiles_y; ty0 += chunk_rows) {
+        const int ty1 = (ty0 + chunk_rows < tiles_y) ? (ty0 + chunk_rows) : tiles_y;
+        const int tiles = (ty1 - ty0) * tiles_x;
+        float *V = workspace;                               // [position][c][tiles]
+        float *M = workspace + (size_t)positions * c * tiles; // [position][n][tiles]
+        int ch, k, p;
+
+        #pragma omp parallel for
+        for (ch = 0; ch < c; ++ch) {
+            const float *im = input + (size_t)ch * h * w;
+            float d[36], v[36];
+            int ty, tx, i, j, pp;
+            for (ty = ty0; ty < ty1; ++ty) {
+                const int iy0 = ty * m - pad;
+                for (tx = 0; tx < tiles_x; ++tx) {
+                    const int ix0 = tx * m - pad;
+                    const int t = (ty - ty0) * tiles_x + tx;
+                    if (iy0 >= 0 && ix0 >= 0 && iy0 + alpha <= h && ix0 + alpha <= w) {
+                        for (i = 0; i < alpha; ++i) {
+                            memcpy(d + i * alpha, im + (size_t)(iy0 + i) * w + ix0, alpha * sizeof(float));
+                        }
+                    }
+                    else {
+                        for (i = 0; i < alpha; ++i) {
+                            const int iy = iy0 + i;
+                            for (j = 0; j < alpha; ++j) {
+                                const int ix = ix0 + j;
+                                d[i * alpha + j] = (iy >= 0 && iy < h && ix >= 0 && ix < w) ? im[(size_t)iy * w + ix] : 0;
+                            }
+                        }
+                    }
+                    winograd_input_tile(m, d, v);
+                    for (pp = 0; pp < positions; ++pp) V[((size_t)pp*c + ch)*tiles + t] = v[pp];
+                }
+            }
+        }
+
+        for (p = 0; p < positions; ++p) {
+            gemm_prepacked(0, n, tiles, c, transformed + p*packed_size,
+                V + (size_t)p*c*tiles, tiles, 0, M + (size_t)p*n*tiles, tiles);
+        }
+
+        #pragma omp parallel for
+        for (k = 0; k < n; ++k) {
+            float *out = output + (size_t)k * out_h * out_w;
+            float mm[36], y[16];
+            int ty, tx, i, j, pp;
+            for (ty = ty0; ty < ty1; ++ty) {
+                const int oy0 = ty * m;
+                for (tx = 0; tx < tiles_x; ++tx) {
+                    const int ox0 = tx * m;
+                    const int t = (ty - ty0) * tiles_x + tx;
+                    for (pp = 0; pp < positions; ++pp) mm[pp] = M[((size_t)pp*n + k)*tiles + t];
+                    winograd_output_tile(m, mm, y);
+                    for (i = 0; i < m && oy0 + i < out_h; ++i) {
+                        for (j = 0; j < m && ox0 + j < out_w; ++j) {
+                            out[(size_t)(oy0 + i) * out_w + ox0 + j] = y[i * m + j];
+                        }
+                    }
+                }
+            }
+            if (epilogue) {
+                const int oy1 = (ty1 * m < out_h) ? ty1 * m : out_h;
+                (epilogue->fast ? fast_bias_activate_array : bias_activate_array)(out + (size_t)ty0 * m * out_w, (oy1 - ty0 * m) * out_w, epilogue->bias[k], epilogue->activation);
+            }
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+#include "gemm_packed.h"
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Winograd F(m x m, 3x3) convolution for 3x3 / stride 1 / dilation 1 layers
+// (m = 2 or 4, tile = m + 2), inference only:
+//   U = G g G^T       - weights, transformed and packed once at load time
+//   V = B^T d B       - input tiles
+//   M[p] = U[p] * V[p] - one GEMM per tile position p
+//   Y = A^T M A       - output tiles
+// Tiles are processed in chunks of tile-rows, so the workspace is bounded.
+
+// number of floats of the transformed (and packed) weights
+size_t winograd_weights_size(int m, int n, int c);
+void winograd_transform_weights(int m, const float *weights, int n, int c, float *transformed);
+
+// bytes of workspace needed to stay within max_workspace (or one tile-row when it doesn't fit)
+size_t winograd_workspace_size(int m, int n, int c, int out_h, int out_w, size_t max_workspace);
+
+// epilogue (can be NULL): bias + activation of each chunk of output rows, right after its output transform
+void winograd_convolution(int m, const float *input, int c, int h, int w, int pad,
+    const float *transformed, int n, float *output, int out_h, int out_w,
+    float *workspace, size_t max_workspace, const gemm_epilogue *epilogue);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
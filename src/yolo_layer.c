@@ -1,11 +1,14 @@
 #include "yolo_layer.h"
 #include "activations.h"
+#include "fast_activations.h"
 #include "blas.h"
 #include "box.h"
 #include "dark_cuda.h"
 #include "utils.h"
+#include "gemm.h"
 
 #include <math.h>
+#include <float.h>
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
@@ -666,16 +669,19 @@ void forward_yolo_layer(const layer l, network_state state)
     int b, n;
 
 #ifndef GPU
-    for (b = 0; b < l.batch; ++b) {
+    void (*logistic_array)(float *, const int, const ACTIVATION) =
+        (!state.train && state.net.fast_activations) ? fast_activate_array : activate_array;
+    // l.output_logits: get_yolo_detections() activates only the candidates
+    for (b = 0; b < l.batch && (state.train || !l.output_logits); ++b) {
         for (n = 0; n < l.n; ++n) {
             int bbox_index = entry_index(l, b, n*l.w*l.h, 0);
             if (l.new_coords) {
                 //activate_array(l.output + bbox_index, 4 * l.w*l.h, LOGISTIC);    // x,y,w,h
             }
             else {
-                activate_array(l.output + bbox_index, 2 * l.w*l.h, LOGISTIC);        // x,y,
+                logistic_array(l.output + bbox_index, 2 * l.w*l.h, LOGISTIC);        // x,y,
                 int obj_index = entry_index(l, b, n*l.w*l.h, 4);
-                activate_array(l.output + obj_index, (1 + l.classes)*l.w*l.h, LOGISTIC);
+                logistic_array(l.output + obj_index, (1 + l.classes)*l.w*l.h, LOGISTIC);
             }
             scal_add_cpu(2 * l.w*l.h, l.scale_x_y, -0.5*(l.scale_x_y - 1), l.output + bbox_index, 1);    // scale x,y
         }
@@ -708,8 +714,9 @@ void forward_yolo_layer(const layer l, network_state state)
     *(l.cost) = 0;
 
 
+    if (l.batch <= 0) return;
     int num_threads = l.batch;
-    pthread_t* threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    pthread_t* threads = (pthread_t*)xcalloc(num_threads, sizeof(pthread_t));
 
     struct train_yolo_args* yolo_args = (train_yolo_args*)xcalloc(l.batch, sizeof(struct train_yolo_args));
 
@@ -932,13 +939,17 @@ void backward_yolo_layer(const layer l, network_state state)
    axpy_cpu(l.batch*l.inputs, 1, l.delta, 1, state.delta, 1);
 }
 
-// Converts output of the network to detection boxes
-// w,h: image width,height
-// netw,neth: network width,height
-// relative: 1 (all callers seems to pass TRUE)
-void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative, int letter)
+// the letterbox of correct_yolo_boxes()
+typedef struct yolo_letterbox {
+    float deltaw;   // difference between network width and "rotated" width
+    float deltah;   // difference between network height and "rotated" height
+    float ratiow;   // ratio between rotated network width and network width
+    float ratioh;   // ratio between rotated network height and network height
+} yolo_letterbox;
+
+static yolo_letterbox get_yolo_letterbox(int w, int h, int netw, int neth, int letter)
 {
-    int i;
+    yolo_letterbox lb;
     // network height (or width)
     int new_w = 0;
     // network height (or width)
@@ -960,34 +971,43 @@ void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth
         new_w = netw;
         new_h = neth;
     }
-    // difference between network width and "rotated" width
-    float deltaw = netw - new_w;
-    // difference between network height and "rotated" height
-    float deltah = neth - new_h;
-    // ratio between rotated network width and network width
-    float ratiow = (float)new_w / netw;
-    // ratio between rotated network width and network width
-    float ratioh = (float)new_h / neth;
-    for (i = 0; i < n; ++i) {
+    lb.deltaw = netw - new_w;
+    lb.deltah = neth - new_h;
+    lb.ratiow = (float)new_w / netw;
+    lb.ratioh = (float)new_h / neth;
+    return lb;
+}
 
-        box b = dets[i].bbox;
-        // x = ( x - (deltaw/2)/netw ) / ratiow;
-        //   x - [(1/2 the difference of the network width and rotated width) / (network width)]
-        b.x = (b.x - deltaw / 2. / netw) / ratiow;
-        b.y = (b.y - deltah / 2. / neth) / ratioh;
-        // scale to match rotation of incoming image
-        b.w *= 1 / ratiow;
-        b.h *= 1 / ratioh;
-
-        // relative seems to always be == 1, I don't think we hit this condition, ever.
-        if (!relative) {
-            b.x *= w;
-            b.w *= w;
-            b.y *= h;
-            b.h *= h;
-        }
+static inline box correct_yolo_box(box b, const yolo_letterbox *lb, int w, int h, int netw, int neth, int relative)
+{
+    // x = ( x - (deltaw/2)/netw ) / ratiow;
+    //   x - [(1/2 the difference of the network width and rotated width) / (network width)]
+    b.x = (b.x - lb->deltaw / 2. / netw) / lb->ratiow;
+    b.y = (b.y - lb->deltah / 2. / neth) / lb->ratioh;
+    // scale to match rotation of incoming image
+    b.w *= 1 / lb->ratiow;
+    b.h *= 1 / lb->ratioh;
+
+    // relative seems to always be == 1, I don't think we hit this condition, ever.
+    if (!relative) {
+        b.x *= w;
+        b.w *= w;
+        b.y *= h;
+        b.h *= h;
+    }
+    return b;
+}
 
-        dets[i].bbox = b;
+// Converts output of the network to detection boxes
+// w,h: image width,height
+// netw,neth: network width,height
+// relative: 1 (all callers seems to pass TRUE)
+void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative, int letter)
+{
+    int i;
+    const yolo_letterbox lb = get_yolo_letterbox(w, h, netw, neth, letter);
+    for (i = 0; i < n; ++i) {
+        dets[i].bbox = correct_yolo_box(dets[i].bbox, &lb, w, h, netw, neth, relative);
     }
 }
 
@@ -1028,10 +1048,191 @@ void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth
 }
 */
 
+// ----------------------------------------------------------------------------
+// fused decode of the logits (l.output_logits, CPU inference)
+// ----------------------------------------------------------------------------
+
+static int yolo_decode_enabled = 0;
+
+void set_yolo_decode(int enable)
+{
+    yolo_decode_enabled = enable;
+}
+
+int get_yolo_decode(void)
+{
+    return yolo_decode_enabled;
+}
+
+// the logit x of a candidate is above it: logistic_activate(x) > thresh needs
+// x > ln(t/(1-t)), less a few ulp of slack for the rounding of the logistic
+static float yolo_logit_bound(float thresh)
+{
+    const double t = thresh - 8 * FLT_EPSILON;
+    if (t <= 0) return -INFINITY;
+    if (t >= 1) return INFINITY;
+    return (float)(log(t / (1 - t)) - 1e-4);
+}
+
+#define YOLO_DECODE_CHUNK 1024
+
+// the cells of [start, end) where the objectness plane of any anchor is above
+// bound, ascending; NaN never is
+typedef int (*yolo_select_t)(const float *obj, int anchors, int anchor_stride, int start, int end, float bound, int *cells);
+
+static int yolo_select_cells_scalar(const float *obj, int anchors, int anchor_stride, int start, int end, float bound, int *cells)
+{
+    int count = 0, i, n;
+    for (i = start; i < end; ++i) {
+        for (n = 0; n < anchors; ++n) {
+            if (obj[n*anchor_stride + i] > bound) {
+                cells[count++] = i;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define YOLO_SELECT_X86
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define YOLO_TARGET_AVX2 __attribute__((target("avx,avx2")))
+#define YOLO_TARGET_AVX512 __attribute__((target("avx,avx2,avx512f")))
+#else
+#define YOLO_TARGET_AVX2
+#define YOLO_TARGET_AVX512
+#endif
+
+YOLO_TARGET_AVX2
+static int yolo_select_cells_avx2(const float *obj, int anchors, int anchor_stride, int start, int end, float bound, int *cells)
+{
+    const __m256 b = _mm256_set1_ps(bound);
+    int count = 0, i, n, k;
+    for (i = start; i + 8 <= end; i += 8) {
+        __m256 any = _mm256_setzero_ps();
+        for (n = 0; n < anchors; ++n) {
+            any = _mm256_or_ps(any, _mm256_cmp_ps(_mm256_loadu_ps(obj + n*anchor_stride + i), b, _CMP_GT_OQ));
+        }
+        const int mask = _mm256_movemask_ps(any);
+        if (mask) {
+            for (k = 0; k < 8; ++k) {
+                if (mask & (1 << k)) cells[count++] = i + k;
+            }
+        }
+    }
+    return count + yolo_select_cells_scalar(obj, anchors, anchor_stride, i, end, bound, cells + count);
+}
+
+YOLO_TARGET_AVX512
+static int yolo_select_cells_avx512(const float *obj, int anchors, int anchor_stride, int start, int end, float bound, int *cells)
+{
+    const __m512 b = _mm512_set1_ps(bound);
+    int count = 0, i, n, k;
+    for (i = start; i + 16 <= end; i += 16) {
+        __mmask16 mask = 0;
+        for (n = 0; n < anchors; ++n) {
+            mask |= _mm512_cmp_ps_mask(_mm512_loadu_ps(obj + n*anchor_stride + i), b, _CMP_GT_OQ);
+        }
+        if (mask) {
+            for (k = 0; k < 16; ++k) {
+                if (mask & (1 << k)) cells[count++] = i + k;
+            }
+        }
+    }
+    return count + yolo_select_cells_scalar(obj, anchors, anchor_stride, i, end, bound, cells + count);
+}
+#endif
+
+static yolo_select_t yolo_select_kernel(void)
+{
+    static yolo_select_t kernel = NULL;
+    if (!kernel) {
+        yolo_select_t k = yolo_select_cells_scalar;
+#ifdef YOLO_SELECT_X86
+        if (is_cpu_avx512()) k = yolo_select_cells_avx512;
+        else if (is_cpu_fma_avx2()) k = yolo_select_cells_avx2;
+#endif
+        kernel = k;
+    }
+    return kernel;
+}
+
+// get_yolo_detections() of the logits in l.output, or the count with dets == NULL.
+// The objectness planes are compared to the logit of thresh first, so only the
+// candidates get the logistic; the candidates are then decoded straight into dets:
+// x,y, the box, the letterbox and the classes, whose logistic is culled the same way.
+// The detections and their order are those of the activated output, the values
+// up to the rounding of the (vectorized) logistic.
+static int yolo_decode_logits(layer l, int batch, int w, int h, int netw, int neth, float thresh, int relative, detection *dets, int letter)
+{
+    const int wh = l.w*l.h;
+    const int anchor_stride = wh*(4 + l.classes + 1);
+    const int logistic = !l.new_coords;
+    const float bound = logistic ? yolo_logit_bound(thresh) : thresh;
+    const float beta = -0.5*(l.scale_x_y - 1);
+    const float *predictions = l.output + batch*l.outputs;
+    const float *obj = predictions + 4*wh;
+    const yolo_select_t select = yolo_select_kernel();
+    const yolo_letterbox lb = get_yolo_letterbox(w, h, netw, neth, letter);
+    int cells[YOLO_DECODE_CHUNK];
+    int count = 0, start, c, n, j;
+
+    for (start = 0; start < wh; start += YOLO_DECODE_CHUNK) {
+        const int end = (start + YOLO_DECODE_CHUNK < wh) ? start + YOLO_DECODE_CHUNK : wh;
+        const int candidates = select(obj, l.n, anchor_stride, start, end, bound, cells);
+        for (c = 0; c < candidates; ++c) {
+            const int i = cells[c];
+            const int row = i / l.w;
+            const int col = i % l.w;
+            for (n = 0; n < l.n; ++n) {
+                const float *p = predictions + n*anchor_stride + i;
+                const float logit = p[4*wh];
+                if (!(logit > bound)) continue;
+                const float objectness = logistic ? logistic_activate(logit) : logit;
+                if (!(objectness > thresh)) continue;
+                if (!dets) {
+                    ++count;
+                    continue;
+                }
+
+                float t[4] = { p[0], p[wh], p[2*wh], p[3*wh] };
+                if (logistic) {
+                    t[0] = logistic_activate(t[0]);
+                    t[1] = logistic_activate(t[1]);
+                }
+                t[0] = t[0] * l.scale_x_y + beta;
+                t[1] = t[1] * l.scale_x_y + beta;
+                box b = get_yolo_box(t, l.biases, l.mask[n], 0, col, row, l.w, l.h, netw, neth, 1, l.new_coords);
+                dets[count].bbox = correct_yolo_box(b, &lb, w, h, netw, neth, relative);
+                dets[count].objectness = objectness;
+                dets[count].classes = l.classes;
+                if (l.embedding_output) {
+                    get_embedding(l.embedding_output, l.w, l.h, l.n*l.embedding_size, l.embedding_size, col, row, n, batch, dets[count].embeddings);
+                }
+
+                // objectness*logistic(x) > thresh needs logistic(x) > thresh/objectness
+                const float class_bound = logistic ? yolo_logit_bound(thresh / objectness) : -INFINITY;
+                const float *classes = p + 5*wh;
+                for (j = 0; j < l.classes; ++j) {
+                    const float x = classes[j*wh];
+                    float prob = 0;
+                    if (x > class_bound) prob = objectness*(logistic ? logistic_activate(x) : x);
+                    dets[count].prob[j] = (prob > thresh) ? prob : 0;
+                }
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
 int yolo_num_detections(layer l, float thresh)
 {
     int i, n;
     int count = 0;
+    if (l.output_logits) return yolo_decode_logits(l, 0, 0, 0, 0, 0, thresh, 1, NULL, 0);
     for(n = 0; n < l.n; ++n){
         for (i = 0; i < l.w*l.h; ++i) {
             int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
@@ -1047,6 +1248,7 @@ int yolo_num_detections_batch(layer l, float thresh, int batch)
 {
     int i, n;
     int count = 0;
+    if (l.output_logits) return yolo_decode_logits(l, batch, 0, 0, 0, 0, thresh, 1, NULL, 0);
     for (i = 0; i < l.w*l.h; ++i){
         for(n = 0; n < l.n; ++n){
             int obj_index  = entry_index(l, batch, n*l.w*l.h + i, 4);
@@ -1087,6 +1289,7 @@ void avg_flipped_yolo(layer l)
 int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter)
 {
     //printf("\n l.batch = %d, l.w = %d, l.h = %d, l.n = %d \n", l.batch, l.w, l.h, l.n);
+    if (l.output_logits) return yolo_decode_logits(l, 0, w, h, netw, neth, thresh, relative, dets, letter);
     int i,j,n;
     float *predictions = l.output;
     // This snippet below is not necessary
@@ -1125,6 +1328,7 @@ int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh,
 
 int get_yolo_detections_batch(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter, int batch)
 {
+    if (l.output_logits) return yolo_decode_logits(l, batch, w, h, netw, neth, thresh, relative, dets, letter);
     int i,j,n;
     float *predictions = l.output;
     //if (l.batch == 2) avg_flipped_yolo(l);
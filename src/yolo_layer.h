@@ -18,6 +18,13 @@ int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh,
 int get_yolo_detections_batch(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter, int batch);
 void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative, int letter);
 
+// -yolo_decode: the yolo layers of CPU inference keep the logits in l.output and
+// get_yolo_detections() decodes only the cells whose objectness passes thresh,
+// enabled for every network by prepare_network_for_inference(). l.output is then
+// not activated for any other reader (network_predict(), the demo averaging).
+void set_yolo_decode(int enable);
+int get_yolo_decode(void);
+
 #ifdef GPU
 void forward_yolo_layer_gpu(const layer l, network_state state);
 void backward_yolo_layer_gpu(const layer l, network_state state);
@@ -21,6 +21,11 @@ extern "C" {
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <future>
 
 #define NFRAMES 3
 
@@ -125,6 +130,27 @@ struct detector_gpu_t {
     float* predictions[NFRAMES];
     int demo_index;
     unsigned int *track_id;
+    std::mutex mtx;     // the network is used by one call at a time
+};
+
+struct detector_async_request_t {
+    image sized;        // net.w x net.h
+    int w, h;           // the boxes are in w x h pixels
+    float thresh;
+    std::chrono::steady_clock::time_point time;
+    std::promise<std::vector<bbox_t>> promise;
+};
+
+struct detector_async_t {
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::deque<std::unique_ptr<detector_async_request_t>> requests;
+    std::thread worker;
+    bool stop = false;
+    bool batchable = true;  // the batched box extraction exists for [yolo] layers only
+    int max_batch = 1;
+    int max_wait_us = 2000;
+    float *input = NULL;
 };
 
 LIB_API Detector::Detector(std::string cfg_filename, std::string weight_filename, int gpu_id, int batch_size)
@@ -161,6 +187,7 @@ LIB_API Detector::Detector(std::string cfg_filename, std::string weight_filename
     set_batch_network(&net, batch_size);
     net.gpu_index = cur_gpu_id;
     fuse_conv_batchnorm(net);
+    prepare_network_for_inference(&net);
 
     layer l = net.layers[net.n - 1];
     int j;
@@ -172,6 +199,14 @@ LIB_API Detector::Detector(std::string cfg_filename, std::string weight_filename
     detector_gpu.track_id = (unsigned int *)calloc(l.classes, sizeof(unsigned int));
     for (j = 0; j < l.classes; ++j) detector_gpu.track_id[j] = 1;
 
+    detector_async_ptr = std::make_shared<detector_async_t>();
+    detector_async_t &detector_async = *static_cast<detector_async_t *>(detector_async_ptr.get());
+    for (j = 0; j < net.n; ++j) {
+        const LAYER_TYPE type = net.layers[j].type;
+        if (type == GAUSSIAN_YOLO || type == REGION || type == DETECTION) detector_async.batchable = false;
+    }
+    detector_async.max_batch = detector_async.batchable ? net.batch : 1;
+
 #ifdef GPU
     check_cuda( cudaSetDevice(old_gpu_index) );
 #endif
@@ -181,6 +216,16 @@ LIB_API Detector::Detector(std::string cfg_filename, std::string weight_filename
 LIB_API Detector::~Detector()
 {
     detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    detector_async_t &detector_async = *static_cast<detector_async_t *>(detector_async_ptr.get());
+
+    // the queued requests are still detected
+    {
+        std::lock_guard<std::mutex> lock(detector_async.mtx);
+        detector_async.stop = true;
+    }
+    detector_async.cond.notify_all();
+    if (detector_async.worker.joinable()) detector_async.worker.join();
+    free(detector_async.input);
     //layer l = detector_gpu.net.layers[detector_gpu.net.n - 1];
 
     free(detector_gpu.track_id);
@@ -267,10 +312,42 @@ LIB_API void Detector::free_image(image_t m)
     }
 }
 
+// boxes with prob > thresh, in w x h pixels
+static std::vector<bbox_t> detections_to_bbox_vec(detection *dets, int nboxes, int classes, float thresh, int w, int h)
+{
+    std::vector<bbox_t> bbox_vec;
+
+    for (int i = 0; i < nboxes; ++i) {
+        box b = dets[i].bbox;
+        int const obj_id = max_index(dets[i].prob, classes);
+        float const prob = dets[i].prob[obj_id];
+
+        if (prob > thresh)
+        {
+            bbox_t bbox;
+            bbox.x = std::max((double)0, (b.x - b.w / 2.)*w);
+            bbox.y = std::max((double)0, (b.y - b.h / 2.)*h);
+            bbox.w = b.w*w;
+            bbox.h = b.h*h;
+            bbox.obj_id = obj_id;
+            bbox.prob = prob;
+            bbox.track_id = 0;
+            bbox.frames_counter = 0;
+            bbox.x_3d = NAN;
+            bbox.y_3d = NAN;
+            bbox.z_3d = NAN;
+
+            bbox_vec.push_back(bbox);
+        }
+    }
+    return bbox_vec;
+}
+
 LIB_API std::vector<bbox_t> Detector::detect(image_t img, float thresh, bool use_mean)
 {
     detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
     network &net = detector_gpu.net;
+    std::lock_guard<std::mutex> lock(detector_gpu.mtx);
 #ifdef GPU
     int old_gpu_index;
     cudaGetDevice(&old_gpu_index);
@@ -314,36 +391,12 @@ LIB_API std::vector<bbox_t> Detector::detect(image_t img, float thresh, bool use
     int nboxes = 0;
     int letterbox = 0;
     float hier_thresh = 0.5;
-    detection *dets = get_network_boxes(&net, im.w, im.h, thresh, hier_thresh, 0, 1, &nboxes, letterbox);
+    detection *dets = get_network_boxes_pooled(&net, im.w, im.h, thresh, hier_thresh, 0, 1, &nboxes, letterbox);
     if (nms) do_nms_sort(dets, nboxes, l.classes, nms);
 
-    std::vector<bbox_t> bbox_vec;
-
-    for (int i = 0; i < nboxes; ++i) {
-        box b = dets[i].bbox;
-        int const obj_id = max_index(dets[i].prob, l.classes);
-        float const prob = dets[i].prob[obj_id];
+    std::vector<bbox_t> bbox_vec = detections_to_bbox_vec(dets, nboxes, l.classes, thresh, im.w, im.h);
 
-        if (prob > thresh)
-        {
-            bbox_t bbox;
-            bbox.x = std::max((double)0, (b.x - b.w / 2.)*im.w);
-            bbox.y = std::max((double)0, (b.y - b.h / 2.)*im.h);
-            bbox.w = b.w*im.w;
-            bbox.h = b.h*im.h;
-            bbox.obj_id = obj_id;
-            bbox.prob = prob;
-            bbox.track_id = 0;
-            bbox.frames_counter = 0;
-            bbox.x_3d = NAN;
-            bbox.y_3d = NAN;
-            bbox.z_3d = NAN;
-
-            bbox_vec.push_back(bbox);
-        }
-    }
-
-    free_detections(dets, nboxes);
+    release_network_boxes(dets);
     if(sized.data)
         free(sized.data);
 
@@ -359,6 +412,7 @@ LIB_API std::vector<std::vector<bbox_t>> Detector::detectBatch(image_t img, int
 {
     detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
     network &net = detector_gpu.net;
+    std::lock_guard<std::mutex> lock(detector_gpu.mtx);
 #ifdef GPU
     int old_gpu_index;
     cudaGetDevice(&old_gpu_index);
@@ -388,30 +442,8 @@ LIB_API std::vector<std::vector<bbox_t>> Detector::detectBatch(image_t img, int
         if (make_nms && nms)
             do_nms_sort(dets, prediction[bi].num, l.classes, nms);
 
-        for (int i = 0; i < prediction[bi].num; ++i)
-        {
-            box b = dets[i].bbox;
-            int const obj_id = max_index(dets[i].prob, l.classes);
-            float const prob = dets[i].prob[obj_id];
-
-            if (prob > thresh)
-            {
-                bbox_t bbox;
-                bbox.x = std::max((double)0, (b.x - b.w / 2.));
-                bbox.y = std::max((double)0, (b.y - b.h / 2.));
-                bbox.w = b.w;
-                bbox.h = b.h;
-                bbox.obj_id = obj_id;
-                bbox.prob = prob;
-                bbox.track_id = 0;
-                bbox.frames_counter = 0;
-                bbox.x_3d = NAN;
-                bbox.y_3d = NAN;
-                bbox.z_3d = NAN;
-
-                bbox_vec[bi].push_back(bbox);
-            }
-        }
+        // relative = 0: the boxes are in pixels already
+        bbox_vec[bi] = detections_to_bbox_vec(dets, prediction[bi].num, l.classes, thresh, 1, 1);
     }
     free_batch_detections(prediction, batch_size);
 
@@ -423,6 +455,129 @@ LIB_API std::vector<std::vector<bbox_t>> Detector::detectBatch(image_t img, int
     return bbox_vec;
 }
 
+// one forward pass for the whole batch, then every request gets its boxes
+static void run_detector_async_batch(Detector *detector, detector_gpu_t &detector_gpu, detector_async_t &detector_async,
+    std::vector<std::unique_ptr<detector_async_request_t>> &batch)
+{
+    std::lock_guard<std::mutex> lock(detector_gpu.mtx);
+    network &net = detector_gpu.net;
+    const size_t size = (size_t)net.w*net.h*net.c;
+    const int count = batch.size();
+    const float hier_thresh = 0.5;
+    layer l = net.layers[net.n - 1];
+    int b = 0;
+
+    try {
+        for (b = 0; b < count; ++b) memcpy(detector_async.input + b*size, batch[b]->sized.data, size * sizeof(float));
+        network_predict_batched(&net, detector_async.input, count);
+        for (b = 0; b < count; ++b) {
+            detector_async_request_t &r = *batch[b];
+            int nboxes = 0;
+            detection *dets;
+            if (detector_async.batchable) dets = get_network_boxes_batch_pooled(&net, r.w, r.h, r.thresh, hier_thresh, 0, 1, &nboxes, 0, b);
+            else dets = get_network_boxes_pooled(&net, r.w, r.h, r.thresh, hier_thresh, 0, 1, &nboxes, 0);
+            if (detector->nms) do_nms_sort(dets, nboxes, l.classes, detector->nms);
+            std::vector<bbox_t> bbox_vec = detections_to_bbox_vec(dets, nboxes, l.classes, r.thresh, r.w, r.h);
+            release_network_boxes(dets);
+            r.promise.set_value(bbox_vec);
+        }
+    }
+    catch (...) {
+        for (; b < count; ++b) batch[b]->promise.set_exception(std::current_exception());
+    }
+}
+
+static void detector_async_worker(Detector *detector, detector_gpu_t *detector_gpu, detector_async_t *detector_async)
+{
+    detector_async_t &da = *detector_async;
+#ifdef GPU
+    cuda_set_device(detector_gpu->net.gpu_index);
+#endif
+    std::unique_lock<std::mutex> lock(da.mtx);
+    while (true) {
+        da.cond.wait(lock, [&da]() { return da.stop || !da.requests.empty(); });
+        if (da.requests.empty()) break;     // stopped and drained
+
+        // wait for more requests until the batch is full or its first request waited long enough
+        const auto deadline = da.requests.front()->time + std::chrono::microseconds(da.max_wait_us);
+        while (!da.stop && (int)da.requests.size() < da.max_batch) {
+            if (da.cond.wait_until(lock, deadline) == std::cv_status::timeout) break;
+        }
+
+        std::vector<std::unique_ptr<detector_async_request_t>> batch;
+        while (!da.requests.empty() && (int)batch.size() < da.max_batch) {
+            batch.push_back(std::move(da.requests.front()));
+            da.requests.pop_front();
+        }
+        lock.unlock();
+        run_detector_async_batch(detector, *detector_gpu, da, batch);
+        for (auto &r : batch) ::free_image(r->sized);
+        lock.lock();
+    }
+}
+
+LIB_API std::future<std::vector<bbox_t>> Detector::detect_async(image_t img, float thresh)
+{
+    return detect_async_resized(img, img.w, img.h, thresh);
+}
+
+LIB_API std::future<std::vector<bbox_t>> Detector::detect_async_resized(image_t img, int init_w, int init_h, float thresh)
+{
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    detector_async_t &detector_async = *static_cast<detector_async_t *>(detector_async_ptr.get());
+    network &net = detector_gpu.net;
+
+    if (img.data == NULL)
+        throw std::runtime_error("Image is empty");
+
+    // resized by the calling thread
+    image im;
+    im.c = img.c;
+    im.data = img.data;
+    im.h = img.h;
+    im.w = img.w;
+
+    std::unique_ptr<detector_async_request_t> request(new detector_async_request_t);
+    if (net.w == im.w && net.h == im.h) {
+        request->sized = make_image(im.w, im.h, im.c);
+        memcpy(request->sized.data, im.data, im.w*im.h*im.c * sizeof(float));
+    }
+    else
+        request->sized = resize_image(im, net.w, net.h);
+    request->w = init_w;
+    request->h = init_h;
+    request->thresh = thresh;
+    request->time = std::chrono::steady_clock::now();
+    std::future<std::vector<bbox_t>> result = request->promise.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(detector_async.mtx);
+        if (detector_async.stop) {
+            ::free_image(request->sized);
+            throw std::runtime_error("Detector is being destroyed");
+        }
+        if (!detector_async.worker.joinable()) {
+            detector_async.input = (float *)xcalloc((size_t)net.batch*net.w*net.h*net.c, sizeof(float));
+            detector_async.worker = std::thread(detector_async_worker, this, &detector_gpu, &detector_async);
+        }
+        detector_async.requests.push_back(std::move(request));
+    }
+    detector_async.cond.notify_one();
+    return result;
+}
+
+LIB_API void Detector::set_async_batching(int max_batch, int max_wait_us)
+{
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    detector_async_t &detector_async = *static_cast<detector_async_t *>(detector_async_ptr.get());
+    std::lock_guard<std::mutex> lock(detector_async.mtx);
+    // the network holds batch_size images (the constructor parameter)
+    detector_async.max_batch = std::max(1, std::min(max_batch, detector_gpu.net.batch));
+    if (!detector_async.batchable) detector_async.max_batch = 1;
+    detector_async.max_wait_us = std::max(0, max_wait_us);
+    detector_async.cond.notify_one();
+}
+
 LIB_API std::vector<bbox_t> Detector::tracking_id(std::vector<bbox_t> cur_bbox_vec, bool const change_history,
     int const frames_story, int const max_dist)
 {